@@ -12,6 +12,7 @@ public class SensorService(IDbContextFactory<ApplicationDbContext> dbContextFact
     : BackgroundService
 {
     private UdpClient? _udpClient;
+    private static readonly byte[] DiscoveryQuery = """{"discover":true}"""u8.ToArray();
     private bool _udpRunning;
     /// <summary>
     ///     Contains sensors saved in the database. 
@@ -92,16 +93,33 @@ public class SensorService(IDbContextFactory<ApplicationDbContext> dbContextFact
         _udpRunning = true;
         _udpClient = new UdpClient();
         _udpClient.Client.Bind(new IPEndPoint(IPAddress.Any, 5506));
+        _udpClient.EnableBroadcast = true;
         var cancellationTokenSource = CancellationTokenSource.CreateLinkedTokenSource(token);
         cancellationTokenSource.CancelAfter(TimeSpan.FromSeconds(5));
         List<Sensor> sensorsFound = [];
         try
         {
+            // devices only announce themselves every minute once they've been up for a while, the query makes them
+            // reply right away
+            await _udpClient.SendAsync(DiscoveryQuery, new IPEndPoint(IPAddress.Broadcast, 5506),
+                cancellationTokenSource.Token);
             while (!cancellationTokenSource.Token.IsCancellationRequested)
             {
                 var result = await _udpClient.ReceiveAsync(cancellationTokenSource.Token);
                 var resultStr = Encoding.UTF8.GetString(result.Buffer);
-                var device = JsonSerializer.Deserialize<Sensor>(resultStr)!;
+                Sensor? device;
+                try
+                {
+                    device = JsonSerializer.Deserialize<Sensor>(resultStr);
+                }
+                catch (JsonException)
+                {
+                    continue;
+                }
+
+                // skips the app's own query, which is received as well, and devices that both replied and announced
+                // themselves
+                if (device?.MacAddress is null || sensorsFound.Contains(device)) continue;
                 if (!allowAlreadyAdded)
                 {
                     if (!Sensors.Contains(device)) sensorsFound.Add(device);
@@ -165,6 +183,7 @@ public class SensorService(IDbContextFactory<ApplicationDbContext> dbContextFact
             sensor.Error = false;
             ShowSnackbarMessage($"Połączono z czujnikiem {GetPreferredParameter(sensor)}", Severity.Success);
             var buffer = new byte[1024];
+            var received = new StringBuilder();
             while (true)
             {
                 if (token.IsCancellationRequested) break;
@@ -187,20 +206,37 @@ public class SensorService(IDbContextFactory<ApplicationDbContext> dbContextFact
 
                 if (bytesRead == 0) break;
 
-                var data = Encoding.UTF8.GetString(buffer, 0, bytesRead);
-
-                var reading = JsonSerializer.Deserialize<SensorReading>(data)
-                              ?? new SensorReading { Temperature = 0, Humidity = 0, Rssi = 0 };
-                reading.Epoch = DateTimeOffset.Now.ToUnixTimeSeconds();
-                reading.Sensor = sensor;
-                sensor.LastReading = reading;
-                sensor.Rssi = reading.Rssi;
-                if (reading.Interval != sensor.FetchInterval)
-                    sensor.FetchInterval = reading.Interval;
-                readings.Add(reading);
-                if (readings.Count != bufferSize) continue;
-                await AddReadingsToDb(readings);
-                readings.Clear();
+                // every message ends with a newline, a packet can carry part of one or several of them
+                received.Append(Encoding.UTF8.GetString(buffer, 0, bytesRead));
+                var data = received.ToString();
+                var end = data.LastIndexOf('\n');
+                if (end == -1) continue;
+                received.Remove(0, end + 1);
+
+                foreach (var line in data[..end].Split('\n', StringSplitOptions.RemoveEmptyEntries))
+                {
+                    // replies to commands, e.g. {"ack":"interval"}, and notices like {"event":"reconnected",...}
+                    if (line.StartsWith("{\"ack\"") || line.StartsWith("{\"error\"") || line.StartsWith("{\"event\""))
+                    {
+                        if (line.StartsWith("{\"error\"")) logger.LogWarning($"Sensor rejected a command: {line}");
+                        continue;
+                    }
+
+                    var reading = JsonSerializer.Deserialize<SensorReading>(line)
+                                  ?? new SensorReading { Temperature = 0, Humidity = 0, Rssi = 0 };
+                    // a device can have several probes, the app records the first one
+                    if (reading.Probe != 0) continue;
+                    reading.Epoch = DateTimeOffset.Now.ToUnixTimeSeconds();
+                    reading.Sensor = sensor;
+                    sensor.LastReading = reading;
+                    sensor.Rssi = reading.Rssi;
+                    if (reading.Interval != sensor.FetchInterval)
+                        sensor.FetchInterval = reading.Interval;
+                    readings.Add(reading);
+                    if (readings.Count != bufferSize) continue;
+                    await AddReadingsToDb(readings);
+                    readings.Clear();
+                }
             }
         }
         catch (IOException e) when (e.InnerException is SocketException
@@ -314,7 +350,7 @@ public class SensorService(IDbContextFactory<ApplicationDbContext> dbContextFact
         try
         {
             var stream = sensor.TcpClient.GetStream();
-            var json = $"{{\"interval\": {interval}}}";
+            var json = $"{{\"interval\": {interval}}}\n";
             await stream.WriteAsync(Encoding.UTF8.GetBytes(json).ToArray(), token);
             ShowSnackbarMessage($"Pomyślnie zmieniono częstotliwość czujnika {GetPreferredParameter(sensor)}",
                 Severity.Success);
@@ -19,6 +19,8 @@ public class SensorReading
     [JsonPropertyName("interval")]
     public int Interval { get; set; }
 
+    [NotMapped] [JsonPropertyName("probe")] public int Probe { get; set; }
+
     [JsonIgnore] public long Epoch { get; set; }
 
     [ForeignKey(nameof(Sensor))]
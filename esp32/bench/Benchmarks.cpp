@@ -0,0 +1,1175 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <WiFiUdp.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <malloc.h>
+#include <memory>
+#include <new>
+#include <random>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "CommandParser.h"
+#include "EspUDPServer.h"
+#include "EventLoop.h"
+#include "HistoryLog.h"
+#include "HTTPRequest.h"
+#include "HTTPServer.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "ProbeFrame.h"
+#include "ReadingChannel.h"
+#include "ReadingCodec.h"
+#include "ReportWindow.h"
+#include "SensorBus.h"
+#include "Settings.h"
+#include "TCPServer.h"
+
+// Microbenchmarks of the firmware's hot paths, built by the native_bench environment in place of main.cpp. Every benchmark
+// prints one JSON object per line, so the output of two releases can be compared by a script. POLEKO_BENCH_FILTER runs
+// only the benchmarks whose name contains it.
+
+// operations timed together, so that the clock's resolution doesn't dominate operations taking a few ns
+constexpr uint32_t BATCH_SIZE = 64;
+constexpr size_t HTTP_RESPONSE_BUFFER = 8192;
+// seconds between the history log's rows, HISTORY_INTERVAL in main.cpp
+constexpr uint32_t HISTORY_BENCH_INTERVAL = 10;
+// setup/connect/disconnect/stop cycles of the soak test, after the ones that warm up lazily allocated state
+constexpr int SOAK_CYCLES = 2000;
+constexpr int SOAK_WARMUP_CYCLES = 20;
+// how long the soak test waits for a reply or for the servers to notice a disconnect
+constexpr int SOAK_TIMEOUT = 2000;
+// readings streamed at every batch size, two of the largest batches
+constexpr uint32_t BATCHING_READINGS = 2 * MAX_TCP_BATCH;
+// IPv4 and TCP headers without options, which every segment carries
+constexpr size_t TCP_IP_HEADER = 40;
+// events posted to a sleeping event loop, and posted as fast as a thread can
+constexpr int EVENT_LOOP_WAKES = 10000;
+constexpr int EVENT_LOOP_POSTS = 1000000;
+// readings handed over between two threads as fast as the producer can, and at a steady pace
+constexpr uint32_t CHANNEL_FLOOD_READINGS = 2000000;
+constexpr uint32_t CHANNEL_PACED_READINGS = 20000;
+constexpr uint32_t CHANNEL_PACE_US = 100;
+// increments of a counter shared by two threads, by each of them
+constexpr uint32_t CONTENDED_INCREMENTS = 10000000;
+// times the ring is filled and drained
+constexpr int LOG_DRAIN_ROUNDS = 5000;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // every thread is counted, so that requests served by the network thread are included
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    // bytes held by objects that weren't deleted yet, as malloc sized their blocks
+    std::atomic<int64_t> liveBytes{0};
+
+    // results are written to it, so that the compiler can't drop the benchmarked code
+    volatile uint32_t sink;
+
+    struct AllocationCount {
+        uint64_t count;
+        uint64_t bytes;
+
+        static AllocationCount now() {
+            return {allocations.load(std::memory_order_relaxed), allocatedBytes.load(std::memory_order_relaxed)};
+        }
+    };
+
+    double percentile(std::vector<double> &sorted, double fraction) {
+        auto index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    bool selected(const char *name) {
+        auto filter = getenv("POLEKO_BENCH_FILTER");
+        return filter == nullptr || strstr(name, filter) != nullptr;
+    }
+
+    /// @brief Runs the operation the given amount of times in batches and prints the time and allocations per operation.
+    /// Percentiles are those of the batches' averages.
+    template<typename Operation>
+    void run(const char *name, uint32_t iterations, uint32_t batch, Operation &&operation) {
+        if (!selected(name)) {
+            return;
+        }
+        for (uint32_t i = 0; i < batch; i++) {
+            operation();
+        }
+        std::vector<double> samples;
+        samples.reserve(iterations / batch + 1);
+
+        auto allocatedBefore = AllocationCount::now();
+        auto startedAt = Clock::now();
+        uint32_t done = 0;
+        while (done < iterations) {
+            auto batchStartedAt = Clock::now();
+            for (uint32_t i = 0; i < batch; i++) {
+                operation();
+            }
+            auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - batchStartedAt).count();
+            samples.push_back(elapsed / batch);
+            done += batch;
+        }
+        auto total = std::chrono::duration<double, std::nano>(Clock::now() - startedAt).count();
+        auto allocatedAfter = AllocationCount::now();
+
+        std::sort(samples.begin(), samples.end());
+        printf("{\"benchmark\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"p50_ns\":%.1f,"
+               "\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+               name, done, total / done, done / (total / 1e9), percentile(samples, 0.5), percentile(samples, 0.9),
+               percentile(samples, 0.99), samples.back(),
+               static_cast<double>(allocatedAfter.count - allocatedBefore.count) / done,
+               static_cast<double>(allocatedAfter.bytes - allocatedBefore.bytes) / done);
+    }
+
+    /// @brief The TCP frame as it was serialized before JsonEncoder, through an ArduinoJson document and a String
+    String arduinoJsonFrame(const StreamRecord &record, bool withMetrics) {
+        JsonDocument doc;
+        doc["humidity"] = record.humidity / 100.0f;
+        doc["temperature"] = record.temperature / 100.0f;
+        doc["rssi"] = static_cast<int>(record.rssi);
+        doc["interval"] = record.interval;
+        doc["sequence"] = record.sequence;
+        doc["timestamp"] = record.uptime;
+        doc["probe"] = record.probe;
+        if (withMetrics) {
+            auto health = doc["metrics"].to<JsonObject>();
+            health["freeHeap"] = ESP.getFreeHeap();
+            health["largestBlock"] = ESP.getMaxAllocHeap();
+            health["sensorTimeouts"] = metrics.sensorTimeouts.get();
+            health["parseFailures"] = metrics.sensorParseFailures.get();
+            health["droppedFrames"] = metrics.tcpDroppedFrames.get();
+        }
+        String serialized;
+        serializeJson(doc, serialized);
+        serialized += '\n';
+        return serialized;
+    }
+
+    /// @brief Checks that both encoders produce the same bytes for a range of readings, so that the monitoring app can't
+    /// tell them apart
+    /// @return Whether every frame was the same
+    bool compareJsonEncoders() {
+        if (!selected("json_compatibility")) {
+            return true;
+        }
+        uint32_t checked = 0;
+        uint32_t mismatches = 0;
+        char json[JSON_FRAME_BUFFER];
+        for (int32_t value = -4000; value <= 12000; value += 7) {
+            StreamRecord record{static_cast<uint32_t>(value + 4000), 1000u * value, static_cast<int16_t>(value),
+                                static_cast<int16_t>(value / 3), -61, 2, true};
+            for (bool withMetrics: {false, true}) {
+                auto length = TCPServer::toJson(record, withMetrics, json, sizeof(json));
+                auto expected = arduinoJsonFrame(record, withMetrics);
+                checked++;
+                if (std::string_view(json, length) != std::string_view(expected.c_str(), expected.length())) {
+                    if (mismatches++ == 0) {
+                        fprintf(stderr, "JSON mismatch: %.*s vs %s", static_cast<int>(length), json, expected.c_str());
+                    }
+                }
+            }
+        }
+        printf("{\"benchmark\":\"json_compatibility\",\"checked\":%u,\"mismatches\":%u}\n", checked, mismatches);
+        return mismatches == 0;
+    }
+
+    /// @brief Changes a setting as often as a misbehaving client could, and counts the writes it took to the simulated flash
+    void measureSettingsWear(Settings &settings) {
+        if (!selected("settings_wear")) {
+            return;
+        }
+        constexpr uint32_t updates = 100000;
+        auto before = nvsStats();
+        for (uint32_t i = 0; i < updates; i++) {
+            settings.setTcpInterval(i % 60 + 1);
+            settings.loop();
+        }
+        settings.flush();
+        auto after = nvsStats();
+        printf("{\"benchmark\":\"settings_wear\",\"updates\":%u,\"nvs_writes\":%u,\"nvs_erases\":%u}\n", updates,
+               after.writes - before.writes, after.erases - before.erases);
+    }
+
+    // what the event loop's handler saw, it can't capture anything
+    std::atomic<uint32_t> handledEvents{0};
+    std::atomic<Clock::rep> handledAt{0};
+
+    void onBenchEvent() {
+        handledAt.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        handledEvents.fetch_add(1, std::memory_order_release);
+    }
+
+    /// @brief Measures the event loop: the events it dispatches per second when they're posted by its own handlers, the
+    /// time from a post by another thread to the handler while the loop was asleep, and how many of the posts of a thread
+    /// posting as fast as it can are coalesced. On the host the loop sleeps on a condition variable, in the task
+    /// notification of the FreeRTOS shim.
+    void measureEventLoop() {
+        EventLoop loop;
+        loop.begin();
+        loop.on(Event::Sensor, onBenchEvent);
+        run("event_loop_dispatch", 2000000, BATCH_SIZE, [&]() {
+            loop.post(Event::Sensor);
+            loop.runOnce();
+        });
+        if (!selected("event_loop_wake") && !selected("event_loop_cross_thread")) {
+            return;
+        }
+
+        // posts wake up the task that called begin(), so this one is bound to the thread running it
+        EventLoop sleeper;
+        sleeper.on(Event::Sensor, onBenchEvent);
+        std::atomic<bool> started{false};
+        std::atomic<bool> stopped{false};
+        std::thread runner([&]() {
+            sleeper.begin();
+            started.store(true, std::memory_order_release);
+            while (!stopped.load(std::memory_order_acquire)) {
+                sleeper.runOnce();
+            }
+        });
+        while (!started.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        std::vector<double> latencies;
+        latencies.reserve(EVENT_LOOP_WAKES);
+        for (int i = 0; i < EVENT_LOOP_WAKES; i++) {
+            // time for the loop to go back to sleep, so that the post has to wake it up
+            usleep(100);
+            auto handled = handledEvents.load(std::memory_order_acquire);
+            auto postedAt = Clock::now();
+            sleeper.post(Event::Sensor);
+            while (handledEvents.load(std::memory_order_acquire) == handled) {
+                std::this_thread::yield();
+            }
+            auto wokenAt = Clock::time_point(Clock::duration(handledAt.load(std::memory_order_relaxed)));
+            latencies.push_back(std::chrono::duration<double, std::nano>(wokenAt - postedAt).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        printf("{\"benchmark\":\"event_loop_wake\",\"wakes\":%d,\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,"
+               "\"max_ns\":%.1f}\n", EVENT_LOOP_WAKES, percentile(latencies, 0.5), percentile(latencies, 0.9),
+               percentile(latencies, 0.99), latencies.back());
+
+        auto handledBefore = handledEvents.load(std::memory_order_acquire);
+        auto startedAt = Clock::now();
+        for (int i = 0; i < EVENT_LOOP_POSTS; i++) {
+            sleeper.post(Event::Sensor);
+        }
+        auto seconds = std::chrono::duration<double>(Clock::now() - startedAt).count();
+        stopped.store(true, std::memory_order_release);
+        sleeper.post(Event::Sensor);
+        runner.join();
+        // give or take the post waking the runner up to stop, which may be coalesced with the last ones
+        auto handled = handledEvents.load(std::memory_order_acquire) - handledBefore;
+        printf("{\"benchmark\":\"event_loop_cross_thread\",\"posts\":%d,\"posts_per_sec\":%.0f,"
+               "\"handled_per_post\":%.4f}\n", EVENT_LOOP_POSTS, EVENT_LOOP_POSTS / seconds,
+               static_cast<double>(handled) / EVENT_LOOP_POSTS);
+    }
+
+    /// @brief Hands readings over from a producer thread to a consumer polling for them, as the sensor task does to the
+    /// loop: the readings published per second, the ones replaced before the consumer took them and the time from
+    /// publish() to the poll() that took the reading. Once with the producer publishing as fast as it can and once
+    /// pacing it, the latency of a loop that is waiting for readings.
+    void measureReadingChannel() {
+        ReadingChannel channel;
+        SensorReading reading{45.32f, 23.45f, 0, true};
+        run("reading_channel_publish_poll", 5000000, BATCH_SIZE, [&]() {
+            reading.timestamp++;
+            channel.publish(reading);
+            channel.poll();
+            sink = channel.latest().timestamp;
+        });
+        if (!selected("reading_channel_handoff")) {
+            return;
+        }
+
+        for (uint32_t pace: {0u, CHANNEL_PACE_US}) {
+            auto readings = pace == 0 ? CHANNEL_FLOOD_READINGS : CHANNEL_PACED_READINGS;
+            ReadingChannel handoff;
+            std::atomic<bool> finished{false};
+            std::vector<double> latencies;
+            latencies.reserve(readings);
+            std::thread consumer([&]() {
+                while (true) {
+                    // read before polling, so that the last reading is taken before the consumer stops
+                    auto last = finished.load(std::memory_order_acquire);
+                    if (handoff.poll()) {
+                        // the timestamp is the time the reading was published at, in steady clock ticks
+                        auto publishedAt = Clock::time_point(Clock::duration(handoff.latest().timestamp));
+                        auto latency = std::chrono::duration<double, std::nano>(Clock::now() - publishedAt);
+                        latencies.push_back(latency.count());
+                    } else if (last) {
+                        break;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+            auto startedAt = Clock::now();
+            for (uint32_t i = 0; i < readings; i++) {
+                if (pace > 0) {
+                    usleep(pace);
+                }
+                reading.timestamp = static_cast<unsigned long>(Clock::now().time_since_epoch().count());
+                handoff.publish(reading);
+            }
+            auto seconds = std::chrono::duration<double>(Clock::now() - startedAt).count();
+            finished.store(true, std::memory_order_release);
+            consumer.join();
+            std::sort(latencies.begin(), latencies.end());
+            printf("{\"benchmark\":\"reading_channel_handoff\",\"pace_us\":%u,\"published\":%u,"
+                   "\"published_per_sec\":%.0f,\"taken\":%zu,\"dropped\":%u,\"p50_ns\":%.1f,\"p90_ns\":%.1f,"
+                   "\"p99_ns\":%.1f,\"max_ns\":%.1f}\n", pace, handoff.getPublished(), readings / seconds,
+                   latencies.size(), handoff.getDropped(), percentile(latencies, 0.5), percentile(latencies, 0.9),
+                   percentile(latencies, 0.99), latencies.back());
+        }
+    }
+
+    /// @brief Times a counter increment and a histogram observation, which the hot paths do for every reading, frame
+    /// and loop iteration. The increment is also timed with two threads incrementing the same counter, as the sensor task
+    /// and the network thread can.
+    void measureMetrics() {
+        Counter counter;
+        run("metrics_counter_increment", 20000000, BATCH_SIZE, [&]() {
+            counter.increment();
+        });
+        // the bounds of the sensor read time, with values spread over every bucket
+        Histogram<7> histogram{{25, 50, 75, 100, 150, 250, 500}};
+        uint32_t value = 0;
+        run("metrics_histogram_observe", 20000000, BATCH_SIZE, [&]() {
+            histogram.observe(value++ % 600);
+        });
+        if (!selected("metrics_counter_contended")) {
+            return;
+        }
+
+        Counter shared;
+        std::atomic<bool> go{false};
+        auto incrementAll = [&]() {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (uint32_t i = 0; i < CONTENDED_INCREMENTS; i++) {
+                shared.increment();
+            }
+        };
+        std::thread other(incrementAll);
+        auto startedAt = Clock::now();
+        go.store(true, std::memory_order_release);
+        incrementAll();
+        other.join();
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - startedAt).count();
+        // relaxed increments are still atomic, none of them may be lost
+        constexpr uint32_t increments = 2 * CONTENDED_INCREMENTS;
+        printf("{\"benchmark\":\"metrics_counter_contended\",\"threads\":2,\"increments\":%u,"
+               "\"ns_per_increment\":%.2f,\"lost\":%u}\n", increments, elapsed / increments,
+               increments - shared.get());
+    }
+
+    /// @brief Times a log call, which only captures its arguments into the ring, against the log_e() it replaced, which
+    /// formats the line and writes it out before returning (on the host to stderr, sent to /dev/null meanwhile; on the
+    /// device to the serial port, which is slower still). The drain's formatting is timed per record too.
+    void measureLog() {
+        Log::begin([](const char *line, size_t length) {
+            sink = length;
+        });
+        static LogSite site{"Disconnecting %s after %u dropped frames", LogLevel::Error};
+        const char *client = "192.168.1.31";
+        uint32_t dropped = 0;
+        run("log_deferred", 2000000, BATCH_SIZE, [&]() {
+            // or the rate limit would leave out nearly every call
+            site.inWindow.store(0, std::memory_order_relaxed);
+            Log::write(site, client, dropped++);
+        });
+        run("log_deferred_rate_limited", 2000000, BATCH_SIZE, [&]() {
+            Log::write(site, client, dropped++);
+        });
+        if (selected("log_sync_printf")) {
+            fflush(stderr);
+            auto savedStderr = dup(STDERR_FILENO);
+            auto devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDERR_FILENO);
+            run("log_sync_printf", 500000, BATCH_SIZE, [&]() {
+                log_e("Disconnecting %s after %u dropped frames", client, dropped++);
+            });
+            dup2(savedStderr, STDERR_FILENO);
+            close(devNull);
+            close(savedStderr);
+        }
+        if (selected("log_drain")) {
+            // the records of the calls above were mostly overwritten, they're counted as lost here
+            Log::drain();
+            auto lost = Log::getLost();
+            double elapsed = 0;
+            for (int round = 0; round < LOG_DRAIN_ROUNDS; round++) {
+                for (size_t i = 0; i < LOG_RING_CAPACITY; i++) {
+                    site.inWindow.store(0, std::memory_order_relaxed);
+                    Log::write(site, client, dropped++);
+                }
+                auto startedAt = Clock::now();
+                Log::drain();
+                elapsed += std::chrono::duration<double, std::nano>(Clock::now() - startedAt).count();
+            }
+            printf("{\"benchmark\":\"log_drain\",\"records\":%zu,\"ns_per_record\":%.1f,\"lost\":%u}\n",
+                   LOG_DRAIN_ROUNDS * LOG_RING_CAPACITY, elapsed / (LOG_DRAIN_ROUNDS * LOG_RING_CAPACITY),
+                   Log::getLost() - lost);
+        }
+    }
+
+    /// @brief Counts the readings per second a bus of simulated probes with different latencies delivers when every probe is
+    /// asked for a new reading as soon as it answered. Once with the transactions overlapping, as SensorBus runs them, and
+    /// once with one transaction at a time, which is what polling the probes one after another would get.
+    void measureSensorBus() {
+        if (!selected("sensor_bus")) {
+            return;
+        }
+        // the simulated probes on UARTs 1 to 4 take 20, 60, 120 and 250 ms to start answering, see setup()
+        const ProbePins pins[MAX_PROBES] = {{1, -1, -1}, {2, -1, -1}, {3, -1, -1}, {4, -1, -1}};
+        constexpr unsigned long duration = 2000;
+        for (size_t count = 1; count <= MAX_PROBES; count++) {
+            SensorBus bus(pins, count);
+            uint32_t overlapped = 0;
+            auto startedAt = millis();
+            while (millis() - startedAt < duration) {
+                for (size_t probe = 0; probe < count; probe++) {
+                    bus[probe].requestReading(0);
+                }
+                bus.loop();
+                for (size_t probe = 0; probe < count; probe++) {
+                    overlapped += bus[probe].takeReadings();
+                }
+                usleep(200);
+            }
+
+            uint32_t sequential = 0;
+            startedAt = millis();
+            for (size_t probe = 0; millis() - startedAt < duration; probe = (probe + 1) % count) {
+                // a reading taken in the same millisecond as the request meets it, so the request is repeated until one
+                // arrives
+                do {
+                    bus[probe].requestReading(0);
+                    bus[probe].loop();
+                    usleep(200);
+                } while (!bus[probe].takeReadings());
+                sequential++;
+            }
+            printf("{\"benchmark\":\"sensor_bus\",\"probes\":%zu,\"readings_per_sec\":%.1f,"
+                   "\"sequential_readings_per_sec\":%.1f}\n", count, overlapped * 1000.0 / duration,
+                   sequential * 1000.0 / duration);
+        }
+    }
+
+    /// @brief Reading of a trace, in hundredths
+    struct TraceSample {
+        int16_t humidity;
+        int16_t temperature;
+    };
+
+    /// @brief Reads a trace with a "humidity,temperature" line per second, e.g. exported from the monitoring app
+    std::vector<TraceSample> loadTrace(const char *path) {
+        std::vector<TraceSample> trace;
+        auto file = fopen(path, "r");
+        if (!file) {
+            perror(path);
+            return trace;
+        }
+        float humidity;
+        float temperature;
+        while (fscanf(file, "%f,%f", &humidity, &temperature) == 2) {
+            trace.push_back({static_cast<int16_t>(lroundf(humidity * 100)), static_cast<int16_t>(lroundf(temperature * 100))});
+        }
+        fclose(file);
+        return trace;
+    }
+
+    /// @brief Makes a day of readings taken every second in a chamber: the probe's noise on top of the set point, plus a
+    /// slow daily drift and door openings (humidity jumping and settling over minutes) if asked for
+    std::vector<TraceSample> chamberTrace(float drift, bool doorOpenings) {
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> noise(-0.03f, 0.03f);
+        std::vector<TraceSample> trace;
+        for (uint32_t second = 0; second < 24 * 3600; second++) {
+            auto humidity = 45.0f + noise(random);
+            auto temperature = 23.0f + drift * sinf(second * 2 * static_cast<float>(M_PI) / (24 * 3600)) + noise(random);
+            // the door is opened every 2 hours
+            if (doorOpenings && second >= 3600) {
+                auto sinceOpening = (second - 3600) % 7200;
+                humidity += 8.0f * expf(-static_cast<float>(sinceOpening) / 120);
+                temperature -= 1.5f * expf(-static_cast<float>(sinceOpening) / 300);
+            }
+            trace.push_back({static_cast<int16_t>(lroundf(humidity * 100)), static_cast<int16_t>(lroundf(temperature * 100))});
+        }
+        return trace;
+    }
+
+    /// @brief Replays a trace through report-by-exception with the default thresholds, like a TCP client in the exception
+    /// mode with a 1 s interval would get it. Prints how many times fewer frames and bytes it takes than sending every
+    /// reading, and the largest difference between a reading and the last reported value a client holds until the next
+    /// report.
+    void replayTrace(const char *name, const std::vector<TraceSample> &trace) {
+        ReportWindow window;
+        ReportThresholds thresholds;
+        char json[JSON_FRAME_BUFFER];
+        uint64_t everyReadingBytes = 0;
+        uint64_t reportedBytes = 0;
+        uint32_t reports = 0;
+        TraceSample held{};
+        int32_t maxHumidityError = 0;
+        int32_t maxTemperatureError = 0;
+        // the window's extremes have to match the readings it stands for
+        int16_t windowMax = INT16_MIN;
+        uint32_t hiddenExtremes = 0;
+        for (uint32_t i = 0; i < trace.size(); i++) {
+            StreamRecord record{i, i * 1000, trace[i].humidity, trace[i].temperature, -60, 1, true, 0};
+            everyReadingBytes += TCPServer::toJson(record, false, json, sizeof(json));
+            windowMax = std::max(windowMax, record.humidity);
+            if (window.add(record, thresholds)) {
+                auto summary = window.summary();
+                reportedBytes += TCPServer::toJson(record, false, json, sizeof(json), &summary);
+                hiddenExtremes += lroundf(summary.humidity.max * 100) != windowMax;
+                window.nextWindow(record);
+                windowMax = INT16_MIN;
+                held = trace[i];
+                reports++;
+            }
+            maxHumidityError = std::max(maxHumidityError, abs(trace[i].humidity - held.humidity));
+            maxTemperatureError = std::max(maxTemperatureError, abs(trace[i].temperature - held.temperature));
+        }
+        printf("{\"benchmark\":\"report_by_exception\",\"trace\":\"%s\",\"readings\":%zu,\"reports\":%u,"
+               "\"compression\":%.1f,\"bytes_compression\":%.1f,\"max_humidity_error\":%.2f,"
+               "\"max_temperature_error\":%.2f,\"hidden_extremes\":%u}\n", name, trace.size(), reports,
+               static_cast<double>(trace.size()) / std::max(reports, 1u),
+               static_cast<double>(everyReadingBytes) / std::max<uint64_t>(reportedBytes, 1), maxHumidityError / 100.0,
+               maxTemperatureError / 100.0, hiddenExtremes);
+    }
+
+    /// @brief Replays synthetic chamber traces, and the one in the file POLEKO_TRACE points to if it's set
+    void measureReportByException() {
+        if (!selected("report_by_exception")) {
+            return;
+        }
+        replayTrace("stable", chamberTrace(0.0f, false));
+        replayTrace("daily_drift", chamberTrace(1.0f, false));
+        replayTrace("door_openings", chamberTrace(0.3f, true));
+        if (auto path = getenv("POLEKO_TRACE")) {
+            replayTrace(path, loadTrace(path));
+        }
+    }
+
+    /// @brief Logs a trace at the firmware's interval, with every probe reading the same values offset a little, and prints
+    /// the flash a row takes against the 4 byte timestamp and 2 byte values of an uncompressed one. The whole log is read
+    /// back, every decoded value has to match the logged one.
+    void logTrace(HistoryLog &history, const char *name, const std::vector<TraceSample> &trace, size_t probes) {
+        history.erase();
+        auto before = history.getStats();
+        uint32_t rows = 0;
+        for (size_t i = 0; i < trace.size(); i += HISTORY_BENCH_INTERVAL) {
+            HistorySample samples[MAX_PROBES];
+            for (size_t probe = 0; probe < probes; probe++) {
+                samples[probe] = {static_cast<int16_t>(trace[i].humidity + probe * 100),
+                                  static_cast<int16_t>(trace[i].temperature - probe * 50), true};
+            }
+            rows += history.append(HISTORY_MIN_TIME + i, samples, probes);
+        }
+        auto after = history.getStats();
+
+        HistoryCursor cursor;
+        HistoryRow row;
+        uint32_t decoded = 0, mismatches = 0;
+        history.open(cursor, 0, UINT32_MAX);
+        while (history.next(cursor, row)) {
+            auto &sample = trace[(row.time - HISTORY_MIN_TIME) % trace.size()];
+            for (size_t probe = 0; probe < row.probes; probe++) {
+                mismatches += row.samples[probe].humidity != sample.humidity + static_cast<int>(probe) * 100 ||
+                              row.samples[probe].temperature != sample.temperature - static_cast<int>(probe) * 50;
+            }
+            decoded++;
+        }
+        auto bytes = (after.bitsStored - before.bitsStored) / 8.0;
+        printf("{\"benchmark\":\"history_log\",\"trace\":\"%s\",\"probes\":%zu,\"rows\":%u,\"bytes_per_row\":%.2f,"
+               "\"bits_per_sample\":%.2f,\"compression\":%.1f,\"sectors\":%u,\"decoded_rows\":%u,\"mismatches\":%u}\n",
+               name, probes, rows, bytes / rows, bytes * 8.0 / rows / probes,
+               (4.0 + 4.0 * probes) * rows / bytes, after.sectorsUsed, decoded, mismatches);
+    }
+
+    /// @brief Measures the history log on the emulated flash: the flash a row takes for the chamber traces, the time an
+    /// append takes, how fast a cursor decodes a day of rows and how evenly the ring wears the sectors once it turned a few
+    /// times
+    void measureHistoryLog(HistoryLog &history) {
+        if (!selected("history")) {
+            return;
+        }
+        auto drift = chamberTrace(1.0f, false);
+        auto doors = chamberTrace(0.3f, true);
+        for (size_t probes: {1, 2}) {
+            logTrace(history, "stable", chamberTrace(0.0f, false), probes);
+            logTrace(history, "daily_drift", drift, probes);
+            logTrace(history, "door_openings", doors, probes);
+        }
+        if (auto path = getenv("POLEKO_TRACE")) {
+            logTrace(history, path, loadTrace(path), 1);
+        }
+
+        // a day of door openings is left in the log for the cursor and the /history request
+        history.erase();
+        uint32_t time = HISTORY_MIN_TIME;
+        size_t i = 0;
+        auto appendNext = [&]() {
+            HistorySample sample{doors[i].humidity, doors[i].temperature, true};
+            i = (i + HISTORY_BENCH_INTERVAL) % doors.size();
+            time += HISTORY_BENCH_INTERVAL;
+            return history.append(time, &sample, 1);
+        };
+        run("history_append", 200000, BATCH_SIZE, [&]() {
+            sink = appendNext();
+        });
+
+        HistoryCursor cursor;
+        HistoryRow row;
+        uint32_t rows = 0;
+        auto end = time;
+        auto startedAt = Clock::now();
+        history.open(cursor, end - 24 * 3600, end);
+        while (history.next(cursor, row)) {
+            rows++;
+        }
+        auto seconds = std::chrono::duration<double>(Clock::now() - startedAt).count();
+        printf("{\"benchmark\":\"history_cursor\",\"rows\":%u,\"rows_per_sec\":%.0f}\n", rows, rows / seconds);
+
+        // the ring turned three times, every sector should have been erased as often as the others
+        auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "history");
+        auto stats = history.getStats();
+        auto erasesBefore = flashStats(partition).erases;
+        while (flashStats(partition).erases - erasesBefore < 3 * stats.sectorCount) {
+            appendNext();
+        }
+        auto wear = flashStats(partition);
+        stats = history.getStats();
+        printf("{\"benchmark\":\"history_wear\",\"sectors\":%u,\"days_kept\":%.1f,\"min_sector_erases\":%u,"
+               "\"max_sector_erases\":%u}\n", stats.sectorCount, (time - stats.oldestTime) / 86400.0,
+               wear.minSectorErases, wear.maxSectorErases);
+    }
+
+    /// @brief Connects to an in-process server over loopback
+    /// @return The socket or -1 if the connection failed
+    int openLoopback(uint16_t port) {
+        auto socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+            perror("connect");
+            close(socket);
+            return -1;
+        }
+        int enable = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        return socket;
+    }
+
+    /// @brief Streams the readings of a bus of four probes to a TCP client in batches of 1, 8 and 32 readings, and prints
+    /// per reading: the send() calls (a call into lwIP on the ESP32, a syscall on a sockets API), the writes the native
+    /// network thread made, the payload and the bytes on the wire with the headers of the segments the sends took
+    void measureTcpBatching(Settings &settings) {
+        if (!selected("tcp_batching")) {
+            return;
+        }
+        const ProbePins pins[MAX_PROBES] = {{1, -1, -1}, {2, -1, -1}, {3, -1, -1}, {4, -1, -1}};
+        SensorBus bus(pins, MAX_PROBES);
+        TCPServer server(bus, settings);
+        server.setup();
+        for (unsigned short batch: {1, 8, 32}) {
+            auto socket = openLoopback(hal::hostPort(5505));
+            char command[64];
+            auto length = snprintf(command, sizeof(command), "{\"interval\":1,\"save\":false,\"batch\":%u}\n", batch);
+            send(socket, command, length, MSG_NOSIGNAL);
+            // counted from the batch's acknowledgement on, every frame after it is batched
+            std::string received;
+            AsyncTcpStats before{};
+            bool configured = false;
+            uint32_t readings = 0;
+            auto startedAt = Clock::now();
+            while (readings < BATCHING_READINGS && Clock::now() - startedAt < std::chrono::seconds(60)) {
+                bus.loop();
+                for (size_t probe = 0; probe < bus.size(); probe++) {
+                    bus[probe].takeReadings();
+                }
+                TCPServer::loop();
+                char buffer[4096];
+                auto count = recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (count > 0) {
+                    received.append(buffer, count);
+                }
+                for (auto end = received.find('\n'); end != std::string::npos; end = received.find('\n')) {
+                    if (configured) {
+                        readings++;
+                    } else if (received.compare(0, end, "{\"ack\":\"batch\"}") == 0) {
+                        configured = true;
+                        before = asyncTcpStats();
+                    }
+                    received.erase(0, end + 1);
+                }
+                usleep(200);
+            }
+            auto after = asyncTcpStats();
+            close(socket);
+            auto bytes = after.bytes - before.bytes;
+            auto segments = after.segments - before.segments;
+            printf("{\"benchmark\":\"tcp_batching\",\"batch\":%u,\"readings\":%u,\"syscalls_per_reading\":%.3f,"
+                   "\"host_writes_per_reading\":%.3f,\"segments_per_reading\":%.3f,\"payload_bytes_per_reading\":%.1f,"
+                   "\"wire_bytes_per_reading\":%.1f}\n", batch, readings,
+                   static_cast<double>(after.sends - before.sends) / readings,
+                   static_cast<double>(after.writes - before.writes) / readings,
+                   static_cast<double>(segments) / readings, static_cast<double>(bytes) / readings,
+                   static_cast<double>(bytes + segments * TCP_IP_HEADER) / readings);
+        }
+        server.stop();
+        // the batching is saved, the servers measured later start without it
+        settings.setTcpBatch(1);
+    }
+
+    /// @brief Keep-alive connection to the in-process HTTP server
+    class HTTPBenchClient {
+    public:
+        explicit HTTPBenchClient(uint16_t port) : socket(openLoopback(port)) {}
+
+        ~HTTPBenchClient() {
+            if (socket >= 0) {
+                close(socket);
+            }
+        }
+
+        bool connected() const {
+            return socket >= 0;
+        }
+
+        /// @brief Sends the request and reads the whole response
+        /// @return Length of the body or 0 if the response didn't arrive
+        size_t exchange(std::string_view request) {
+            if (send(socket, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+                return 0;
+            }
+            size_t used = 0;
+            size_t headerEnd = 0;
+            size_t contentLength = 0;
+            while (true) {
+                auto received = recv(socket, response + used, sizeof(response) - used, 0);
+                if (received <= 0) {
+                    return 0;
+                }
+                used += received;
+                std::string_view text(response, used);
+                if (headerEnd == 0) {
+                    auto end = text.find("\r\n\r\n");
+                    if (end == std::string_view::npos) {
+                        continue;
+                    }
+                    headerEnd = end + 4;
+                    auto header = text.find("Content-Length: ");
+                    contentLength = header == std::string_view::npos ? 0 : strtoul(response + header + 16, nullptr, 10);
+                }
+                if (used >= headerEnd + contentLength) {
+                    responseLength = used;
+                    return contentLength;
+                }
+            }
+        }
+
+        /// @brief Sends a request whose response ends with the connection, like a /history export, and reads all of it
+        /// @return Amount of bytes received
+        size_t exchangeUntilClosed(std::string_view request) {
+            if (send(socket, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+                return 0;
+            }
+            size_t total = 0;
+            while (true) {
+                auto received = recv(socket, response, sizeof(response), 0);
+                if (received <= 0) {
+                    return total;
+                }
+                total += received;
+            }
+        }
+
+        /// @brief Gets the whole response exchange() received last, header included
+        std::string_view lastResponse() const {
+            return std::string_view(response, responseLength);
+        }
+
+        /// @brief Sends a request without waiting for the response, e.g. to open an /events stream
+        bool sendOnly(std::string_view request) {
+            return send(socket, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size());
+        }
+
+        /// @brief Reads what arrived so far without waiting
+        /// @return The bytes received by this call, empty once nothing more arrived
+        std::string_view poll() {
+            auto received = recv(socket, response, sizeof(response), MSG_DONTWAIT);
+            return std::string_view(response, received > 0 ? received : 0);
+        }
+
+    private:
+        int socket = -1;
+        char response[HTTP_RESPONSE_BUFFER];
+        size_t responseLength = 0;
+    };
+
+    /// @brief Runs loop() of the servers, as the event loop would, until the condition holds or SOAK_TIMEOUT passes
+    template<typename Condition>
+    bool pumpUntil(HTTPServer &httpServer, Condition condition) {
+        auto startedAt = Clock::now();
+        while (!condition()) {
+            if (Clock::now() - startedAt > std::chrono::milliseconds(SOAK_TIMEOUT)) {
+                return false;
+            }
+            TCPServer::loop();
+            httpServer.loop();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return true;
+    }
+
+    /// @brief Gets the amount of TCP clients holding a slot, from the server's metrics
+    unsigned long tcpClientCount() {
+        static char text[HTTP_RESPONSE_BUFFER];
+        MetricsWriter writer(text, sizeof(text));
+        TCPServer::writeMetrics(writer);
+        // the sample, not the # TYPE line before it
+        auto found = strstr(text, "\npoleko_tcp_clients ");
+        return found == nullptr ? ULONG_MAX : strtoul(found + sizeof("\npoleko_tcp_clients ") - 1, nullptr, 10);
+    }
+
+    /// @brief One life of the network services: they're set up, filled with clients beyond their slots, and stopped while
+    /// half the clients disconnected on their own and the others are still connected
+    /// @return false if a client didn't get what it should have
+    bool soakCycle(TCPServer &tcpServer, HTTPServer &httpServer, EspUDPServer &udpServer) {
+        tcpServer.setup();
+        udpServer.setup();
+        httpServer.setup();
+        bool passed = true;
+
+        // one client more than there are slots, it's turned away with {"error":"busy"}
+        std::array<int, MAX_TCP_CLIENTS + 1> tcpClients{};
+        std::array<std::string, MAX_TCP_CLIENTS + 1> replies;
+        for (auto &socket: tcpClients) {
+            socket = openLoopback(hal::hostPort(5505));
+            send(socket, "{\"ping\":true}\n", 14, MSG_NOSIGNAL);
+        }
+        passed &= pumpUntil(httpServer, [&]() {
+            bool replied = true;
+            for (size_t i = 0; i < tcpClients.size(); i++) {
+                char buffer[64];
+                auto received = recv(tcpClients[i], buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (received > 0) {
+                    replies[i].append(buffer, received);
+                }
+                replied &= replies[i].find('\n') != std::string::npos;
+            }
+            return replied;
+        });
+        passed &= replies.back().compare(0, 16, "{\"error\":\"busy\"}") == 0;
+        for (size_t i = 0; i < MAX_TCP_CLIENTS; i += 2) {
+            close(tcpClients[i]);
+            tcpClients[i] = -1;
+        }
+        close(tcpClients.back());
+        tcpClients.back() = -1;
+        passed &= pumpUntil(httpServer, []() { return tcpClientCount() == MAX_TCP_CLIENTS / 2; });
+
+        // every request slot and an /events stream, half of them closed by the client
+        std::array<std::unique_ptr<HTTPBenchClient>, MAX_HTTP_CONNECTIONS - 1> httpClients;
+        for (auto &client: httpClients) {
+            client = std::make_unique<HTTPBenchClient>(hal::hostPort(80));
+            passed &= client->exchange("GET /status HTTP/1.1\r\nHost: 192.168.1.20\r\n\r\n") > 0;
+        }
+        auto stream = std::make_unique<HTTPBenchClient>(hal::hostPort(80));
+        std::string events;
+        stream->sendOnly("GET /events HTTP/1.1\r\nHost: 192.168.1.20\r\n\r\n");
+        passed &= pumpUntil(httpServer, [&]() {
+            events.append(stream->poll());
+            return events.find("retry:") != std::string::npos;
+        });
+        for (size_t i = 0; i < httpClients.size(); i += 2) {
+            httpClients[i] = nullptr;
+        }
+        // the disconnects are handled before the server is stopped, a request on a remaining connection waits for them
+        passed &= pumpUntil(httpServer, [&]() {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "\"httpConnections\":%zu", httpClients.size() / 2);
+            auto &client = *httpClients[1];
+            return client.exchange("GET /status HTTP/1.1\r\nHost: 192.168.1.20\r\n\r\n") > 0 &&
+                   client.lastResponse().find(expected) != std::string_view::npos;
+        });
+
+        tcpServer.stop();
+        udpServer.stop();
+        httpServer.stop();
+        for (auto socket: tcpClients) {
+            if (socket >= 0) {
+                close(socket);
+            }
+        }
+        return passed;
+    }
+
+    /// @brief Cycles the network services through thousands of lives and checks that nothing they allocate for a client
+    /// or a setup outlives it. The check counts the objects still allocated rather than the free heap, which also moves
+    /// with the blocks malloc keeps cached for its threads; the free heap's change is printed next to it.
+    /// @return false if objects were left allocated or a cycle failed
+    bool measureNetworkSoak(TCPServer &tcpServer, HTTPServer &httpServer, EspUDPServer &udpServer) {
+        if (!selected("network_soak")) {
+            return true;
+        }
+        bool passed = true;
+        for (int i = 0; i < SOAK_WARMUP_CYCLES; i++) {
+            passed &= soakCycle(tcpServer, httpServer, udpServer);
+        }
+        auto freeBefore = ESP.getFreeHeap();
+        auto liveBefore = liveBytes.load(std::memory_order_relaxed);
+        auto allocatedBefore = AllocationCount::now();
+        auto startedAt = Clock::now();
+        for (int i = 0; i < SOAK_CYCLES; i++) {
+            passed &= soakCycle(tcpServer, httpServer, udpServer);
+        }
+        auto seconds = std::chrono::duration<double>(Clock::now() - startedAt).count();
+        auto allocatedAfter = AllocationCount::now();
+        auto growth = liveBytes.load(std::memory_order_relaxed) - liveBefore;
+        auto freeHeapDrop = static_cast<int64_t>(freeBefore) - ESP.getFreeHeap();
+        passed &= growth <= 0;
+        printf("{\"benchmark\":\"network_soak\",\"cycles\":%d,\"ms_per_cycle\":%.2f,\"heap_growth_bytes\":%lld,"
+               "\"free_heap_drop_bytes\":%lld,\"allocs_per_cycle\":%.1f,\"passed\":%s}\n",
+               SOAK_CYCLES, seconds * 1000 / SOAK_CYCLES, static_cast<long long>(growth),
+               static_cast<long long>(freeHeapDrop),
+               static_cast<double>(allocatedAfter.count - allocatedBefore.count) / SOAK_CYCLES,
+               passed ? "true" : "false");
+        return passed;
+    }
+}
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    auto memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+// malloc itself is wrapped to count the bytes that are still allocated, frames and strings don't go through new
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *memory, size_t size);
+void __libc_free(void *memory);
+
+void *malloc(size_t size) {
+    auto memory = __libc_malloc(size);
+    if (memory != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+void *calloc(size_t count, size_t size) {
+    auto memory = __libc_calloc(count, size);
+    if (memory != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+void *realloc(void *memory, size_t size) {
+    auto previous = memory == nullptr ? 0 : static_cast<int64_t>(malloc_usable_size(memory));
+    auto moved = __libc_realloc(memory, size);
+    if (moved != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(moved)) - previous, std::memory_order_relaxed);
+    } else if (size == 0) {
+        liveBytes.fetch_sub(previous, std::memory_order_relaxed);
+    }
+    return moved;
+}
+
+void free(void *memory) {
+    if (memory != nullptr) {
+        liveBytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    __libc_free(memory);
+}
+}
+
+void setup() {
+    // the servers run on the loopback interface, away from the ports a firmware process would use
+    setenv("POLEKO_PORT_OFFSET", "30000", 0);
+    // settings are changed over and over, they shouldn't end up in a file
+    setenv("POLEKO_NVS", ":memory:", 0);
+    // and the history log is erased and filled a few times
+    setenv("POLEKO_FLASH", ":memory:", 0);
+    // probes answering at different speeds, for the sensor bus
+    setenv("POLEKO_PROBE_DELAY", "20,60,120,250", 0);
+
+    const std::string_view response =
+            "{F00rdd 001; 45.32;%rh;000;=; 23.45;'C;000;=;nc;---.-;'C;000; ;001;V1.7-1;0060568338;        }";
+    // a whole response, as collected by Sensor::loop()
+    ProbeFrame frame;
+    run("probe_frame_parse", 2000000, BATCH_SIZE, [&]() {
+        frame.clear();
+        for (auto c: response) {
+            frame.push(c);
+        }
+        sink = frame.parse().valid();
+    });
+
+    const ProbePins pins[] = {{2, 16, 17}};
+    static SensorBus sensors(pins, 1);
+    auto &sensor = sensors[0];
+    run("sensor_json", 500000, BATCH_SIZE, [&]() {
+        sink = sensor.getJsonString().length();
+    });
+
+    // the same frames encoded by JsonEncoder and by ArduinoJson, which the firmware used before
+    StreamRecord record{1234, 5678000, 4532, 2345, -61, 2, true};
+    char json[JSON_FRAME_BUFFER];
+    run("tcp_json_frame", 500000, BATCH_SIZE, [&]() {
+        sink = TCPServer::toJson(record, false, json, sizeof(json));
+    });
+    run("tcp_json_frame_arduinojson", 500000, BATCH_SIZE, [&]() {
+        sink = arduinoJsonFrame(record, false).length();
+    });
+    run("tcp_json_frame_metrics", 200000, BATCH_SIZE, [&]() {
+        sink = TCPServer::toJson(record, true, json, sizeof(json));
+    });
+    run("tcp_json_frame_metrics_arduinojson", 200000, BATCH_SIZE, [&]() {
+        sink = arduinoJsonFrame(record, true).length();
+    });
+    // a frame the monitoring app could tell apart fails the run, like a leak in the soak test
+    bool encodersMatch = compareJsonEncoders();
+
+    uint8_t binary[BINARY_RECORD_SIZE];
+    run("tcp_binary_frame", 2000000, BATCH_SIZE, [&]() {
+        sink = encodeBinaryRecord(record, binary);
+    });
+
+    static EspUDPServer udpServer;
+    udpServer.setup();
+    run("udp_beacon", 100000, BATCH_SIZE, [&]() {
+        udpServer.sendPacket();
+    });
+    udpServer.stop();
+
+    const std::string_view request = "GET /reading HTTP/1.1\r\nHost: 192.168.1.20\r\nUser-Agent: bench\r\n"
+                                     "Accept: */*\r\n\r\n";
+    HTTPRequestParser parser;
+    run("http_request_parse", 1000000, BATCH_SIZE, [&]() {
+        parser.reset();
+        parser.push(request.data(), request.size());
+        sink = parser.getPath().size();
+    });
+
+    // a TCP command split across two packets, framed and parsed
+    const std::string_view command = "{\"interval\":5,\"save\":false}\n{\"stats\":true}\n";
+    CommandFramer commandFramer;
+    run("tcp_command_parse", 1000000, BATCH_SIZE, [&]() {
+        auto parse = [](std::string_view text, bool tooLong) {
+            Command parsed;
+            sink = parsed.parse(text) ? parsed.size() : 0;
+        };
+        commandFramer.push(command.data(), 10, parse);
+        commandFramer.push(command.data() + 10, command.size() - 10, parse);
+    });
+
+    // a TCP command changing the interval, which is only written to flash once the changes stop
+    static Settings settings;
+    settings.begin();
+    uint16_t interval = 0;
+    run("settings_update", 1000000, BATCH_SIZE, [&]() {
+        settings.setTcpInterval(interval++ % 60 + 1);
+        settings.loop();
+    });
+    measureSettingsWear(settings);
+    measureEventLoop();
+    measureReadingChannel();
+    measureMetrics();
+    measureLog();
+
+    // whole requests served by the server, including the loopback round trip. /metrics also lists the TCP clients.
+    measureSensorBus();
+    measureReportByException();
+    static HistoryLog history;
+    history.begin();
+    measureHistoryLog(history);
+
+    measureTcpBatching(settings);
+
+    static TCPServer tcpServer(sensors, settings);
+    static HTTPServer httpServer(sensors, history);
+    // the probe isn't polled here, the cached reading is served no matter how old it is
+    sensor.setMaxAge(ULONG_MAX);
+    httpServer.setup();
+    // closed once they're done, so that the soak test gets every slot
+    {
+        HTTPBenchClient client(hal::hostPort(80));
+        if (client.connected()) {
+            run("http_reading_request", 20000, 1, [&]() {
+                sink = client.exchange(request);
+            });
+            run("http_metrics_request", 5000, 1, [&]() {
+                sink = client.exchange("GET /metrics HTTP/1.1\r\nHost: 192.168.1.20\r\n\r\n");
+            });
+        }
+    }
+    // the last day of the history log streamed as CSV, each export on a connection of its own as it closes it
+    if (selected("http_history_export") && history.getStats().sectorsUsed > 0) {
+        HistoryCursor cursor;
+        HistoryRow row;
+        uint32_t newest = 0;
+        history.open(cursor, 0, UINT32_MAX);
+        while (history.next(cursor, row)) {
+            newest = row.time;
+        }
+        char exportRequest[128];
+        snprintf(exportRequest, sizeof(exportRequest), "GET /history?from=%lu&to=%lu HTTP/1.1\r\nHost: 192.168.1.20\r\n\r\n",
+                 static_cast<unsigned long>(newest - 24 * 3600), static_cast<unsigned long>(newest));
+        constexpr int exports = 20;
+        size_t bytes = 0;
+        auto startedAt = Clock::now();
+        for (int i = 0; i < exports; i++) {
+            HTTPBenchClient exportClient(hal::hostPort(80));
+            bytes += exportClient.exchangeUntilClosed(exportRequest);
+        }
+        auto seconds = std::chrono::duration<double>(Clock::now() - startedAt).count();
+        printf("{\"benchmark\":\"http_history_export\",\"bytes_per_export\":%zu,\"mb_per_sec\":%.2f}\n",
+               bytes / exports, bytes / seconds / 1e6);
+    }
+
+    // last, as it leaves the servers stopped
+    bool soakPassed = measureNetworkSoak(tcpServer, httpServer, udpServer);
+
+    // the servers' threads are still running, static destructors would race with them
+    fflush(stdout);
+    _exit(soakPassed && encodersMatch ? 0 : 1);
+}
+
+void loop() {}
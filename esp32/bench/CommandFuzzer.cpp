@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "CommandParser.h"
+
+// Fuzz target of the TCP command parser, built by the native_fuzz environment. With clang it can be linked with libFuzzer
+// (-fsanitize=fuzzer,address -D POLEKO_LIBFUZZER), otherwise the main() below replays the files given as arguments or, with
+// none, feeds it random inputs made of command fragments. Both ways it's meant to run under AddressSanitizer and UBSan.
+
+namespace {
+    struct ParsedCommand {
+        std::string text;
+        bool tooLong;
+        bool valid;
+        size_t fields;
+    };
+
+    void check(bool condition, const char *message) {
+        if (!condition) {
+            fprintf(stderr, "%s\n", message);
+            abort();
+        }
+    }
+
+    /// @brief Feeds the input to a framer in chunks of the given size, parsing every command it completes
+    std::vector<ParsedCommand> frame(const uint8_t *data, size_t size, size_t chunk) {
+        std::vector<ParsedCommand> commands;
+        CommandFramer framer;
+        for (size_t offset = 0; offset < size; offset += chunk) {
+            auto length = std::min(chunk, size - offset);
+            framer.push(reinterpret_cast<const char *>(data + offset), length, [&commands](std::string_view text, bool tooLong) {
+                check(text.size() <= TCP_COMMAND_BUFFER, "command longer than the buffer");
+                check(!tooLong || text.empty(), "too long command passed with its text");
+                Command command;
+                bool valid = command.parse(text);
+                check(command.size() <= MAX_COMMAND_FIELDS, "too many fields");
+                for (size_t i = 0; valid && i < command.size(); i++) {
+                    auto &field = command[i];
+                    // keys and values have to point into the command
+                    check(field.key.data() >= text.data() && field.key.data() + field.key.size() <= text.data() + text.size(),
+                          "key outside of the command");
+                    check(field.value.data() >= text.data() &&
+                          field.value.data() + field.value.size() <= text.data() + text.size(), "value outside of the command");
+                    check(command.find(field.key) != nullptr, "field not found by its key");
+                    uint32_t number;
+                    bool boolean;
+                    field.toUnsigned(number);
+                    field.toBool(boolean);
+                }
+                commands.push_back({std::string(text), tooLong, valid, valid ? command.size() : 0});
+            });
+        }
+        return commands;
+    }
+}
+
+/// @brief The commands have to be the same no matter how TCP splits the input
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    auto whole = frame(data, size, size == 0 ? 1 : size);
+    for (size_t chunk: {1, 2, 7, 64}) {
+        auto split = frame(data, size, chunk);
+        check(split.size() == whole.size(), "different amount of commands when split");
+        for (size_t i = 0; i < whole.size(); i++) {
+            check(split[i].text == whole[i].text && split[i].tooLong == whole[i].tooLong &&
+                  split[i].valid == whole[i].valid && split[i].fields == whole[i].fields, "different command when split");
+        }
+    }
+    return 0;
+}
+
+#ifndef POLEKO_LIBFUZZER
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            auto file = fopen(argv[i], "rb");
+            if (!file) {
+                perror(argv[i]);
+                return 1;
+            }
+            std::vector<uint8_t> input;
+            int c;
+            while ((c = fgetc(file)) != EOF) {
+                input.push_back(static_cast<uint8_t>(c));
+            }
+            fclose(file);
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        return 0;
+    }
+
+    // fragments of valid and broken commands, so that random inputs get past the first brace
+    const char *fragments[] = {"{", "}", "[", "]", "\"", "\\", ":", ",", "\n", " ", "\"interval\"", "\"save\"", "\"stats\"",
+                               "5", "-1", "4294967296", "1.5e3", "true", "false", "null", "\"average\"", "\"a\\\"b\"",
+                               "{\"ping\":true}", "{\"since\":123,\"format\":\"binary\"}", "\xff", "\0"};
+    auto iterations = getenv("POLEKO_FUZZ_ITERATIONS") ? strtoul(getenv("POLEKO_FUZZ_ITERATIONS"), nullptr, 10) : 100000;
+    std::mt19937 random(1);
+    for (unsigned long i = 0; i < iterations; i++) {
+        std::string input;
+        auto pieces = random() % 64;
+        for (unsigned long j = 0; j < pieces; j++) {
+            if (random() % 8 == 0) {
+                input += static_cast<char>(random());
+            } else {
+                auto fragment = fragments[random() % (sizeof(fragments) / sizeof(fragments[0]))];
+                input.append(fragment, std::max<size_t>(strlen(fragment), 1));
+            }
+        }
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+    }
+    printf("%lu inputs OK\n", iterations);
+    return 0;
+}
+
+#endif
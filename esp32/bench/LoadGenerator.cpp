@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Simulated fleet: starts N native firmware processes and loads them with TCP subscribers, HTTP pollers and /events
+// stream clients spread over them round robin, then prints one JSON object with the throughput, latency percentiles and
+// the CPU time and memory the firmware processes used. Built by the native_loadgen environment.
+//
+//   program --firmware .pio/build/native/program [--probes N] [--tcp M] [--http K] [--http-rate R] [--sse S]
+//           [--interval S] [--duration S] [--port-offset O]
+
+// every probe uses ports 80, 5505 and 5506 shifted by its offset, probe i gets base + PORT_STEP * i. With an even step
+// 5505 and 5506 of different probes never collide.
+constexpr uint16_t PORT_STEP = 2;
+constexpr uint16_t HTTP_PORT = 80;
+constexpr uint16_t TCP_PORT = 5505;
+// how long a probe gets to start listening
+constexpr int STARTUP_TIMEOUT = 5000;
+// a poller whose connection was refused or closed tries again after that long
+constexpr int RECONNECT_DELAY = 100;
+constexpr size_t RECEIVE_BUFFER = 4096;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        const char *firmware = nullptr;
+        int probes = 1;
+        int tcpClients = 1;
+        int httpPollers = 1;
+        // requests per second of every poller, 0 sends the next request as soon as the response arrives
+        double httpRate = 0;
+        int streamClients = 0;
+        int interval = 1;
+        int duration = 30;
+        int portOffset = 40000;
+    };
+
+    struct Probe {
+        pid_t pid;
+        uint16_t offset;
+        std::string nvsPath;
+        // when the probe's millis() was 0, so that a reading's timestamp can be told in local time
+        Clock::time_point origin;
+    };
+
+    enum class Kind {
+        Subscriber,
+        Poller,
+        Stream
+    };
+
+    struct Connection {
+        Connection(Kind kind, uint16_t port, Clock::time_point origin = {}) : kind(kind), port(port), origin(origin) {}
+
+        Kind kind;
+        uint16_t port;
+        Clock::time_point origin;
+        Clock::time_point connectedAt;
+        int socket = -1;
+        std::string received;
+        Clock::time_point sentAt;
+        Clock::time_point nextActionAt;
+        bool awaitingResponse = false;
+        Clock::time_point lastFrameAt;
+        bool receivedFrame = false;
+    };
+
+    struct Results {
+        uint64_t tcpFrames = 0;
+        uint64_t tcpDisconnects = 0;
+        // difference between the time between two frames and the interval, in ms
+        std::vector<double> tcpJitter;
+        uint64_t httpRequests = 0;
+        uint64_t httpErrors = 0;
+        std::vector<double> httpLatency;
+        uint64_t streamEvents = 0;
+        uint64_t streamDisconnects = 0;
+        // from the reading being taken to its event arriving, in ms
+        std::vector<double> streamLatency;
+    };
+
+    int64_t elapsedMs(Clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - since).count();
+    }
+
+    double percentile(std::vector<double> &values, double fraction) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        auto index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string_view name(argv[i]);
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const char *value = argv[++i];
+            if (name == "--firmware") {
+                options.firmware = value;
+            } else if (name == "--probes") {
+                options.probes = atoi(value);
+            } else if (name == "--tcp") {
+                options.tcpClients = atoi(value);
+            } else if (name == "--http") {
+                options.httpPollers = atoi(value);
+            } else if (name == "--http-rate") {
+                options.httpRate = atof(value);
+            } else if (name == "--sse") {
+                options.streamClients = atoi(value);
+            } else if (name == "--interval") {
+                options.interval = atoi(value);
+            } else if (name == "--duration") {
+                options.duration = atoi(value);
+            } else if (name == "--port-offset") {
+                options.portOffset = atoi(value);
+            } else {
+                return false;
+            }
+        }
+        return options.firmware != nullptr && options.probes > 0 && options.interval > 0 && options.duration > 0;
+    }
+
+    /// @brief Starts a firmware process with its own ports and preferences file, its output is discarded
+    Probe startProbe(const Options &options, int index) {
+        Probe probe{0, static_cast<uint16_t>(options.portOffset + PORT_STEP * index),
+                    "/tmp/poleko-loadgen-" + std::to_string(getpid()) + "-" + std::to_string(index) + ".bin"};
+        unlink(probe.nvsPath.c_str());
+        probe.pid = fork();
+        if (probe.pid == 0) {
+            auto offset = std::to_string(probe.offset);
+            setenv("POLEKO_PORT_OFFSET", offset.c_str(), 1);
+            setenv("POLEKO_NVS", probe.nvsPath.c_str(), 1);
+            setenv("POLEKO_FLASH", ":memory:", 1);
+            auto null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            execl(options.firmware, options.firmware, nullptr);
+            _exit(127);
+        }
+        return probe;
+    }
+
+    int openConnection(uint16_t port) {
+        auto socket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (socket < 0) {
+            return -1;
+        }
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+            close(socket);
+            return -1;
+        }
+        int enable = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        return socket;
+    }
+
+    bool waitUntilListening(uint16_t port) {
+        auto startedAt = Clock::now();
+        while (elapsedMs(startedAt) < STARTUP_TIMEOUT) {
+            auto socket = openConnection(port);
+            if (socket >= 0) {
+                close(socket);
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        return false;
+    }
+
+    /// @brief Finds when the probe's clock started from the uptime /status reports, assuming it was read halfway through
+    /// the request
+    bool findOrigin(Probe &probe) {
+        auto socket = openConnection(probe.offset + HTTP_PORT);
+        if (socket < 0) {
+            return false;
+        }
+        constexpr std::string_view request = "GET /status HTTP/1.1\r\nHost: poleko\r\nConnection: close\r\n\r\n";
+        auto sentAt = Clock::now();
+        send(socket, request.data(), request.size(), MSG_NOSIGNAL);
+        std::string response;
+        char buffer[RECEIVE_BUFFER];
+        ssize_t received;
+        while ((received = recv(socket, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, received);
+        }
+        auto receivedAt = Clock::now();
+        close(socket);
+        auto uptime = response.find("\"uptime\":");
+        if (uptime == std::string::npos) {
+            return false;
+        }
+        auto millis = strtoull(response.c_str() + uptime + 9, nullptr, 10);
+        probe.origin = sentAt + (receivedAt - sentAt) / 2 - std::chrono::milliseconds(millis);
+        return true;
+    }
+
+    /// @brief Gets the CPU time the process used so far, in seconds
+    double cpuSeconds(pid_t pid) {
+        auto path = "/proc/" + std::to_string(pid) + "/stat";
+        auto file = fopen(path.c_str(), "r");
+        if (file == nullptr) {
+            return 0;
+        }
+        char buffer[1024];
+        auto length = fread(buffer, 1, sizeof(buffer) - 1, file);
+        fclose(file);
+        buffer[length] = '\0';
+        // the command name can contain spaces, the fields are counted from the parenthesis closing it
+        auto fields = strrchr(buffer, ')');
+        if (fields == nullptr) {
+            return 0;
+        }
+        unsigned long userTicks = 0;
+        unsigned long systemTicks = 0;
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &userTicks, &systemTicks);
+        return static_cast<double>(userTicks + systemTicks) / sysconf(_SC_CLK_TCK);
+    }
+
+    /// @brief Gets the resident memory of the process, in kB
+    long residentKb(pid_t pid) {
+        auto path = "/proc/" + std::to_string(pid) + "/statm";
+        auto file = fopen(path.c_str(), "r");
+        if (file == nullptr) {
+            return 0;
+        }
+        long pages = 0;
+        long resident = 0;
+        if (fscanf(file, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(file);
+        return resident * sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    void sendAll(Connection &connection, std::string_view data) {
+        if (send(connection.socket, data.data(), data.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(data.size())) {
+            close(connection.socket);
+            connection.socket = -1;
+        }
+    }
+
+    void connectPeer(Connection &connection, const Options &options) {
+        connection.socket = openConnection(connection.port);
+        connection.received.clear();
+        connection.awaitingResponse = false;
+        connection.receivedFrame = false;
+        if (connection.socket < 0) {
+            connection.nextActionAt = Clock::now() + std::chrono::milliseconds(RECONNECT_DELAY);
+            return;
+        }
+        fcntl(connection.socket, F_SETFL, fcntl(connection.socket, F_GETFL) | O_NONBLOCK);
+        if (connection.kind == Kind::Subscriber) {
+            auto command = "{\"interval\":" + std::to_string(options.interval) + ",\"save\":false}\n";
+            sendAll(connection, command);
+        } else if (connection.kind == Kind::Stream) {
+            sendAll(connection, "GET /events HTTP/1.1\r\nHost: poleko\r\n\r\n");
+        }
+        connection.connectedAt = Clock::now();
+        connection.nextActionAt = connection.connectedAt;
+    }
+
+    void sendRequest(Connection &connection, const Options &options) {
+        constexpr std::string_view request = "GET /reading HTTP/1.1\r\nHost: poleko\r\n\r\n";
+        connection.sentAt = Clock::now();
+        connection.awaitingResponse = true;
+        sendAll(connection, request);
+        if (options.httpRate > 0) {
+            connection.nextActionAt = connection.sentAt + std::chrono::microseconds(
+                    static_cast<int64_t>(1000000 / options.httpRate));
+        }
+    }
+
+    /// @brief Takes complete frames (subscribers) or responses (pollers) out of the received bytes
+    void consume(Connection &connection, const Options &options, Results &results) {
+        auto now = Clock::now();
+        if (connection.kind == Kind::Subscriber) {
+            size_t end;
+            while ((end = connection.received.find('\n')) != std::string::npos) {
+                // replies to commands and notices aren't readings
+                bool reply = connection.received.compare(0, 7, "{\"ack\":") == 0 ||
+                             connection.received.compare(0, 9, "{\"error\":") == 0 ||
+                             connection.received.compare(0, 9, "{\"event\":") == 0;
+                connection.received.erase(0, end + 1);
+                if (reply) {
+                    continue;
+                }
+                results.tcpFrames++;
+                if (connection.receivedFrame) {
+                    auto gap = std::chrono::duration<double, std::milli>(now - connection.lastFrameAt).count();
+                    results.tcpJitter.push_back(gap - options.interval * 1000.0);
+                }
+                connection.lastFrameAt = now;
+                connection.receivedFrame = true;
+            }
+            return;
+        }
+        if (connection.kind == Kind::Stream) {
+            size_t end;
+            while ((end = connection.received.find("\n\n")) != std::string::npos) {
+                auto timestamp = connection.received.find("\"timestamp\":");
+                if (timestamp < end && connection.received.compare(0, 15, "event: reading\n") == 0) {
+                    results.streamEvents++;
+                    auto takenAt = connection.origin + std::chrono::milliseconds(
+                            strtoull(connection.received.c_str() + timestamp + 12, nullptr, 10));
+                    // the stream starts with the latest readings, which were taken before it was opened
+                    if (takenAt >= connection.connectedAt) {
+                        results.streamLatency.push_back(
+                                std::chrono::duration<double, std::milli>(now - takenAt).count());
+                    }
+                }
+                // the response header, retry and keepalive comments aren't readings
+                connection.received.erase(0, end + 2);
+            }
+            return;
+        }
+        auto headerEnd = connection.received.find("\r\n\r\n");
+        if (!connection.awaitingResponse || headerEnd == std::string::npos) {
+            return;
+        }
+        auto header = connection.received.find("Content-Length: ");
+        auto length = header == std::string::npos ? 0 : strtoul(connection.received.c_str() + header + 16, nullptr, 10);
+        if (connection.received.size() < headerEnd + 4 + length) {
+            return;
+        }
+        if (connection.received.compare(0, 12, "HTTP/1.1 200") == 0) {
+            results.httpRequests++;
+            results.httpLatency.push_back(std::chrono::duration<double, std::micro>(now - connection.sentAt).count());
+        } else {
+            results.httpErrors++;
+        }
+        connection.received.erase(0, headerEnd + 4 + length);
+        connection.awaitingResponse = false;
+    }
+
+    void receive(Connection &connection, const Options &options, Results &results) {
+        char buffer[RECEIVE_BUFFER];
+        while (true) {
+            auto received = recv(connection.socket, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                connection.received.append(buffer, received);
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            // the probe closed the connection, e.g. because all HTTP slots were taken
+            consume(connection, options, results);
+            if (connection.kind == Kind::Subscriber) {
+                results.tcpDisconnects++;
+            } else if (connection.kind == Kind::Stream) {
+                results.streamDisconnects++;
+            } else if (connection.awaitingResponse) {
+                results.httpErrors++;
+            }
+            close(connection.socket);
+            connection.socket = -1;
+            connection.nextActionAt = Clock::now() + std::chrono::milliseconds(RECONNECT_DELAY);
+            return;
+        }
+        consume(connection, options, results);
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s --firmware PATH [--probes N] [--tcp M] [--http K] [--http-rate R] [--sse S] "
+                        "[--interval S] [--duration S] [--port-offset O]\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Probe> probes;
+    for (int i = 0; i < options.probes; i++) {
+        probes.push_back(startProbe(options, i));
+    }
+    bool started = std::all_of(probes.begin(), probes.end(), [](Probe &probe) {
+        return waitUntilListening(probe.offset + HTTP_PORT) && waitUntilListening(probe.offset + TCP_PORT) &&
+               findOrigin(probe);
+    });
+
+    Results results;
+    std::vector<double> cpuBefore;
+    std::vector<Connection> connections;
+    auto startedAt = Clock::now();
+    if (started) {
+        for (int i = 0; i < options.tcpClients; i++) {
+            connections.emplace_back(Kind::Subscriber, probes[i % probes.size()].offset + TCP_PORT);
+        }
+        for (int i = 0; i < options.httpPollers; i++) {
+            connections.emplace_back(Kind::Poller, probes[i % probes.size()].offset + HTTP_PORT);
+        }
+        for (int i = 0; i < options.streamClients; i++) {
+            auto &probe = probes[i % probes.size()];
+            connections.emplace_back(Kind::Stream, probe.offset + HTTP_PORT, probe.origin);
+        }
+        for (auto &probe: probes) {
+            cpuBefore.push_back(cpuSeconds(probe.pid));
+        }
+        startedAt = Clock::now();
+        for (auto &connection: connections) {
+            connectPeer(connection, options);
+        }
+    } else {
+        fprintf(stderr, "a probe didn't start listening, is the firmware built for the native environment?\n");
+    }
+
+    std::vector<pollfd> descriptors;
+    while (started && elapsedMs(startedAt) < options.duration * 1000) {
+        auto now = Clock::now();
+        for (auto &connection: connections) {
+            if (now < connection.nextActionAt) {
+                continue;
+            }
+            if (connection.socket < 0) {
+                connectPeer(connection, options);
+            } else if (connection.kind == Kind::Poller && !connection.awaitingResponse) {
+                sendRequest(connection, options);
+            }
+        }
+        descriptors.clear();
+        for (auto &connection: connections) {
+            descriptors.push_back({connection.socket, POLLIN, 0});
+        }
+        // a negative descriptor is ignored by poll(), the connection is retried when its delay passes
+        poll(descriptors.data(), descriptors.size(), options.httpRate > 0 ? 1 : 10);
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (connections[i].socket >= 0 && (descriptors[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                receive(connections[i], options, results);
+            }
+        }
+    }
+    auto duration = std::chrono::duration<double>(Clock::now() - startedAt).count();
+
+    double cpuSecondsUsed = 0;
+    double cpuTotal = 0;
+    double cpuMax = 0;
+    long residentMax = 0;
+    for (size_t i = 0; i < cpuBefore.size(); i++) {
+        auto seconds = cpuSeconds(probes[i].pid) - cpuBefore[i];
+        cpuSecondsUsed += seconds;
+        auto used = seconds / duration * 100;
+        cpuTotal += used;
+        cpuMax = std::max(cpuMax, used);
+        residentMax = std::max(residentMax, residentKb(probes[i].pid));
+    }
+    for (auto &connection: connections) {
+        if (connection.socket >= 0) {
+            close(connection.socket);
+        }
+    }
+    for (auto &probe: probes) {
+        kill(probe.pid, SIGTERM);
+        waitpid(probe.pid, nullptr, 0);
+        unlink(probe.nvsPath.c_str());
+    }
+    if (!started) {
+        return 1;
+    }
+
+    // what the probes spent on everything, per event delivered, only tells the cost of a stream when nothing else runs
+    auto cpuPerEvent = results.streamEvents > 0 ? cpuSecondsUsed * 1000000 / results.streamEvents : 0;
+    printf("{\"probes\":%d,\"tcp_clients\":%d,\"http_pollers\":%d,\"http_rate\":%.1f,\"sse_clients\":%d,"
+           "\"interval_s\":%d,\"duration_s\":%.1f,"
+           "\"tcp\":{\"frames\":%llu,\"frames_per_sec\":%.1f,\"disconnects\":%llu,\"jitter_ms_p50\":%.1f,"
+           "\"jitter_ms_p99\":%.1f,\"jitter_ms_max\":%.1f},"
+           "\"http\":{\"requests\":%llu,\"requests_per_sec\":%.1f,\"errors\":%llu,\"latency_us_p50\":%.0f,"
+           "\"latency_us_p90\":%.0f,\"latency_us_p99\":%.0f,\"latency_us_max\":%.0f},"
+           "\"sse\":{\"events\":%llu,\"events_per_sec\":%.1f,\"disconnects\":%llu,\"latency_ms_p50\":%.1f,"
+           "\"latency_ms_p99\":%.1f,\"latency_ms_max\":%.1f,\"cpu_us_per_event\":%.1f},"
+           "\"firmware\":{\"cpu_percent_mean\":%.2f,\"cpu_percent_max\":%.2f,\"rss_kb_max\":%ld}}\n",
+           options.probes, options.tcpClients, options.httpPollers, options.httpRate, options.streamClients,
+           options.interval, duration,
+           static_cast<unsigned long long>(results.tcpFrames), results.tcpFrames / duration,
+           static_cast<unsigned long long>(results.tcpDisconnects), percentile(results.tcpJitter, 0.5),
+           percentile(results.tcpJitter, 0.99), percentile(results.tcpJitter, 1.0),
+           static_cast<unsigned long long>(results.httpRequests), results.httpRequests / duration,
+           static_cast<unsigned long long>(results.httpErrors), percentile(results.httpLatency, 0.5),
+           percentile(results.httpLatency, 0.9), percentile(results.httpLatency, 0.99),
+           percentile(results.httpLatency, 1.0), static_cast<unsigned long long>(results.streamEvents),
+           results.streamEvents / duration, static_cast<unsigned long long>(results.streamDisconnects),
+           percentile(results.streamLatency, 0.5), percentile(results.streamLatency, 0.99),
+           percentile(results.streamLatency, 1.0), cpuPerEvent, cpuTotal / options.probes, cpuMax, residentMax);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ProbeFrame.h"
+
+// Fuzz target of the probe frame parser, built by the native_probe_fuzz environment. With clang it can be linked with
+// libFuzzer (-fsanitize=fuzzer,address -D POLEKO_LIBFUZZER), otherwise the main() below replays the files given as
+// arguments or, with none, feeds it mutations of a valid response. Both ways it's meant to run under AddressSanitizer
+// and UBSan.
+
+namespace {
+    // a whole response to {F99RDD}, the seed of the mutations
+    constexpr char VALID_FRAME[] =
+            "{F00rdd 001; 45.32;%rh;000;=; 23.45;'C;000;=;nc;---.-;'C;000; ;001;V1.7-1;0060568338;        }";
+
+    void check(bool condition, const char *message) {
+        if (!condition) {
+            fprintf(stderr, "%s\n", message);
+            abort();
+        }
+    }
+
+    /// @brief Checks a parsed number against strtod, which accepts every text FixedDecimal does
+    void checkDecimal(std::string_view text) {
+        auto decimal = FixedDecimal::parse(text);
+        if (!decimal.valid) {
+            return;
+        }
+        // valid numbers hold only spaces, a sign, digits and a point, so there's no NUL cutting the copy short
+        auto expected = strtod(std::string(text).c_str(), nullptr) * 100;
+        check(fabs(expected - decimal.hundredths) <= 1.0, "number parsed to a different value");
+    }
+
+    /// @brief Pushes a response the way Sensor does and parses it
+    ProbeReading parseFrame(ProbeFrame &frame, std::string_view response) {
+        frame.clear();
+        for (size_t i = 0; i < response.size(); i++) {
+            bool pushed = frame.push(response[i]);
+            check(pushed == (i < PROBE_FRAME_LENGTH), "byte pushed past the end of the frame or dropped before it");
+        }
+        check(frame.length() == std::min(response.size(), PROBE_FRAME_LENGTH), "wrong length");
+        auto reading = frame.parse();
+        check(frame.fieldCount() <= PROBE_FRAME_MAX_FIELDS, "too many fields");
+        auto begin = reinterpret_cast<const char *>(&frame);
+        for (size_t i = 0; i < frame.fieldCount(); i++) {
+            auto field = frame.field(i);
+            // fields have to point into the frame's buffer, and there can't be a separator in them
+            check(!field.empty() && field.find(';') == std::string_view::npos, "empty field or one with a separator");
+            check(field.data() >= begin && field.data() + field.size() <= begin + sizeof(frame),
+                  "field outside of the frame");
+            checkDecimal(field);
+        }
+        check(frame.field(frame.fieldCount()).empty(), "field past the last one");
+        if (reading.valid()) {
+            check(response.size() == PROBE_FRAME_LENGTH, "reading from a frame of the wrong length");
+            check(reading.humidity.valid && reading.temperature.valid, "valid reading with an invalid value");
+            check(reading.humidity.hundredths == frame.decimalField(HUMIDITY_FIELD).hundredths &&
+                  reading.temperature.hundredths == frame.decimalField(TEMPERATURE_FIELD).hundredths,
+                  "reading different from its fields");
+        }
+        return reading;
+    }
+}
+
+/// @brief Every response has to parse the same whether the frame is reused, like Sensor does, or new
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    std::string_view input(reinterpret_cast<const char *>(data), size);
+    checkDecimal(input);
+    ProbeFrame reused;
+    size_t start = 0;
+    while (start <= input.size()) {
+        auto end = input.find('\r', start);
+        if (end == std::string_view::npos) {
+            end = input.size();
+        }
+        auto response = input.substr(start, end - start);
+        ProbeFrame fresh;
+        auto first = parseFrame(fresh, response);
+        auto second = parseFrame(reused, response);
+        check(first.status == second.status && first.humidity.hundredths == second.humidity.hundredths &&
+              first.temperature.hundredths == second.temperature.hundredths, "different reading from a reused frame");
+        start = end + 1;
+    }
+    return 0;
+}
+
+#ifndef POLEKO_LIBFUZZER
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            auto file = fopen(argv[i], "rb");
+            if (!file) {
+                perror(argv[i]);
+                return 1;
+            }
+            std::vector<uint8_t> input;
+            int c;
+            while ((c = fgetc(file)) != EOF) {
+                input.push_back(static_cast<uint8_t>(c));
+            }
+            fclose(file);
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        return 0;
+    }
+
+    // what a probe sends in place of a value, and numbers around the limits, so that mutations reach the number parser
+    const char *fragments[] = {";", ";;", " ", "-", "+", ".", "---.-", " 45.32", "-12.345", "+.5", "5.", "9999999",
+                               "99999999", "9999999.995", "0.004", "-0", "1e3", "nan", "\r", "\n", "\xff", "\0"};
+    auto iterations = getenv("POLEKO_FUZZ_ITERATIONS") ? strtoul(getenv("POLEKO_FUZZ_ITERATIONS"), nullptr, 10) : 100000;
+    std::mt19937 random(1);
+    for (unsigned long i = 0; i < iterations; i++) {
+        std::string input(VALID_FRAME);
+        auto mutations = 1 + random() % 8;
+        for (unsigned long j = 0; j < mutations; j++) {
+            auto at = random() % (input.size() + 1);
+            auto fragment = fragments[random() % (sizeof(fragments) / sizeof(fragments[0]))];
+            auto length = std::max<size_t>(strlen(fragment), 1);
+            switch (random() % 4) {
+                case 0:
+                    // overwritten in place, most of these keep the length the parser insists on
+                    input.replace(at, length, fragment, length);
+                    input.resize(std::max(input.size(), PROBE_FRAME_LENGTH), ' ');
+                    input.resize(PROBE_FRAME_LENGTH);
+                    break;
+                case 1:
+                    input.insert(at, fragment, length);
+                    break;
+                case 2:
+                    input.erase(at, 1 + random() % 8);
+                    break;
+                default:
+                    if (at < input.size()) {
+                        input[at] = static_cast<char>(random());
+                    }
+            }
+        }
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+    }
+    printf("%lu inputs OK\n", iterations);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#pragma once
+
+// the longest command a client can send, longer ones are rejected as a whole
+constexpr size_t TCP_COMMAND_BUFFER = 128;
+
+// keys a single command object can have
+constexpr size_t MAX_COMMAND_FIELDS = 8;
+
+enum class CommandValueType : uint8_t {
+    Number,
+    String,
+    Bool,
+    Null
+};
+
+/// @brief Key and value of a command object. Both point into the text the command was parsed from.
+struct CommandField {
+    std::string_view key;
+    // the number as written, the string without its quotes, or true, false or null
+    std::string_view value;
+    CommandValueType type;
+
+    bool toUnsigned(uint32_t &out) const;
+
+    bool toBool(bool &out) const;
+};
+
+/// @brief Command sent by a TCP client: a flat JSON object like {"interval":5,"save":false}, with numbers, strings without
+/// escape sequences, booleans and null as values. Parsed in place, so it never allocates.
+class Command {
+public:
+    bool parse(std::string_view text);
+
+    size_t size() const;
+
+    const CommandField &operator[](size_t index) const;
+
+    const CommandField *find(std::string_view key) const;
+
+private:
+    std::array<CommandField, MAX_COMMAND_FIELDS> fields{};
+    size_t count = 0;
+};
+
+/// @brief Splits the byte stream received from a client into commands, no matter how TCP split or coalesced them. A
+/// command ends with a newline or with the brace closing its outermost object, so clients that don't terminate their
+/// commands still work. Commands are collected in a fixed buffer, one that doesn't fit in it is skipped as a whole.
+class CommandFramer {
+public:
+    /// @brief Takes received bytes and calls handler(std::string_view command, bool tooLong) for every command they
+    /// complete. The view is only valid during the call. A command that was too long is passed as an empty view.
+    template<typename Handler>
+    void push(const char *data, size_t length, Handler &&handler) {
+        for (size_t i = 0; i < length; i++) {
+            if (consume(data[i])) {
+                handler(std::string_view(buffer.data(), discarding ? 0 : used), discarding);
+                reset();
+            }
+        }
+    }
+
+    void reset();
+
+private:
+    std::array<char, TCP_COMMAND_BUFFER> buffer{};
+    size_t used = 0;
+    // nesting of braces and brackets outside of strings
+    uint8_t depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    // the command didn't fit, the rest of it is skipped
+    bool discarding = false;
+
+    bool consume(char c);
+};
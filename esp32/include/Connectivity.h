@@ -0,0 +1,64 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#pragma once
+
+#ifndef WIFI_PORTAL_TIMEOUT
+// ms without a connection after which the configuration portal is opened, can be changed with a build flag
+#define WIFI_PORTAL_TIMEOUT 120000
+#endif
+
+// reconnect attempts start this often and back off up to the maximum
+constexpr unsigned long WIFI_RECONNECT_INTERVAL = 500;
+constexpr unsigned long WIFI_MAX_RECONNECT_INTERVAL = 8000;
+
+enum class LinkState : uint8_t {
+    Connected,
+    // the link is down, services keep running while it's being reconnected in the background
+    Reconnecting,
+    // the grace period is over, the configuration portal should be opened
+    Portal
+};
+
+/// @brief Keeps the WiFi link up without stopping the services. When the link drops, the device reconnects in the background,
+/// first to the access point it was connected to (its BSSID and channel are cached, which skips the scan), then to any
+/// access point of the network. Only if that doesn't succeed in the grace period does it ask for the configuration portal.
+class Connectivity {
+public:
+    explicit Connectivity(unsigned long portalTimeout = WIFI_PORTAL_TIMEOUT);
+
+    void begin();
+
+    void loop();
+
+    bool nextDeadline(uint32_t &deadline);
+
+    void onChange(void (*callback)());
+
+    void onReconnected(void (*callback)(unsigned long downtime));
+
+    void onPortalNeeded(void (*callback)());
+
+    LinkState getState() const;
+
+private:
+    unsigned long portalTimeout;
+    LinkState state = LinkState::Connected;
+    unsigned long lostAt = 0;
+    unsigned long nextAttemptAt = 0;
+    unsigned long attemptInterval = WIFI_RECONNECT_INTERVAL;
+    uint32_t attempts = 0;
+    // the access point the device was last connected to
+    String ssid;
+    String passphrase;
+    uint8_t bssid[6] = {};
+    int32_t channel = 0;
+    bool accessPointCached = false;
+    void (*changeCallback)() = nullptr;
+    void (*reconnectedCallback)(unsigned long downtime) = nullptr;
+    void (*portalCallback)() = nullptr;
+
+    void cacheAccessPoint();
+
+    void attemptReconnect();
+};
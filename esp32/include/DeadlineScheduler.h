@@ -0,0 +1,114 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#pragma once
+
+/// @brief Min-heap of deadlines (in milliseconds) identified by an id. Lets a single time source serve any amount of
+/// periodic tasks: the caller only ever has to wait for the earliest deadline. Deadlines are compared in a way that handles
+/// millis() wrapping around.
+template<size_t Capacity>
+class DeadlineScheduler {
+public:
+    /// @brief Adds a deadline
+    /// @return false if the scheduler is full
+    bool schedule(uint16_t id, uint32_t deadline) {
+        if (count == Capacity) {
+            return false;
+        }
+        entries[count] = Entry{deadline, id};
+        siftUp(count++);
+        return true;
+    }
+
+    /// @brief Removes every deadline with the given id
+    void cancel(uint16_t id) {
+        size_t i = 0;
+        while (i < count) {
+            if (entries[i].id != id) {
+                i++;
+                continue;
+            }
+            entries[i] = entries[--count];
+            // the moved entry can belong either higher or lower in the heap
+            siftDown(i);
+            siftUp(i);
+        }
+    }
+
+    /// @brief Removes the earliest deadline if it has passed
+    /// @param now Current time
+    /// @param id Set to the id of the removed deadline
+    /// @param deadline Set to the removed deadline, useful for scheduling the next one without drift
+    /// @return false if no deadline has passed
+    bool popDue(uint32_t now, uint16_t &id, uint32_t &deadline) {
+        if (count == 0 || static_cast<int32_t>(now - entries[0].deadline) < 0) {
+            return false;
+        }
+        id = entries[0].id;
+        deadline = entries[0].deadline;
+        entries[0] = entries[--count];
+        siftDown(0);
+        return true;
+    }
+
+    /// @brief Gets the earliest deadline
+    /// @return false if nothing is scheduled
+    bool nextDeadline(uint32_t &deadline) const {
+        if (count == 0) {
+            return false;
+        }
+        deadline = entries[0].deadline;
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    struct Entry {
+        uint32_t deadline;
+        uint16_t id;
+    };
+
+    std::array<Entry, Capacity> entries{};
+    size_t count = 0;
+
+    // equal deadlines are ordered by id, so lower ids always run first
+    static bool before(const Entry &a, const Entry &b) {
+        auto difference = static_cast<int32_t>(a.deadline - b.deadline);
+        return difference < 0 || (difference == 0 && a.id < b.id);
+    }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!before(entries[i], entries[parent])) {
+                return;
+            }
+            std::swap(entries[i], entries[parent]);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            size_t left = 2 * i + 1;
+            size_t right = left + 1;
+            if (left < count && before(entries[left], entries[smallest])) {
+                smallest = left;
+            }
+            if (right < count && before(entries[right], entries[smallest])) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                return;
+            }
+            std::swap(entries[i], entries[smallest]);
+            i = smallest;
+        }
+    }
+};
@@ -1,15 +1,15 @@
 #include <WiFiUdp.h>
 #include <WiFi.h>
-#include <ArduinoJson.h>
-#include "Sensor.h"
-#include <ESP32TimerInterrupt.hpp>
-#include <memory>
+#include <atomic>
 
 #pragma once
 
+// {"ip":"255.255.255.255","mac":"FF:FF:FF:FF:FF:FF","probes":4} is 61 characters long
+constexpr size_t BEACON_BUFFER = 80;
+
 class EspUDPServer {
 public:
-    EspUDPServer();
+    explicit EspUDPServer(uint8_t probes = 1);
 
     void setup(unsigned short port = 5506);
 
@@ -17,16 +17,31 @@ public:
 
     void loop();
 
+    unsigned long nextDeadline() const;
+
     void sendPacket();
 
-    static bool timerHandle(void *_);
+    void addressChanged();
 
 private:
-    volatile bool timerFlag;
     bool started;
     bool stopped;
-    ESP32Timer timer;
+    unsigned short port = 5506;
+    // amount of probes on the sensor bus, their ids go from 0
+    uint8_t probes;
+    unsigned long lastSentAt = 0;
+    unsigned long lastPolledAt = 0;
+    unsigned long lastRepliedAt = 0;
+    unsigned long interval = 0;
+    // set from the WiFi event task, the beacon is rebuilt by loop()
+    std::atomic<bool> rebuildRequested{true};
+    char beacon[BEACON_BUFFER];
+    size_t beaconLength = 0;
     WiFiUDP udp;
-    // need to do this because no callback signature in timer library accepts parameters
-    static EspUDPServer *instance;
-};
\ No newline at end of file
+
+    void buildBeacon();
+
+    void restartBurst();
+
+    void answerQueries();
+};
@@ -0,0 +1,88 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include "DeadlineScheduler.h"
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#pragma once
+
+#ifndef ARDUINO_ISR_ATTR
+#define ARDUINO_ISR_ATTR
+#endif
+
+enum class Event : uint8_t {
+    ButtonPressed,
+    Connectivity,
+    Reconnected,
+    Sensor,
+    TCP,
+    UDP,
+    HTTP,
+    Settings,
+    Count
+};
+
+struct EventLoopStats {
+    uint32_t wakeups;
+    uint32_t dispatched;
+    // time between the moment an event was posted (or its timer expired) and the moment its handler was called
+    uint32_t maxLatencyUs;
+    uint64_t totalLatencyUs;
+};
+
+/// @brief Cooperative executor that sleeps until an event is posted or a timer expires, then calls the handlers.
+/// Events carry no data, posting an event that is already pending does nothing, so the set of pending events is a single
+/// atomic bitmask. That makes posting lock-free and safe from ISRs and other tasks, and the "queue" can never overflow.
+class EventLoop {
+public:
+    using Handler = void (*)();
+
+    void begin();
+
+    void on(Event event, Handler handler);
+
+    void post(Event event);
+
+    void postFromISR(Event event);
+
+    void setTimer(Event event, uint32_t deadline);
+
+    void cancelTimer(Event event);
+
+    void runOnce();
+
+    const EventLoopStats &getStats() const;
+
+private:
+    static constexpr size_t EVENT_COUNT = static_cast<size_t>(Event::Count);
+    static_assert(EVENT_COUNT <= 32, "Pending events have to fit in a 32-bit mask");
+
+    std::atomic<uint32_t> pending{0};
+    std::array<std::atomic<uint32_t>, EVENT_COUNT> postedAt{};
+    std::array<Handler, EVENT_COUNT> handlers{};
+    DeadlineScheduler<EVENT_COUNT> timers;
+    EventLoopStats stats{};
+
+    bool markPending(Event event);
+
+    void wait(uint32_t timeoutMs);
+
+    void wake();
+
+    void wakeFromISR();
+
+#ifdef ARDUINO
+    TaskHandle_t task = nullptr;
+#else
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool woken = false;
+#endif
+};
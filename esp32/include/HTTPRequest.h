@@ -0,0 +1,73 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#pragma once
+
+// the request line and the longest header line have to fit in it together, the headers aren't kept after being read
+constexpr size_t HTTP_REQUEST_BUFFER = 512;
+
+enum class HTTPMethod : uint8_t {
+    Get,
+    Head,
+    Other
+};
+
+enum class HTTPParseState : uint8_t {
+    // waiting for more bytes
+    Incomplete,
+    // the whole request (including the body, which is skipped) arrived
+    Complete,
+    // the request is malformed, the connection has to be closed after responding with getErrorStatus()
+    Failed
+};
+
+/// @brief Incremental HTTP/1.x request parser. Bytes can be pushed in chunks of any size as they arrive from the network,
+/// they're collected in a fixed buffer and parsed one line at a time, so a request never allocates.
+class HTTPRequestParser {
+public:
+    void reset();
+
+    size_t push(const char *data, size_t length);
+
+    HTTPParseState getState() const;
+
+    unsigned short getErrorStatus() const;
+
+    HTTPMethod getMethod() const;
+
+    std::string_view getPath() const;
+
+    std::string_view getQuery() const;
+
+    bool keepAlive() const;
+
+private:
+    enum class Stage : uint8_t {
+        RequestLine,
+        Headers,
+        Body,
+        Done
+    };
+
+    std::array<char, HTTP_REQUEST_BUFFER> buffer{};
+    // bytes of the request line, the path and the query point into them
+    size_t requestLineLength = 0;
+    // end of the line that's being collected
+    size_t used = 0;
+    Stage stage = Stage::RequestLine;
+    HTTPParseState state = HTTPParseState::Incomplete;
+    unsigned short errorStatus = 0;
+    HTTPMethod method = HTTPMethod::Other;
+    std::string_view path;
+    std::string_view query;
+    bool persistent = false;
+    size_t bodyRemaining = 0;
+
+    bool parseRequestLine(std::string_view line);
+
+    bool parseHeader(std::string_view line);
+
+    void fail(unsigned short status);
+};
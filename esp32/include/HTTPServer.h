@@ -1,11 +1,93 @@
-#include <WiFi.h>
-#include "Sensor.h"
+#include <AsyncTCP.h>
+#include "SensorBus.h"
+#include "HistoryLog.h"
+#include "HTTPRequest.h"
+#include "SendQueue.h"
+#include "Metrics.h"
+#include <array>
+#include <mutex>
+#include <string_view>
 
 #pragma once
 
+// scrapers usually keep their connections open, a few more slots than there are scrapers is enough
+constexpr size_t MAX_HTTP_CONNECTIONS = 4;
+
+// seconds after which a connection that didn't send anything is closed, so idle keep-alive connections don't hold slots forever
+constexpr uint32_t HTTP_IDLE_TIMEOUT = 15;
+
+// milliseconds a request waits for a fresh reading before the latest one is served anyway, longer than a probe timeout
+constexpr unsigned long HTTP_READING_WAIT = 1000;
+
+// /events subscribers, each one takes a slot of its own so that they can't starve requests
+constexpr size_t MAX_HTTP_STREAMS = 4;
+
+// bytes of events held for a subscriber that doesn't read them, the oldest ones are dropped past it
+constexpr size_t HTTP_STREAM_QUEUE_BYTES = 2048;
+
+// milliseconds after which a comment is sent on a stream that had nothing else to send, so that proxies and the client
+// can tell it's alive
+constexpr unsigned long HTTP_STREAM_KEEPALIVE = 15000;
+
+// milliseconds after which a stream whose client took nothing is closed
+constexpr unsigned long HTTP_STREAM_STALL_TIMEOUT = 30000;
+
+// CSV bytes of a /history chunk, a chunk is encoded from flash whenever the previous one was handed to the socket
+constexpr size_t HTTP_HISTORY_CHUNK = 1024;
+
+/// @brief A request slot, served by the AsyncTCP task. A /reading request waiting for a fresh reading parks the connection:
+/// loop() answers it as soon as the reading is published, handles what the client sent meanwhile and hands the connection
+/// back. The fields guarded by connectionLock are shared, the rest belongs to whichever side has the connection.
+struct HTTPConnection {
+    // guarded by connectionLock: the slot is free when client is nullptr, parked while loop() owns the connection and
+    // closed once the client disconnected meanwhile
+    AsyncClient *client = nullptr;
+    bool parked = false;
+    bool closed = false;
+    // guarded by connectionLock: what the client sent while the connection was parked, handled once it's handed back
+    std::array<char, HTTP_REQUEST_BUFFER> pendingInput{};
+    size_t pendingLength = 0;
+    bool pendingOverrun = false;
+    HTTPRequestParser parser;
+    SendQueue queue;
+    bool closeAfterSend = false;
+    // the parsed request is a /reading one waiting for a reading at most maxAge milliseconds old
+    bool awaitingReading = false;
+    unsigned long maxAge = 0;
+    // probe the request asked for, ?probe=N
+    uint8_t probe = 0;
+    unsigned long receivedAt = 0;
+    // micros() when the request arrived, for the latency histogram
+    unsigned long receivedAtMicros = 0;
+    // a /history response is being streamed from the cursor, the connection is closed once it ends
+    bool exporting = false;
+    HistoryCursor cursor;
+};
+
+/// @brief An /events subscriber. The slot is claimed by the AsyncTCP task, which parsed the request, and then served by
+/// loop(): the fields guarded by streamLock are shared, the rest belongs to loop() once it took the stream over.
+struct HTTPStream {
+    // guarded by streamLock: the slot is free when client is nullptr, joined until loop() takes the stream over and
+    // closed once the client disconnected
+    AsyncClient *client = nullptr;
+    bool joined = false;
+    bool closed = false;
+    SendQueue queue;
+    // probes whose readings are sent, a bit per probe id
+    uint8_t probes = 0;
+    unsigned long lastQueuedAt = 0;
+    unsigned long lastProgressAt = 0;
+};
+
 class HTTPServer {
 public:
-    HTTPServer(Sensor &sensor);
+    HTTPServer(SensorBus &sensors, HistoryLog &history, unsigned short port = 80);
+
+    ~HTTPServer();
+
+    HTTPServer(const HTTPServer &) = delete;
+
+    HTTPServer &operator=(const HTTPServer &) = delete;
 
     void setup();
 
@@ -13,9 +95,91 @@ public:
 
     void loop();
 
+    void onActivity(void (*callback)());
+
 private:
-    bool started;
-    bool stopped;
-    WiFiServer server;
-    Sensor &sensor;
-};
\ No newline at end of file
+    // what the handlers running in the AsyncTCP task know about the device, refreshed by loop()
+    struct Snapshot {
+        // latest reading of every probe, by its id
+        std::array<SensorReading, MAX_PROBES> readings{};
+        int8_t rssi = 0;
+    };
+
+    AsyncServer server;
+    SensorBus &sensors;
+    HistoryLog &history;
+    unsigned short port;
+    bool started = false;
+    bool stopped = false;
+    std::mutex connectionLock;
+    std::array<HTTPConnection, MAX_HTTP_CONNECTIONS> connections;
+    std::mutex streamLock;
+    std::array<HTTPStream, MAX_HTTP_STREAMS> streams;
+    void (*activityCallback)() = nullptr;
+    std::mutex snapshotLock;
+    Snapshot snapshot;
+    static HTTPServer *instance;
+
+    static Snapshot getSnapshot();
+
+    static void respond(HTTPConnection &connection, bool canWait);
+
+    static void sendReading(HTTPConnection &connection);
+
+    static void finishRequest(HTTPConnection &connection);
+
+    void answerParked(const Snapshot &current);
+
+    void releaseParked(HTTPConnection &connection);
+
+    static bool receive(HTTPConnection &connection, const char *bytes, size_t len);
+
+
+    static void writeMetrics(MetricsWriter &writer);
+
+    static void startStream(HTTPConnection &connection);
+
+    void serveStreams(const Snapshot &previous, const Snapshot &current);
+
+    void closeStream(HTTPStream &stream);
+
+    static FrameRef encodeEvent(const Snapshot &current, uint8_t probe);
+
+    static size_t activeConnections();
+
+    static size_t activeStreams();
+
+    static void notifyActivity();
+
+    static void handleStreamAck(void *arg, AsyncClient *client, size_t len, uint32_t time);
+
+    static void handleStreamDisconnect(void *arg, AsyncClient *client);
+
+    static void startExport(HTTPConnection &connection);
+
+    static void sendExportChunk(HTTPConnection &connection);
+
+    static bool queueHeader(HTTPConnection &connection, unsigned short status, const char *contentType,
+                            const char *framing, const char *extraHeaders);
+
+    static void sendResponse(HTTPConnection &connection, unsigned short status, const char *contentType,
+                             std::string_view body, const char *extraHeaders = "");
+
+    static void drainQueue(HTTPConnection &connection);
+
+    static HTTPConnection *findConnection(AsyncClient *client);
+
+    static void handleClient(void *arg, AsyncClient *client);
+
+    static void handleData(void *arg, AsyncClient *client, void *data, size_t len);
+
+    static void handleError(void *arg, AsyncClient *client, int8_t error);
+
+    static void handleDisconnect(void *arg, AsyncClient *client);
+
+    static void handleTimeout(void *arg, AsyncClient *client, uint32_t time);
+
+    static void handleAck(void *arg, AsyncClient *client, size_t len, uint32_t time);
+
+    static void handlePoll(void *arg, AsyncClient *client);
+};
@@ -0,0 +1,140 @@
+#include <esp_partition.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "SensorBus.h"
+
+#pragma once
+
+// the flash is erased in sectors of this size, each one holds a header and the rows compressed after it
+constexpr uint32_t HISTORY_SECTOR_SIZE = 4096;
+constexpr uint32_t HISTORY_HEADER_SIZE = 16;
+// "PLOG", marks a sector that holds rows
+constexpr uint32_t HISTORY_MAGIC = 0x474F4C50;
+constexpr uint8_t HISTORY_VERSION = 1;
+// a timestamp before 2024-01-01 means the clock wasn't set by SNTP yet, rows with it would be useless
+constexpr uint32_t HISTORY_MIN_TIME = 1704067200;
+// flash the cursor reads at once
+constexpr size_t HISTORY_READ_WINDOW = 32;
+
+/// @brief A probe's reading as it's logged, in hundredths of %rh and °C
+struct HistorySample {
+    int16_t humidity;
+    int16_t temperature;
+    bool valid;
+};
+
+/// @brief The readings of every probe taken at one time
+struct HistoryRow {
+    // Unix time in seconds
+    uint32_t time;
+    uint8_t probes;
+    std::array<HistorySample, MAX_PROBES> samples;
+};
+
+struct HistoryStats {
+    uint32_t rows;
+    // bits the rows and sector headers take, and the bytes programmed to store them (the byte a row shares with the
+    // previous one is programmed again)
+    uint64_t bitsStored;
+    uint32_t bytesWritten;
+    uint32_t sectorErases;
+    // sectors holding rows and the amount of them the partition has
+    uint32_t sectorsUsed;
+    uint32_t sectorCount;
+    // time of the oldest row that's still kept, 0 if there's none
+    uint32_t oldestTime;
+};
+
+/// @brief What's needed to continue a delta encoding, the writer's and a reader's are the same
+struct HistoryCodecState {
+    uint32_t time;
+    int32_t delta;
+    std::array<int16_t, MAX_PROBES> humidity;
+    std::array<int16_t, MAX_PROBES> temperature;
+};
+
+/// @brief Position of a reader in the log. It only holds a small window of the flash and the decoder's state, so a range
+/// of any length is read in constant memory. Opened by HistoryLog::open().
+struct HistoryCursor {
+    uint32_t from = 0;
+    uint32_t to = 0;
+    uint32_t generation = 0;
+    // position in the sector's rows
+    uint32_t bit = 0;
+    uint8_t probes = 0;
+    bool done = true;
+    HistoryCodecState state{};
+    // bytes of the sector's rows starting at windowStart, windowSize is 0 when nothing's read yet
+    std::array<uint8_t, HISTORY_READ_WINDOW> window{};
+    uint32_t windowStart = 0;
+    uint32_t windowSize = 0;
+};
+
+/// @brief Append-only time series of the probes' readings in a dedicated flash partition, which keeps about four months
+/// of a probe's rows taken every 10 seconds.
+///
+/// The partition is used as a ring of sectors: the sector a generation is written to is its number modulo the amount of
+/// sectors, so every sector is erased once per turn of the ring and the oldest rows are the ones overwritten. Rows are
+/// compressed Gorilla-style into a bit stream: a timestamp is stored as the difference between its delta and the previous
+/// one, which is a single 0 bit while rows come at a steady interval, and the readings as the difference from the
+/// previous ones in hundredths, which is a bit when nothing changed and a few more for the usual small changes. Every
+/// row is written as soon as it's appended, by programming the bits following the previous row (NOR flash can clear
+/// bits without an erase), and the erased bits after the last row read as its end. A sector starts over from absolute
+/// values, so it can be read on its own. After a boot a new sector is started, so a row torn by a reset can't garble the
+/// ones following it.
+class HistoryLog {
+public:
+    explicit HistoryLog(const char *label = "history");
+
+    HistoryLog(const HistoryLog &) = delete;
+
+    HistoryLog &operator=(const HistoryLog &) = delete;
+
+    bool begin();
+
+    bool append(uint32_t time, const HistorySample *samples, size_t count);
+
+    bool open(HistoryCursor &cursor, uint32_t from, uint32_t to);
+
+    bool next(HistoryCursor &cursor, HistoryRow &row);
+
+    HistoryStats getStats();
+
+    bool erase();
+
+private:
+    const char *label;
+    const esp_partition_t *partition = nullptr;
+    uint32_t sectorCount = 0;
+    std::mutex lock;
+    // generations still in the partition, none when empty is set
+    bool empty = true;
+    uint32_t oldestGeneration = 0;
+    uint32_t newestGeneration = 0;
+    // generation of the next sector, it keeps counting when the log is erased so that the ring keeps turning
+    uint32_t nextGeneration = 0;
+    // rows can be appended to the newest generation's sector, false until the first row after a boot
+    bool writable = false;
+    uint32_t bit = 0;
+    uint8_t probes = 0;
+    HistoryCodecState state{};
+    // time of the last row appended or found in the partition, rows have to come after it
+    uint32_t lastTime = 0;
+    HistoryStats stats{};
+
+    uint32_t sectorOffset(uint32_t generation) const;
+
+    bool readHeader(uint32_t generation, uint32_t &startTime, uint8_t &headerProbes);
+
+    bool startSector(uint32_t time, uint8_t count);
+
+    uint32_t findLastTime();
+
+    bool seek(HistoryCursor &cursor, uint32_t generation);
+
+    bool fill(HistoryCursor &cursor, uint32_t position);
+
+    uint32_t readBits(HistoryCursor &cursor, uint8_t count);
+};
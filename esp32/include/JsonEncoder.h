@@ -0,0 +1,137 @@
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+// the precision ArduinoJson serializes floats and doubles with, so that the output stays the same
+constexpr int8_t JSON_FLOAT_DECIMAL_PLACES = 6;
+constexpr int8_t JSON_DOUBLE_DECIMAL_PLACES = 9;
+
+/// @brief Appends JSON tokens to a caller-provided buffer. Once something doesn't fit, every later write is ignored and
+/// overflowed() returns true, so a message only has to be checked after it's written.
+class JsonWriter {
+public:
+    JsonWriter(char *buffer, size_t size);
+
+    void raw(char c);
+
+    void raw(const char *text, size_t length);
+
+    void string(const char *text);
+
+    void integer(int32_t value);
+
+    void integer(int64_t value);
+
+    void unsignedInteger(uint32_t value);
+
+    void unsignedInteger(uint64_t value);
+
+    void floating(double value, int8_t decimalPlaces);
+
+    void boolean(bool value);
+
+    size_t length() const;
+
+    bool overflowed() const;
+
+private:
+    char *buffer;
+    size_t size;
+    size_t used = 0;
+    bool overflow = false;
+};
+
+/// @brief Describes a member of a message struct serialized as a JSON field. The key is stored with its separator and
+/// quotes (,"name":) at compile time, so that writing it is a single copy.
+template<typename Message, typename T, size_t N>
+struct JsonField {
+    char key[N + 3];
+    T Message::*member;
+
+    constexpr JsonField(const char (&name)[N], T Message::*member) : key{}, member(member) {
+        key[0] = ',';
+        key[1] = '"';
+        for (size_t i = 0; i + 1 < N; i++) {
+            key[i + 2] = name[i];
+        }
+        key[N + 1] = '"';
+        key[N + 2] = ':';
+    }
+};
+
+template<typename Message, typename T, size_t N>
+constexpr JsonField<Message, T, N> jsonField(const char (&name)[N], T Message::*member) {
+    return JsonField<Message, T, N>(name, member);
+}
+
+/// @brief Declares how a message struct is serialized. Specializations have a static constexpr tuple of jsonField()s
+/// named fields, in the order they're written in. Supported member types are bool, integers, float, double, const char *,
+/// other messages and pointers to them, which are left out when null (so they can't be the first field).
+template<typename Message>
+struct JsonSchema;
+
+template<typename Message>
+void writeJsonObject(JsonWriter &writer, const Message &message);
+
+template<typename T>
+void writeJsonValue(JsonWriter &writer, const T &value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        writer.boolean(value);
+    } else if constexpr (std::is_same_v<T, float>) {
+        writer.floating(value, JSON_FLOAT_DECIMAL_PLACES);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        writer.floating(value, JSON_DOUBLE_DECIMAL_PLACES);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        writer.integer(static_cast<std::conditional_t<sizeof(T) <= 4, int32_t, int64_t>>(value));
+    } else if constexpr (std::is_integral_v<T>) {
+        writer.unsignedInteger(static_cast<std::conditional_t<sizeof(T) <= 4, uint32_t, uint64_t>>(value));
+    } else if constexpr (std::is_same_v<T, const char *>) {
+        writer.string(value);
+    } else if constexpr (std::is_pointer_v<T>) {
+        writeJsonObject(writer, *value);
+    } else {
+        writeJsonObject(writer, value);
+    }
+}
+
+template<bool First, typename Message, typename T, size_t N>
+void writeJsonField(JsonWriter &writer, const Message &message, const JsonField<Message, T, N> &field) {
+    auto &value = message.*(field.member);
+    if constexpr (std::is_pointer_v<T> && !std::is_same_v<T, const char *>) {
+        static_assert(!First, "the first field is always written");
+        if (value == nullptr) {
+            return;
+        }
+    }
+    // the first field's key is written without the comma
+    writer.raw(field.key + (First ? 1 : 0), sizeof(field.key) - (First ? 1 : 0));
+    writeJsonValue(writer, value);
+}
+
+template<typename Message, typename Fields, size_t... I>
+void writeJsonFields(JsonWriter &writer, const Message &message, const Fields &fields, std::index_sequence<I...>) {
+    (writeJsonField<I == 0>(writer, message, std::get<I>(fields)), ...);
+}
+
+template<typename Message>
+void writeJsonObject(JsonWriter &writer, const Message &message) {
+    constexpr auto &fields = JsonSchema<Message>::fields;
+    writer.raw('{');
+    writeJsonFields(writer, message, fields,
+                    std::make_index_sequence<std::tuple_size_v<std::remove_cv_t<std::remove_reference_t<decltype(fields)>>>>{});
+    writer.raw('}');
+}
+
+/// @brief Serializes a message into the buffer without allocating. The output is the same as ArduinoJson's for a
+/// document with the same fields.
+/// @return Length of the JSON (not terminated), 0 if it didn't fit
+template<typename Message>
+size_t encodeJson(const Message &message, char *buffer, size_t size) {
+    JsonWriter writer(buffer, size);
+    writeJsonObject(writer, message);
+    return writer.overflowed() ? 0 : writer.length();
+}
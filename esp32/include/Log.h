@@ -0,0 +1,180 @@
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#pragma once
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// calls above this level are removed by the preprocessor, arguments included. Can be set with -D LOG_LEVEL=...
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// records kept in memory, the oldest ones are overwritten when the drain falls behind
+constexpr size_t LOG_RING_CAPACITY = 64;
+constexpr size_t LOG_MAX_ARGUMENTS = 4;
+// string arguments are copied into the record, together they're cut to that length
+constexpr size_t LOG_TEXT_LENGTH = 24;
+// every call site can log LOG_SITE_BURST records per LOG_SITE_WINDOW ms, the rest is counted and reported with the next one
+constexpr uint32_t LOG_SITE_WINDOW = 1000;
+constexpr uint32_t LOG_SITE_BURST = 5;
+
+enum class LogLevel : uint8_t {
+    Error = LOG_LEVEL_ERROR,
+    Warning = LOG_LEVEL_WARNING,
+    Info = LOG_LEVEL_INFO,
+    Debug = LOG_LEVEL_DEBUG
+};
+
+/// @brief State of a single logging statement, created by the LOG_* macros
+struct LogSite {
+    const char *format;
+    LogLevel level;
+    std::atomic<uint32_t> windowStart{0};
+    std::atomic<uint32_t> inWindow{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+enum class LogArgumentType : uint8_t {
+    Signed,
+    Unsigned,
+    Float,
+    // the value is the offset of the text in the record, the length is in textLength
+    Text,
+    Address
+};
+
+struct LogArgument {
+    LogArgumentType type;
+    uint8_t textLength;
+    union {
+        int32_t i;
+        uint32_t u;
+        float f;
+    };
+};
+
+/// @brief Log statement captured without formatting it. The format string is a literal, so only a pointer to the site is kept.
+struct LogRecord {
+    const LogSite *site;
+    uint32_t timestamp;
+    // records of the same site that were left out by the rate limit before this one
+    uint32_t suppressed;
+    uint8_t argumentCount;
+    uint8_t textUsed;
+    std::array<LogArgument, LOG_MAX_ARGUMENTS> arguments;
+    std::array<char, LOG_TEXT_LENGTH> text;
+};
+
+/// @brief Deferred logging. A log call only copies its arguments into a lock-free ring, formatting and writing to the serial
+/// port happen later in a background task, so logging doesn't hold up the code that does it. The ring also keeps the recent
+/// records, so they can be read over HTTP.
+class Log {
+public:
+    using Sink = void (*)(const char *line, size_t length);
+
+    static void begin(Sink sink);
+
+    static void drain();
+
+    static size_t writeRecent(char *buffer, size_t capacity);
+
+    static size_t format(const LogRecord &record, char *buffer, size_t capacity);
+
+    static uint32_t getLost();
+
+    template<typename... Args>
+    static void write(LogSite &site, const Args &... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGUMENTS, "Too many log arguments");
+        uint32_t suppressed;
+        if (!admit(site, suppressed)) {
+            return;
+        }
+        // the record is filled in place, the slot is marked as being written until publish()
+        uint32_t index;
+        auto &record = claim(index);
+        record.site = &site;
+        record.timestamp = now();
+        record.suppressed = suppressed;
+        record.argumentCount = 0;
+        record.textUsed = 0;
+        (capture(record, args), ...);
+        publish(index);
+    }
+
+private:
+    static bool admit(LogSite &site, uint32_t &suppressed);
+
+    static uint32_t now();
+
+    static LogRecord &claim(uint32_t &index);
+
+    static void publish(uint32_t index);
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    static void capture(LogRecord &record, T value) {
+        auto &argument = record.arguments[record.argumentCount++];
+        if (std::is_signed<T>::value) {
+            argument.type = LogArgumentType::Signed;
+            argument.i = static_cast<int32_t>(value);
+        } else {
+            argument.type = LogArgumentType::Unsigned;
+            argument.u = static_cast<uint32_t>(value);
+        }
+    }
+
+    static void capture(LogRecord &record, double value);
+
+    static void capture(LogRecord &record, std::string_view value);
+
+    static void capture(LogRecord &record, const char *value);
+
+#ifdef ARDUINO
+
+    static void capture(LogRecord &record, const String &value);
+
+    static void capture(LogRecord &record, const IPAddress &value);
+
+#endif
+};
+
+#define LOG_AT(level, format, ...) do { \
+        static LogSite logSite{format, level}; \
+        Log::write(logSite __VA_OPT__(,) __VA_ARGS__); \
+    } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_AT(LogLevel::Error, format __VA_OPT__(,) __VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(format, ...) LOG_AT(LogLevel::Warning, format __VA_OPT__(,) __VA_ARGS__)
+#else
+#define LOG_WARNING(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_AT(LogLevel::Info, format __VA_OPT__(,) __VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_AT(LogLevel::Debug, format __VA_OPT__(,) __VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
@@ -0,0 +1,153 @@
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+/// @brief Monotonic event counter. Incrementing is a single relaxed atomic add, so it can be done from any task or ISR.
+class Counter {
+public:
+    void increment(uint32_t amount = 1) {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint32_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> value{0};
+};
+
+/// @brief Distribution of observed values over fixed buckets, each one counting values up to and including its bound.
+/// Values above the last bound go into an overflow bucket. Observing never allocates or locks.
+template<size_t Buckets>
+class Histogram {
+public:
+    constexpr explicit Histogram(const std::array<uint32_t, Buckets> &bounds) : bounds(bounds) {}
+
+    void observe(uint32_t value) {
+        size_t bucket = 0;
+        while (bucket < Buckets && value > bounds[bucket]) {
+            bucket++;
+        }
+        counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static constexpr size_t bucketCount() {
+        return Buckets;
+    }
+
+    uint32_t upperBound(size_t bucket) const {
+        return bounds[bucket];
+    }
+
+    /// @brief Gets the amount of values that fell into the bucket (not including lower buckets). Bucket number Buckets is
+    /// the overflow bucket.
+    uint32_t countIn(size_t bucket) const {
+        return counts[bucket].load(std::memory_order_relaxed);
+    }
+
+    /// @brief Gets the sum of all observed values. Like the counts, it wraps around instead of saturating.
+    uint32_t getSum() const {
+        return sum.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<uint32_t, Buckets> bounds;
+    std::array<std::atomic<uint32_t>, Buckets + 1> counts{};
+    std::atomic<uint32_t> sum{0};
+};
+
+/// @brief Writes metrics in the Prometheus text exposition format into a fixed buffer. HELP lines are left out to keep the
+/// output small. A line that doesn't fit is left out whole, so the output is always valid even when it's truncated.
+class MetricsWriter {
+public:
+    MetricsWriter(char *buffer, size_t capacity);
+
+    void counter(const char *name, uint32_t value);
+
+    void gauge(const char *name, int32_t value);
+
+    void type(const char *name, const char *type);
+
+    void sample(const char *name, const char *labels, uint32_t value);
+
+    template<size_t Buckets>
+    void histogram(const char *name, const Histogram<Buckets> &histogram) {
+        type(name, "histogram");
+        uint32_t cumulative = 0;
+        for (size_t i = 0; i < Buckets; i++) {
+            cumulative += histogram.countIn(i);
+            append("%s_bucket{le=\"%lu\"} %lu\n", name, static_cast<unsigned long>(histogram.upperBound(i)),
+                   static_cast<unsigned long>(cumulative));
+        }
+        cumulative += histogram.countIn(Buckets);
+        append("%s_bucket{le=\"+Inf\"} %lu\n", name, static_cast<unsigned long>(cumulative));
+        append("%s_sum %lu\n", name, static_cast<unsigned long>(histogram.getSum()));
+        append("%s_count %lu\n", name, static_cast<unsigned long>(cumulative));
+    }
+
+    size_t length() const;
+
+    bool truncated() const;
+
+private:
+    char *buffer;
+    size_t capacity;
+    size_t used = 0;
+    bool overflowed = false;
+
+    void append(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/// @brief Instrumentation of the firmware's hot paths, updated where the work happens and read when metrics are requested
+struct FirmwareMetrics {
+    // time between sending a request to the probe and receiving the whole response, in ms
+    Histogram<7> sensorReadTime{{25, 50, 75, 100, 150, 250, 500}};
+    // requests the probe didn't answer in time, the next poll is the retry
+    Counter sensorTimeouts;
+    // responses that couldn't be parsed into a reading
+    Counter sensorParseFailures;
+    // requests sent to the probe because a consumer needed a fresher reading than the latest one
+    Counter sensorDemandReads;
+    // HTTP requests for a reading served from the latest one and ones that had to wait for a fresh one
+    Counter readingCacheHits;
+    Counter readingCacheMisses;
+    Counter tcpSentBytes;
+    Counter tcpSentFrames;
+    Counter tcpDroppedFrames;
+    // readings clients in the exception mode weren't sent, as they stayed within the deadband
+    Counter tcpSuppressedReadings;
+    // commands received from TCP clients and ones rejected as malformed, unknown, too long or with an invalid value
+    Counter tcpCommands;
+    Counter tcpCommandErrors;
+    // clients turned away because all slots were taken
+    Counter tcpRejectedConnections;
+    // time between receiving a request and queueing the response, in µs
+    Histogram<8> httpLatency{{50, 100, 250, 500, 1000, 2500, 5000, 10000}};
+    Counter httpRequests;
+    // connections closed right away because all slots were taken
+    Counter httpRejectedConnections;
+    // readings queued on /events streams and the ones dropped for subscribers that didn't keep up
+    Counter httpStreamEvents;
+    Counter httpStreamDroppedEvents;
+    Counter udpBeacons;
+    // beacons unicast in reply to discovery queries
+    Counter udpDiscoveryReplies;
+    // times the WiFi link dropped and how long it took to get it back, in ms
+    Counter wifiDisconnects;
+    Histogram<8> wifiRecoveryTime{{250, 500, 1000, 2500, 5000, 10000, 30000, 60000}};
+    // times the settings were written to flash, every change after a quiet period at most
+    Counter settingsWrites;
+    // rows appended to the history log, the flash bytes they took (sector headers included) and the sectors it erased
+    Counter historyRows;
+    Counter historyBytes;
+    Counter historySectorErases;
+    // time the event loop spends running handlers after each wakeup, in µs
+    Histogram<8> loopTime{{50, 100, 250, 500, 1000, 2500, 5000, 10000}};
+};
+
+extern FirmwareMetrics metrics;
@@ -0,0 +1,74 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#pragma once
+
+// the response to {F99RDD} always has the same length (CR not included)
+constexpr size_t PROBE_FRAME_LENGTH = 94;
+constexpr size_t PROBE_FRAME_MAX_FIELDS = 24;
+
+constexpr size_t HUMIDITY_FIELD = 1;
+constexpr size_t TEMPERATURE_FIELD = 5;
+
+/// @brief Decimal number stored as an integer amount of hundredths (23.45 is stored as 2345)
+struct FixedDecimal {
+    int32_t hundredths;
+    bool valid;
+
+    float toFloat() const;
+
+    static FixedDecimal parse(std::string_view text);
+};
+
+enum class ProbeFrameStatus : uint8_t {
+    Ok,
+    Empty,
+    WrongLength,
+    Overflow,
+    MissingFields,
+    InvalidHumidity,
+    InvalidTemperature
+};
+
+struct ProbeReading {
+    FixedDecimal humidity;
+    FixedDecimal temperature;
+    ProbeFrameStatus status;
+
+    bool valid() const;
+};
+
+/// @brief Line buffer for a single probe response. Bytes are appended into a fixed array and split into fields in place,
+/// so neither collecting nor parsing a frame allocates.
+class ProbeFrame {
+public:
+    void clear();
+
+    bool push(char c);
+
+    ProbeReading parse();
+
+    size_t length() const;
+
+    size_t fieldCount() const;
+
+    std::string_view field(size_t index) const;
+
+    FixedDecimal decimalField(size_t index) const;
+
+private:
+    struct FieldSpan {
+        uint8_t start;
+        uint8_t length;
+    };
+
+    std::array<char, PROBE_FRAME_LENGTH> buffer{};
+    std::array<FieldSpan, PROBE_FRAME_MAX_FIELDS> fields{};
+    uint8_t used = 0;
+    uint8_t fieldsFound = 0;
+    bool overflowed = false;
+
+    void split();
+};
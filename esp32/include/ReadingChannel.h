@@ -0,0 +1,73 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#pragma once
+
+struct SensorReading {
+    float humidity;
+    float temperature;
+    // value of millis() at the moment the reading was received from the probe
+    unsigned long timestamp;
+    bool valid;
+};
+
+/// @brief Hands readings over from the side that talks to the probe to the side that serves them, which can run on another
+/// core. The producer calls publish(), the consumer calls poll() and reads latest().
+/// The consumer only ever needs the newest reading, so this is a lock-free triple buffer: each side owns a buffer and the
+/// third one is swapped between them. A reading the consumer didn't take yet is replaced by the next one, the newest
+/// reading is never the one lost.
+class ReadingChannel {
+public:
+    /// @brief Hands a reading over to the consumer. Only to be called by the producer.
+    /// @return false if it replaced a reading the consumer didn't take yet
+    bool publish(const SensorReading &reading) {
+        published.fetch_add(1, std::memory_order_relaxed);
+        buffers[back] = reading;
+        auto previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX;
+        if (previous & FRESH) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Takes the newest reading published since the last call. Only to be called by the consumer.
+    /// @return true if there was a new reading
+    bool poll() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    /// @brief Gets the newest reading taken by poll(). Only to be called by the consumer.
+    const SensorReading &latest() const {
+        return buffers[front];
+    }
+
+    uint32_t getPublished() const {
+        return published.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Gets the amount of readings replaced by a newer one before the consumer took them
+    uint32_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint8_t INDEX = 0x03;
+    // set in middle while it holds a reading the consumer didn't take yet
+    static constexpr uint8_t FRESH = 0x04;
+    std::array<SensorReading, 3> buffers{};
+    // index of the buffer being swapped, written by both sides
+    alignas(64) std::atomic<uint8_t> middle{1};
+    // index of the buffer latest() reads, owned by the consumer
+    alignas(64) uint8_t front = 0;
+    // index of the buffer the next reading is written to, owned by the producer
+    alignas(64) uint8_t back = 2;
+    std::atomic<uint32_t> published{0};
+    std::atomic<uint32_t> dropped{0};
+};
@@ -0,0 +1,157 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "JsonEncoder.h"
+
+#pragma once
+
+enum class StreamEncoding : uint8_t {
+    Json,
+    Binary
+};
+
+/// @brief Reading as it is sent to TCP clients. Humidity and temperature are in hundredths, interval is in seconds.
+struct StreamRecord {
+    uint32_t sequence;
+    uint32_t uptime;
+    int16_t humidity;
+    int16_t temperature;
+    int8_t rssi;
+    uint16_t interval;
+    bool valid;
+    // id of the probe on the sensor bus
+    uint8_t probe;
+};
+
+/// @brief Device health sent along with JSON readings to TCP clients that asked for it
+struct HealthMessage {
+    uint32_t freeHeap;
+    uint32_t largestBlock;
+    uint32_t sensorTimeouts;
+    uint32_t parseFailures;
+    uint32_t droppedFrames;
+};
+
+template<>
+struct JsonSchema<HealthMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("freeHeap", &HealthMessage::freeHeap),
+            jsonField("largestBlock", &HealthMessage::largestBlock),
+            jsonField("sensorTimeouts", &HealthMessage::sensorTimeouts),
+            jsonField("parseFailures", &HealthMessage::parseFailures),
+            jsonField("droppedFrames", &HealthMessage::droppedFrames));
+};
+
+/// @brief Statistics of a value over the readings a report stands for
+struct StatsMessage {
+    float min;
+    float max;
+    float mean;
+    float stddev;
+};
+
+template<>
+struct JsonSchema<StatsMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("min", &StatsMessage::min),
+            jsonField("max", &StatsMessage::max),
+            jsonField("mean", &StatsMessage::mean),
+            jsonField("stddev", &StatsMessage::stddev));
+};
+
+/// @brief Aggregate of the readings taken since the previous report, sent with readings reported by exception
+struct WindowMessage {
+    // valid readings in the window
+    uint32_t count;
+    // uptime of the first reading of the window
+    uint32_t start;
+    StatsMessage humidity;
+    StatsMessage temperature;
+};
+
+template<>
+struct JsonSchema<WindowMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("count", &WindowMessage::count),
+            jsonField("start", &WindowMessage::start),
+            jsonField("humidity", &WindowMessage::humidity),
+            jsonField("temperature", &WindowMessage::temperature));
+};
+
+/// @brief JSON form of a StreamRecord, in units the monitoring app reads
+struct StreamMessage {
+    float humidity;
+    float temperature;
+    int8_t rssi;
+    uint16_t interval;
+    uint32_t sequence;
+    uint32_t timestamp;
+    uint8_t probe;
+    // left out if null
+    const WindowMessage *window;
+    const HealthMessage *metrics;
+};
+
+template<>
+struct JsonSchema<StreamMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("humidity", &StreamMessage::humidity),
+            jsonField("temperature", &StreamMessage::temperature),
+            jsonField("rssi", &StreamMessage::rssi),
+            jsonField("interval", &StreamMessage::interval),
+            jsonField("sequence", &StreamMessage::sequence),
+            jsonField("timestamp", &StreamMessage::timestamp),
+            jsonField("probe", &StreamMessage::probe),
+            jsonField("window", &StreamMessage::window),
+            jsonField("metrics", &StreamMessage::metrics));
+};
+
+/// @brief Latest reading as it's served over HTTP, with the time it was taken at and its age in milliseconds
+struct ReadingMessage {
+    float humidity;
+    float temperature;
+    int8_t rssi;
+    uint32_t timestamp;
+    uint32_t age;
+    uint8_t probe;
+};
+
+template<>
+struct JsonSchema<ReadingMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("humidity", &ReadingMessage::humidity),
+            jsonField("temperature", &ReadingMessage::temperature),
+            jsonField("rssi", &ReadingMessage::rssi),
+            jsonField("timestamp", &ReadingMessage::timestamp),
+            jsonField("age", &ReadingMessage::age),
+            jsonField("probe", &ReadingMessage::probe));
+};
+
+// layout (little endian): magic, type, flags (probe id in the upper 4 bits), sequence (4), uptime in ms (4), humidity (2), temperature (2), rssi, interval (2), CRC-16 (2)
+constexpr size_t BINARY_RECORD_SIZE = 20;
+constexpr uint8_t BINARY_RECORD_MAGIC = 0xA5;
+constexpr uint8_t BINARY_RECORD_TYPE_READING = 0x01;
+constexpr uint8_t BINARY_RECORD_FLAG_VALID = 0x01;
+constexpr uint8_t BINARY_RECORD_PROBE_SHIFT = 4;
+
+uint16_t crc16(const uint8_t *data, size_t length);
+
+size_t encodeBinaryRecord(const StreamRecord &record, uint8_t *out);
+
+bool decodeBinaryRecord(const uint8_t *in, StreamRecord &record);
+
+/// @brief Reassembles binary records from a byte stream regardless of how TCP split or coalesced them.
+/// Skips garbage until it finds a record with a matching checksum.
+class BinaryRecordDecoder {
+public:
+    bool push(uint8_t byte, StreamRecord &record);
+
+    uint32_t getDroppedBytes() const;
+
+private:
+    std::array<uint8_t, BINARY_RECORD_SIZE> buffer{};
+    size_t used = 0;
+    uint32_t droppedBytes = 0;
+
+    void resync();
+};
@@ -0,0 +1,67 @@
+#include <cstdint>
+#include "ReadingCodec.h"
+
+#pragma once
+
+/// @brief Minimum, maximum, mean and standard deviation of a value, updated in a single pass in constant memory
+/// (Welford's algorithm, which doesn't lose precision the way a sum of squares does)
+class RunningStats {
+public:
+    void add(float value);
+
+    void clear();
+
+    uint32_t getCount() const;
+
+    float getMin() const;
+
+    float getMax() const;
+
+    float getMean() const;
+
+    float getStddev() const;
+
+private:
+    uint32_t count = 0;
+    float min = 0.0f;
+    float max = 0.0f;
+    float mean = 0.0f;
+    // sum of squared differences from the mean
+    float m2 = 0.0f;
+};
+
+/// @brief When a TCP client in the exception mode is sent a reading
+struct ReportThresholds {
+    // change from the last reported value, in hundredths of %rh and °C, that's reported right away
+    uint16_t humidityDeadband = 50;
+    uint16_t temperatureDeadband = 20;
+    // seconds after which a reading is reported even if nothing changed, so the client can tell the probe is alive
+    uint16_t heartbeat = 300;
+};
+
+/// @brief Report-by-exception of one probe's readings: every reading is folded into the statistics of the current window,
+/// but only the ones that moved past the deadband from the last reported value, or came a heartbeat after it, are
+/// reported. The report carries the window's statistics, so extremes between two reports aren't lost.
+class ReportWindow {
+public:
+    bool add(const StreamRecord &record, const ReportThresholds &thresholds);
+
+    void nextWindow(const StreamRecord &record);
+
+    void reset();
+
+    WindowMessage summary() const;
+
+private:
+    RunningStats humidity;
+    RunningStats temperature;
+    // uptime of the first reading of the window
+    uint32_t startedAt = 0;
+    bool started = false;
+    // the last reported reading
+    bool reported = false;
+    int16_t reportedHumidity = 0;
+    int16_t reportedTemperature = 0;
+    bool reportedValid = false;
+    uint32_t reportedAt = 0;
+};
@@ -0,0 +1,84 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+enum class OverflowPolicy : uint8_t {
+    // the oldest sample is replaced, used for history where the newest data matters most
+    OverwriteOldest,
+    // new samples are rejected until there's space again
+    DropNewest
+};
+
+/// @brief Fixed-capacity ring of samples stored in one contiguous array. T must have a uint32_t sequence member,
+/// and samples must be pushed in increasing sequence order.
+template<typename T, size_t Capacity, OverflowPolicy Policy = OverflowPolicy::OverwriteOldest>
+class SampleRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    /// @brief Adds a sample, applying the overflow policy if the ring is full
+    /// @return false if the sample was rejected
+    bool push(const T &sample) {
+        if (count == Capacity) {
+            if (Policy == OverflowPolicy::DropNewest) {
+                dropped++;
+                return false;
+            }
+            head = (head + 1) & MASK;
+            count--;
+            dropped++;
+        }
+        samples[(head + count) & MASK] = sample;
+        count++;
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /// @brief Gets a sample
+    /// @param index Index counted from the oldest sample
+    const T &at(size_t index) const {
+        return samples[(head + index) & MASK];
+    }
+
+    const T &newest() const {
+        return at(count - 1);
+    }
+
+    /// @brief Gets the amount of samples lost due to the overflow policy
+    uint32_t getDropped() const {
+        return dropped;
+    }
+
+    /// @brief Finds the oldest sample with a sequence number greater than the given one
+    /// @return Index of the sample or size() if there's none. 0 if the given sequence is older than everything in the ring
+    size_t firstAfter(uint32_t sequence) const {
+        // sequence numbers are increasing, so binary search works. comparing differences handles their wrap-around
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (static_cast<int32_t>(at(middle).sequence - sequence) > 0) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        return low;
+    }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+    std::array<T, Capacity> samples{};
+    size_t head = 0;
+    size_t count = 0;
+    uint32_t dropped = 0;
+};
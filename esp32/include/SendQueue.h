@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+/// @brief Reference to an immutable, reference counted byte buffer. A frame is encoded once and the same buffer is queued
+/// for every client, copying the reference only bumps the counter.
+class FrameRef {
+public:
+    FrameRef() = default;
+
+    FrameRef(const FrameRef &other);
+
+    FrameRef(FrameRef &&other) noexcept;
+
+    FrameRef &operator=(FrameRef other) noexcept;
+
+    ~FrameRef();
+
+    static FrameRef copyOf(const uint8_t *data, size_t size);
+
+    static FrameRef withCapacity(size_t capacity);
+
+    bool rewrite(const uint8_t *data, size_t size);
+
+    const uint8_t *data() const;
+
+    size_t size() const;
+
+    explicit operator bool() const;
+
+private:
+    struct Block {
+        std::atomic<uint16_t> references;
+        size_t size;
+        size_t capacity;
+    };
+
+    Block *block = nullptr;
+
+    void release();
+};
+
+enum class QueueOverflowPolicy : uint8_t {
+    // the oldest frame that hasn't started being sent is dropped
+    DropOldest,
+    // every frame that hasn't started being sent is replaced with the newest one
+    CoalesceToLatest,
+    // the client is considered too slow and should be disconnected
+    Disconnect
+};
+
+enum class EnqueueResult : uint8_t {
+    Queued,
+    // the frame was queued once the policy dropped older ones to make room for it, getStats() counts every one of them
+    Evicted,
+    // the frame wasn't queued, only a frame that started being sent was left and there's still no room
+    Dropped,
+    Disconnect
+};
+
+struct SendQueueStats {
+    uint32_t queuedBytes;
+    uint32_t sentBytes;
+    uint32_t sentFrames;
+    uint32_t droppedFrames;
+};
+
+constexpr size_t SEND_QUEUE_CAPACITY = 32;
+constexpr size_t SEND_QUEUE_MAX_BYTES = 4096;
+
+/// @brief Bounded queue of frames waiting to be sent to a single client
+class SendQueue {
+public:
+    EnqueueResult push(const FrameRef &frame);
+
+    /// @brief Writes as much of the queue as the writer accepts
+    /// @param write Callable taking (const uint8_t *data, size_t size) and returning the amount of bytes it accepted
+    /// @return Amount of bytes written
+    template<typename Writer>
+    size_t drain(Writer &&write) {
+        size_t written = 0;
+        while (count > 0) {
+            auto &frame = frames[head];
+            auto remaining = frame.size() - headOffset;
+            auto accepted = write(frame.data() + headOffset, remaining);
+            written += accepted;
+            headOffset += accepted;
+            stats.queuedBytes -= accepted;
+            stats.sentBytes += accepted;
+            if (accepted < remaining) {
+                break;
+            }
+            stats.sentFrames++;
+            popFront();
+        }
+        return written;
+    }
+
+    /// @brief Hands as much of the queue to the client as its send buffer takes, without sending it yet
+    /// @param client AsyncClient, or anything with its canSend(), space() and add()
+    /// @return Amount of bytes added
+    template<typename Client>
+    size_t drainTo(Client &client) {
+        return drain([&client](const uint8_t *data, size_t size) -> size_t {
+            if (!client.canSend()) {
+                return 0;
+            }
+            return client.add(reinterpret_cast<const char *>(data), std::min(size, client.space()));
+        });
+    }
+
+    void clear();
+
+    bool empty() const;
+
+    bool fits(size_t bytes) const;
+
+    void setPolicy(QueueOverflowPolicy newPolicy);
+
+    void setMaxBytes(size_t bytes);
+
+    const SendQueueStats &getStats() const;
+
+private:
+    std::array<FrameRef, SEND_QUEUE_CAPACITY> frames;
+    size_t head = 0;
+    size_t count = 0;
+    // bytes of the first frame that were already handed to the socket, such a frame can't be dropped anymore
+    size_t headOffset = 0;
+    QueueOverflowPolicy policy = QueueOverflowPolicy::DropOldest;
+    size_t maxBytes = SEND_QUEUE_MAX_BYTES;
+    SendQueueStats stats{};
+
+    void popFront();
+
+    bool dropUnstarted();
+
+    size_t firstUnstarted() const;
+};
@@ -1,20 +1,76 @@
 #include <Arduino.h>
+#include <atomic>
 #include <utility>
+#include "ProbeFrame.h"
+#include "ReadingChannel.h"
 
 #pragma once
 
+// readings at most this many milliseconds old are served without asking the probe, unless a consumer asks for a fresher one
+constexpr unsigned long SENSOR_MAX_AGE = 2000;
+
 class Sensor {
 public:
-    Sensor(int uartNr, int rxPin, int txPin);
+    Sensor(int uartNr, int rxPin, int txPin, unsigned long pollInterval = 1000, unsigned long maxAge = SENSOR_MAX_AGE);
+
+    void loop();
+
+    unsigned long nextDeadline() const;
+
+    void onReceive(void (*callback)());
+
+    void onPublish(void (*callback)());
+
+    void onDemand(void (*callback)());
+
+    void setPollInterval(unsigned long interval);
+
+    void setMaxAge(unsigned long age);
+
+    unsigned long getMaxAge() const;
+
+    void requestReading(unsigned long maxAge);
+
+    bool takeReadings();
+
+    SensorReading getLatestReading() const;
 
     std::pair<float, float> getSensorData();
 
     String getJsonString();
 
+    const ProbeFrame &getLatestFrame() const;
+
 private:
+    enum class State {
+        Idle,
+        AwaitingResponse
+    };
+
     HardwareSerial serial;
+    State state = State::Idle;
+    ProbeFrame receivedFrame;
+    ProbeFrame latestFrame;
+    // written by the networking side, read by whichever task runs loop()
+    std::atomic<unsigned long> pollInterval;
+    std::atomic<unsigned long> maxAge;
+    // smallest age asked for by requestReading() since the last reading, NO_DEMAND if none
+    std::atomic<unsigned long> demandedAge;
+    unsigned long requestSentAt = 0;
+    // time of the last request sent on schedule, requests made on demand don't shift the schedule
+    unsigned long polledAt = 0;
+    bool requestedOnce = false;
+    // producer side copy, so that loop() never touches what the consumer reads
+    SensorReading lastPublished{0.0f, 0.0f, 0, false};
+    ReadingChannel readings;
+    void (*publishCallback)() = nullptr;
+    void (*demandCallback)() = nullptr;
+
+    bool demandPending();
+
+    void sendRequest();
 
-    String readSensorData();
+    void collectResponse();
 
-    std::pair<float, float> processSensorData(String &sensorData);
+    void publishReading();
 };
@@ -0,0 +1,56 @@
+#include <Arduino.h>
+#include <array>
+#include <memory>
+#include "Sensor.h"
+
+#pragma once
+
+// the ESP32 has three UARTs and the first one is the console, but the native build can simulate more
+constexpr size_t MAX_PROBES = 4;
+
+/// @brief UART and pins a probe is connected to
+struct ProbePins {
+    int uartNr;
+    int rxPin;
+    int txPin;
+};
+
+/// @brief Probes connected to the device, each on its own UART and identified by its index. Every probe runs its own
+/// transaction state machine, so their transactions overlap: a probe that's slow to answer doesn't hold up the others,
+/// and the samples taken per second grow with the amount of probes. loop() serves them round-robin, starting with a
+/// different probe every time.
+class SensorBus {
+public:
+    SensorBus(const ProbePins *pins, size_t count, unsigned long pollInterval = 1000,
+              unsigned long maxAge = SENSOR_MAX_AGE);
+
+    SensorBus(const SensorBus &) = delete;
+
+    SensorBus &operator=(const SensorBus &) = delete;
+
+    void loop();
+
+    unsigned long nextDeadline() const;
+
+    void onReceive(void (*callback)());
+
+    void onPublish(void (*callback)());
+
+    void onDemand(void (*callback)());
+
+    void setPollInterval(unsigned long interval);
+
+    bool takeReadings();
+
+    size_t size() const;
+
+    Sensor &operator[](size_t probe);
+
+    const Sensor &operator[](size_t probe) const;
+
+private:
+    std::array<std::unique_ptr<Sensor>, MAX_PROBES> probes;
+    size_t count;
+    // probe loop() starts with, advanced on every call
+    size_t first = 0;
+};
@@ -0,0 +1,76 @@
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <array>
+#include <mutex>
+
+#pragma once
+
+// version of the stored layout, bumped whenever a field is added, older versions are migrated when they're loaded
+constexpr uint8_t SETTINGS_VERSION = 1;
+
+// changes are written once they stopped coming for this long...
+constexpr unsigned long SETTINGS_FLUSH_DELAY = 5000;
+// ...but no later than this after the first unsaved one, so that a client changing them all the time can't hold them off
+constexpr unsigned long SETTINGS_MAX_FLUSH_DELAY = 30000;
+
+// layout (little endian): version, length of the fields, TCP interval (2), TCP batch (2), TCP flush timeout (4), IP (4),
+// subnet mask (4), default gateway (4), CRC-16 (2) of the preceding bytes
+constexpr size_t SETTINGS_RECORD_SIZE = 24;
+
+struct DeviceSettings {
+    // interval new TCP clients start with, in seconds
+    uint16_t tcpInterval = 2;
+    uint16_t tcpBatch = 1;
+    // ms after which an incomplete TCP batch is sent, 0 disables it
+    uint32_t tcpFlushTimeout = 0;
+    // static network configuration, all zeros for DHCP
+    uint32_t ip = 0;
+    uint32_t subnetMask = 0;
+    uint32_t defaultGateway = 0;
+};
+
+/// @brief Device settings cached in RAM. They're read from flash once at boot and every change is only written back after
+/// a quiet period, as a single record, so that frequent changes neither wear the flash nor block the caller while it's
+/// being written. Setters can be called from any task, loop() writes the changes from the event loop.
+class Settings {
+public:
+    void begin();
+
+    void loop();
+
+    bool nextDeadline(uint32_t &deadline);
+
+    void flush();
+
+    void onChange(void (*callback)());
+
+    DeviceSettings get();
+
+    void setTcpInterval(uint16_t interval);
+
+    void setTcpBatch(uint16_t batch);
+
+    void setTcpFlushTimeout(uint32_t timeout);
+
+    void setNetwork(IPAddress ip, IPAddress subnetMask, IPAddress defaultGateway);
+
+private:
+    std::mutex lock;
+    DeviceSettings current;
+    // the record last read from or written to flash, a change that's reverted before the flush isn't written
+    std::array<uint8_t, SETTINGS_RECORD_SIZE> stored{};
+    bool loaded = false;
+    bool dirty = false;
+    unsigned long firstChangeAt = 0;
+    unsigned long lastChangeAt = 0;
+    void (*changeCallback)() = nullptr;
+
+    template<typename T>
+    void update(T DeviceSettings::*field, T value);
+
+    void migrate(uint8_t version);
+
+    static void encode(const DeviceSettings &settings, uint8_t *out);
+
+    static bool decode(const uint8_t *in, size_t length, DeviceSettings &settings, uint8_t &version);
+};
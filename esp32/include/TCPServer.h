@@ -1,14 +1,121 @@
 #include <HardwareSerial.h>
 #include <AsyncTCP.h>
-#include <Sensor.h>
-#include <ESP32TimerInterrupt.hpp>
-#include <memory>
+#include "SensorBus.h"
+#include "ReadingCodec.h"
+#include "SampleRing.h"
+#include "SendQueue.h"
+#include "DeadlineScheduler.h"
+#include "Metrics.h"
+#include "CommandParser.h"
+#include "Settings.h"
+#include "ReportWindow.h"
+#include <array>
+#include <atomic>
+#include <mutex>
 
 #pragma once
 
+// at the fastest rate (1 s) that's 17 minutes of readings, taking up 20 kB of RAM
+constexpr size_t TCP_HISTORY_CAPACITY = 1024;
+
+// batches are held in the client's send queue, so their size has to be limited by its capacity. A batch of frames that
+// outgrows the queue's bytes is sent in parts.
+constexpr unsigned short MAX_TCP_BATCH = SEND_QUEUE_CAPACITY;
+
+// ms an incomplete batch is held at most, longer timeouts are clamped so that the time it's due at can't wrap around
+constexpr uint32_t MAX_TCP_FLUSH_TIMEOUT = 600000;
+
+// clients connected at once, their slots are allocated with the server and reused. A client connecting while they're all
+// taken is turned away.
+constexpr size_t MAX_TCP_CLIENTS = 8;
+
+// a JSON reading with metrics, a window aggregate and large counters is about 450 bytes long
+constexpr size_t JSON_FRAME_BUFFER = 512;
+
+// a reply to the stats command with large counters is about 150 bytes long
+constexpr size_t TCP_REPLY_BUFFER = 192;
+
+enum class DeliveryMode : uint8_t {
+    // the newest reading at the time of delivery
+    Latest,
+    // mean of the readings taken since the previous delivery
+    Average,
+    // readings that moved past the deadband or the heartbeat, with the aggregate of the ones in between
+    Exception
+};
+
+enum class CommandResult : uint8_t {
+    // the command was carried out and gets an acknowledgement
+    Acknowledged,
+    // the command's value was wrong, nothing changed
+    Invalid,
+    // the handler queued its own reply
+    Replied,
+    // the reply couldn't be prepared because the previous one wasn't sent yet
+    Busy
+};
+
+// commands a client can have waiting for loop(), the ones arriving while they're all taken get {"error":"busy"}
+constexpr size_t TCP_PENDING_COMMANDS = 4;
+static_assert(TCP_COMMAND_BUFFER <= UINT8_MAX, "the length of a pending command has to fit in a byte");
+
+/// @brief A command framed by the AsyncTCP task, waiting to be handled by loop()
+struct PendingCommand {
+    std::array<char, TCP_COMMAND_BUFFER> text;
+    uint8_t length;
+    bool tooLong;
+};
+
+/// @brief A client slot. The slot is claimed by the AsyncTCP task when a client connects and then served by loop(): the
+/// fields guarded by slotLock are shared, the rest belongs to loop(), which resets them when it takes the slot over. The
+/// stats reply's frame is allocated once and reused by every client of the slot.
+struct TCPSubscriber {
+    // guarded by slotLock: the slot is free when client is nullptr, joined until loop() takes it over and disconnected once
+    // the client is gone, after which loop() frees it
+    AsyncClient *client = nullptr;
+    bool joined = false;
+    bool disconnected = false;
+    // id of the subscriber's deadline in the scheduler, given when the slot is claimed
+    uint16_t id = 0;
+    // commands the AsyncTCP task framed for loop(), and the amount of those that didn't fit
+    std::array<PendingCommand, TCP_PENDING_COMMANDS> pendingCommands{};
+    uint8_t pendingCount = 0;
+    uint8_t overrunCommands = 0;
+    // only used by the AsyncTCP task: bytes of a command that was split across packets
+    CommandFramer commands;
+    // the send queue's counters, published by loop() for writeMetrics()
+    std::atomic<uint32_t> sentBytes{0};
+    std::atomic<uint32_t> sentFrames{0};
+    // owned by loop(), set from the time it took the slot over until it freed it
+    bool active = false;
+    // seconds between deliveries
+    unsigned short interval = 0;
+    StreamEncoding encoding = StreamEncoding::Json;
+    DeliveryMode mode = DeliveryMode::Latest;
+    // JSON frames carry a "metrics" object with the device's health
+    bool withMetrics = false;
+    // set when the client requested history, cleared once it caught up with the newest reading
+    bool backfilling = false;
+    // whether the sample the backfill is in the middle of is sent, it's sent or thinned out with the readings of every probe
+    bool backfillSample = false;
+    // sequence number and uptime of the newest reading queued for the client
+    uint32_t lastSentSequence = 0;
+    uint32_t lastSentUptime = 0;
+    SendQueue queue;
+    // frames of the batch that's being collected, they're held in the queue until the batch is complete
+    unsigned short heldFrames = 0;
+    unsigned long batchStartedAt = 0;
+    bool closeRequested = false;
+    // reused for replies to the stats command, so that they don't need an allocation each
+    FrameRef statsReply;
+    // used by the exception mode, every probe has its own window
+    ReportThresholds thresholds;
+    std::array<ReportWindow, MAX_PROBES> windows{};
+};
+
 class TCPServer {
 public:
-    TCPServer(Sensor &sensor, unsigned short port = 5505);
+    TCPServer(SensorBus &sensors, Settings &settings, unsigned short port = 5505);
 
     ~TCPServer();
 
@@ -20,30 +127,148 @@ public:
 
     void stop();
 
+    void onActivity(void (*callback)());
+
+    void announceReconnect(unsigned long downtime);
+
     static void loop();
 
+    static bool nextDeadline(uint32_t &deadline);
+
+    static void writeMetrics(MetricsWriter &writer);
+
+    static size_t toJson(const StreamRecord &record, bool withMetrics, char *buffer, size_t size,
+                         const WindowMessage *window = nullptr);
+
 private:
-    std::shared_ptr <AsyncServer> server;
-    Sensor &sensor;
-    std::vector<AsyncClient *> clients;
-    ESP32Timer timer;
-    bool interruptAttachedOnce;
+    struct CachedFrame {
+        uint32_t sequence;
+        unsigned short interval;
+        StreamEncoding encoding;
+        DeliveryMode mode;
+        bool withMetrics;
+        FrameRef frame;
+    };
+
+    struct CommandHandler {
+        const char *name;
+        // nullptr for parameters of other commands, like "save"
+        CommandResult (*handle)(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+    };
+
+    AsyncServer server;
+    SensorBus &sensors;
+    Settings &settings;
+    std::mutex slotLock;
+    std::array<TCPSubscriber, MAX_TCP_CLIENTS> clients;
+    // owned by loop(), like everything below but nextSubscriberId
+    DeadlineScheduler<MAX_TCP_CLIENTS + 1> scheduler;
     bool started = false;
     bool stopped = false;
     unsigned short port;
+    // interval new clients start with, saved in settings
+    unsigned short defaultInterval = 2;
+    // seconds between readings stored in history, the greatest common divisor of all intervals
+    unsigned short baseInterval = 0;
+    // guarded by slotLock
+    uint16_t nextSubscriberId = 1;
+    uint32_t sequence = 0;
+    SampleRing<StreamRecord, TCP_HISTORY_CAPACITY> history;
+    // recently encoded frames, clients with the same interval, mode and encoding get the same frame
+    std::array<CachedFrame, 2 * MAX_PROBES> frameCache{};
+    size_t nextCacheSlot = 0;
+    unsigned short batchSize = 1;
+    unsigned long flushTimeout = 0;
+    void (*activityCallback)() = nullptr;
+    // replies are the same every time, so they're encoded once and shared by every client, in the order of commandHandlers
+    std::vector<FrameRef> acknowledgements;
+    std::vector<FrameRef> rejections;
+    FrameRef unknownCommandReply;
+    FrameRef malformedReply;
+    FrameRef tooLongReply;
+    FrameRef busyReply;
     static TCPServer *instance;
+    static const CommandHandler commandHandlers[];
+
+    static void takeSample();
+
+    static void deliver(TCPSubscriber &subscriber);
+
+    static void deliverExceptions(TCPSubscriber &subscriber);
+
+    static bool newestSince(uint32_t sequence, uint8_t probe, StreamRecord &record);
+
+    static bool averageSince(uint32_t sequence, uint8_t probe, StreamRecord &record);
+
+    static FrameRef encodeFrame(const StreamRecord &record, const TCPSubscriber &subscriber);
+
+    static void queueFrame(TCPSubscriber &subscriber, const FrameRef &frame);
+
+    static void releaseBatch(TCPSubscriber &subscriber);
 
-    static bool timerHandle(void *_);
+    static void drainQueue(TCPSubscriber &subscriber);
 
-    static bool sendDataToClient();
+    static void closeSlowClients();
+
+    static void sendBackfill(TCPSubscriber &subscriber);
+
+    static void updateBaseInterval();
+
+    static void scheduleSubscriber(TCPSubscriber &subscriber);
+
+    static TCPSubscriber *findSubscriber(AsyncClient *client);
+
+    static size_t connectedClients();
+
+    static void startSubscriber(TCPSubscriber &subscriber);
+
+    static void releaseSubscriber(TCPSubscriber &subscriber);
+
+    static void syncSlots();
 
     static void handleClient(void *arg, AsyncClient *client);
 
     static void handleData(void *arg, AsyncClient *client, void *data, size_t len);
 
+    static void handleCommand(TCPSubscriber &subscriber, std::string_view text, bool tooLong);
+
+    static void queueReply(TCPSubscriber &subscriber, const FrameRef &reply);
+
+    static EnqueueResult enqueue(TCPSubscriber &subscriber, const FrameRef &frame);
+
+    static void prepareReplies();
+
+    static CommandResult setInterval(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setMode(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setBatch(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setFlushTimeout(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setFormat(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setMetrics(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setOverflow(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setDeadband(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult setHeartbeat(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult requestSince(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult ping(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
+    static CommandResult sendStats(TCPSubscriber &subscriber, const CommandField &field, const Command &command);
+
     static void handleError(void *arg, AsyncClient *client, int8_t error);
 
     static void handleDisconnect(void *arg, AsyncClient *client);
 
     static void handleTimeout(void *arg, AsyncClient *client, uint32_t time);
-};
\ No newline at end of file
+
+    static void handleAck(void *arg, AsyncClient *client, size_t len, uint32_t time);
+
+    static void notifyActivity();
+};
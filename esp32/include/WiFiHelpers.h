@@ -1,7 +1,7 @@
 #include <Arduino.h>
 #include <WiFiManager.h>
 #include <WiFi.h>
-#include <Preferences.h>
+#include "Settings.h"
 
 #pragma once
 
@@ -23,10 +23,10 @@ public:
     bool isValid();
 };
 
-void setupWiFi();
+void setupWiFi(Settings &settings);
 
-void setupIpSetup();
+void setupIpSetup(Settings &settings);
 
-IpSettings getSavedIpSettings(Preferences &preferences);
+IpSettings getSavedIpSettings(Settings &settings);
 
-void saveIpSettings(Preferences &preferences, IpSettings &settings);
\ No newline at end of file
+void saveIpSettings(Settings &settings, IpSettings &ipSettings);
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include "WString.h"
+#include "IPAddress.h"
+#include "Print.h"
+#include "HardwareSerial.h"
+#include "Esp.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#pragma once
+
+// Host implementation of the part of arduino-esp32 the firmware uses, so that it can run as a Linux process
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define ARDUINO_ISR_ATTR
+#define IRAM_ATTR
+
+#define log_e(format, ...) fprintf(stderr, "[E] " format "\n" __VA_OPT__(,) __VA_ARGS__)
+#define log_w(format, ...) fprintf(stderr, "[W] " format "\n" __VA_OPT__(,) __VA_ARGS__)
+#define log_i(format, ...) fprintf(stderr, "[I] " format "\n" __VA_OPT__(,) __VA_ARGS__)
+#define log_d(format, ...) do {} while (0)
+
+unsigned long millis();
+
+unsigned long micros();
+
+void delay(uint32_t ms);
+
+void delayMicroseconds(uint32_t us);
+
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+
+void digitalWrite(uint8_t pin, uint8_t value);
+
+int digitalRead(uint8_t pin);
+
+int digitalPinToInterrupt(uint8_t pin);
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+
+void detachInterrupt(uint8_t pin);
+
+long random(long max);
+
+long random(long min, long max);
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2 = nullptr,
+                const char *server3 = nullptr);
+
+void setup();
+
+void loop();
+
+namespace hal {
+    void pressButton(uint8_t pin);
+}
@@ -0,0 +1,163 @@
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+#pragma once
+
+// Host implementation of the AsyncTCP API over non-blocking POSIX sockets. A single network thread stands in for the
+// async_tcp task: every callback is invoked from it, with the network lock held, so callbacks never run concurrently
+// with each other or with calls made from other tasks.
+
+class AsyncClient;
+
+// lwIP's default maximum segment size on the ESP32
+constexpr size_t ASYNC_TCP_MSS = 1436;
+// the amount of data the real stack accepts before the first ack (4 * TCP_MSS)
+constexpr size_t ASYNC_CLIENT_SEND_BUFFER = 4 * ASYNC_TCP_MSS;
+
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void *, AsyncClient *, int8_t error)> AcErrorHandler;
+typedef std::function<void(void *, AsyncClient *, void *data, size_t len)> AcDataHandler;
+typedef std::function<void(void *, AsyncClient *, uint32_t time)> AcTimeoutHandler;
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+
+/// @brief Data sent to clients since the start of the process. The real stack sends what every send() call released in
+/// segments of its own, which the native build stands in for by counting them, while the network thread may write the
+/// data of several calls at once.
+struct AsyncTcpStats {
+    // send() calls that released data, and the segments and bytes the real stack would send for them
+    uint32_t sends;
+    uint32_t segments;
+    uint64_t bytes;
+    // writes the network thread made to the sockets
+    uint32_t writes;
+};
+
+AsyncTcpStats asyncTcpStats();
+
+class AsyncClient {
+public:
+    AsyncClient() = default;
+
+    explicit AsyncClient(int socket);
+
+    AsyncClient(const AsyncClient &) = delete;
+
+    AsyncClient &operator=(const AsyncClient &) = delete;
+
+    /// @brief Like the real one, deleting a connected client closes it and calls the disconnect handler
+    ~AsyncClient();
+
+    bool connected();
+
+    bool disconnected();
+
+    bool canSend();
+
+    size_t space();
+
+    size_t add(const char *data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+
+    bool send();
+
+    size_t write(const char *data);
+
+    size_t write(const char *data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+
+    void close(bool now = false);
+
+    void stop();
+
+    int8_t abort();
+
+    void setRxTimeout(uint32_t timeout);
+
+    uint32_t getRxTimeout();
+
+    void setNoDelay(bool noDelay);
+
+    IPAddress remoteIP();
+
+    uint16_t remotePort();
+
+    IPAddress localIP();
+
+    uint16_t localPort();
+
+    void onConnect(AcConnectHandler handler, void *arg = nullptr);
+
+    void onDisconnect(AcConnectHandler handler, void *arg = nullptr);
+
+    void onAck(AcAckHandler handler, void *arg = nullptr);
+
+    void onError(AcErrorHandler handler, void *arg = nullptr);
+
+    void onData(AcDataHandler handler, void *arg = nullptr);
+
+    void onTimeout(AcTimeoutHandler handler, void *arg = nullptr);
+
+    void onPoll(AcConnectHandler handler, void *arg = nullptr);
+
+private:
+    friend class AsyncNetwork;
+
+    int socket = -1;
+    std::vector<char> pending;
+    // bytes at the start of pending that send() released to the network thread
+    size_t pushed = 0;
+    uint32_t pushedAt = 0;
+    uint32_t rxTimeout = 0;
+    uint32_t lastRx = 0;
+    uint32_t lastPoll = 0;
+
+    AcConnectHandler connectHandler;
+    void *connectArg = nullptr;
+    AcConnectHandler disconnectHandler;
+    void *disconnectArg = nullptr;
+    AcAckHandler ackHandler;
+    void *ackArg = nullptr;
+    AcErrorHandler errorHandler;
+    void *errorArg = nullptr;
+    AcDataHandler dataHandler;
+    void *dataArg = nullptr;
+    AcTimeoutHandler timeoutHandler;
+    void *timeoutArg = nullptr;
+    AcConnectHandler pollHandler;
+    void *pollArg = nullptr;
+
+    void closeSocket();
+};
+
+class AsyncServer {
+public:
+    explicit AsyncServer(uint16_t port);
+
+    AsyncServer(IPAddress address, uint16_t port);
+
+    AsyncServer(const AsyncServer &) = delete;
+
+    AsyncServer &operator=(const AsyncServer &) = delete;
+
+    ~AsyncServer();
+
+    void onClient(AcConnectHandler handler, void *arg);
+
+    void begin();
+
+    void end();
+
+    void setNoDelay(bool noDelay);
+
+    uint8_t status();
+
+private:
+    friend class AsyncNetwork;
+
+    uint16_t port;
+    int socket = -1;
+    bool noDelay = false;
+    AcConnectHandler clientHandler;
+    void *clientArg = nullptr;
+};
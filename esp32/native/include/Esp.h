@@ -0,0 +1,21 @@
+#include <cstdint>
+
+#pragma once
+
+/// @brief Heap statistics of the process, reported as if it had the ESP32's usable heap
+class EspClass {
+public:
+    uint32_t getHeapSize();
+
+    uint32_t getFreeHeap();
+
+    uint32_t getMinFreeHeap();
+
+    uint32_t getMaxAllocHeap();
+
+    uint64_t getEfuseMac();
+
+    [[noreturn]] void restart();
+};
+
+extern EspClass ESP;
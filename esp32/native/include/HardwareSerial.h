@@ -0,0 +1,56 @@
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Print.h"
+
+#pragma once
+
+#define SERIAL_8N1 0x800001c
+
+class SimulatedProbe;
+
+/// @brief UART. Port 0 is the console (stdout), the other ports are connected to a simulated probe that answers read
+/// requests like the real one, with a delay matching the baud rate.
+class HardwareSerial : public Stream {
+public:
+    explicit HardwareSerial(int uartNr);
+
+    ~HardwareSerial() override;
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+
+    void end();
+
+    void onReceive(std::function<void()> callback, bool onlyOnTimeout = false);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    size_t write(uint8_t byte) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+
+    void flush() override;
+
+    /// @brief Called by the simulated device with bytes it sends to the firmware
+    void receive(const char *data, size_t length);
+
+private:
+    int uartNr;
+    unsigned long baud = 0;
+    std::mutex mutex;
+    std::deque<char> received;
+    std::function<void()> receiveCallback;
+    std::unique_ptr<SimulatedProbe> probe;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,44 @@
+#include <cstdint>
+#include "Print.h"
+#include "WString.h"
+
+#pragma once
+
+/// @brief IPv4 address stored like on the ESP32: the first octet is the lowest byte of the integer value
+class IPAddress : public Printable {
+public:
+    IPAddress() = default;
+
+    IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth);
+
+    IPAddress(uint32_t address) : address(address) {}
+
+    bool fromString(const char *text);
+
+    bool fromString(const String &text) {
+        return fromString(text.c_str());
+    }
+
+    String toString() const;
+
+    size_t printTo(Print &print) const override;
+
+    operator uint32_t() const {
+        return address;
+    }
+
+    uint8_t operator[](int index) const {
+        return (address >> (index * 8)) & 0xFF;
+    }
+
+    bool operator==(const IPAddress &other) const {
+        return address == other.address;
+    }
+
+    bool operator!=(const IPAddress &other) const {
+        return address != other.address;
+    }
+
+private:
+    uint32_t address = 0;
+};
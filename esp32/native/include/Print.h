@@ -0,0 +1,116 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "WString.h"
+
+#pragma once
+
+class Print;
+
+/// @brief Arduino Printable, what ArduinoJson uses to store e.g. an IPAddress as a string
+class Printable {
+public:
+    virtual ~Printable() = default;
+
+    virtual size_t printTo(Print &print) const = 0;
+};
+
+/// @brief Arduino Print, everything ends up in write(const uint8_t *, size_t)
+class Print {
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t byte) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t written = 0;
+        while (written < size && write(buffer[written])) {
+            written++;
+        }
+        return written;
+    }
+
+    size_t write(const char *text) {
+        return write(reinterpret_cast<const uint8_t *>(text), strlen(text));
+    }
+
+    size_t write(const char *buffer, size_t size) {
+        return write(reinterpret_cast<const uint8_t *>(buffer), size);
+    }
+
+    size_t print(const char *text) {
+        return write(text);
+    }
+
+    size_t print(const String &text) {
+        return write(text.c_str(), text.length());
+    }
+
+    size_t print(char c) {
+        return write(static_cast<uint8_t>(c));
+    }
+
+    size_t print(int number) {
+        return print(String(number));
+    }
+
+    size_t print(unsigned int number) {
+        return print(String(number));
+    }
+
+    size_t print(long number) {
+        return print(String(number));
+    }
+
+    size_t print(unsigned long number) {
+        return print(String(number));
+    }
+
+    size_t print(double number, int decimals = 2) {
+        return print(String(number, decimals));
+    }
+
+    size_t print(const Printable &printable) {
+        return printable.printTo(*this);
+    }
+
+    size_t println() {
+        return write("\r\n");
+    }
+
+    template<typename T>
+    size_t println(const T &value) {
+        auto written = print(value);
+        return written + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    virtual void flush() {}
+};
+
+/// @brief Arduino Stream, a Print that can also be read from
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+
+    virtual int read() = 0;
+
+    virtual int peek() = 0;
+
+    size_t readBytes(char *buffer, size_t length) {
+        size_t count = 0;
+        while (count < length) {
+            auto c = read();
+            if (c < 0) {
+                break;
+            }
+            buffer[count++] = static_cast<char>(c);
+        }
+        return count;
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length) {
+        return readBytes(reinterpret_cast<char *>(buffer), length);
+    }
+};
@@ -0,0 +1,171 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#pragma once
+
+/// @brief Arduino String on top of std::string, implementing the part of the API used by the firmware and ArduinoJson
+class String {
+public:
+    String() = default;
+
+    String(const char *text) : value(text == nullptr ? "" : text) {}
+
+    String(const std::string &text) : value(text) {}
+
+    explicit String(char c) : value(1, c) {}
+
+    explicit String(int number, unsigned char base = 10);
+
+    explicit String(unsigned int number, unsigned char base = 10);
+
+    explicit String(long number, unsigned char base = 10);
+
+    explicit String(unsigned long number, unsigned char base = 10);
+
+    explicit String(float number, unsigned int decimals = 2);
+
+    explicit String(double number, unsigned int decimals = 2);
+
+    const char *c_str() const {
+        return value.c_str();
+    }
+
+    unsigned int length() const {
+        return value.size();
+    }
+
+    bool isEmpty() const {
+        return value.empty();
+    }
+
+    bool reserve(unsigned int size) {
+        value.reserve(size);
+        return true;
+    }
+
+    bool concat(const char *text) {
+        value += text;
+        return true;
+    }
+
+    bool concat(const char *text, unsigned int length) {
+        value.append(text, length);
+        return true;
+    }
+
+    bool concat(const String &text) {
+        value += text.value;
+        return true;
+    }
+
+    bool concat(char c) {
+        value += c;
+        return true;
+    }
+
+    String &operator+=(const String &text) {
+        concat(text);
+        return *this;
+    }
+
+    String &operator+=(const char *text) {
+        concat(text);
+        return *this;
+    }
+
+    String &operator+=(char c) {
+        concat(c);
+        return *this;
+    }
+
+    char operator[](unsigned int index) const {
+        return index < value.size() ? value[index] : '\0';
+    }
+
+    char charAt(unsigned int index) const {
+        return (*this)[index];
+    }
+
+    bool operator==(const String &other) const {
+        return value == other.value;
+    }
+
+    bool operator==(const char *other) const {
+        return value == other;
+    }
+
+    bool operator!=(const String &other) const {
+        return value != other.value;
+    }
+
+    bool operator!=(const char *other) const {
+        return value != other;
+    }
+
+    bool operator<(const String &other) const {
+        return value < other.value;
+    }
+
+    bool equals(const String &other) const {
+        return value == other.value;
+    }
+
+    bool startsWith(const String &prefix) const {
+        return value.compare(0, prefix.value.size(), prefix.value) == 0;
+    }
+
+    bool endsWith(const String &suffix) const {
+        return value.size() >= suffix.value.size() &&
+               value.compare(value.size() - suffix.value.size(), suffix.value.size(), suffix.value) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        auto position = value.find(c, from);
+        return position == std::string::npos ? -1 : static_cast<int>(position);
+    }
+
+    int indexOf(const String &text, unsigned int from = 0) const {
+        auto position = value.find(text.value, from);
+        return position == std::string::npos ? -1 : static_cast<int>(position);
+    }
+
+    String substring(unsigned int from) const {
+        return from < value.size() ? String(value.substr(from)) : String();
+    }
+
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) {
+            std::swap(from, to);
+        }
+        return from < value.size() ? String(value.substr(from, to - from)) : String();
+    }
+
+    void trim();
+
+    long toInt() const {
+        return strtol(value.c_str(), nullptr, 10);
+    }
+
+    float toFloat() const {
+        return strtof(value.c_str(), nullptr);
+    }
+
+    friend String operator+(const String &a, const String &b) {
+        return String(a.value + b.value);
+    }
+
+    friend String operator+(const String &a, const char *b) {
+        return String(a.value + b);
+    }
+
+private:
+    std::string value;
+};
+
+/// @brief Type of String concatenations in the Arduino core, ArduinoJson accepts it wherever it accepts a String
+class StringSumHelper : public String {
+public:
+    using String::String;
+};
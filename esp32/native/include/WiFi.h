@@ -0,0 +1,132 @@
+#include <Arduino.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "WiFiUdp.h"
+
+#pragma once
+
+// the process is "connected" unless POLEKO_LINK_FLAPS takes the access point away, POLEKO_IP sets the address it reports
+// (127.0.0.1 by default)
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} wifi_mode_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_READY = 0,
+    ARDUINO_EVENT_WIFI_STA_START = 2,
+    ARDUINO_EVENT_WIFI_STA_STOP = 3,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP = 8,
+    ARDUINO_EVENT_MAX = 44
+} arduino_event_id_t;
+
+typedef struct {
+    uint8_t reason;
+} arduino_event_info_t;
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+
+typedef uint16_t wifi_event_id_t;
+
+class WiFiClass {
+public:
+    wl_status_t status();
+
+    bool isConnected();
+
+    wl_status_t begin(const char *ssid = nullptr, const char *passphrase = nullptr, int32_t channel = 0,
+                      const uint8_t *bssid = nullptr, bool connect = true);
+
+    bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(),
+                IPAddress dns2 = IPAddress());
+
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+
+    bool reconnect();
+
+    bool setAutoReconnect(bool autoReconnect);
+
+    bool mode(wifi_mode_t mode);
+
+    wifi_mode_t getMode();
+
+    IPAddress localIP();
+
+    IPAddress subnetMask();
+
+    IPAddress gatewayIP();
+
+    IPAddress broadcastIP();
+
+    String macAddress();
+
+    uint8_t *macAddress(uint8_t *mac);
+
+    String SSID();
+
+    String psk();
+
+    uint8_t *BSSID();
+
+    int32_t channel();
+
+    int8_t RSSI();
+
+    wifi_event_id_t onEvent(WiFiEventFuncCb callback, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+
+    void removeEvent(wifi_event_id_t id);
+
+    WiFiClass();
+
+    /// @brief Simulates the station losing (false) or getting back (true) its connection, used to exercise reconnects
+    void simulateConnection(bool connected);
+
+    /// @brief Simulates the access point going away for the given time. The connection drops and association attempts
+    /// fail until it's back.
+    void simulateOutage(unsigned long duration);
+
+private:
+    struct Handler {
+        wifi_event_id_t id;
+        arduino_event_id_t event;
+        WiFiEventFuncCb callback;
+    };
+
+    std::mutex mutex;
+    std::vector<Handler> handlers;
+    wifi_event_id_t nextHandlerId = 1;
+    bool connected = true;
+    bool autoReconnect = true;
+    wifi_mode_t currentMode = WIFI_STA;
+    IPAddress staticIP;
+    IPAddress staticGateway;
+    IPAddress staticSubnet;
+    uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0xAA};
+    // millis() at which the access point is back
+    unsigned long outageEndsAt = 0;
+    // incremented by every association attempt, an attempt that was superseded by a newer one is dropped
+    uint32_t association = 0;
+
+    void associate(bool knownAccessPoint);
+
+    void dispatch(arduino_event_id_t event);
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,69 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <string>
+#include <vector>
+
+#pragma once
+
+// The host has no access point to run a portal on: autoConnect() connects right away and startConfigPortal() returns
+// as if the user submitted the form unchanged.
+
+#define WFM_NO_LABEL 0
+#define WFM_LABEL_BEFORE 1
+#define WFM_LABEL_AFTER 2
+#define WFM_LABEL_DEFAULT 1
+
+class WiFiManagerParameter {
+public:
+    explicit WiFiManagerParameter(const char *custom);
+
+    WiFiManagerParameter(const char *id, const char *label, const char *defaultValue = "", int length = 10,
+                         const char *custom = "", int labelPlacement = WFM_LABEL_DEFAULT);
+
+    virtual ~WiFiManagerParameter() = default;
+
+    const char *getID() const;
+
+    const char *getValue() const;
+
+    const char *getLabel() const;
+
+    int getValueLength() const;
+
+    void setValue(const char *value, int length);
+
+protected:
+    void init(const char *id, const char *label, const char *defaultValue, int length, const char *custom,
+              int labelPlacement);
+
+private:
+    std::string id;
+    std::string label;
+    std::string value;
+    int length = 0;
+};
+
+class WiFiManager {
+public:
+    void setCountry(String country);
+
+    void setConnectTimeout(unsigned long seconds);
+
+    void setConfigPortalTimeout(unsigned long seconds);
+
+    bool autoConnect(const char *apName = nullptr, const char *apPassword = nullptr);
+
+    bool startConfigPortal(const char *apName = nullptr, const char *apPassword = nullptr);
+
+    bool addParameter(WiFiManagerParameter *parameter);
+
+    void setMenu(std::vector<const char *> &menu);
+
+    void reboot();
+
+private:
+    std::vector<WiFiManagerParameter *> parameters;
+    unsigned long connectTimeout = 30;
+
+    bool connect();
+};
@@ -0,0 +1,73 @@
+#include <Arduino.h>
+#include <vector>
+
+#pragma once
+
+/// @brief UDP socket. Ports are shifted by POLEKO_PORT_OFFSET, so that several instances can run on one host and low
+/// ports don't need root.
+class WiFiUDP : public Stream {
+public:
+    WiFiUDP() = default;
+
+    WiFiUDP(const WiFiUDP &) = delete;
+
+    WiFiUDP(WiFiUDP &&other) noexcept;
+
+    WiFiUDP &operator=(const WiFiUDP &) = delete;
+
+    WiFiUDP &operator=(WiFiUDP &&other) noexcept;
+
+    ~WiFiUDP() override;
+
+    uint8_t begin(uint16_t port);
+
+    uint8_t begin(IPAddress address, uint16_t port);
+
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+
+    int beginPacket(const char *host, uint16_t port);
+
+    int endPacket();
+
+    size_t write(uint8_t byte) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+
+    int parsePacket();
+
+    int available() override;
+
+    int read() override;
+
+    int read(unsigned char *buffer, size_t length);
+
+    int read(char *buffer, size_t length);
+
+    int peek() override;
+
+    void flush() override;
+
+    IPAddress remoteIP();
+
+    uint16_t remotePort();
+
+private:
+    int socket = -1;
+    IPAddress destination;
+    uint16_t destinationPort = 0;
+    std::vector<uint8_t> outgoing;
+    std::vector<uint8_t> incoming;
+    size_t incomingPosition = 0;
+    IPAddress sender;
+    uint16_t senderPort = 0;
+
+    bool open();
+};
+
+namespace hal {
+    uint16_t hostPort(uint16_t port);
+}
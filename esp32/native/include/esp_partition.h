@@ -0,0 +1,59 @@
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+// Host implementation of the part of ESP-IDF's partition API the firmware uses
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+/// @brief Operations made on the emulated flash since the start of the process, erases per sector included, so that the
+/// wear levelling of what's stored there can be checked
+struct FlashStats {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t bytesWritten;
+    // the fewest and most times any sector of the partition was erased
+    uint32_t minSectorErases;
+    uint32_t maxSectorErases;
+};
+
+FlashStats flashStats(const esp_partition_t *partition);
+
+/// @brief Finds a data partition of the emulated flash by its label, only the ones in partitions.csv exist. A partition
+/// is backed by a file named after its label, POLEKO_FLASH sets the directory it's in (the working directory by default,
+/// :memory: keeps the partitions in memory only). Like NOR flash, erasing sets whole sectors to 0xFF and writing can only
+/// clear bits.
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
@@ -0,0 +1,22 @@
+#include <cstdint>
+
+#pragma once
+
+// FreeRTOS API used by the firmware, implemented with threads. A tick is 1 ms.
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+struct NativeTask;
+typedef NativeTask *TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define portYIELD_FROM_ISR(...) do {} while (0)
+#define configMAX_PRIORITIES 25
@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdarg>
+#include <malloc.h>
+#include <mutex>
+#include <random>
+#include <semaphore.h>
+#include <thread>
+#include <unistd.h>
+
+// usable heap of an ESP32 running the Arduino core with WiFi started
+constexpr uint32_t SIMULATED_HEAP_SIZE = 300 * 1024;
+// how long a simulated button press holds the pin low
+constexpr uint32_t BUTTON_PRESS_LENGTH = 100;
+constexpr uint8_t PIN_COUNT = 40;
+
+EspClass ESP;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const Clock::time_point startedAt = Clock::now();
+
+    /// @brief Offset of the virtual clock, set with POLEKO_MILLIS_START so that e.g. the millis() overflow can be reached
+    /// without waiting 49 days
+    uint64_t clockOffsetUs() {
+        static const uint64_t offset = []() {
+            auto start = getenv("POLEKO_MILLIS_START");
+            return start == nullptr ? 0 : strtoull(start, nullptr, 10) * 1000;
+        }();
+        return offset;
+    }
+
+    uint64_t elapsedUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startedAt).count() + clockOffsetUs();
+    }
+
+    std::array<std::atomic<uint8_t>, PIN_COUNT> pinValues;
+    // inputs are pulled up, buttons are released
+    [[maybe_unused]] const bool pinsPulledUp = []() {
+        for (auto &value: pinValues) {
+            value = HIGH;
+        }
+        return true;
+    }();
+    std::array<std::atomic<void (*)()>, PIN_COUNT> interruptHandlers{};
+    std::array<std::atomic<int>, PIN_COUNT> interruptModes{};
+
+    std::mutex randomMutex;
+    std::mt19937 generator(std::random_device{}());
+
+    uint32_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        auto info = mallinfo2();
+        return static_cast<uint32_t>(std::min<size_t>(info.uordblks, SIMULATED_HEAP_SIZE));
+#else
+        return 0;
+#endif
+    }
+
+    std::atomic<uint32_t> minFreeHeap{SIMULATED_HEAP_SIZE};
+}
+
+// the device's unsigned long is 32 bits wide, so the clock wraps around at the same point
+
+unsigned long millis() {
+    return static_cast<uint32_t>(elapsedUs() / 1000);
+}
+
+unsigned long micros() {
+    return static_cast<uint32_t>(elapsedUs());
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/// @brief The host's clock is kept in sync by its OS, time() needs nothing else
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2,
+                const char *server3) {}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < PIN_COUNT) {
+        pinValues[pin] = value;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < PIN_COUNT ? pinValues[pin].load() : LOW;
+}
+
+int digitalPinToInterrupt(uint8_t pin) {
+    return pin < PIN_COUNT ? pin : -1;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+    if (pin < PIN_COUNT) {
+        interruptModes[pin] = mode;
+        interruptHandlers[pin] = handler;
+    }
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < PIN_COUNT) {
+        interruptHandlers[pin] = nullptr;
+    }
+}
+
+long random(long max) {
+    return random(0, max);
+}
+
+long random(long min, long max) {
+    if (max <= min) {
+        return min;
+    }
+    std::lock_guard<std::mutex> lock(randomMutex);
+    return std::uniform_int_distribution<long>(min, max - 1)(generator);
+}
+
+namespace hal {
+    /// @brief Pulls the pin low for a moment, calling its interrupt handler like a pressed button would
+    void pressButton(uint8_t pin) {
+        if (pin >= PIN_COUNT) {
+            return;
+        }
+        pinValues[pin] = LOW;
+        auto handler = interruptHandlers[pin].load();
+        if (handler != nullptr && interruptModes[pin] != RISING) {
+            handler();
+        }
+        delay(BUTTON_PRESS_LENGTH);
+        pinValues[pin] = HIGH;
+        if (handler != nullptr && interruptModes[pin] != FALLING) {
+            handler();
+        }
+    }
+}
+
+uint32_t EspClass::getHeapSize() {
+    return SIMULATED_HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    auto free = SIMULATED_HEAP_SIZE - heapInUse();
+    auto lowest = minFreeHeap.load();
+    while (free < lowest && !minFreeHeap.compare_exchange_weak(lowest, free)) {}
+    return free;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    getFreeHeap();
+    return minFreeHeap;
+}
+
+/// @brief The host heap isn't fragmented the way the device's is, the largest block is all the free memory
+uint32_t EspClass::getMaxAllocHeap() {
+    return getFreeHeap();
+}
+
+uint64_t EspClass::getEfuseMac() {
+    return 0x010000000002ull;
+}
+
+/// @brief Restarts the process with the same arguments
+void EspClass::restart() {
+    fflush(stdout);
+    char path[256];
+    auto length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) {
+        path[length] = '\0';
+        char *arguments[] = {path, nullptr};
+        execv(path, arguments);
+    }
+    std::exit(0);
+}
+
+size_t Print::printf(const char *format, ...) {
+    char small[128];
+    va_list arguments;
+    va_start(arguments, format);
+    auto length = vsnprintf(small, sizeof(small), format, arguments);
+    va_end(arguments);
+    if (length < 0) {
+        return 0;
+    }
+    if (static_cast<size_t>(length) < sizeof(small)) {
+        return write(reinterpret_cast<const uint8_t *>(small), length);
+    }
+    std::string large(length + 1, '\0');
+    va_start(arguments, format);
+    vsnprintf(large.data(), large.size(), format, arguments);
+    va_end(arguments);
+    return write(reinterpret_cast<const uint8_t *>(large.data()), length);
+}
+
+// the unit tests have a main() of their own
+#ifndef PIO_UNIT_TESTING
+
+/// @brief Runs the firmware like the Arduino core does. SIGUSR1 presses the BOOT button.
+int main() {
+    // the probe threads are started by static constructors, before the signal could be blocked in every thread, so
+    // the handler only posts a semaphore and the press happens on a thread of its own
+    static sem_t buttonSignal;
+    sem_init(&buttonSignal, 0, 0);
+    struct sigaction action{};
+    action.sa_handler = [](int) { sem_post(&buttonSignal); };
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+    std::thread([]() {
+        while (true) {
+            if (sem_wait(&buttonSignal) == 0) {
+                hal::pressButton(0);
+            }
+        }
+    }).detach();
+
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    setup();
+    while (true) {
+        loop();
+    }
+}
+
+#endif
@@ -0,0 +1,514 @@
+#include <AsyncTCP.h>
+#include <WiFiUdp.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// how often onPoll handlers are called, the real stack polls every two TCP slow timer ticks
+constexpr uint32_t CLIENT_POLL_INTERVAL = 500;
+// upper bound of a single poll(), so that timeouts and onPoll are checked even without traffic
+constexpr int NETWORK_TICK = 100;
+constexpr size_t RECEIVE_BUFFER = 1460;
+
+/// @brief The network thread and the registry of open servers and clients
+class AsyncNetwork {
+public:
+    static AsyncNetwork &instance() {
+        static AsyncNetwork network;
+        return network;
+    }
+
+    std::recursive_mutex mutex;
+    // guarded by mutex
+    AsyncTcpStats stats{};
+
+    void start() {
+        std::call_once(started, [this]() {
+            if (pipe2(wakePipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+                log_e("pipe: %s", strerror(errno));
+                return;
+            }
+            std::thread([this]() { run(); }).detach();
+        });
+    }
+
+    void wake() {
+        if (wakePipe[1] >= 0) {
+            char byte = 0;
+            [[maybe_unused]] auto written = ::write(wakePipe[1], &byte, 1);
+        }
+    }
+
+    void add(AsyncServer *server) {
+        servers.push_back(server);
+        wake();
+    }
+
+    void remove(AsyncServer *server) {
+        std::erase(servers, server);
+    }
+
+    void add(AsyncClient *client) {
+        clients.push_back(client);
+        wake();
+    }
+
+    void remove(AsyncClient *client) {
+        std::erase(clients, client);
+    }
+
+    bool alive(AsyncClient *client) {
+        return std::find(clients.begin(), clients.end(), client) != clients.end();
+    }
+
+    /// @brief Closes the socket and calls the disconnect handler, which may delete the client
+    void disconnect(AsyncClient *client) {
+        if (client->socket < 0) {
+            return;
+        }
+        client->closeSocket();
+        auto handler = client->disconnectHandler;
+        if (handler) {
+            handler(client->disconnectArg, client);
+        }
+    }
+
+    void fail(AsyncClient *client, int error) {
+        auto handler = client->errorHandler;
+        if (handler) {
+            // lwIP's ERR_CONN, the closest to any socket error
+            handler(client->errorArg, client, static_cast<int8_t>(-11));
+        }
+        if (alive(client)) {
+            disconnect(client);
+        }
+    }
+
+    /// @brief Writes the data released by send() and acks what the kernel took
+    void flush(AsyncClient *client) {
+        if (client->socket < 0 || client->pushed == 0) {
+            return;
+        }
+        auto sent = ::send(client->socket, client->pending.data(), client->pushed, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail(client, errno);
+            }
+            return;
+        }
+        client->pending.erase(client->pending.begin(), client->pending.begin() + sent);
+        client->pushed -= sent;
+        stats.writes += sent > 0;
+        auto handler = client->ackHandler;
+        if (handler && sent > 0) {
+            handler(client->ackArg, client, sent, millis() - client->pushedAt);
+        }
+    }
+
+private:
+    int wakePipe[2] = {-1, -1};
+    std::once_flag started;
+    std::vector<AsyncServer *> servers;
+    std::vector<AsyncClient *> clients;
+
+    [[noreturn]] void run() {
+        std::vector<pollfd> descriptors;
+        std::vector<AsyncServer *> polledServers;
+        std::vector<AsyncClient *> polledClients;
+        while (true) {
+            descriptors.clear();
+            polledServers.clear();
+            polledClients.clear();
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                descriptors.push_back({wakePipe[0], POLLIN, 0});
+                for (auto server: servers) {
+                    descriptors.push_back({server->socket, POLLIN, 0});
+                    polledServers.push_back(server);
+                }
+                for (auto client: clients) {
+                    if (client->socket >= 0) {
+                        short events = POLLIN | (client->pushed > 0 ? POLLOUT : 0);
+                        descriptors.push_back({client->socket, events, 0});
+                        polledClients.push_back(client);
+                    }
+                }
+            }
+            poll(descriptors.data(), descriptors.size(), NETWORK_TICK);
+
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (descriptors[0].revents & POLLIN) {
+                char buffer[64];
+                while (::read(wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+            }
+            size_t index = 1;
+            for (auto server: polledServers) {
+                auto &descriptor = descriptors[index++];
+                if ((descriptor.revents & POLLIN) && std::find(servers.begin(), servers.end(), server) != servers.end()) {
+                    accept(server);
+                }
+            }
+            for (auto client: polledClients) {
+                auto &descriptor = descriptors[index++];
+                if (!alive(client) || client->socket != descriptor.fd) {
+                    continue;
+                }
+                if (descriptor.revents & (POLLIN | POLLHUP | POLLERR)) {
+                    receive(client);
+                }
+                if (alive(client) && (descriptor.revents & POLLOUT)) {
+                    flush(client);
+                }
+            }
+            tick();
+        }
+    }
+
+    void accept(AsyncServer *server) {
+        while (true) {
+            auto socket = accept4(server->socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (socket < 0) {
+                return;
+            }
+            auto client = new AsyncClient(socket);
+            client->setNoDelay(server->noDelay);
+            auto handler = server->clientHandler;
+            if (handler) {
+                handler(server->clientArg, client);
+            } else {
+                delete client;
+            }
+        }
+    }
+
+    void receive(AsyncClient *client) {
+        char buffer[RECEIVE_BUFFER];
+        auto received = recv(client->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received > 0) {
+            client->lastRx = millis();
+            auto handler = client->dataHandler;
+            if (handler) {
+                handler(client->dataArg, client, buffer, received);
+            }
+        } else if (received == 0) {
+            disconnect(client);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            fail(client, errno);
+        }
+    }
+
+    /// @brief Fires receive timeouts and onPoll handlers
+    void tick() {
+        auto now = millis();
+        auto snapshot = clients;
+        for (auto client: snapshot) {
+            if (!alive(client) || client->socket < 0) {
+                continue;
+            }
+            if (client->rxTimeout > 0 && now - client->lastRx >= client->rxTimeout * 1000) {
+                auto idle = now - client->lastRx;
+                client->lastRx = now;
+                auto handler = client->timeoutHandler;
+                if (handler) {
+                    handler(client->timeoutArg, client, idle);
+                }
+            }
+            if (alive(client) && client->socket >= 0 && now - client->lastPoll >= CLIENT_POLL_INTERVAL) {
+                client->lastPoll = now;
+                auto handler = client->pollHandler;
+                if (handler) {
+                    handler(client->pollArg, client);
+                }
+            }
+        }
+    }
+};
+
+namespace {
+    IPAddress addressOf(int socket, bool peer, uint16_t *port = nullptr) {
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        auto result = peer ? getpeername(socket, reinterpret_cast<sockaddr *>(&address), &length)
+                           : getsockname(socket, reinterpret_cast<sockaddr *>(&address), &length);
+        if (result < 0) {
+            return {};
+        }
+        if (port != nullptr) {
+            *port = ntohs(address.sin_port);
+        }
+        return IPAddress(static_cast<uint32_t>(address.sin_addr.s_addr));
+    }
+}
+
+AsyncTcpStats asyncTcpStats() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return AsyncNetwork::instance().stats;
+}
+
+AsyncClient::AsyncClient(int socket) : socket(socket), lastRx(millis()), lastPoll(millis()) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    AsyncNetwork::instance().add(this);
+}
+
+AsyncClient::~AsyncClient() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    AsyncNetwork::instance().disconnect(this);
+    AsyncNetwork::instance().remove(this);
+}
+
+bool AsyncClient::connected() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return socket >= 0;
+}
+
+bool AsyncClient::disconnected() {
+    return !connected();
+}
+
+bool AsyncClient::canSend() {
+    return space() > 0;
+}
+
+size_t AsyncClient::space() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return socket < 0 ? 0 : ASYNC_CLIENT_SEND_BUFFER - pending.size();
+}
+
+/// @brief Copies the data to the send buffer, it's written once send() is called
+/// @return Amount of bytes that fit
+size_t AsyncClient::add(const char *data, size_t size, uint8_t apiflags) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket < 0) {
+        return 0;
+    }
+    auto accepted = std::min(size, ASYNC_CLIENT_SEND_BUFFER - pending.size());
+    pending.insert(pending.end(), data, data + accepted);
+    return accepted;
+}
+
+bool AsyncClient::send() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket < 0) {
+        return false;
+    }
+    if (pushed < pending.size()) {
+        auto &stats = AsyncNetwork::instance().stats;
+        auto released = pending.size() - pushed;
+        stats.sends++;
+        stats.segments += (released + ASYNC_TCP_MSS - 1) / ASYNC_TCP_MSS;
+        stats.bytes += released;
+        pushed = pending.size();
+        pushedAt = millis();
+        AsyncNetwork::instance().wake();
+    }
+    return true;
+}
+
+size_t AsyncClient::write(const char *data) {
+    return write(data, strlen(data));
+}
+
+size_t AsyncClient::write(const char *data, size_t size, uint8_t apiflags) {
+    auto accepted = add(data, size, apiflags);
+    if (accepted > 0) {
+        send();
+    }
+    return accepted;
+}
+
+/// @brief Closes the connection and calls the disconnect handler right away, like the real one does. Data released with
+/// send() is written first if the socket takes it.
+void AsyncClient::close(bool now) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket >= 0 && pushed > 0) {
+        ::send(socket, pending.data(), pushed, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    AsyncNetwork::instance().disconnect(this);
+}
+
+void AsyncClient::stop() {
+    close(false);
+}
+
+int8_t AsyncClient::abort() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket >= 0) {
+        // a zero linger time makes close() send RST instead of FIN
+        linger immediate{1, 0};
+        setsockopt(socket, SOL_SOCKET, SO_LINGER, &immediate, sizeof(immediate));
+    }
+    AsyncNetwork::instance().disconnect(this);
+    // ERR_ABRT
+    return -13;
+}
+
+/// @param timeout Seconds without received data after which onTimeout is called, 0 disables it
+void AsyncClient::setRxTimeout(uint32_t timeout) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    rxTimeout = timeout;
+    lastRx = millis();
+}
+
+uint32_t AsyncClient::getRxTimeout() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return rxTimeout;
+}
+
+void AsyncClient::setNoDelay(bool noDelay) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket >= 0) {
+        int value = noDelay;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    }
+}
+
+IPAddress AsyncClient::remoteIP() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return socket < 0 ? IPAddress() : addressOf(socket, true);
+}
+
+uint16_t AsyncClient::remotePort() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    uint16_t port = 0;
+    if (socket >= 0) {
+        addressOf(socket, true, &port);
+    }
+    return port;
+}
+
+IPAddress AsyncClient::localIP() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    return socket < 0 ? IPAddress() : addressOf(socket, false);
+}
+
+uint16_t AsyncClient::localPort() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    uint16_t port = 0;
+    if (socket >= 0) {
+        addressOf(socket, false, &port);
+    }
+    return port;
+}
+
+void AsyncClient::onConnect(AcConnectHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    connectHandler = std::move(handler);
+    connectArg = arg;
+}
+
+void AsyncClient::onDisconnect(AcConnectHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    disconnectHandler = std::move(handler);
+    disconnectArg = arg;
+}
+
+void AsyncClient::onAck(AcAckHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    ackHandler = std::move(handler);
+    ackArg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    errorHandler = std::move(handler);
+    errorArg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    dataHandler = std::move(handler);
+    dataArg = arg;
+}
+
+void AsyncClient::onTimeout(AcTimeoutHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    timeoutHandler = std::move(handler);
+    timeoutArg = arg;
+}
+
+void AsyncClient::onPoll(AcConnectHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    pollHandler = std::move(handler);
+    pollArg = arg;
+}
+
+void AsyncClient::closeSocket() {
+    if (socket >= 0) {
+        ::close(socket);
+        socket = -1;
+    }
+    pending.clear();
+    pushed = 0;
+}
+
+AsyncServer::AsyncServer(uint16_t port) : port(port) {}
+
+AsyncServer::AsyncServer(IPAddress address, uint16_t port) : port(port) {}
+
+AsyncServer::~AsyncServer() {
+    end();
+}
+
+void AsyncServer::onClient(AcConnectHandler handler, void *arg) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    clientHandler = std::move(handler);
+    clientArg = arg;
+}
+
+void AsyncServer::begin() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket >= 0) {
+        return;
+    }
+    AsyncNetwork::instance().start();
+    socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket < 0) {
+        log_e("socket: %s", strerror(errno));
+        return;
+    }
+    int enable = 1;
+    setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(hal::hostPort(port));
+    if (bind(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(socket, 8) < 0) {
+        log_e("listen on port %u: %s", hal::hostPort(port), strerror(errno));
+        ::close(socket);
+        socket = -1;
+        return;
+    }
+    AsyncNetwork::instance().add(this);
+}
+
+void AsyncServer::end() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    if (socket < 0) {
+        return;
+    }
+    AsyncNetwork::instance().remove(this);
+    // the network thread may be polling the socket, which keeps it open past close(); shutting it down stops listening
+    // right away, so that the port can be bound again by the next begin()
+    ::shutdown(socket, SHUT_RDWR);
+    ::close(socket);
+    socket = -1;
+}
+
+void AsyncServer::setNoDelay(bool value) {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    noDelay = value;
+}
+
+uint8_t AsyncServer::status() {
+    std::lock_guard<std::recursive_mutex> lock(AsyncNetwork::instance().mutex);
+    // LISTEN and CLOSED in lwIP's tcp_state
+    return socket >= 0 ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+
+/// @brief A task is a detached thread with a notification counter
+struct NativeTask {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable condition;
+    uint32_t notifications = 0;
+};
+
+namespace {
+    thread_local NativeTask *currentTask = nullptr;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                       UBaseType_t priority, TaskHandle_t *createdTask) {
+    // tasks run for as long as the process does, like on the device
+    auto task = new NativeTask();
+    task->name = name;
+    if (createdTask != nullptr) {
+        *createdTask = task;
+    }
+    std::thread([task, function, parameter]() {
+        currentTask = task;
+        function(parameter);
+    }).detach();
+    return pdPASS;
+}
+
+/// @brief Same as xTaskCreate(), the host scheduler decides where the thread runs
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t coreId) {
+    return xTaskCreate(function, name, stackDepth, parameter, priority, createdTask);
+}
+
+/// @brief Gets the calling thread's task, threads not created by xTaskCreate() (e.g. the main thread) get one on first use
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (currentTask == nullptr) {
+        currentTask = new NativeTask();
+    }
+    return currentTask;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+    auto task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto notified = [task]() { return task->notifications > 0; };
+    if (ticksToWait == portMAX_DELAY) {
+        task->condition.wait(lock, notified);
+    } else {
+        task->condition.wait_for(lock, std::chrono::milliseconds(ticksToWait), notified);
+    }
+    auto count = task->notifications;
+    if (count > 0) {
+        task->notifications = clearCountOnExit ? 0 : count - 1;
+    }
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifications++;
+    }
+    task->condition.notify_one();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+/// @brief Only deleting the calling task (nullptr) is supported, which ends its thread
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr || task == currentTask) {
+        pthread_exit(nullptr);
+    }
+}
@@ -0,0 +1,199 @@
+#include <HardwareSerial.h>
+#include <Arduino.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+// length of the probe's response to {F99RDD}, not including CR LF
+constexpr size_t SIMULATED_FRAME_LENGTH = 94;
+
+HardwareSerial Serial(0);
+
+namespace {
+    /// @brief Picks the value for a UART from a comma-separated list of numbers, the first one is UART 1's. UARTs past the
+    /// end of the list get the last value.
+    int valueForUart(const char *list, int uartNr) {
+        if (list == nullptr) {
+            return 0;
+        }
+        int value = atoi(list);
+        for (int i = 1; i < uartNr; i++) {
+            list = strchr(list, ',');
+            if (list == nullptr) {
+                break;
+            }
+            value = atoi(++list);
+        }
+        return value;
+    }
+}
+
+/// @brief Answers {F99RDD} requests like a HygroClip probe, with humidity and temperature slowly drifting. Setting
+/// POLEKO_PROBE_DROP to a percentage makes the probe ignore that share of requests, POLEKO_PROBE_DELAY to a number of
+/// milliseconds makes it take that long to start answering. Both can be lists giving the probes on UART 1, 2... their own
+/// values, e.g. POLEKO_PROBE_DELAY=0,300,50.
+class SimulatedProbe {
+public:
+    SimulatedProbe(HardwareSerial &serial, int uartNr) : serial(serial), thread([this]() { run(); }) {
+        dropPercentage = valueForUart(getenv("POLEKO_PROBE_DROP"), uartNr);
+        responseDelay = valueForUart(getenv("POLEKO_PROBE_DELAY"), uartNr);
+        // every probe measures a slightly different spot of the chamber
+        humidity += uartNr;
+        temperature += uartNr / 2.0f;
+    }
+
+    ~SimulatedProbe() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+
+    void setBaud(unsigned long rate) {
+        baud = rate == 0 ? 19200 : rate;
+    }
+
+    /// @brief Takes bytes written by the firmware, a line containing the read command triggers a response
+    void write(const uint8_t *data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        line.append(reinterpret_cast<const char *>(data), size);
+        auto command = line.find("{F99RDD}");
+        if (command != std::string::npos) {
+            requests++;
+            line.clear();
+            condition.notify_one();
+        } else if (line.size() > 64) {
+            line.erase(0, line.size() - 16);
+        }
+    }
+
+private:
+    HardwareSerial &serial;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::string line;
+    unsigned requests = 0;
+    bool stopping = false;
+    int dropPercentage = 0;
+    int responseDelay = 0;
+    std::atomic<unsigned long> baud{19200};
+    float humidity = 45.0f;
+    float temperature = 22.5f;
+    std::thread thread;
+
+    void run() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || requests > 0; });
+                if (stopping) {
+                    return;
+                }
+                requests--;
+            }
+            if (random(100) < dropPercentage) {
+                continue;
+            }
+            auto frame = nextFrame();
+            // 10 bits per byte on the wire
+            std::this_thread::sleep_for(std::chrono::milliseconds(responseDelay) +
+                                        std::chrono::microseconds(frame.size() * 10 * 1000000 / baud));
+            serial.receive(frame.data(), frame.size());
+        }
+    }
+
+    std::string nextFrame() {
+        humidity = std::clamp(humidity + random(-20, 21) / 100.0f, 5.0f, 95.0f);
+        temperature = std::clamp(temperature + random(-10, 11) / 100.0f, -20.0f, 50.0f);
+        char buffer[SIMULATED_FRAME_LENGTH + 1];
+        snprintf(buffer, sizeof(buffer), "{F00rdd 001;%6.2f;%%rh;000;=;%6.2f;'C;000;=;nc;---.-;'C;000; ;001;V1.7-1;0060568338;",
+                 humidity, temperature);
+        std::string frame(buffer);
+        // the rest of the response identifies the probe, it only has to keep the length right
+        frame.resize(SIMULATED_FRAME_LENGTH - 1, ' ');
+        frame += '}';
+        frame += "\r\n";
+        return frame;
+    }
+};
+
+HardwareSerial::HardwareSerial(int uartNr) : uartNr(uartNr) {}
+
+HardwareSerial::~HardwareSerial() = default;
+
+void HardwareSerial::begin(unsigned long baudRate, uint32_t config, int8_t rxPin, int8_t txPin) {
+    baud = baudRate;
+    if (uartNr != 0 && !probe) {
+        probe = std::make_unique<SimulatedProbe>(*this, uartNr);
+    }
+    if (probe) {
+        probe->setBaud(baud);
+    }
+}
+
+void HardwareSerial::end() {
+    probe.reset();
+}
+
+/// @brief Sets the function called (from the simulated device's thread) when bytes arrive
+void HardwareSerial::onReceive(std::function<void()> callback, bool onlyOnTimeout) {
+    std::lock_guard<std::mutex> lock(mutex);
+    receiveCallback = std::move(callback);
+}
+
+int HardwareSerial::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<int>(received.size());
+}
+
+int HardwareSerial::read() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (received.empty()) {
+        return -1;
+    }
+    auto c = static_cast<uint8_t>(received.front());
+    received.pop_front();
+    return c;
+}
+
+int HardwareSerial::peek() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return received.empty() ? -1 : static_cast<uint8_t>(received.front());
+}
+
+size_t HardwareSerial::write(uint8_t byte) {
+    return write(&byte, 1);
+}
+
+/// @brief Writes to stdout for the console port, or to the simulated probe
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    if (uartNr == 0) {
+        return fwrite(buffer, 1, size, stdout);
+    }
+    if (probe) {
+        probe->write(buffer, size);
+    }
+    return size;
+}
+
+void HardwareSerial::flush() {
+    if (uartNr == 0) {
+        fflush(stdout);
+    }
+}
+
+void HardwareSerial::receive(const char *data, size_t length) {
+    std::function<void()> callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        received.insert(received.end(), data, data + length);
+        callback = receiveCallback;
+    }
+    if (callback) {
+        callback();
+    }
+}
@@ -0,0 +1,375 @@
+#include <Preferences.h>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// the default NVS partition has room for about this many entries
+constexpr size_t NVS_ENTRIES = 630;
+// NVS limits keys and namespaces to 15 characters
+constexpr size_t NVS_KEY_LENGTH = 15;
+
+namespace {
+    struct Entry {
+        PreferenceType type;
+        std::vector<uint8_t> value;
+    };
+
+    using Namespace = std::map<std::string, Entry>;
+
+    std::recursive_mutex storeMutex;
+    NvsStats stats{};
+
+    const char *storePath() {
+        auto path = getenv("POLEKO_NVS");
+        return path == nullptr ? "nvs.bin" : path;
+    }
+
+    bool inMemory() {
+        return strcmp(storePath(), ":memory:") == 0;
+    }
+
+    /// @brief Every namespace, loaded from the file on first use. The file holds records of
+    /// [namespace length, namespace, key length, key, type, value length (4 bytes), value].
+    std::map<std::string, Namespace> &store() {
+        static std::map<std::string, Namespace> namespaces = []() {
+            std::map<std::string, Namespace> loaded;
+            if (inMemory()) {
+                return loaded;
+            }
+            auto file = fopen(storePath(), "rb");
+            if (file == nullptr) {
+                return loaded;
+            }
+            while (true) {
+                uint8_t length;
+                std::string name, key;
+                if (fread(&length, 1, 1, file) != 1) {
+                    break;
+                }
+                name.resize(length);
+                if (fread(name.data(), 1, length, file) != length || fread(&length, 1, 1, file) != 1) {
+                    break;
+                }
+                key.resize(length);
+                uint8_t type;
+                uint32_t size;
+                if (fread(key.data(), 1, length, file) != length || fread(&type, 1, 1, file) != 1 ||
+                    fread(&size, sizeof(size), 1, file) != 1) {
+                    break;
+                }
+                Entry entry{static_cast<PreferenceType>(type), std::vector<uint8_t>(size)};
+                if (fread(entry.value.data(), 1, size, file) != size) {
+                    break;
+                }
+                loaded[name][key] = std::move(entry);
+            }
+            fclose(file);
+            return loaded;
+        }();
+        return namespaces;
+    }
+
+    /// @brief Writes every namespace to a temporary file and renames it over the store, so that a crash can't leave a
+    /// half written one behind
+    bool commit() {
+        if (inMemory()) {
+            return true;
+        }
+        std::string temporary = std::string(storePath()) + ".tmp";
+        auto file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            log_e("can't write %s", temporary.c_str());
+            return false;
+        }
+        for (auto &[name, entries]: store()) {
+            for (auto &[key, entry]: entries) {
+                uint8_t nameLength = name.size();
+                uint8_t keyLength = key.size();
+                uint8_t type = entry.type;
+                uint32_t size = entry.value.size();
+                fwrite(&nameLength, 1, 1, file);
+                fwrite(name.data(), 1, nameLength, file);
+                fwrite(&keyLength, 1, 1, file);
+                fwrite(key.data(), 1, keyLength, file);
+                fwrite(&type, 1, 1, file);
+                fwrite(&size, sizeof(size), 1, file);
+                fwrite(entry.value.data(), 1, size, file);
+            }
+        }
+        auto ok = fclose(file) == 0;
+        return ok && rename(temporary.c_str(), storePath()) == 0;
+    }
+
+    size_t entryCount() {
+        size_t count = 0;
+        for (auto &[name, entries]: store()) {
+            count += entries.size();
+        }
+        return count;
+    }
+}
+
+NvsStats nvsStats() {
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    return stats;
+}
+
+bool Preferences::begin(const char *namespaceName, bool openReadOnly, const char *partitionLabel) {
+    if (started || namespaceName == nullptr || strlen(namespaceName) > NVS_KEY_LENGTH) {
+        return false;
+    }
+    name = namespaceName;
+    readOnly = openReadOnly;
+    started = true;
+    return true;
+}
+
+void Preferences::end() {
+    started = false;
+}
+
+bool Preferences::clear() {
+    if (!started || readOnly) {
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    stats.erases += store()[name].size();
+    store().erase(name);
+    return commit();
+}
+
+bool Preferences::remove(const char *key) {
+    if (!started || readOnly || key == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    if (entries.erase(key) == 0) {
+        return false;
+    }
+    stats.erases++;
+    return commit();
+}
+
+size_t Preferences::putRaw(const char *key, PreferenceType type, const void *value, size_t length) {
+    if (!started || readOnly || key == nullptr || strlen(key) > NVS_KEY_LENGTH) {
+        return 0;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    if (!entries.contains(key) && entryCount() >= NVS_ENTRIES) {
+        return 0;
+    }
+    auto bytes = static_cast<const uint8_t *>(value);
+    entries[key] = Entry{type, std::vector<uint8_t>(bytes, bytes + length)};
+    stats.writes++;
+    return commit() ? length : 0;
+}
+
+template<typename T>
+size_t Preferences::put(const char *key, PreferenceType type, T value) {
+    return putRaw(key, type, &value, sizeof(value));
+}
+
+/// @brief Reads a value stored with the same type, like NVS, a value stored as another type is treated as missing
+template<typename T>
+T Preferences::get(const char *key, PreferenceType type, T defaultValue) {
+    if (!started || key == nullptr) {
+        return defaultValue;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    auto entry = entries.find(key);
+    if (entry == entries.end() || entry->second.type != type || entry->second.value.size() != sizeof(T)) {
+        return defaultValue;
+    }
+    T value;
+    memcpy(&value, entry->second.value.data(), sizeof(T));
+    return value;
+}
+
+size_t Preferences::putChar(const char *key, int8_t value) {
+    return put(key, PT_I8, value);
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value) {
+    return put(key, PT_U8, value);
+}
+
+size_t Preferences::putShort(const char *key, int16_t value) {
+    return put(key, PT_I16, value);
+}
+
+size_t Preferences::putUShort(const char *key, uint16_t value) {
+    return put(key, PT_U16, value);
+}
+
+size_t Preferences::putInt(const char *key, int32_t value) {
+    return put(key, PT_I32, value);
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value) {
+    return put(key, PT_U32, value);
+}
+
+size_t Preferences::putLong(const char *key, int32_t value) {
+    return put(key, PT_I32, value);
+}
+
+size_t Preferences::putULong(const char *key, uint32_t value) {
+    return put(key, PT_U32, value);
+}
+
+size_t Preferences::putLong64(const char *key, int64_t value) {
+    return put(key, PT_I64, value);
+}
+
+size_t Preferences::putULong64(const char *key, uint64_t value) {
+    return put(key, PT_U64, value);
+}
+
+size_t Preferences::putFloat(const char *key, float value) {
+    return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putDouble(const char *key, double value) {
+    return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putBool(const char *key, bool value) {
+    return putUChar(key, value);
+}
+
+size_t Preferences::putString(const char *key, const char *value) {
+    return putRaw(key, PT_STR, value, strlen(value));
+}
+
+size_t Preferences::putString(const char *key, const String &value) {
+    return putString(key, value.c_str());
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+    return putRaw(key, PT_BLOB, value, length);
+}
+
+bool Preferences::isKey(const char *key) {
+    return getType(key) != PT_INVALID;
+}
+
+PreferenceType Preferences::getType(const char *key) {
+    if (!started || key == nullptr) {
+        return PT_INVALID;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    auto entry = entries.find(key);
+    return entry == entries.end() ? PT_INVALID : entry->second.type;
+}
+
+size_t Preferences::freeEntries() {
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    return NVS_ENTRIES - std::min(entryCount(), NVS_ENTRIES);
+}
+
+int8_t Preferences::getChar(const char *key, int8_t defaultValue) {
+    return get(key, PT_I8, defaultValue);
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+    return get(key, PT_U8, defaultValue);
+}
+
+int16_t Preferences::getShort(const char *key, int16_t defaultValue) {
+    return get(key, PT_I16, defaultValue);
+}
+
+uint16_t Preferences::getUShort(const char *key, uint16_t defaultValue) {
+    return get(key, PT_U16, defaultValue);
+}
+
+int32_t Preferences::getInt(const char *key, int32_t defaultValue) {
+    return get(key, PT_I32, defaultValue);
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) {
+    return get(key, PT_U32, defaultValue);
+}
+
+int32_t Preferences::getLong(const char *key, int32_t defaultValue) {
+    return get(key, PT_I32, defaultValue);
+}
+
+uint32_t Preferences::getULong(const char *key, uint32_t defaultValue) {
+    return get(key, PT_U32, defaultValue);
+}
+
+int64_t Preferences::getLong64(const char *key, int64_t defaultValue) {
+    return get(key, PT_I64, defaultValue);
+}
+
+uint64_t Preferences::getULong64(const char *key, uint64_t defaultValue) {
+    return get(key, PT_U64, defaultValue);
+}
+
+float Preferences::getFloat(const char *key, float defaultValue) {
+    float value;
+    return getBytesLength(key) == sizeof(value) && getBytes(key, &value, sizeof(value)) ? value : defaultValue;
+}
+
+double Preferences::getDouble(const char *key, double defaultValue) {
+    double value;
+    return getBytesLength(key) == sizeof(value) && getBytes(key, &value, sizeof(value)) ? value : defaultValue;
+}
+
+bool Preferences::getBool(const char *key, bool defaultValue) {
+    return getUChar(key, defaultValue) != 0;
+}
+
+/// @return Length of the string including the terminator, 0 if it's missing or doesn't fit
+size_t Preferences::getString(const char *key, char *value, size_t maxLength) {
+    auto text = getString(key, String());
+    if (!isKey(key) || text.length() + 1 > maxLength) {
+        return 0;
+    }
+    memcpy(value, text.c_str(), text.length() + 1);
+    return text.length() + 1;
+}
+
+String Preferences::getString(const char *key, String defaultValue) {
+    if (!started || key == nullptr) {
+        return defaultValue;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    auto entry = entries.find(key);
+    if (entry == entries.end() || entry->second.type != PT_STR) {
+        return defaultValue;
+    }
+    return String(std::string(entry->second.value.begin(), entry->second.value.end()).c_str());
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!started || key == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    auto entry = entries.find(key);
+    return entry == entries.end() || entry->second.type != PT_BLOB ? 0 : entry->second.value.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLength) {
+    if (!started || key == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::recursive_mutex> lock(storeMutex);
+    auto &entries = store()[name];
+    auto entry = entries.find(key);
+    if (entry == entries.end() || entry->second.type != PT_BLOB || entry->second.value.size() > maxLength) {
+        return 0;
+    }
+    memcpy(buffer, entry->second.value.data(), entry->second.value.size());
+    return entry->second.value.size();
+}
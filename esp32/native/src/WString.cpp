@@ -0,0 +1,96 @@
+#include "WString.h"
+#include "IPAddress.h"
+#include <cstdio>
+
+namespace {
+    std::string toBase(unsigned long number, unsigned char base, bool negative) {
+        if (base < 2 || base > 36) {
+            base = 10;
+        }
+        std::string digits;
+        do {
+            auto digit = number % base;
+            digits.insert(digits.begin(), static_cast<char>(digit < 10 ? '0' + digit : 'a' + digit - 10));
+            number /= base;
+        } while (number > 0);
+        if (negative) {
+            digits.insert(digits.begin(), '-');
+        }
+        return digits;
+    }
+}
+
+String::String(int number, unsigned char base) : String(static_cast<long>(number), base) {}
+
+String::String(unsigned int number, unsigned char base) : String(static_cast<unsigned long>(number), base) {}
+
+String::String(long number, unsigned char base) {
+    bool negative = number < 0 && base == 10;
+    value = toBase(negative ? -static_cast<unsigned long>(number) : static_cast<unsigned long>(number), base, negative);
+}
+
+String::String(unsigned long number, unsigned char base) : value(toBase(number, base, false)) {}
+
+String::String(float number, unsigned int decimals) : String(static_cast<double>(number), decimals) {}
+
+String::String(double number, unsigned int decimals) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(decimals), number);
+    value = buffer;
+}
+
+void String::trim() {
+    auto first = value.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        value.clear();
+        return;
+    }
+    auto last = value.find_last_not_of(" \t\r\n");
+    value = value.substr(first, last - first + 1);
+}
+
+IPAddress::IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth)
+        : address(first | (second << 8) | (third << 16) | (static_cast<uint32_t>(fourth) << 24)) {}
+
+/// @brief Parses a dotted decimal address, the address is left unchanged if the text isn't one
+bool IPAddress::fromString(const char *text) {
+    uint32_t parsed = 0;
+    uint32_t octet = 0;
+    int octets = 0;
+    int digits = 0;
+    for (auto c = text;; c++) {
+        if (*c >= '0' && *c <= '9') {
+            octet = octet * 10 + (*c - '0');
+            if (++digits > 3 || octet > 255) {
+                return false;
+            }
+        } else if (*c == '.' || *c == '\0') {
+            if (digits == 0 || octets == 4) {
+                return false;
+            }
+            parsed |= octet << (octets++ * 8);
+            octet = 0;
+            digits = 0;
+            if (*c == '\0') {
+                break;
+            }
+        } else {
+            return false;
+        }
+    }
+    if (octets != 4) {
+        return false;
+    }
+    address = parsed;
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buffer);
+}
+
+size_t IPAddress::printTo(Print &print) const {
+    return print.print(toString());
+}
@@ -0,0 +1,427 @@
+#include <WiFi.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+// largest datagram the real stack would send without fragmenting
+constexpr size_t MAX_UDP_PAYLOAD = 1460;
+
+// time it takes to associate with an access point whose BSSID and channel are known, and one that has to be scanned for
+constexpr unsigned long KNOWN_AP_ASSOCIATION_TIME = 100;
+constexpr unsigned long SCAN_ASSOCIATION_TIME = 2000;
+
+WiFiClass WiFi;
+
+namespace hal {
+    /// @brief Port the host actually binds, POLEKO_PORT_OFFSET is added to every port the firmware uses
+    uint16_t hostPort(uint16_t port) {
+        static const uint16_t offset = []() {
+            auto value = getenv("POLEKO_PORT_OFFSET");
+            return value == nullptr ? 0 : static_cast<uint16_t>(strtoul(value, nullptr, 10));
+        }();
+        return port + offset;
+    }
+}
+
+namespace {
+    IPAddress configuredIP() {
+        static const IPAddress ip = []() {
+            IPAddress address(127, 0, 0, 1);
+            auto value = getenv("POLEKO_IP");
+            if (value != nullptr) {
+                address.fromString(value);
+            }
+            return address;
+        }();
+        return ip;
+    }
+
+    sockaddr_in toSockaddr(IPAddress ip, uint16_t port) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        // IPAddress keeps the first octet in the lowest byte, which is the network order on a little endian host
+        address.sin_addr.s_addr = static_cast<uint32_t>(ip);
+        address.sin_port = htons(port);
+        return address;
+    }
+}
+
+/// @brief Plays the link flaps scripted by POLEKO_LINK_FLAPS, a comma separated list of at:duration pairs in ms (the time
+/// since the start of the process and how long the access point is gone for), e.g. 10000:1500,30000:20000
+WiFiClass::WiFiClass() {
+    auto script = getenv("POLEKO_LINK_FLAPS");
+    if (script == nullptr) {
+        return;
+    }
+    std::vector<std::pair<unsigned long, unsigned long>> flaps;
+    for (auto position = script; *position != '\0';) {
+        char *end;
+        auto at = strtoul(position, &end, 10);
+        if (*end != ':') {
+            break;
+        }
+        auto duration = strtoul(end + 1, &end, 10);
+        flaps.emplace_back(at, duration);
+        position = *end == ',' ? end + 1 : end;
+    }
+    std::thread([this, flaps = std::move(flaps)]() {
+        auto start = std::chrono::steady_clock::now();
+        for (auto [at, duration]: flaps) {
+            std::this_thread::sleep_until(start + std::chrono::milliseconds(at));
+            log_i("link flap: access point gone for %lu ms", duration);
+            simulateOutage(duration);
+        }
+    }).detach();
+}
+
+wl_status_t WiFiClass::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return connected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+bool WiFiClass::isConnected() {
+    return status() == WL_CONNECTED;
+}
+
+/// @brief Starts associating like the real driver, in the background. It takes KNOWN_AP_ASSOCIATION_TIME with the BSSID
+/// and channel given and SCAN_ASSOCIATION_TIME without them, then fails if the access point is gone.
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid,
+                             bool connect) {
+    if (connect) {
+        associate(bssid != nullptr && channel > 0);
+    }
+    return status();
+}
+
+bool WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+    std::lock_guard<std::mutex> lock(mutex);
+    staticIP = localIP;
+    staticGateway = gateway;
+    staticSubnet = subnet;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+    simulateConnection(false);
+    return true;
+}
+
+bool WiFiClass::reconnect() {
+    associate(false);
+    return true;
+}
+
+bool WiFiClass::setAutoReconnect(bool value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    autoReconnect = value;
+    return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    currentMode = value;
+    return true;
+}
+
+wifi_mode_t WiFiClass::getMode() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return currentMode;
+}
+
+/// @brief Always the host's address, a static IP saved in the settings is stored but can't be applied to the host
+IPAddress WiFiClass::localIP() {
+    return configuredIP();
+}
+
+IPAddress WiFiClass::subnetMask() {
+    return {255, 0, 0, 0};
+}
+
+IPAddress WiFiClass::gatewayIP() {
+    return configuredIP();
+}
+
+IPAddress WiFiClass::broadcastIP() {
+    return {255, 255, 255, 255};
+}
+
+String WiFiClass::macAddress() {
+    return "02:00:00:00:00:01";
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac) {
+    const uint8_t address[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    memcpy(mac, address, sizeof(address));
+    return mac;
+}
+
+String WiFiClass::SSID() {
+    return "native";
+}
+
+String WiFiClass::psk() {
+    return "";
+}
+
+uint8_t *WiFiClass::BSSID() {
+    return bssid;
+}
+
+int32_t WiFiClass::channel() {
+    return 1;
+}
+
+int8_t WiFiClass::RSSI() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return connected ? static_cast<int8_t>(-50 - random(10)) : 0;
+}
+
+wifi_event_id_t WiFiClass::onEvent(WiFiEventFuncCb callback, arduino_event_id_t event) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto id = nextHandlerId++;
+    handlers.push_back({id, event, std::move(callback)});
+    return id;
+}
+
+void WiFiClass::removeEvent(wifi_event_id_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::erase_if(handlers, [id](const Handler &handler) { return handler.id == id; });
+}
+
+void WiFiClass::simulateConnection(bool value) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (connected == value) {
+            return;
+        }
+        connected = value;
+    }
+    if (value) {
+        dispatch(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+        dispatch(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    } else {
+        dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+}
+
+void WiFiClass::simulateOutage(unsigned long duration) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outageEndsAt = millis() + duration;
+    }
+    simulateConnection(false);
+}
+
+void WiFiClass::associate(bool knownAccessPoint) {
+    uint32_t attempt;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (connected) {
+            return;
+        }
+        attempt = ++association;
+    }
+    std::thread([this, attempt, knownAccessPoint]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(knownAccessPoint ? KNOWN_AP_ASSOCIATION_TIME
+                                                                               : SCAN_ASSOCIATION_TIME));
+        bool reachable;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (attempt != association) {
+                return;
+            }
+            reachable = static_cast<long>(millis() - outageEndsAt) >= 0;
+        }
+        if (reachable) {
+            simulateConnection(true);
+        } else {
+            // the driver reports a failed association as a disconnection
+            dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        }
+    }).detach();
+}
+
+void WiFiClass::dispatch(arduino_event_id_t event) {
+    std::vector<Handler> matching;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &handler: handlers) {
+            if (handler.event == event || handler.event == ARDUINO_EVENT_MAX) {
+                matching.push_back(handler);
+            }
+        }
+    }
+    // the real events are delivered from the event task, a thread stands in for it
+    std::thread([matching = std::move(matching), event]() {
+        for (auto &handler: matching) {
+            handler.callback(event, arduino_event_info_t{});
+        }
+    }).detach();
+}
+
+WiFiUDP::WiFiUDP(WiFiUDP &&other) noexcept: socket(other.socket) {
+    other.socket = -1;
+}
+
+WiFiUDP &WiFiUDP::operator=(WiFiUDP &&other) noexcept {
+    if (this != &other) {
+        stop();
+        socket = other.socket;
+        other.socket = -1;
+    }
+    return *this;
+}
+
+WiFiUDP::~WiFiUDP() {
+    stop();
+}
+
+bool WiFiUDP::open() {
+    if (socket >= 0) {
+        return true;
+    }
+    socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket < 0) {
+        log_e("socket: %s", strerror(errno));
+        return false;
+    }
+    int enable = 1;
+    setsockopt(socket, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    return true;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    return begin(IPAddress(0u), port);
+}
+
+/// @brief Binds the socket to the port. The address is ignored, so that broadcasts sent to the port are received on
+/// every interface, like on the device which only has one.
+uint8_t WiFiUDP::begin(IPAddress address, uint16_t port) {
+    stop();
+    if (!open()) {
+        return 0;
+    }
+    auto local = toSockaddr(IPAddress(0u), hal::hostPort(port));
+    if (bind(socket, reinterpret_cast<sockaddr *>(&local), sizeof(local)) < 0) {
+        log_e("bind to port %u: %s", hal::hostPort(port), strerror(errno));
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    if (socket >= 0) {
+        close(socket);
+        socket = -1;
+    }
+    outgoing.clear();
+    incoming.clear();
+    incomingPosition = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    if (!open()) {
+        return 0;
+    }
+    destination = ip;
+    destinationPort = hal::hostPort(port);
+    outgoing.clear();
+    return 1;
+}
+
+int WiFiUDP::beginPacket(const char *host, uint16_t port) {
+    IPAddress ip;
+    if (!ip.fromString(host)) {
+        return 0;
+    }
+    return beginPacket(ip, port);
+}
+
+int WiFiUDP::endPacket() {
+    if (socket < 0) {
+        return 0;
+    }
+    auto address = toSockaddr(destination, destinationPort);
+    auto sent = sendto(socket, outgoing.data(), outgoing.size(), 0, reinterpret_cast<sockaddr *>(&address),
+                       sizeof(address));
+    outgoing.clear();
+    return sent < 0 ? 0 : 1;
+}
+
+size_t WiFiUDP::write(uint8_t byte) {
+    return write(&byte, 1);
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size) {
+    auto accepted = std::min(size, MAX_UDP_PAYLOAD - outgoing.size());
+    outgoing.insert(outgoing.end(), buffer, buffer + accepted);
+    return accepted;
+}
+
+/// @brief Reads the next datagram, if there is one
+/// @return Its size or 0
+int WiFiUDP::parsePacket() {
+    incoming.clear();
+    incomingPosition = 0;
+    if (socket < 0) {
+        return 0;
+    }
+    incoming.resize(MAX_UDP_PAYLOAD);
+    sockaddr_in from{};
+    socklen_t fromLength = sizeof(from);
+    auto received = recvfrom(socket, incoming.data(), incoming.size(), 0, reinterpret_cast<sockaddr *>(&from),
+                             &fromLength);
+    if (received <= 0) {
+        incoming.clear();
+        return 0;
+    }
+    incoming.resize(received);
+    sender = IPAddress(from.sin_addr.s_addr);
+    senderPort = ntohs(from.sin_port);
+    return static_cast<int>(received);
+}
+
+int WiFiUDP::available() {
+    return static_cast<int>(incoming.size() - incomingPosition);
+}
+
+int WiFiUDP::read() {
+    return incomingPosition < incoming.size() ? incoming[incomingPosition++] : -1;
+}
+
+int WiFiUDP::read(unsigned char *buffer, size_t length) {
+    auto count = std::min(length, incoming.size() - incomingPosition);
+    memcpy(buffer, incoming.data() + incomingPosition, count);
+    incomingPosition += count;
+    return static_cast<int>(count);
+}
+
+int WiFiUDP::read(char *buffer, size_t length) {
+    return read(reinterpret_cast<unsigned char *>(buffer), length);
+}
+
+int WiFiUDP::peek() {
+    return incomingPosition < incoming.size() ? incoming[incomingPosition] : -1;
+}
+
+void WiFiUDP::flush() {
+    incoming.clear();
+    incomingPosition = 0;
+}
+
+IPAddress WiFiUDP::remoteIP() {
+    return sender;
+}
+
+/// @brief Sender's port with POLEKO_PORT_OFFSET subtracted, so that replying to it with beginPacket() reaches the sender
+uint16_t WiFiUDP::remotePort() {
+    return static_cast<uint16_t>(senderPort - hal::hostPort(0));
+}
@@ -0,0 +1,80 @@
+#include <WiFiManager.h>
+
+WiFiManagerParameter::WiFiManagerParameter(const char *custom) {
+    init(nullptr, nullptr, nullptr, 0, custom, WFM_LABEL_DEFAULT);
+}
+
+WiFiManagerParameter::WiFiManagerParameter(const char *id, const char *label, const char *defaultValue, int length,
+                                           const char *custom, int labelPlacement) {
+    init(id, label, defaultValue, length, custom, labelPlacement);
+}
+
+void WiFiManagerParameter::init(const char *newId, const char *newLabel, const char *defaultValue, int newLength,
+                                const char *custom, int labelPlacement) {
+    id = newId == nullptr ? "" : newId;
+    label = newLabel == nullptr ? "" : newLabel;
+    length = newLength;
+    setValue(defaultValue, newLength);
+}
+
+const char *WiFiManagerParameter::getID() const {
+    return id.c_str();
+}
+
+const char *WiFiManagerParameter::getValue() const {
+    return value.c_str();
+}
+
+const char *WiFiManagerParameter::getLabel() const {
+    return label.c_str();
+}
+
+int WiFiManagerParameter::getValueLength() const {
+    return length;
+}
+
+/// @brief Stores the value cut to the parameter's length, like the form field does
+void WiFiManagerParameter::setValue(const char *newValue, int maxLength) {
+    value = newValue == nullptr ? "" : newValue;
+    if (maxLength >= 0 && value.size() > static_cast<size_t>(maxLength)) {
+        value.resize(maxLength);
+    }
+}
+
+void WiFiManager::setCountry(String country) {}
+
+void WiFiManager::setConnectTimeout(unsigned long seconds) {
+    connectTimeout = seconds;
+}
+
+void WiFiManager::setConfigPortalTimeout(unsigned long seconds) {}
+
+bool WiFiManager::autoConnect(const char *apName, const char *apPassword) {
+    return connect();
+}
+
+bool WiFiManager::startConfigPortal(const char *apName, const char *apPassword) {
+    log_i("configuration portal requested, the native build keeps the current settings");
+    return connect();
+}
+
+/// @brief Associates and waits for the result for the connect timeout, like the library does
+bool WiFiManager::connect() {
+    WiFi.begin();
+    auto startedAt = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - startedAt < connectTimeout * 1000) {
+        delay(10);
+    }
+    return WiFi.status() == WL_CONNECTED;
+}
+
+bool WiFiManager::addParameter(WiFiManagerParameter *parameter) {
+    parameters.push_back(parameter);
+    return true;
+}
+
+void WiFiManager::setMenu(std::vector<const char *> &menu) {}
+
+void WiFiManager::reboot() {
+    ESP.restart();
+}
@@ -0,0 +1,166 @@
+#include <esp_partition.h>
+#include <Arduino.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the ESP32's flash is erased in sectors of this size
+constexpr uint32_t FLASH_SECTOR_SIZE = 4096;
+
+namespace {
+    /// @brief An emulated partition: its contents, the file they're written through to and the erases of each sector
+    struct Partition {
+        esp_partition_t info;
+        std::vector<uint8_t> data;
+        FILE *file = nullptr;
+        FlashStats stats{};
+        std::vector<uint32_t> sectorErases;
+    };
+
+    // the data partitions of partitions.csv
+    Partition partitions[] = {
+            {{ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(0x40), 0x290000, 0x170000,
+              FLASH_SECTOR_SIZE, "history", false}},
+    };
+
+    std::mutex flashMutex;
+
+    const char *flashDirectory() {
+        auto path = getenv("POLEKO_FLASH");
+        return path == nullptr ? "." : path;
+    }
+
+    bool inMemory() {
+        return strcmp(flashDirectory(), ":memory:") == 0;
+    }
+
+    /// @brief Loads the partition from its file the first time it's found. A missing or shorter file reads as erased
+    /// flash, like a freshly flashed device.
+    void open(Partition &partition) {
+        if (!partition.data.empty()) {
+            return;
+        }
+        partition.data.assign(partition.info.size, 0xFF);
+        partition.sectorErases.assign(partition.info.size / FLASH_SECTOR_SIZE, 0);
+        if (inMemory()) {
+            return;
+        }
+        auto path = std::string(flashDirectory()) + "/" + partition.info.label + ".bin";
+        partition.file = fopen(path.c_str(), "r+b");
+        if (partition.file != nullptr) {
+            auto read = fread(partition.data.data(), 1, partition.data.size(), partition.file);
+            std::fill(partition.data.begin() + read, partition.data.end(), 0xFF);
+        } else {
+            partition.file = fopen(path.c_str(), "w+b");
+        }
+        if (partition.file == nullptr) {
+            log_e("can't open %s, the %s partition is kept in memory only", path.c_str(), partition.info.label);
+            return;
+        }
+        // the whole image is written once, so that later writes can seek anywhere in it
+        fseek(partition.file, 0, SEEK_SET);
+        fwrite(partition.data.data(), 1, partition.data.size(), partition.file);
+        fflush(partition.file);
+    }
+
+    Partition *find(const esp_partition_t *info) {
+        for (auto &partition: partitions) {
+            if (&partition.info == info) {
+                return &partition;
+            }
+        }
+        return nullptr;
+    }
+
+    void writeThrough(Partition &partition, size_t offset, size_t size) {
+        if (partition.file == nullptr) {
+            return;
+        }
+        fseek(partition.file, static_cast<long>(offset), SEEK_SET);
+        fwrite(partition.data.data() + offset, 1, size, partition.file);
+        fflush(partition.file);
+    }
+}
+
+FlashStats flashStats(const esp_partition_t *info) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    auto partition = find(info);
+    if (partition == nullptr) {
+        return {};
+    }
+    auto stats = partition->stats;
+    auto [least, most] = std::minmax_element(partition->sectorErases.begin(), partition->sectorErases.end());
+    stats.minSectorErases = *least;
+    stats.maxSectorErases = *most;
+    return stats;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    for (auto &partition: partitions) {
+        if (partition.info.type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.info.subtype == subtype) &&
+            (label == nullptr || strcmp(partition.info.label, label) == 0)) {
+            open(partition);
+            return &partition.info;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *info, size_t src_offset, void *dst, size_t size) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    auto partition = find(info);
+    if (partition == nullptr || dst == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (src_offset > info->size || size > info->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, partition->data.data() + src_offset, size);
+    partition->stats.reads++;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *info, size_t dst_offset, const void *src, size_t size) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    auto partition = find(info);
+    if (partition == nullptr || src == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dst_offset > info->size || size > info->size - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // programming flash can only turn ones into zeroes
+    auto bytes = static_cast<const uint8_t *>(src);
+    for (size_t i = 0; i < size; i++) {
+        partition->data[dst_offset + i] &= bytes[i];
+    }
+    partition->stats.writes++;
+    partition->stats.bytesWritten += size;
+    writeThrough(*partition, dst_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *info, size_t offset, size_t size) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    auto partition = find(info);
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset % FLASH_SECTOR_SIZE != 0 || size % FLASH_SECTOR_SIZE != 0 || offset > info->size ||
+        size > info->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    std::fill_n(partition->data.begin() + offset, size, 0xFF);
+    for (auto sector = offset / FLASH_SECTOR_SIZE; sector < (offset + size) / FLASH_SECTOR_SIZE; sector++) {
+        partition->sectorErases[sector]++;
+        partition->stats.erases++;
+    }
+    writeThrough(*partition, offset, size);
+    return ESP_OK;
+}
@@ -0,0 +1,239 @@
+#include "CommandParser.h"
+
+namespace {
+    bool isWhitespace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    /// @brief Reads strings and scalars of a flat JSON object
+    class Scanner {
+    public:
+        explicit Scanner(std::string_view text) : text(text) {}
+
+        void skipWhitespace() {
+            while (position < text.size() && isWhitespace(text[position])) {
+                position++;
+            }
+        }
+
+        bool consume(char c) {
+            skipWhitespace();
+            if (position < text.size() && text[position] == c) {
+                position++;
+                return true;
+            }
+            return false;
+        }
+
+        bool atEnd() {
+            skipWhitespace();
+            return position == text.size();
+        }
+
+        /// @brief Reads a string without escape sequences, which no command needs
+        bool string(std::string_view &out) {
+            if (!consume('"')) {
+                return false;
+            }
+            auto start = position;
+            while (position < text.size() && text[position] != '"') {
+                auto c = static_cast<unsigned char>(text[position]);
+                if (c == '\\' || c < 0x20) {
+                    return false;
+                }
+                position++;
+            }
+            if (position == text.size()) {
+                return false;
+            }
+            out = text.substr(start, position - start);
+            position++;
+            return true;
+        }
+
+        bool value(CommandField &field) {
+            skipWhitespace();
+            if (position == text.size()) {
+                return false;
+            }
+            auto c = text[position];
+            if (c == '"') {
+                field.type = CommandValueType::String;
+                return string(field.value);
+            }
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                field.type = CommandValueType::Number;
+                return number(field.value);
+            }
+            for (auto literal: {std::string_view("true"), std::string_view("false"), std::string_view("null")}) {
+                if (text.substr(position, literal.size()) == literal) {
+                    field.type = literal == "null" ? CommandValueType::Null : CommandValueType::Bool;
+                    field.value = text.substr(position, literal.size());
+                    position += literal.size();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::string_view text;
+        size_t position = 0;
+
+        /// @brief Reads a number in the JSON syntax (optional minus, digits, optional fraction and exponent)
+        bool number(std::string_view &out) {
+            auto start = position;
+            if (text[position] == '-') {
+                position++;
+            }
+            if (digits() == 0) {
+                return false;
+            }
+            if (position < text.size() && text[position] == '.') {
+                position++;
+                if (digits() == 0) {
+                    return false;
+                }
+            }
+            if (position < text.size() && (text[position] == 'e' || text[position] == 'E')) {
+                position++;
+                if (position < text.size() && (text[position] == '+' || text[position] == '-')) {
+                    position++;
+                }
+                if (digits() == 0) {
+                    return false;
+                }
+            }
+            out = text.substr(start, position - start);
+            return true;
+        }
+
+        size_t digits() {
+            auto start = position;
+            while (position < text.size() && text[position] >= '0' && text[position] <= '9') {
+                position++;
+            }
+            return position - start;
+        }
+    };
+}
+
+/// @brief Gets the value as a non-negative integer
+/// @return false if it isn't a number, has a fraction or exponent, or doesn't fit in 32 bits
+bool CommandField::toUnsigned(uint32_t &out) const {
+    if (type != CommandValueType::Number || value.empty() || value.size() > 10) {
+        return false;
+    }
+    uint64_t parsed = 0;
+    for (auto c: value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        parsed = parsed * 10 + (c - '0');
+    }
+    if (parsed > UINT32_MAX) {
+        return false;
+    }
+    out = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+bool CommandField::toBool(bool &out) const {
+    if (type != CommandValueType::Bool) {
+        return false;
+    }
+    out = value == "true";
+    return true;
+}
+
+/// @brief Parses the command. Keys repeated in the object are kept, find() returns the first one.
+/// @return false if it isn't a flat JSON object or has more than MAX_COMMAND_FIELDS keys
+bool Command::parse(std::string_view text) {
+    count = 0;
+    Scanner scanner(text);
+    if (!scanner.consume('{')) {
+        return false;
+    }
+    if (scanner.consume('}')) {
+        return scanner.atEnd();
+    }
+    do {
+        if (count == fields.size()) {
+            return false;
+        }
+        auto &field = fields[count];
+        if (!scanner.string(field.key) || !scanner.consume(':') || !scanner.value(field)) {
+            return false;
+        }
+        count++;
+    } while (scanner.consume(','));
+    return scanner.consume('}') && scanner.atEnd();
+}
+
+size_t Command::size() const {
+    return count;
+}
+
+const CommandField &Command::operator[](size_t index) const {
+    return fields[index];
+}
+
+/// @return The field with the key or nullptr if there's none
+const CommandField *Command::find(std::string_view key) const {
+    for (size_t i = 0; i < count; i++) {
+        if (fields[i].key == key) {
+            return &fields[i];
+        }
+    }
+    return nullptr;
+}
+
+void CommandFramer::reset() {
+    used = 0;
+    depth = 0;
+    inString = false;
+    escaped = false;
+    discarding = false;
+}
+
+/// @brief Adds a byte to the command that's being collected
+/// @return true if the byte completed a command
+bool CommandFramer::consume(char c) {
+    // a newline always ends a command, even inside a string (JSON strings can't hold a raw newline), so that a malformed
+    // one, e.g. with an unterminated string, can't swallow the ones following it
+    if (c == '\n') {
+        return used > 0 || discarding;
+    }
+    if (used == 0 && !discarding && isWhitespace(c)) {
+        return false;
+    }
+
+    bool complete = false;
+    if (inString) {
+        if (escaped) {
+            escaped = false;
+        } else if (c == '\\') {
+            escaped = true;
+        } else if (c == '"') {
+            inString = false;
+        }
+    } else if (c == '"') {
+        inString = true;
+    } else if (c == '{' || c == '[') {
+        // deeper nesting than any command has only happens with garbage, which ends at the next newline anyway
+        if (depth < UINT8_MAX) {
+            depth++;
+        }
+    } else if ((c == '}' || c == ']') && depth > 0) {
+        complete = --depth == 0;
+    }
+
+    if (!discarding) {
+        if (used == buffer.size()) {
+            discarding = true;
+        } else {
+            buffer[used++] = c;
+        }
+    }
+    return complete;
+}
@@ -0,0 +1,161 @@
+#include "Connectivity.h"
+#include <algorithm>
+#include <cstring>
+#include "Metrics.h"
+#include "Log.h"
+#include "WiFiHelpers.h"
+
+// every few attempts the network is scanned, in case the cached access point is gone or the device moved to another one
+constexpr uint32_t WIFI_SCAN_EVERY = 4;
+
+Connectivity::Connectivity(unsigned long portalTimeout) : portalTimeout(portalTimeout) {}
+
+/// @brief Starts following the link. Must be called once the device connected for the first time, as the access point it
+/// connected to is the one it reconnects to.
+void Connectivity::begin() {
+    // reconnecting is done here, so that the driver's own attempts don't interrupt ours
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+        if (changeCallback) {
+            changeCallback();
+        }
+    }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+        if (changeCallback) {
+            changeCallback();
+        }
+    }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    state = WiFi.status() == WL_CONNECTED ? LinkState::Connected : LinkState::Reconnecting;
+    lostAt = millis();
+    if (state == LinkState::Connected) {
+        cacheAccessPoint();
+    }
+}
+
+/// @brief Follows the link's state: starts reconnecting when it drops, makes the reconnect attempts and reports the recovery.
+/// Calls the portal callback once the link was down for longer than the portal timeout. The LED is on while the link is up.
+void Connectivity::loop() {
+    auto now = millis();
+    bool connected = WiFi.status() == WL_CONNECTED;
+    switch (state) {
+        case LinkState::Connected:
+            if (connected) {
+                return;
+            }
+            LOG_WARNING("WiFi connection lost, reconnecting in the background");
+            metrics.wifiDisconnects.increment();
+            digitalWrite(LED_PIN, LOW);
+            state = LinkState::Reconnecting;
+            lostAt = now;
+            attempts = 0;
+            attemptInterval = WIFI_RECONNECT_INTERVAL;
+            // the driver might still be associating, the first attempt is only made if it doesn't manage it right away
+            nextAttemptAt = now + WIFI_RECONNECT_INTERVAL;
+            return;
+        case LinkState::Reconnecting:
+            if (connected) {
+                auto downtime = now - lostAt;
+                LOG_INFO("WiFi reconnected after %lu ms and %u attempts", downtime, attempts);
+                metrics.wifiRecoveryTime.observe(downtime);
+                digitalWrite(LED_PIN, HIGH);
+                state = LinkState::Connected;
+                cacheAccessPoint();
+                if (reconnectedCallback) {
+                    reconnectedCallback(downtime);
+                }
+                return;
+            }
+            if (now - lostAt >= portalTimeout) {
+                LOG_WARNING("WiFi not reconnected in %lu ms, opening the configuration portal", portalTimeout);
+                state = LinkState::Portal;
+                if (portalCallback) {
+                    portalCallback();
+                }
+                return;
+            }
+            if (static_cast<long>(now - nextAttemptAt) >= 0) {
+                attemptReconnect();
+                nextAttemptAt = now + attemptInterval;
+                attemptInterval = std::min(attemptInterval * 2, WIFI_MAX_RECONNECT_INTERVAL);
+            }
+            return;
+        case LinkState::Portal:
+            // the portal returned, with or without a connection, services were restarted by it
+            state = connected ? LinkState::Connected : LinkState::Reconnecting;
+            digitalWrite(LED_PIN, connected ? HIGH : LOW);
+            lostAt = now;
+            attempts = 0;
+            attemptInterval = WIFI_RECONNECT_INTERVAL;
+            nextAttemptAt = now;
+            if (connected) {
+                cacheAccessPoint();
+            }
+            return;
+    }
+}
+
+/// @brief Gets the time of the next reconnect attempt or of the portal fallback, whichever is sooner
+/// @return false while connected, changes are reported by the onChange() callback then
+bool Connectivity::nextDeadline(uint32_t &deadline) {
+    if (state == LinkState::Connected) {
+        return false;
+    }
+    if (state == LinkState::Portal) {
+        deadline = millis();
+        return true;
+    }
+    auto portalAt = lostAt + portalTimeout;
+    deadline = static_cast<long>(nextAttemptAt - portalAt) < 0 ? nextAttemptAt : portalAt;
+    return true;
+}
+
+/// @brief Sets the function called (from the WiFi event task) when the link goes up or down. loop() should be called soon
+/// after.
+void Connectivity::onChange(void (*callback)()) {
+    changeCallback = callback;
+}
+
+/// @brief Sets the function called by loop() when the link is back up after a drop, with the time it was down for in ms.
+/// Connections and buffered readings survived it, clients can catch up on what they missed by sequence number.
+void Connectivity::onReconnected(void (*callback)(unsigned long downtime)) {
+    reconnectedCallback = callback;
+}
+
+/// @brief Sets the function called by loop() when the link wasn't reconnected in time, it should open the configuration
+/// portal. loop() picks the state up again once it returns.
+void Connectivity::onPortalNeeded(void (*callback)()) {
+    portalCallback = callback;
+}
+
+LinkState Connectivity::getState() const {
+    return state;
+}
+
+/// @brief Remembers the access point the device is connected to, so that it can reconnect to it without a scan
+void Connectivity::cacheAccessPoint() {
+    auto connectedBssid = WiFi.BSSID();
+    ssid = WiFi.SSID();
+    passphrase = WiFi.psk();
+    channel = WiFi.channel();
+    accessPointCached = connectedBssid != nullptr && channel > 0;
+    if (accessPointCached) {
+        memcpy(bssid, connectedBssid, sizeof(bssid));
+    }
+}
+
+/// @brief Starts associating with the cached access point, or with any access point of the network every few attempts.
+/// Doesn't wait for the result, loop() sees it.
+void Connectivity::attemptReconnect() {
+    attempts++;
+    if (ssid.length() == 0) {
+        WiFi.reconnect();
+        return;
+    }
+    bool scan = !accessPointCached || attempts % WIFI_SCAN_EVERY == 0;
+    LOG_DEBUG("WiFi reconnect attempt %u%s", attempts, scan ? " with a scan" : "");
+    if (scan) {
+        WiFi.begin(ssid.c_str(), passphrase.c_str());
+    } else {
+        WiFi.begin(ssid.c_str(), passphrase.c_str(), channel, bssid);
+    }
+}
@@ -1,31 +1,43 @@
 #include "EspUDPServer.h"
+#include "Metrics.h"
+#include "Log.h"
 
-// instance variable is required because the timer handle is static, so there's a lot of shenanigans involving static methods
-EspUDPServer* EspUDPServer::instance = nullptr;
+// time between the first broadcasts after boot or an address change in milliseconds, doubled after every broadcast
+constexpr unsigned long BURST_INTERVAL = 1000;
+// time between two broadcasts once the burst is over in milliseconds
+constexpr unsigned long STEADY_INTERVAL = 60000;
+// time between two checks for discovery queries in milliseconds
+constexpr unsigned long QUERY_POLL_INTERVAL = 500;
+// minimum time between two replies to discovery queries in milliseconds, so that a flood of queries can't turn the
+// device into a traffic amplifier
+constexpr unsigned long REPLY_INTERVAL = 50;
+// sent by the monitoring app to make every device announce itself right away
+constexpr char DISCOVERY_QUERY[] = "{\"discover\":true}";
+constexpr size_t DISCOVERY_QUERY_LENGTH = sizeof(DISCOVERY_QUERY) - 1;
 
-EspUDPServer::EspUDPServer() : udp(WiFiUDP()), timer(ESP32Timer(0)) {
-    instance = this;
-}
+/// @param probes Amount of probes the device has, announced so that the monitoring app knows which ids to expect
+EspUDPServer::EspUDPServer(uint8_t probes) : probes(probes), udp(WiFiUDP()) {}
 
-/// @brief Sets up a UDP server periodically broadcasting sensor data (IP and MAC addresses) in the network. Must be used in the setup() function in
-/// main.cpp. You must also include the EspUDPServer::loop() function in loop() in main.cpp.
+/// @brief Sets up a UDP server announcing the sensor (IP and MAC addresses, amount of probes) in the network: a burst of broadcasts
+/// with growing intervals after it starts or its address changes, then one every STEADY_INTERVAL, and a reply to every
+/// discovery query. Must be used in the setup() function in main.cpp. You must also include the EspUDPServer::loop()
+/// function in loop() in main.cpp.
 /// @param port Port to use (5506 by default)
 void EspUDPServer::setup(unsigned short port) {
     if (started) {
         return;
     }
-    if (!stopped) {
-        udp.begin(WiFi.localIP(), port);
-        timer.attachInterrupt(0.2, timerHandle);
-        log_e("UDP set up");
-    } else {
+    if (stopped) {
         udp = WiFiUDP();
-        udp.begin(WiFi.localIP(), port);
-        timer.reattachInterrupt();
-        log_e("UDP set up");
         stopped = false;
     }
+    this->port = port;
+    udp.begin(WiFi.localIP(), port);
+    buildBeacon();
+    restartBurst();
+    lastPolledAt = millis();
     started = true;
+    LOG_INFO("UDP set up");
 }
 
 /// @brief Stops the UDP server.
@@ -34,37 +46,89 @@ void EspUDPServer::stop() {
         return;
     }
     udp.stop();
-    timer.detachInterrupt();
     stopped = true;
     started = false;
-    log_e("UDP stopped");
+    LOG_INFO("UDP stopped");
 }
 
-/// @brief Listens for timer flag changes. Must be used in loop() function in main.cpp. You must also include 
-/// the EspUDPServer::setup() function in setup() in main.cpp.
+/// @brief Answers discovery queries and broadcasts a packet if the interval passed. Must be used in loop() function in
+/// main.cpp. You must also include the EspUDPServer::setup() function in setup() in main.cpp.
 void EspUDPServer::loop() {
-    if (!instance->stopped) {
-        if (timerFlag) {
-            timerFlag = false;
-            sendPacket();
-        }
+    if (!started) {
+        return;
+    }
+    if (rebuildRequested.load(std::memory_order_acquire)) {
+        buildBeacon();
+        restartBurst();
+    }
+    if (millis() - lastPolledAt >= QUERY_POLL_INTERVAL) {
+        lastPolledAt = millis();
+        answerQueries();
+    }
+    if (millis() - lastSentAt >= interval) {
+        lastSentAt = millis();
+        sendPacket();
+        interval = interval == 0 ? BURST_INTERVAL : std::min(interval * 2, STEADY_INTERVAL);
     }
 }
 
-/// @brief Hardware timer handle
-bool EspUDPServer::timerHandle(void *_) {
-    instance->timerFlag = true;
-    return true;
+/// @brief Gets the time at which the next packet is due or the socket has to be checked for queries
+/// @return Time in milliseconds, as returned by millis()
+unsigned long EspUDPServer::nextDeadline() const {
+    auto now = millis();
+    auto untilBroadcast = interval - std::min(now - lastSentAt, interval);
+    auto untilPoll = QUERY_POLL_INTERVAL - std::min(now - lastPolledAt, QUERY_POLL_INTERVAL);
+    return now + std::min(untilBroadcast, untilPoll);
 }
 
 /// @brief Broadcasts a packet that includes sensor's IP and MAC addresses
 void EspUDPServer::sendPacket() {
-    udp.beginPacket(IPAddress(255, 255, 255, 255), 5506);
-    JsonDocument doc;
-    doc["ip"] = WiFi.localIP();
-    doc["mac"] = WiFi.macAddress();
-    String interfaceInfo;
-    serializeJson(doc, interfaceInfo);
-    udp.printf(interfaceInfo.c_str());
+    udp.beginPacket(IPAddress(255, 255, 255, 255), port);
+    udp.write(reinterpret_cast<const uint8_t *>(beacon), beaconLength);
     udp.endPacket();
-}
\ No newline at end of file
+    metrics.udpBeacons.increment();
+}
+
+/// @brief Makes the server rebuild the beacon and start a new burst. Can be called from any task, e.g. by the handler
+/// of the WiFi got-IP event.
+void EspUDPServer::addressChanged() {
+    rebuildRequested.store(true, std::memory_order_release);
+}
+
+/// @brief Serializes the addresses and the amount of probes into the beacon, which is only done when they change instead of for every packet
+void EspUDPServer::buildBeacon() {
+    rebuildRequested.store(false, std::memory_order_relaxed);
+    auto ip = WiFi.localIP();
+    auto mac = WiFi.macAddress();
+    auto length = snprintf(beacon, sizeof(beacon), R"({"ip":"%u.%u.%u.%u","mac":"%s","probes":%u})", ip[0], ip[1], ip[2],
+                           ip[3], mac.c_str(), probes);
+    beaconLength = std::min(static_cast<size_t>(std::max(length, 0)), sizeof(beacon) - 1);
+}
+
+/// @brief Schedules a broadcast right away, followed by ones with intervals doubling up to STEADY_INTERVAL
+void EspUDPServer::restartBurst() {
+    interval = 0;
+    lastSentAt = millis();
+}
+
+/// @brief Reads the datagrams received since the last check and unicasts the beacon to the sender of every discovery
+/// query. Other datagrams, e.g. other devices' broadcasts, are skipped.
+void EspUDPServer::answerQueries() {
+    char query[DISCOVERY_QUERY_LENGTH];
+    int size;
+    while ((size = udp.parsePacket()) > 0) {
+        if (size != static_cast<int>(DISCOVERY_QUERY_LENGTH) ||
+            udp.read(query, sizeof(query)) != static_cast<int>(DISCOVERY_QUERY_LENGTH) ||
+            memcmp(query, DISCOVERY_QUERY, DISCOVERY_QUERY_LENGTH) != 0) {
+            continue;
+        }
+        if (millis() - lastRepliedAt < REPLY_INTERVAL) {
+            continue;
+        }
+        lastRepliedAt = millis();
+        udp.beginPacket(udp.remoteIP(), udp.remotePort());
+        udp.write(reinterpret_cast<const uint8_t *>(beacon), beaconLength);
+        udp.endPacket();
+        metrics.udpDiscoveryReplies.increment();
+    }
+}
@@ -0,0 +1,164 @@
+#include "EventLoop.h"
+#include "Metrics.h"
+#include <algorithm>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+
+namespace {
+    uint32_t millis() {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t micros() {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+}
+#endif
+
+// the loop wakes up at least this often even with nothing scheduled, so a lost wakeup can't stall it for good
+constexpr uint32_t MAX_SLEEP = 1000;
+
+/// @brief Binds the loop to the calling task, which is the one that will be woken up by posted events. Must be called from
+/// the task that calls runOnce().
+void EventLoop::begin() {
+#ifdef ARDUINO
+    task = xTaskGetCurrentTaskHandle();
+#endif
+}
+
+/// @brief Sets the function called when the event is dispatched. Handlers run on the loop's task and must not block.
+void EventLoop::on(Event event, Handler handler) {
+    handlers[static_cast<size_t>(event)] = handler;
+}
+
+/// @brief Posts an event from a task (including the loop's own handlers and AsyncTCP/WiFi callbacks)
+void EventLoop::post(Event event) {
+    if (markPending(event)) {
+        wake();
+    }
+}
+
+/// @brief Posts an event from an interrupt service routine
+void ARDUINO_ISR_ATTR EventLoop::postFromISR(Event event) {
+    if (markPending(event)) {
+        wakeFromISR();
+    }
+}
+
+/// @brief Makes the event fire at the given time, replacing the previously set time. Only to be used from the loop's task.
+/// @param deadline Time in milliseconds, as returned by millis()
+void EventLoop::setTimer(Event event, uint32_t deadline) {
+    auto id = static_cast<uint16_t>(event);
+    timers.cancel(id);
+    timers.schedule(id, deadline);
+}
+
+/// @brief Removes the event's timer. Only to be used from the loop's task.
+void EventLoop::cancelTimer(Event event) {
+    timers.cancel(static_cast<uint16_t>(event));
+}
+
+/// @brief Sleeps until an event is posted or the earliest timer expires, then dispatches every pending event.
+/// Must be used in loop() function in main.cpp.
+void EventLoop::runOnce() {
+    if (pending.load(std::memory_order_acquire) == 0) {
+        uint32_t timeout = MAX_SLEEP;
+        uint32_t deadline;
+        if (timers.nextDeadline(deadline)) {
+            auto remaining = static_cast<int32_t>(deadline - millis());
+            timeout = remaining <= 0 ? 0 : std::min<uint32_t>(remaining, MAX_SLEEP);
+        }
+        if (timeout > 0) {
+            wait(timeout);
+        }
+    }
+    stats.wakeups++;
+    uint32_t wokeAt = micros();
+
+    uint16_t id;
+    uint32_t deadline;
+    auto now = millis();
+    while (timers.popDue(now, id, deadline)) {
+        markPending(static_cast<Event>(id));
+    }
+
+    auto events = pending.exchange(0, std::memory_order_acq_rel);
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        if (!(events & (1u << i))) {
+            continue;
+        }
+        uint32_t latency = micros() - postedAt[i].load(std::memory_order_relaxed);
+        stats.maxLatencyUs = std::max(stats.maxLatencyUs, latency);
+        stats.totalLatencyUs += latency;
+        stats.dispatched++;
+        if (handlers[i]) {
+            handlers[i]();
+        }
+    }
+    metrics.loopTime.observe(micros() - wokeAt);
+}
+
+const EventLoopStats &EventLoop::getStats() const {
+    return stats;
+}
+
+/// @brief Marks the event as pending
+/// @return false if it already was, in which case there's no need to wake the loop up
+bool EventLoop::markPending(Event event) {
+    auto bit = 1u << static_cast<size_t>(event);
+    // the time is only stored for the first post, so that latency is measured from the oldest one
+    if (!(pending.load(std::memory_order_relaxed) & bit)) {
+        postedAt[static_cast<size_t>(event)].store(micros(), std::memory_order_relaxed);
+    }
+    return !(pending.fetch_or(bit, std::memory_order_acq_rel) & bit);
+}
+
+#ifdef ARDUINO
+
+void EventLoop::wait(uint32_t timeoutMs) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+}
+
+void EventLoop::wake() {
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void ARDUINO_ISR_ATTR EventLoop::wakeFromISR() {
+    if (!task) {
+        return;
+    }
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+#else
+
+void EventLoop::wait(uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return woken; });
+    woken = false;
+}
+
+void EventLoop::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = true;
+    }
+    condition.notify_one();
+}
+
+void EventLoop::wakeFromISR() {
+    wake();
+}
+
+#endif
@@ -0,0 +1,233 @@
+#include "HTTPRequest.h"
+#include <algorithm>
+
+namespace {
+    bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            auto x = a[i] >= 'A' && a[i] <= 'Z' ? a[i] + ('a' - 'A') : a[i];
+            auto y = b[i] >= 'A' && b[i] <= 'Z' ? b[i] + ('a' - 'A') : b[i];
+            if (x != y) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string_view trim(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    /// @brief Checks whether a comma separated header value like "keep-alive, Upgrade" contains the token
+    bool hasToken(std::string_view value, std::string_view token) {
+        while (!value.empty()) {
+            auto comma = value.find(',');
+            if (equalsIgnoreCase(trim(value.substr(0, comma)), token)) {
+                return true;
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            value.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+}
+
+/// @brief Prepares the parser for the next request on the same connection
+void HTTPRequestParser::reset() {
+    requestLineLength = 0;
+    used = 0;
+    stage = Stage::RequestLine;
+    state = HTTPParseState::Incomplete;
+    errorStatus = 0;
+    method = HTTPMethod::Other;
+    path = {};
+    query = {};
+    persistent = false;
+    bodyRemaining = 0;
+}
+
+/// @brief Consumes bytes of the request. Stops at the end of the request, so that the bytes of a pipelined request that
+/// follows can be pushed again after reset().
+/// @param data Received bytes
+/// @param length Amount of received bytes
+/// @return Amount of bytes consumed
+size_t HTTPRequestParser::push(const char *data, size_t length) {
+    size_t consumed = 0;
+    while (consumed < length && state == HTTPParseState::Incomplete) {
+        if (stage == Stage::Body) {
+            auto skipped = std::min(bodyRemaining, length - consumed);
+            bodyRemaining -= skipped;
+            consumed += skipped;
+            if (bodyRemaining == 0) {
+                stage = Stage::Done;
+                state = HTTPParseState::Complete;
+            }
+            continue;
+        }
+
+        char c = data[consumed++];
+        if (c != '\n') {
+            if (used == buffer.size()) {
+                fail(stage == Stage::RequestLine ? 414 : 431);
+                break;
+            }
+            buffer[used++] = c;
+            continue;
+        }
+
+        auto lineStart = stage == Stage::RequestLine ? 0 : requestLineLength;
+        auto lineEnd = used > lineStart && buffer[used - 1] == '\r' ? used - 1 : used;
+        std::string_view line(buffer.data() + lineStart, lineEnd - lineStart);
+        if (stage == Stage::RequestLine) {
+            // empty lines before the request line are allowed by RFC 9112
+            if (line.empty()) {
+                used = 0;
+                continue;
+            }
+            requestLineLength = used;
+            if (!parseRequestLine(line)) {
+                break;
+            }
+            stage = Stage::Headers;
+        } else if (line.empty()) {
+            if (bodyRemaining > 0) {
+                stage = Stage::Body;
+            } else {
+                stage = Stage::Done;
+                state = HTTPParseState::Complete;
+            }
+        } else {
+            if (!parseHeader(line)) {
+                break;
+            }
+            // the header isn't needed anymore, the next line can overwrite it
+            used = requestLineLength;
+        }
+    }
+    return consumed;
+}
+
+HTTPParseState HTTPRequestParser::getState() const {
+    return state;
+}
+
+/// @brief Gets the status code the server should respond with when parsing failed
+unsigned short HTTPRequestParser::getErrorStatus() const {
+    return errorStatus;
+}
+
+HTTPMethod HTTPRequestParser::getMethod() const {
+    return method;
+}
+
+/// @brief Gets the path of the request target, e.g. "/reading" for "/reading?probe=1". Valid until reset().
+std::string_view HTTPRequestParser::getPath() const {
+    return path;
+}
+
+/// @brief Gets the query of the request target without the "?", empty if there's none. Valid until reset().
+std::string_view HTTPRequestParser::getQuery() const {
+    return query;
+}
+
+/// @brief Checks whether the connection should stay open after responding. HTTP/1.1 connections are persistent unless the
+/// client sent "Connection: close", HTTP/1.0 ones only if it sent "Connection: keep-alive".
+bool HTTPRequestParser::keepAlive() const {
+    return persistent;
+}
+
+bool HTTPRequestParser::parseRequestLine(std::string_view line) {
+    auto firstSpace = line.find(' ');
+    auto lastSpace = line.rfind(' ');
+    if (firstSpace == std::string_view::npos || firstSpace == lastSpace) {
+        fail(400);
+        return false;
+    }
+    auto methodName = line.substr(0, firstSpace);
+    auto target = line.substr(firstSpace + 1, lastSpace - firstSpace - 1);
+    auto version = line.substr(lastSpace + 1);
+
+    if (methodName == "GET") {
+        method = HTTPMethod::Get;
+    } else if (methodName == "HEAD") {
+        method = HTTPMethod::Head;
+    }
+
+    if (version == "HTTP/1.1") {
+        persistent = true;
+    } else if (version == "HTTP/1.0") {
+        persistent = false;
+    } else {
+        fail(version.substr(0, 5) == "HTTP/" ? 505 : 400);
+        return false;
+    }
+
+    if (target.empty() || target.front() != '/') {
+        fail(400);
+        return false;
+    }
+    auto questionMark = target.find('?');
+    path = target.substr(0, questionMark);
+    if (questionMark != std::string_view::npos) {
+        query = target.substr(questionMark + 1);
+    }
+    return true;
+}
+
+bool HTTPRequestParser::parseHeader(std::string_view line) {
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        fail(400);
+        return false;
+    }
+    auto name = line.substr(0, colon);
+    auto value = trim(line.substr(colon + 1));
+
+    if (equalsIgnoreCase(name, "Connection")) {
+        if (hasToken(value, "close")) {
+            persistent = false;
+        } else if (hasToken(value, "keep-alive")) {
+            persistent = true;
+        }
+    } else if (equalsIgnoreCase(name, "Content-Length")) {
+        size_t length = 0;
+        if (value.empty()) {
+            fail(400);
+            return false;
+        }
+        for (auto c: value) {
+            // nothing the server handles has a body, anything longer than the buffer is refused instead of skipped
+            if (c < '0' || c > '9' || length > HTTP_REQUEST_BUFFER) {
+                fail(c < '0' || c > '9' ? 400 : 413);
+                return false;
+            }
+            length = length * 10 + (c - '0');
+        }
+        if (length > HTTP_REQUEST_BUFFER) {
+            fail(413);
+            return false;
+        }
+        bodyRemaining = length;
+    } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+        // a chunked body can't be skipped without decoding it
+        fail(501);
+        return false;
+    }
+    return true;
+}
+
+void HTTPRequestParser::fail(unsigned short status) {
+    errorStatus = status;
+    state = HTTPParseState::Failed;
+    persistent = false;
+}
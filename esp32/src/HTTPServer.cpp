@@ -1,18 +1,167 @@
 #include "HTTPServer.h"
-#include <ArduinoJson.h>
+#include <WiFi.h>
+#include <algorithm>
+#include <climits>
+#include "TCPServer.h"
+#include "Log.h"
 
-HTTPServer::HTTPServer(Sensor &sensor) : server(WiFiServer(80)), sensor(sensor) {}
+// the status line and headers, the body is queued separately
+constexpr size_t HTTP_HEADER_BUFFER = 256;
+// /reading and /status are small JSON documents
+constexpr size_t HTTP_BODY_BUFFER = 512;
+// /metrics and /log, has to stay below HTTP_QUEUE_MAX_BYTES, metrics and log lines that don't fit are left out
+constexpr size_t HTTP_TEXT_BUFFER = 6144;
+// a whole /metrics response has to fit in a connection's queue, the histograms alone take a few KB
+constexpr size_t HTTP_QUEUE_MAX_BYTES = 8192;
+// room a /history chunk leaves in front of its CSV for the size line
+constexpr size_t HTTP_CHUNK_PREFIX = 8;
+// longest CSV line of a /history row, the time, probe and both values at their widest
+constexpr size_t HTTP_HISTORY_LINE = sizeof("4294967295,3,-327.68,-327.68\n");
+static_assert(HTTP_CHUNK_PREFIX + HTTP_HISTORY_CHUNK + sizeof("\r\n0\r\n\r\n") <= HTTP_TEXT_BUFFER,
+              "a /history chunk has to fit in the text buffer");
 
-/// @brief Sets up a simple HTTP server that returns a JSON document containing sensor's IP and MAC addresses as well as RSSI to every request.
+HTTPServer *HTTPServer::instance = nullptr;
+
+/// @brief Device status served by /status, the heap's low watermark and largest free block tell whether it fragments
+struct StatusMessage {
+    uint32_t uptime;
+    const char *ip;
+    const char *mac;
+    int8_t rssi;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;
+    uint32_t maxAllocHeap;
+    bool readingValid;
+    uint32_t readingTimestamp;
+    uint8_t probes;
+    uint8_t httpStreams;
+    uint8_t httpConnections;
+};
+
+template<>
+struct JsonSchema<StatusMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("uptime", &StatusMessage::uptime),
+            jsonField("ip", &StatusMessage::ip),
+            jsonField("mac", &StatusMessage::mac),
+            jsonField("rssi", &StatusMessage::rssi),
+            jsonField("freeHeap", &StatusMessage::freeHeap),
+            jsonField("minFreeHeap", &StatusMessage::minFreeHeap),
+            jsonField("maxAllocHeap", &StatusMessage::maxAllocHeap),
+            jsonField("readingValid", &StatusMessage::readingValid),
+            jsonField("readingTimestamp", &StatusMessage::readingTimestamp),
+            jsonField("probes", &StatusMessage::probes),
+            jsonField("httpStreams", &StatusMessage::httpStreams),
+            jsonField("httpConnections", &StatusMessage::httpConnections)
+    );
+};
+
+namespace {
+    const char *reasonPhrase(unsigned short status) {
+        switch (status) {
+            case 200:
+                return "OK";
+            case 400:
+                return "Bad Request";
+            case 404:
+                return "Not Found";
+            case 405:
+                return "Method Not Allowed";
+            case 413:
+                return "Content Too Large";
+            case 414:
+                return "URI Too Long";
+            case 431:
+                return "Request Header Fields Too Large";
+            case 501:
+                return "Not Implemented";
+            case 503:
+                return "Service Unavailable";
+            case 505:
+                return "HTTP Version Not Supported";
+            default:
+                return "Error";
+        }
+    }
+
+    // requests are handled by the AsyncTCP task and, while a connection is parked, by loop(). They share one buffer, so
+    // that it doesn't have to take up their stacks.
+    char textBody[HTTP_TEXT_BUFFER];
+    std::mutex textBodyLock;
+
+    constexpr char BUSY_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    // an event stream has no length, it lasts until either side closes the connection. EventSource reconnects after
+    // retry ms when it's closed.
+    constexpr char STREAM_HEADER[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-store\r\n"
+                                     "Connection: keep-alive\r\n\r\nretry: 1000\n\n";
+    constexpr char STREAM_KEEPALIVE[] = ": keepalive\n\n";
+    constexpr char EVENT_PREFIX[] = "event: reading\ndata: ";
+
+    /// @brief Reads a numeric parameter from a query like "a=1&b=2"
+    /// @return false if the parameter is missing or isn't a number, in which case value is left unchanged
+    bool queryParameter(std::string_view query, std::string_view name, unsigned long &value) {
+        while (!query.empty()) {
+            auto separator = query.find('&');
+            auto parameter = query.substr(0, separator);
+            query = separator == std::string_view::npos ? std::string_view() : query.substr(separator + 1);
+            if (parameter.size() <= name.size() || parameter.substr(0, name.size()) != name ||
+                parameter[name.size()] != '=') {
+                continue;
+            }
+            auto digits = parameter.substr(name.size() + 1);
+            // Unix times take 10 digits, anything that doesn't fit in 32 bits is rejected
+            if (digits.empty() || digits.size() > 10) {
+                return false;
+            }
+            uint64_t parsed = 0;
+            for (auto c: digits) {
+                if (c < '0' || c > '9') {
+                    return false;
+                }
+                parsed = parsed * 10 + (c - '0');
+            }
+            if (parsed > UINT32_MAX) {
+                return false;
+            }
+            value = parsed;
+            return true;
+        }
+        return false;
+    }
+
+    /// @brief Writes a value in hundredths as a decimal number, e.g. -5 as -0.05
+    size_t writeHundredths(char *buffer, size_t size, int16_t value) {
+        auto magnitude = abs(static_cast<int32_t>(value));
+        auto length = snprintf(buffer, size, "%s%ld.%02ld", value < 0 ? "-" : "", static_cast<long>(magnitude / 100),
+                               static_cast<long>(magnitude % 100));
+        return length < 0 ? 0 : std::min(static_cast<size_t>(length), size - 1);
+    }
+}
+
+HTTPServer::HTTPServer(SensorBus &sensors, HistoryLog &history, unsigned short port) :
+        server(port), sensors(sensors), history(history), port(port) {
+    instance = this;
+}
+
+HTTPServer::~HTTPServer() {
+    stop();
+}
+
+/// @brief Sets up an HTTP/1.1 server that serves the latest reading of a probe (/reading), device status (/status), metrics in the
+/// Prometheus text format (/metrics), ranges of the history log as CSV (/history) and every new reading as it's taken as
+/// Server-Sent Events (/events). Several clients can be connected at once and keep their connections open.
 /// Must be used in the setup() function in main.cpp. You must also include the HTTPServer::loop() function in loop() in main.cpp.
 void HTTPServer::setup() {
     if (started) {
         return;
     }
+    stopped = false;
+    server.onClient(&handleClient, nullptr);
     server.begin();
+    loop();
     started = true;
-    stopped = false;
-    log_e("HTTP set up");
+    LOG_INFO("HTTP set up");
 }
 
 /// @brief Stops the HTTP server.
@@ -20,58 +169,840 @@ void HTTPServer::stop() {
     if (stopped) {
         return;
     }
-    server.stop();
+    server.end();
+    for (auto &connection: connections) {
+        AsyncClient *client;
+        {
+            std::lock_guard<std::mutex> lock(connectionLock);
+            client = connection.client;
+        }
+        if (client == nullptr) {
+            continue;
+        }
+        // deleting the client closes it, which would call handleDisconnect and delete it again
+        client->onDisconnect(nullptr, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(connectionLock);
+            connection.client = nullptr;
+            connection.parked = false;
+            connection.closed = false;
+            connection.pendingLength = 0;
+            connection.pendingOverrun = false;
+        }
+        connection.queue.clear();
+        connection.exporting = false;
+        delete client;
+    }
+    for (auto &stream: streams) {
+        closeStream(stream);
+    }
     stopped = true;
     started = false;
-    log_e("HTTP stopped");
+    LOG_INFO("HTTP stopped");
 }
 
-/// @brief Listens for clients. Must be used in loop() function in main.cpp. You must also include 
-/// the HTTPServer::setup() function in setup() in main.cpp.
+/// @brief Refreshes what requests are served from, answers the /reading requests that waited for the new readings and pushes
+/// them to the /events streams. Other requests are handled as soon as they arrive, without waiting for this function or the
+/// probe. Must be used in loop() function in main.cpp after
+/// new readings are taken and when onActivity() calls back. You must also include the HTTPServer::setup() function in
+/// setup() in main.cpp.
 void HTTPServer::loop() {
-    if (stopped) {
+    Snapshot fresh;
+    for (size_t probe = 0; probe < sensors.size(); probe++) {
+        fresh.readings[probe] = sensors[probe].getLatestReading();
+    }
+    fresh.rssi = WiFi.RSSI();
+    Snapshot previous;
+    {
+        std::lock_guard<std::mutex> lock(snapshotLock);
+        previous = snapshot;
+        snapshot = fresh;
+    }
+    serveStreams(previous, fresh);
+    answerParked(fresh);
+}
+
+/// @brief Sets the function called (from the AsyncTCP task) when a stream needs loop() to run: a subscriber joined, left
+/// or acknowledged data, which frees space for queued events
+void HTTPServer::onActivity(void (*callback)()) {
+    activityCallback = callback;
+}
+
+HTTPServer::Snapshot HTTPServer::getSnapshot() {
+    std::lock_guard<std::mutex> lock(instance->snapshotLock);
+    return instance->snapshot;
+}
+
+/// @brief Client handler
+void HTTPServer::handleClient(void *arg, AsyncClient *client) {
+    HTTPConnection *slot;
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        slot = findConnection(nullptr);
+        if (slot != nullptr) {
+            slot->client = client;
+            slot->parked = false;
+            slot->closed = false;
+            slot->pendingLength = 0;
+            slot->pendingOverrun = false;
+        }
+    }
+    if (slot == nullptr) {
+        metrics.httpRejectedConnections.increment();
+        client->onDisconnect([](void *arg, AsyncClient *client) { delete client; }, nullptr);
+        client->add(BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1);
+        client->send();
+        client->close();
         return;
     }
-    auto client = server.accept();
-
-    if (client) {
-        log_e("Client connected");
-        String currentLine = "";
-        while (client.connected()) {
-            if (client.available()) {
-                char c = client.read();
-                if (c == '\n') {
-                    // if the current line is blank, you got two newline characters in a row.
-                    // that's the end of the client HTTP request, so send a response:
-                    if (currentLine.length() == 0) {
-                        // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-                        // and a content-type so the client knows what's coming, then a blank line:
-                        client.println("HTTP/1.1 200 OK");
-                        client.println("Content-type:application/json");
-                        client.println();
-
-                        // the content of the HTTP response follows the header:
-                        auto sensorData = sensor.getSensorData();
-                        JsonDocument doc;
-                        doc["humidity"] = sensorData.first;
-                        doc["temperature"] = sensorData.second;
-                        doc["rssi"] = WiFi.RSSI();
-                        String serialized;
-                        serializeJson(doc, serialized);
-                        client.print(serialized);
-
-                        // The HTTP response ends with another blank line:
-                        client.println();
-                        break;
-                    } else {
-                        currentLine = "";
-                    }
-                } else if (c != '\r') {
-                    currentLine += c;
-                }
+    slot->parser.reset();
+    slot->queue.clear();
+    // a response that doesn't fit in the queue can't be dropped without corrupting the stream
+    slot->queue.setPolicy(QueueOverflowPolicy::Disconnect);
+    slot->queue.setMaxBytes(HTTP_QUEUE_MAX_BYTES);
+    slot->closeAfterSend = false;
+    slot->awaitingReading = false;
+    slot->exporting = false;
+
+    client->setNoDelay(true);
+    client->setRxTimeout(HTTP_IDLE_TIMEOUT);
+    client->onData(&handleData, nullptr);
+    client->onError(&handleError, nullptr);
+    client->onDisconnect(&handleDisconnect, nullptr);
+    client->onTimeout(&handleTimeout, nullptr);
+    client->onAck(&handleAck, nullptr);
+    client->onPoll(&handlePoll, nullptr);
+}
+
+/// @brief Responds to every request completed by the received bytes. While the connection is parked they're kept for
+/// loop(), which answers the waiting request right away so that the ones following it aren't held up, and handles them.
+void HTTPServer::handleData(void *arg, AsyncClient *client, void *data, size_t len) {
+    HTTPConnection *connection;
+    bool parked;
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        connection = findConnection(client);
+        if (connection == nullptr) {
+            return;
+        }
+        parked = connection->parked;
+        if (parked && connection->pendingLength + len <= connection->pendingInput.size()) {
+            memcpy(connection->pendingInput.data() + connection->pendingLength, data, len);
+            connection->pendingLength += len;
+        } else if (parked) {
+            connection->pendingOverrun = true;
+        }
+    }
+    if (parked) {
+        notifyActivity();
+        return;
+    }
+    receive(*connection, static_cast<const char *>(data), len);
+}
+
+/// @brief Parses the bytes and responds to every request completed by them, pipelined requests are answered in order. A
+/// /reading request left waiting for a fresh reading parks the connection, loop() answers it.
+/// @return false if the connection was parked or became a stream, this task doesn't serve it anymore
+bool HTTPServer::receive(HTTPConnection &connection, const char *bytes, size_t len) {
+    auto receivedAt = micros();
+    size_t offset = 0;
+    // whatever arrives after a request that closes the connection is ignored
+    while (offset < len && !connection.closeAfterSend) {
+        offset += connection.parser.push(bytes + offset, len - offset);
+        auto state = connection.parser.getState();
+        if (state == HTTPParseState::Incomplete) {
+            break;
+        }
+        if (state == HTTPParseState::Failed) {
+            auto status = connection.parser.getErrorStatus();
+            sendResponse(connection, status, "text/plain", reasonPhrase(status));
+            connection.closeAfterSend = true;
+            break;
+        }
+        connection.receivedAt = millis();
+        connection.receivedAtMicros = receivedAt;
+        // only the last request of the chunk can wait, the bytes following it would have nowhere to go
+        respond(connection, offset == len);
+        // the connection became a stream, which loop() serves from now on
+        if (connection.client == nullptr) {
+            return false;
+        }
+        if (connection.awaitingReading) {
+            break;
+        }
+        finishRequest(connection);
+    }
+    drainQueue(connection);
+    if (!connection.awaitingReading) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        connection.parked = true;
+    }
+    // the reading might have been published already
+    notifyActivity();
+    return false;
+}
+
+/// @brief Routes the parsed request and queues the response. A /reading request for which the latest reading is too old
+/// is left waiting for a fresh one instead, if canWait is set.
+void HTTPServer::respond(HTTPConnection &connection, bool canWait) {
+    auto &parser = connection.parser;
+    if (!parser.keepAlive()) {
+        connection.closeAfterSend = true;
+    }
+    metrics.httpRequests.increment();
+    if (parser.getMethod() == HTTPMethod::Other) {
+        sendResponse(connection, 405, "text/plain", reasonPhrase(405), "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    auto path = parser.getPath();
+    char body[HTTP_BODY_BUFFER];
+    size_t length;
+    if (path == "/" || path == "/reading") {
+        // ?probe=N picks the probe, the first one by default
+        unsigned long probe = 0;
+        queryParameter(parser.getQuery(), "probe", probe);
+        if (probe >= instance->sensors.size()) {
+            sendResponse(connection, 404, "text/plain", reasonPhrase(404));
+            return;
+        }
+        connection.probe = probe;
+        auto &sensor = instance->sensors[probe];
+        // ?maxAge=N (in milliseconds) overrides the sensor's staleness budget for this request
+        auto maxAge = sensor.getMaxAge();
+        queryParameter(parser.getQuery(), "maxAge", maxAge);
+        if (millis() - getSnapshot().readings[probe].timestamp <= maxAge) {
+            metrics.readingCacheHits.increment();
+            sendReading(connection);
+            return;
+        }
+        metrics.readingCacheMisses.increment();
+        if (!canWait) {
+            sendReading(connection);
+            return;
+        }
+        // answered by handlePoll() once the reading arrives, every request waiting meanwhile shares it
+        connection.awaitingReading = true;
+        connection.maxAge = maxAge;
+        sensor.requestReading(maxAge);
+    } else if (path == "/status") {
+        auto current = getSnapshot();
+        auto address = WiFi.localIP();
+        char ip[sizeof("255.255.255.255")];
+        snprintf(ip, sizeof(ip), "%u.%u.%u.%u", address[0], address[1], address[2], address[3]);
+        uint8_t macBytes[6];
+        WiFi.macAddress(macBytes);
+        char mac[sizeof("FF:FF:FF:FF:FF:FF")];
+        snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X", macBytes[0], macBytes[1], macBytes[2],
+                 macBytes[3], macBytes[4], macBytes[5]);
+        StatusMessage status{
+                static_cast<uint32_t>(millis()),
+                ip,
+                mac,
+                current.rssi,
+                ESP.getFreeHeap(),
+                ESP.getMinFreeHeap(),
+                ESP.getMaxAllocHeap(),
+                current.readings[0].valid,
+                static_cast<uint32_t>(current.readings[0].timestamp),
+                static_cast<uint8_t>(instance->sensors.size()),
+                static_cast<uint8_t>(activeStreams()),
+                static_cast<uint8_t>(activeConnections())
+        };
+        length = encodeJson(status, body, sizeof(body));
+        sendResponse(connection, 200, "application/json", std::string_view(body, length));
+    } else if (path == "/metrics") {
+        std::lock_guard<std::mutex> lock(textBodyLock);
+        MetricsWriter writer(textBody, sizeof(textBody));
+        writeMetrics(writer);
+        sendResponse(connection, 200, "text/plain; version=0.0.4", std::string_view(textBody, writer.length()));
+    } else if (path == "/events") {
+        startStream(connection);
+    } else if (path == "/history") {
+        startExport(connection);
+    } else if (path == "/log") {
+        std::lock_guard<std::mutex> lock(textBodyLock);
+        length = Log::writeRecent(textBody, sizeof(textBody));
+        sendResponse(connection, 200, "text/plain", std::string_view(textBody, length));
+    } else {
+        sendResponse(connection, 404, "text/plain", reasonPhrase(404));
+    }
+}
+
+/// @brief Queues the latest reading of the requested probe with the time it was taken at (millis()), its age in milliseconds
+/// and the probe's id. Apart from them it's the same document the server sent before routes existed.
+void HTTPServer::sendReading(HTTPConnection &connection) {
+    auto current = getSnapshot();
+    auto &reading = current.readings[connection.probe];
+    ReadingMessage message{
+            reading.valid ? reading.humidity : 0.0f,
+            reading.valid ? reading.temperature : 0.0f,
+            current.rssi,
+            static_cast<uint32_t>(reading.timestamp),
+            static_cast<uint32_t>(millis() - reading.timestamp),
+            connection.probe
+    };
+    char body[HTTP_BODY_BUFFER];
+    auto length = encodeJson(message, body, sizeof(body));
+    sendResponse(connection, 200, "application/json", std::string_view(body, length));
+}
+
+/// @brief Turns the connection into an /events stream of every reading taken from now on (or only the ones of the probe
+/// given by ?probe=N), as Server-Sent Events named "reading" carrying the same JSON as /reading. The stream starts with the
+/// latest readings. It moves to a stream slot, which loop() serves, and the request slot is freed; whatever the client
+/// sends from then on is ignored.
+void HTTPServer::startStream(HTTPConnection &connection) {
+    auto &sensors = instance->sensors;
+    uint8_t probes = (1u << sensors.size()) - 1;
+    unsigned long probe = 0;
+    if (queryParameter(connection.parser.getQuery(), "probe", probe)) {
+        if (probe >= sensors.size()) {
+            sendResponse(connection, 404, "text/plain", reasonPhrase(404));
+            return;
+        }
+        probes = 1u << probe;
+    }
+    if (connection.parser.getMethod() == HTTPMethod::Head) {
+        sendResponse(connection, 200, "text/event-stream", "");
+        return;
+    }
+    auto client = connection.client;
+    bool claimed = false;
+    {
+        std::lock_guard<std::mutex> lock(instance->streamLock);
+        for (auto &stream: instance->streams) {
+            if (stream.client != nullptr) {
+                continue;
+            }
+            // a client that doesn't keep up loses the oldest events, the header is never dropped as nothing is queued
+            // behind it until it started being sent
+            stream.queue.clear();
+            stream.queue.setPolicy(QueueOverflowPolicy::DropOldest);
+            stream.queue.setMaxBytes(HTTP_STREAM_QUEUE_BYTES);
+            stream.queue.push(FrameRef::copyOf(reinterpret_cast<const uint8_t *>(STREAM_HEADER),
+                                               sizeof(STREAM_HEADER) - 1));
+            stream.probes = probes;
+            stream.joined = true;
+            stream.closed = false;
+            stream.client = client;
+            claimed = true;
+            break;
+        }
+    }
+    if (!claimed) {
+        connection.closeAfterSend = true;
+        sendResponse(connection, 503, "text/plain", reasonPhrase(503));
+        return;
+    }
+    // a subscriber doesn't send anything, the stream notices a dead one by the data it doesn't take
+    client->setRxTimeout(0);
+    client->onData([](void *arg, AsyncClient *client, void *data, size_t len) {}, nullptr);
+    client->onAck(&handleStreamAck, nullptr);
+    client->onDisconnect(&handleStreamDisconnect, nullptr);
+    client->onTimeout(nullptr, nullptr);
+    client->onPoll(nullptr, nullptr);
+    finishRequest(connection);
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        connection.client = nullptr;
+        connection.parked = false;
+    }
+    connection.queue.clear();
+    notifyActivity();
+}
+
+/// @brief Queues the readings taken since the last call on every stream and hands them to the clients. A reading is encoded
+/// once and the same frame is queued for every subscriber of its probe. Streams that just joined get the latest readings,
+/// streams whose client left are freed and ones whose client took nothing for HTTP_STREAM_STALL_TIMEOUT are closed.
+void HTTPServer::serveStreams(const Snapshot &previous, const Snapshot &current) {
+    std::array<FrameRef, MAX_PROBES> events;
+    for (uint8_t probe = 0; probe < sensors.size(); probe++) {
+        if (current.readings[probe].timestamp != previous.readings[probe].timestamp) {
+            events[probe] = encodeEvent(current, probe);
+        }
+    }
+    static const auto keepalive = FrameRef::copyOf(reinterpret_cast<const uint8_t *>(STREAM_KEEPALIVE),
+                                                   sizeof(STREAM_KEEPALIVE) - 1);
+    auto now = millis();
+    for (auto &stream: streams) {
+        AsyncClient *client;
+        bool joined;
+        bool closed;
+        {
+            std::lock_guard<std::mutex> lock(streamLock);
+            client = stream.client;
+            joined = stream.joined;
+            closed = stream.closed;
+            stream.joined = false;
+        }
+        if (client == nullptr) {
+            continue;
+        }
+        if (closed) {
+            closeStream(stream);
+            continue;
+        }
+        if (joined) {
+            stream.lastQueuedAt = now;
+            stream.lastProgressAt = now;
+        }
+        // nothing is queued behind a header that hasn't started being sent, dropping it would garble the stream
+        bool headerSent = stream.queue.getStats().sentBytes > 0;
+        for (uint8_t probe = 0; probe < sensors.size(); probe++) {
+            if ((stream.probes >> probe & 1) == 0 || (!joined && !headerSent)) {
+                continue;
+            }
+            auto frame = joined ? encodeEvent(current, probe) : events[probe];
+            if (!frame) {
+                continue;
+            }
+            auto dropped = stream.queue.getStats().droppedFrames;
+            stream.queue.push(frame);
+            // a push can evict several events
+            metrics.httpStreamDroppedEvents.increment(stream.queue.getStats().droppedFrames - dropped);
+            metrics.httpStreamEvents.increment();
+            stream.lastQueuedAt = now;
+        }
+        if (headerSent && now - stream.lastQueuedAt >= HTTP_STREAM_KEEPALIVE) {
+            stream.queue.push(keepalive);
+            stream.lastQueuedAt = now;
+        }
+        if (!client->connected()) {
+            continue;
+        }
+        auto written = stream.queue.drainTo(*client);
+        if (written > 0) {
+            client->send();
+        }
+        if (written > 0 || stream.queue.empty()) {
+            stream.lastProgressAt = now;
+        } else if (now - stream.lastProgressAt >= HTTP_STREAM_STALL_TIMEOUT) {
+            LOG_WARNING("Closing an event stream whose client doesn't read it");
+            // the disconnect handler marks the stream closed, it's freed the next time
+            client->close();
+        }
+    }
+}
+
+/// @brief Deletes the stream's client and frees its slot, must only be called by the task running loop()
+void HTTPServer::closeStream(HTTPStream &stream) {
+    AsyncClient *client;
+    {
+        std::lock_guard<std::mutex> lock(streamLock);
+        client = stream.client;
+    }
+    if (client == nullptr) {
+        return;
+    }
+    // deleting the client closes it, which would call handleStreamDisconnect
+    client->onDisconnect(nullptr, nullptr);
+    delete client;
+    stream.queue.clear();
+    std::lock_guard<std::mutex> lock(streamLock);
+    stream.client = nullptr;
+    stream.joined = false;
+    stream.closed = false;
+}
+
+/// @brief Encodes a probe's reading as an event, or returns an empty frame if the probe wasn't read yet
+FrameRef HTTPServer::encodeEvent(const Snapshot &current, uint8_t probe) {
+    auto &reading = current.readings[probe];
+    if (reading.timestamp == 0) {
+        return FrameRef();
+    }
+    ReadingMessage message{
+            reading.valid ? reading.humidity : 0.0f,
+            reading.valid ? reading.temperature : 0.0f,
+            current.rssi,
+            static_cast<uint32_t>(reading.timestamp),
+            static_cast<uint32_t>(millis() - reading.timestamp),
+            probe
+    };
+    char event[HTTP_BODY_BUFFER];
+    auto length = sizeof(EVENT_PREFIX) - 1;
+    memcpy(event, EVENT_PREFIX, length);
+    // the blank line ending the event has to fit after the data
+    length += encodeJson(message, event + length, sizeof(event) - length - 2);
+    event[length++] = '\n';
+    event[length++] = '\n';
+    return FrameRef::copyOf(reinterpret_cast<const uint8_t *>(event), length);
+}
+
+size_t HTTPServer::activeConnections() {
+    std::lock_guard<std::mutex> lock(instance->connectionLock);
+    return std::count_if(instance->connections.begin(), instance->connections.end(),
+                         [](const HTTPConnection &connection) { return connection.client != nullptr; });
+}
+
+size_t HTTPServer::activeStreams() {
+    std::lock_guard<std::mutex> lock(instance->streamLock);
+    return std::count_if(instance->streams.begin(), instance->streams.end(),
+                         [](const HTTPStream &stream) { return stream.client != nullptr; });
+}
+
+void HTTPServer::notifyActivity() {
+    if (instance->activityCallback) {
+        instance->activityCallback();
+    }
+}
+
+/// @brief Called when a subscriber acknowledged sent data, loop() queues more
+void HTTPServer::handleStreamAck(void *arg, AsyncClient *client, size_t len, uint32_t time) {
+    notifyActivity();
+}
+
+/// @brief Marks the subscriber's stream closed, loop() deletes the client and frees the slot as it might be using it
+void HTTPServer::handleStreamDisconnect(void *arg, AsyncClient *client) {
+    {
+        std::lock_guard<std::mutex> lock(instance->streamLock);
+        for (auto &stream: instance->streams) {
+            if (stream.client == client) {
+                stream.closed = true;
             }
         }
-        client.stop();
-        log_e("Client disconnected");
     }
-}
\ No newline at end of file
+    notifyActivity();
+}
+
+/// @brief Starts streaming the rows logged between ?from=T and ?to=T (Unix times in seconds, both inclusive, the whole log by
+/// default) as CSV with chunked transfer encoding. The rows are decoded straight from flash a chunk at a time as the client
+/// takes them, so an export of any length takes the same memory. Requests pipelined behind it are dropped and the connection
+/// is closed after it, so that their responses can't end up between its chunks.
+void HTTPServer::startExport(HTTPConnection &connection) {
+    unsigned long from = 0, to = UINT32_MAX;
+    queryParameter(connection.parser.getQuery(), "from", from);
+    queryParameter(connection.parser.getQuery(), "to", to);
+    connection.closeAfterSend = true;
+    if (!queueHeader(connection, 200, "text/csv", "Transfer-Encoding: chunked\r\n", "")) {
+        return;
+    }
+    if (connection.parser.getMethod() == HTTPMethod::Head) {
+        return;
+    }
+    // the column names are the first chunk, 0x20 bytes long
+    constexpr char COLUMNS[] = "20\r\ntime,probe,humidity,temperature\n\r\n";
+    connection.queue.push(FrameRef::copyOf(reinterpret_cast<const uint8_t *>(COLUMNS), sizeof(COLUMNS) - 1));
+    instance->history.open(connection.cursor, from, to);
+    connection.exporting = true;
+}
+
+/// @brief Queues the next chunk of a /history export, followed by the last (empty) chunk once the cursor reached the end
+void HTTPServer::sendExportChunk(HTTPConnection &connection) {
+    std::lock_guard<std::mutex> lock(textBodyLock);
+    auto data = textBody + HTTP_CHUNK_PREFIX;
+    size_t length = 0;
+    HistoryRow row;
+    while (length + MAX_PROBES * HTTP_HISTORY_LINE <= HTTP_HISTORY_CHUNK && instance->history.next(connection.cursor, row)) {
+        for (uint8_t probe = 0; probe < row.probes; probe++) {
+            auto &sample = row.samples[probe];
+            length += snprintf(data + length, HTTP_HISTORY_CHUNK - length, "%lu,%u,",
+                               static_cast<unsigned long>(row.time), static_cast<unsigned>(probe));
+            if (sample.valid) {
+                length += writeHundredths(data + length, HTTP_HISTORY_CHUNK - length, sample.humidity);
+                data[length++] = ',';
+                length += writeHundredths(data + length, HTTP_HISTORY_CHUNK - length, sample.temperature);
+            } else {
+                data[length++] = ',';
+            }
+            data[length++] = '\n';
+        }
+    }
+    char *start = data;
+    size_t size = length;
+    if (length > 0) {
+        char prefix[HTTP_CHUNK_PREFIX + 1];
+        auto prefixLength = snprintf(prefix, sizeof(prefix), "%x\r\n", static_cast<unsigned>(length));
+        start -= prefixLength;
+        memcpy(start, prefix, prefixLength);
+        memcpy(data + length, "\r\n", 2);
+        size += prefixLength + 2;
+    }
+    if (connection.cursor.done) {
+        memcpy(start + size, "0\r\n\r\n", 5);
+        size += 5;
+        connection.exporting = false;
+    }
+    if (connection.queue.push(FrameRef::copyOf(reinterpret_cast<const uint8_t *>(start), size)) !=
+        EnqueueResult::Queued) {
+        connection.queue.clear();
+        connection.exporting = false;
+    }
+}
+
+/// @brief Records the latency of the request that was answered and gets the parser ready for the next one
+void HTTPServer::finishRequest(HTTPConnection &connection) {
+    metrics.httpLatency.observe(micros() - connection.receivedAtMicros);
+    connection.awaitingReading = false;
+    connection.parser.reset();
+}
+
+/// @brief Writes the firmware's metrics along with the ones only known at the time of the request
+void HTTPServer::writeMetrics(MetricsWriter &writer) {
+    auto current = getSnapshot();
+    writer.gauge("poleko_uptime_seconds", millis() / 1000);
+    writer.gauge("poleko_wifi_rssi_dbm", current.rssi);
+    writer.gauge("poleko_heap_free_bytes", ESP.getFreeHeap());
+    writer.gauge("poleko_heap_largest_block_bytes", ESP.getMaxAllocHeap());
+    writer.gauge("poleko_heap_min_free_bytes", ESP.getMinFreeHeap());
+    writer.histogram("poleko_sensor_read_milliseconds", metrics.sensorReadTime);
+    writer.counter("poleko_sensor_timeouts_total", metrics.sensorTimeouts.get());
+    writer.counter("poleko_sensor_parse_failures_total", metrics.sensorParseFailures.get());
+    writer.counter("poleko_sensor_demand_reads_total", metrics.sensorDemandReads.get());
+    writer.counter("poleko_reading_cache_hits_total", metrics.readingCacheHits.get());
+    writer.counter("poleko_reading_cache_misses_total", metrics.readingCacheMisses.get());
+    writer.counter("poleko_tcp_sent_bytes_total", metrics.tcpSentBytes.get());
+    writer.counter("poleko_tcp_sent_frames_total", metrics.tcpSentFrames.get());
+    writer.counter("poleko_tcp_dropped_frames_total", metrics.tcpDroppedFrames.get());
+    writer.counter("poleko_tcp_suppressed_readings_total", metrics.tcpSuppressedReadings.get());
+    writer.counter("poleko_tcp_commands_total", metrics.tcpCommands.get());
+    writer.counter("poleko_tcp_command_errors_total", metrics.tcpCommandErrors.get());
+    writer.counter("poleko_tcp_rejected_connections_total", metrics.tcpRejectedConnections.get());
+    writer.histogram("poleko_http_request_microseconds", metrics.httpLatency);
+    writer.counter("poleko_http_requests_total", metrics.httpRequests.get());
+    writer.counter("poleko_http_rejected_connections_total", metrics.httpRejectedConnections.get());
+    writer.gauge("poleko_http_streams", activeStreams());
+    writer.counter("poleko_http_stream_events_total", metrics.httpStreamEvents.get());
+    writer.counter("poleko_http_stream_dropped_events_total", metrics.httpStreamDroppedEvents.get());
+    writer.counter("poleko_udp_beacons_total", metrics.udpBeacons.get());
+    writer.counter("poleko_udp_discovery_replies_total", metrics.udpDiscoveryReplies.get());
+    writer.counter("poleko_wifi_disconnects_total", metrics.wifiDisconnects.get());
+    writer.histogram("poleko_wifi_recovery_milliseconds", metrics.wifiRecoveryTime);
+    writer.counter("poleko_settings_writes_total", metrics.settingsWrites.get());
+    writer.counter("poleko_history_rows_total", metrics.historyRows.get());
+    writer.counter("poleko_history_written_bytes_total", metrics.historyBytes.get());
+    writer.counter("poleko_history_sector_erases_total", metrics.historySectorErases.get());
+    auto historyStats = instance->history.getStats();
+    writer.gauge("poleko_history_sectors_used", historyStats.sectorsUsed);
+    writer.gauge("poleko_history_sectors", historyStats.sectorCount);
+    writer.gauge("poleko_history_oldest_timestamp_seconds", historyStats.oldestTime);
+    writer.histogram("poleko_loop_busy_microseconds", metrics.loopTime);
+    writer.counter("poleko_log_lost_records_total", Log::getLost());
+    TCPServer::writeMetrics(writer);
+}
+
+/// @brief Queues a response with the given body, which is left out when responding to HEAD
+/// @param extraHeaders Header lines to add, each one terminated with CRLF
+void HTTPServer::sendResponse(HTTPConnection &connection, unsigned short status, const char *contentType,
+                              std::string_view body, const char *extraHeaders) {
+    char framing[32];
+    snprintf(framing, sizeof(framing), "Content-Length: %u\r\n", static_cast<unsigned>(body.size()));
+    if (!queueHeader(connection, status, contentType, framing, extraHeaders)) {
+        return;
+    }
+    if (!body.empty() && connection.parser.getMethod() != HTTPMethod::Head) {
+        auto frame = FrameRef::copyOf(reinterpret_cast<const uint8_t *>(body.data()), body.size());
+        if (connection.queue.push(frame) != EnqueueResult::Queued) {
+            LOG_WARNING("Disconnecting an HTTP client that doesn't read its responses");
+            connection.queue.clear();
+            connection.closeAfterSend = true;
+        }
+    }
+}
+
+/// @brief Queues the status line and headers of a response
+/// @param framing The header line telling where the body ends, Content-Length or Transfer-Encoding
+/// @return false if the client was too slow to take it, in which case the connection is closed
+bool HTTPServer::queueHeader(HTTPConnection &connection, unsigned short status, const char *contentType,
+                             const char *framing, const char *extraHeaders) {
+    char header[HTTP_HEADER_BUFFER];
+    auto headerLength = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 %u %s\r\nContent-Type: %s\r\n%sCache-Control: no-store\r\n"
+                                 "%sConnection: %s\r\n\r\n",
+                                 status, reasonPhrase(status), contentType, framing, extraHeaders,
+                                 connection.closeAfterSend ? "close" : "keep-alive");
+    if (headerLength < 0 || static_cast<size_t>(headerLength) >= sizeof(header)) {
+        return false;
+    }
+    if (connection.queue.push(FrameRef::copyOf(reinterpret_cast<const uint8_t *>(header), headerLength)) !=
+        EnqueueResult::Queued) {
+        LOG_WARNING("Disconnecting an HTTP client that doesn't read its responses");
+        connection.queue.clear();
+        connection.closeAfterSend = true;
+        return false;
+    }
+    return true;
+}
+
+/// @brief Hands queued responses to the client for as long as it has space in its send buffer, encoding the next chunk of an
+/// export whenever the previous one was taken. Closes the connection once everything was sent (including a response to a
+/// request waiting for a reading and the rest of an export) if it isn't persistent.
+void HTTPServer::drainQueue(HTTPConnection &connection) {
+    auto client = connection.client;
+    if (!client->connected()) {
+        return;
+    }
+    size_t written = 0;
+    while (true) {
+        written += connection.queue.drainTo(*client);
+        if (!connection.exporting || !connection.queue.empty()) {
+            break;
+        }
+        sendExportChunk(connection);
+    }
+    if (written > 0) {
+        client->send();
+    }
+    if (connection.closeAfterSend && connection.queue.empty() && !connection.awaitingReading &&
+        !connection.exporting) {
+        client->close();
+    }
+}
+
+/// @brief Finds the slot of the client, or a free slot when nullptr is passed. connectionLock must be held.
+HTTPConnection *HTTPServer::findConnection(AsyncClient *client) {
+    for (auto &connection: instance->connections) {
+        if (connection.client == client) {
+            return &connection;
+        }
+    }
+    return nullptr;
+}
+
+void HTTPServer::handleError(void *arg, AsyncClient *client, int8_t error) {
+    LOG_WARNING("HTTP client error %d", error);
+}
+
+/// @brief Frees the client's slot. Clients accepted by AsyncServer are owned by the application, so it's deleted here,
+/// unless the connection is parked: loop() might be using it, it deletes the client and frees the slot then.
+void HTTPServer::handleDisconnect(void *arg, AsyncClient *client) {
+    bool parked = false;
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        auto connection = findConnection(client);
+        if (connection != nullptr && connection->parked) {
+            connection->closed = true;
+            parked = true;
+        } else if (connection != nullptr) {
+            connection->client = nullptr;
+            connection->pendingLength = 0;
+            connection->pendingOverrun = false;
+            connection->queue.clear();
+            connection->exporting = false;
+        }
+    }
+    if (parked) {
+        notifyActivity();
+        return;
+    }
+    delete client;
+}
+
+void HTTPServer::handleTimeout(void *arg, AsyncClient *client, uint32_t time) {
+    client->close();
+}
+
+/// @brief Called when the client acknowledged sent data, which frees space for queued responses. loop() sends those of a
+/// parked connection.
+void HTTPServer::handleAck(void *arg, AsyncClient *client, size_t len, uint32_t time) {
+    HTTPConnection *connection;
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        connection = findConnection(client);
+        if (connection == nullptr || connection->parked) {
+            return;
+        }
+    }
+    drainQueue(*connection);
+}
+
+/// @brief Called by AsyncTCP every 500 ms, has loop() answer a parked request that waited for HTTP_READING_WAIT: loop() isn't
+/// necessarily run before then
+void HTTPServer::handlePoll(void *arg, AsyncClient *client) {
+    HTTPConnection *connection;
+    {
+        std::lock_guard<std::mutex> lock(instance->connectionLock);
+        connection = findConnection(client);
+        if (connection == nullptr || !connection->parked) {
+            return;
+        }
+    }
+    // the AsyncTCP task doesn't change it while the connection is parked
+    if (millis() - connection->receivedAt >= HTTP_READING_WAIT) {
+        notifyActivity();
+    }
+}
+
+/// @brief Answers the parked /reading requests whose reading arrived, which waited for HTTP_READING_WAIT or which were
+/// followed by another request (with the latest reading), handles what the client sent meanwhile and hands the
+/// connections back to the AsyncTCP task. Frees the slots of the ones whose client disconnected. Must only be called by the
+/// task running loop().
+void HTTPServer::answerParked(const Snapshot &current) {
+    for (auto &connection: connections) {
+        bool parked;
+        bool closed;
+        bool followed;
+        {
+            std::lock_guard<std::mutex> lock(connectionLock);
+            parked = connection.parked;
+            closed = connection.closed;
+            followed = connection.pendingLength > 0 || connection.pendingOverrun;
+        }
+        if (!parked) {
+            continue;
+        }
+        auto now = millis();
+        auto takenAt = current.readings[connection.probe].timestamp;
+        bool fresh = static_cast<long>(takenAt - connection.receivedAt) >= 0 || now - takenAt <= connection.maxAge;
+        if (!closed && !fresh && !followed && now - connection.receivedAt < HTTP_READING_WAIT) {
+            continue;
+        }
+        // the requests that arrived meanwhile are handled until one waits again or no more arrived
+        while (!closed) {
+            if (connection.awaitingReading) {
+                sendReading(connection);
+                finishRequest(connection);
+            }
+            char input[HTTP_REQUEST_BUFFER];
+            size_t length;
+            bool overrun;
+            {
+                std::lock_guard<std::mutex> lock(connectionLock);
+                length = connection.pendingLength;
+                overrun = connection.pendingOverrun;
+                memcpy(input, connection.pendingInput.data(), length);
+                connection.pendingLength = 0;
+                connection.pendingOverrun = false;
+            }
+            if (overrun) {
+                // more requests were pipelined than could be kept, the connection is closed after the answers so far
+                connection.closeAfterSend = true;
+            } else if (length > 0 && !receive(connection, input, length) && !connection.awaitingReading) {
+                // it became a stream, which serveStreams() took over
+                break;
+            }
+            // may close the client, which marks the connection closed
+            drainQueue(connection);
+            std::lock_guard<std::mutex> lock(connectionLock);
+            closed = connection.closed;
+            if (connection.pendingLength == 0 && !connection.pendingOverrun) {
+                connection.parked = closed || connection.awaitingReading;
+                break;
+            }
+        }
+        if (closed) {
+            releaseParked(connection);
+        }
+    }
+}
+
+/// @brief Deletes the client of a parked connection that was closed and frees the slot, must only be called by the task
+/// running loop()
+void HTTPServer::releaseParked(HTTPConnection &connection) {
+    connection.queue.clear();
+    connection.exporting = false;
+    connection.awaitingReading = false;
+    AsyncClient *client;
+    {
+        std::lock_guard<std::mutex> lock(connectionLock);
+        client = connection.client;
+        connection.client = nullptr;
+        connection.parked = false;
+        connection.closed = false;
+        connection.pendingLength = 0;
+        connection.pendingOverrun = false;
+    }
+    delete client;
+}
@@ -0,0 +1,457 @@
+#include "HistoryLog.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "Log.h"
+#include "Metrics.h"
+
+// bits of a sector that hold rows
+constexpr uint32_t HISTORY_PAYLOAD_BITS = (HISTORY_SECTOR_SIZE - HISTORY_HEADER_SIZE) * 8;
+// longest possible row: a 32 bit timestamp and a 17 bit change of both values of every probe, with their prefixes
+constexpr uint32_t HISTORY_MAX_ROW_BITS = 4 + 32 + MAX_PROBES * 2 * (4 + 17);
+
+namespace {
+    /// @brief The header at the start of every sector, its rows are decoded starting from startTime and zero values
+    struct SectorHeader {
+        uint32_t magic;
+        uint32_t generation;
+        uint32_t startTime;
+        uint8_t probes;
+        uint8_t version;
+        uint16_t reserved;
+    };
+
+    static_assert(sizeof(SectorHeader) == HISTORY_HEADER_SIZE, "the sector header has to keep its size");
+
+    /// @brief Writes bits MSB first into a buffer of erased (all ones) bytes, only the zeroes have to be written
+    struct BitWriter {
+        uint8_t *buffer;
+        uint32_t bit;
+
+        void write(uint32_t value, uint8_t count) {
+            while (count > 0) {
+                count--;
+                if ((value >> count & 1) == 0) {
+                    buffer[bit / 8] &= ~(0x80 >> (bit % 8));
+                }
+                bit++;
+            }
+        }
+    };
+
+    bool fits(int64_t value, uint8_t bits) {
+        return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+    }
+
+    int32_t signExtend(uint32_t value, uint8_t bits) {
+        return static_cast<int32_t>(value << (32 - bits)) >> (32 - bits);
+    }
+
+    /// @brief Writes the difference of a value from the previous one: '0' for none, then '10', '110' and '1110' followed
+    /// by 4, 8 and 17 bits of it. '1111' is left for a missing reading.
+    void writeChange(BitWriter &writer, int32_t change) {
+        if (change == 0) {
+            writer.write(0b0, 1);
+        } else if (fits(change, 4)) {
+            writer.write(0b10, 2);
+            writer.write(change & 0xF, 4);
+        } else if (fits(change, 8)) {
+            writer.write(0b110, 3);
+            writer.write(change & 0xFF, 8);
+        } else {
+            writer.write(0b1110, 4);
+            writer.write(change & 0x1FFFF, 17);
+        }
+    }
+
+    /// @brief Encodes a row following the state and advances the state past it
+    /// @return false if the time is too far from the previous row's to be encoded, the row has to start a new sector
+    bool encodeRow(HistoryCodecState &state, uint32_t time, const HistorySample *samples, size_t count,
+                   BitWriter &writer) {
+        int64_t delta = static_cast<int64_t>(time) - state.time;
+        int64_t deltaOfDelta = delta - state.delta;
+        if (!fits(delta, 32) || !fits(deltaOfDelta, 32)) {
+            return false;
+        }
+        // '0' while the rows come at a steady interval, then '10', '110', '1110' and '1111' followed by 7, 9, 12 and 32
+        // bits. The erased flash after the last row reads as '1111' and 32 ones, which no row uses: -1 takes 7 bits.
+        if (deltaOfDelta == 0) {
+            writer.write(0b0, 1);
+        } else if (fits(deltaOfDelta, 7)) {
+            writer.write(0b10, 2);
+            writer.write(deltaOfDelta & 0x7F, 7);
+        } else if (fits(deltaOfDelta, 9)) {
+            writer.write(0b110, 3);
+            writer.write(deltaOfDelta & 0x1FF, 9);
+        } else if (fits(deltaOfDelta, 12)) {
+            writer.write(0b1110, 4);
+            writer.write(deltaOfDelta & 0xFFF, 12);
+        } else {
+            writer.write(0b1111, 4);
+            writer.write(static_cast<uint32_t>(deltaOfDelta), 32);
+        }
+        state.time = time;
+        state.delta = static_cast<int32_t>(delta);
+        for (size_t probe = 0; probe < count; probe++) {
+            auto &sample = samples[probe];
+            if (!sample.valid) {
+                writer.write(0b1111, 4);
+                continue;
+            }
+            writeChange(writer, sample.humidity - state.humidity[probe]);
+            writeChange(writer, sample.temperature - state.temperature[probe]);
+            state.humidity[probe] = sample.humidity;
+            state.temperature[probe] = sample.temperature;
+        }
+        return true;
+    }
+}
+
+/// @param label Label of the data partition in partitions.csv
+HistoryLog::HistoryLog(const char *label) : label(label) {}
+
+/// @brief Finds the partition and the generations it holds. Must be called once before anything else, the log does nothing
+/// if the partition is missing.
+/// @return false if there's no partition with the label
+bool HistoryLog::begin() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (partition == nullptr) {
+            LOG_WARNING("No %s partition, the history isn't logged", label);
+            return false;
+        }
+        sectorCount = partition->size / HISTORY_SECTOR_SIZE;
+        empty = true;
+        uint32_t lowest = UINT32_MAX, highest = 0;
+        for (uint32_t sector = 0; sector < sectorCount; sector++) {
+            SectorHeader header;
+            if (esp_partition_read(partition, sector * HISTORY_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+                header.magic != HISTORY_MAGIC || header.version != HISTORY_VERSION ||
+                header.generation % sectorCount != sector) {
+                continue;
+            }
+            empty = false;
+            lowest = std::min(lowest, header.generation);
+            highest = std::max(highest, header.generation);
+        }
+        nextGeneration = empty ? 0 : highest + 1;
+        if (!empty) {
+            newestGeneration = highest;
+            // the ones before a full turn of the ring were overwritten
+            oldestGeneration = highest >= sectorCount ? std::max(lowest, highest - sectorCount + 1) : lowest;
+        }
+        writable = false;
+    }
+    lastTime = empty ? 0 : findLastTime();
+    LOG_INFO("History log has %u of %u sectors", empty ? 0u : newestGeneration - oldestGeneration + 1, sectorCount);
+    return true;
+}
+
+/// @brief Appends the probes' readings taken at the given time
+/// @param time Unix time in seconds, has to be later than the previous row's and from a set clock
+/// @param count Amount of probes, rows with a different amount than the previous one start a new sector
+/// @return false if the row wasn't logged
+bool HistoryLog::append(uint32_t time, const HistorySample *samples, size_t count) {
+    std::lock_guard<std::mutex> guard(lock);
+    count = std::min(count, MAX_PROBES);
+    if (partition == nullptr || count == 0 || time < HISTORY_MIN_TIME || time <= lastTime) {
+        return false;
+    }
+    // the first byte can be shared with the previous row, its bits are left as ones so that they aren't touched
+    uint8_t buffer[HISTORY_MAX_ROW_BITS / 8 + 2];
+    memset(buffer, 0xFF, sizeof(buffer));
+    auto encoded = state;
+    BitWriter writer{buffer, bit % 8};
+    bool fitsSector = writable && probes == count && encodeRow(encoded, time, samples, count, writer) &&
+                      bit + (writer.bit - bit % 8) <= HISTORY_PAYLOAD_BITS;
+    if (!fitsSector) {
+        if (!startSector(time, count)) {
+            return false;
+        }
+        memset(buffer, 0xFF, sizeof(buffer));
+        encoded = state;
+        writer = BitWriter{buffer, 0};
+        encodeRow(encoded, time, samples, count, writer);
+    }
+    auto length = (writer.bit + 7) / 8;
+    auto offset = sectorOffset(newestGeneration) + HISTORY_HEADER_SIZE + bit / 8;
+    if (esp_partition_write(partition, offset, buffer, length) != ESP_OK) {
+        LOG_WARNING("Can't write the history log");
+        // whatever was written can't be continued reliably
+        writable = false;
+        return false;
+    }
+    auto rowBits = writer.bit - bit % 8;
+    state = encoded;
+    bit += rowBits;
+    lastTime = time;
+    stats.rows++;
+    stats.bitsStored += rowBits;
+    stats.bytesWritten += length;
+    metrics.historyRows.increment();
+    metrics.historyBytes.increment(length);
+    return true;
+}
+
+/// @brief Opens a cursor on the rows from the given time to the given time, both inclusive. The rows are read by next().
+/// @return false if there are no rows at all
+bool HistoryLog::open(HistoryCursor &cursor, uint32_t from, uint32_t to) {
+    std::lock_guard<std::mutex> guard(lock);
+    cursor = HistoryCursor();
+    cursor.from = from;
+    cursor.to = to;
+    if (partition == nullptr || empty || from > to) {
+        return false;
+    }
+    // the sectors' start times grow with their generation, the range starts in the last one starting before it
+    uint32_t low = oldestGeneration, high = newestGeneration, start = oldestGeneration;
+    while (low <= high) {
+        auto middle = low + (high - low) / 2;
+        uint32_t startTime;
+        uint8_t headerProbes;
+        if (readHeader(middle, startTime, headerProbes) && startTime > from) {
+            if (middle == 0) {
+                break;
+            }
+            high = middle - 1;
+        } else {
+            start = middle;
+            low = middle + 1;
+        }
+    }
+    return seek(cursor, start);
+}
+
+/// @brief Reads the next row of the cursor's range. Rows appended while reading are read as well, if the cursor didn't reach
+/// the end yet. A cursor left so far behind that its sector was overwritten skips to the oldest rows that are kept.
+/// @return false once there are no more rows in the range
+bool HistoryLog::next(HistoryCursor &cursor, HistoryRow &row) {
+    std::lock_guard<std::mutex> guard(lock);
+    while (!cursor.done) {
+        if (empty || cursor.generation < oldestGeneration) {
+            if (empty || !seek(cursor, oldestGeneration)) {
+                return false;
+            }
+            continue;
+        }
+        uint8_t prefix = 0;
+        while (prefix < 4 && readBits(cursor, 1) == 1) {
+            prefix++;
+        }
+        int32_t deltaOfDelta = 0;
+        bool endOfSector = false;
+        switch (prefix) {
+            case 1:
+                deltaOfDelta = signExtend(readBits(cursor, 7), 7);
+                break;
+            case 2:
+                deltaOfDelta = signExtend(readBits(cursor, 9), 9);
+                break;
+            case 3:
+                deltaOfDelta = signExtend(readBits(cursor, 12), 12);
+                break;
+            case 4: {
+                auto value = readBits(cursor, 32);
+                endOfSector = value == UINT32_MAX;
+                deltaOfDelta = static_cast<int32_t>(value);
+                break;
+            }
+            default:
+                break;
+        }
+        if (endOfSector) {
+            if (cursor.generation >= newestGeneration || !seek(cursor, cursor.generation + 1)) {
+                cursor.done = true;
+            }
+            continue;
+        }
+        auto &state = cursor.state;
+        state.delta += deltaOfDelta;
+        state.time += state.delta;
+        row.time = state.time;
+        row.probes = cursor.probes;
+        for (size_t probe = 0; probe < cursor.probes; probe++) {
+            auto &sample = row.samples[probe];
+            sample.valid = true;
+            for (auto value: {&state.humidity[probe], &state.temperature[probe]}) {
+                prefix = 0;
+                while (prefix < 4 && readBits(cursor, 1) == 1) {
+                    prefix++;
+                }
+                static constexpr uint8_t CHANGE_BITS[] = {0, 4, 8, 17};
+                if (prefix == 4) {
+                    sample.valid = false;
+                    break;
+                }
+                if (prefix > 0) {
+                    *value += signExtend(readBits(cursor, CHANGE_BITS[prefix]), CHANGE_BITS[prefix]);
+                }
+            }
+            sample.humidity = state.humidity[probe];
+            sample.temperature = state.temperature[probe];
+        }
+        if (row.time > cursor.to) {
+            cursor.done = true;
+            return false;
+        }
+        if (row.time >= cursor.from) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HistoryStats HistoryLog::getStats() {
+    std::lock_guard<std::mutex> guard(lock);
+    auto current = stats;
+    current.sectorCount = sectorCount;
+    current.sectorsUsed = empty ? 0 : newestGeneration - oldestGeneration + 1;
+    uint8_t headerProbes;
+    if (empty || !readHeader(oldestGeneration, current.oldestTime, headerProbes)) {
+        current.oldestTime = 0;
+    }
+    return current;
+}
+
+/// @brief Erases every row. The next row goes to the sector after the last one written, like it would have otherwise.
+bool HistoryLog::erase() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (partition == nullptr) {
+        return false;
+    }
+    if (esp_partition_erase_range(partition, 0, sectorCount * HISTORY_SECTOR_SIZE) != ESP_OK) {
+        return false;
+    }
+    stats.sectorErases += sectorCount;
+    metrics.historySectorErases.increment(sectorCount);
+    empty = true;
+    writable = false;
+    lastTime = 0;
+    return true;
+}
+
+uint32_t HistoryLog::sectorOffset(uint32_t generation) const {
+    return generation % sectorCount * HISTORY_SECTOR_SIZE;
+}
+
+/// @return false if the generation's sector was overwritten or its header is damaged
+bool HistoryLog::readHeader(uint32_t generation, uint32_t &startTime, uint8_t &headerProbes) {
+    SectorHeader header;
+    if (esp_partition_read(partition, sectorOffset(generation), &header, sizeof(header)) != ESP_OK ||
+        header.magic != HISTORY_MAGIC || header.version != HISTORY_VERSION || header.generation != generation ||
+        header.probes == 0 || header.probes > MAX_PROBES) {
+        return false;
+    }
+    startTime = header.startTime;
+    headerProbes = header.probes;
+    return true;
+}
+
+/// @brief Erases the sector of the next generation, overwriting the oldest one once the ring is full, and writes its header
+bool HistoryLog::startSector(uint32_t time, uint8_t count) {
+    auto generation = nextGeneration;
+    auto offset = sectorOffset(generation);
+    writable = false;
+    if (esp_partition_erase_range(partition, offset, HISTORY_SECTOR_SIZE) != ESP_OK) {
+        LOG_WARNING("Can't erase a history log sector");
+        return false;
+    }
+    stats.sectorErases++;
+    metrics.historySectorErases.increment();
+    if (empty) {
+        oldestGeneration = generation;
+    } else if (generation - oldestGeneration >= sectorCount) {
+        oldestGeneration = generation - sectorCount + 1;
+    }
+    newestGeneration = generation;
+    nextGeneration = generation + 1;
+    empty = false;
+    SectorHeader header{HISTORY_MAGIC, generation, time, count, HISTORY_VERSION, 0xFFFF};
+    if (esp_partition_write(partition, offset, &header, sizeof(header)) != ESP_OK) {
+        LOG_WARNING("Can't write a history log sector header");
+        return false;
+    }
+    stats.bitsStored += sizeof(header) * 8;
+    stats.bytesWritten += sizeof(header);
+    metrics.historyBytes.increment(sizeof(header));
+    writable = true;
+    bit = 0;
+    probes = count;
+    state = HistoryCodecState{time, 0, {}, {}};
+    return true;
+}
+
+/// @brief Decodes the newest sector to find the time of the last row written before the boot
+uint32_t HistoryLog::findLastTime() {
+    HistoryCursor cursor;
+    HistoryRow row;
+    uint32_t last = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cursor.to = UINT32_MAX;
+        if (!seek(cursor, newestGeneration)) {
+            return 0;
+        }
+        last = cursor.state.time;
+    }
+    while (next(cursor, row)) {
+        last = row.time;
+    }
+    return last;
+}
+
+/// @brief Moves the cursor to the start of the generation's sector, or the first readable one after it
+/// @return false if there's no readable sector left
+bool HistoryLog::seek(HistoryCursor &cursor, uint32_t generation) {
+    for (; generation <= newestGeneration; generation++) {
+        uint32_t startTime;
+        uint8_t headerProbes;
+        if (!readHeader(generation, startTime, headerProbes)) {
+            continue;
+        }
+        cursor.generation = generation;
+        cursor.bit = 0;
+        cursor.probes = headerProbes;
+        cursor.done = false;
+        cursor.state = HistoryCodecState{startTime, 0, {}, {}};
+        cursor.windowSize = 0;
+        return true;
+    }
+    cursor.done = true;
+    return false;
+}
+
+/// @brief Reads the window of the sector's rows starting at the byte holding the bit
+/// @return false if the bit is past the end of the sector
+bool HistoryLog::fill(HistoryCursor &cursor, uint32_t position) {
+    auto start = position / 8;
+    if (position >= HISTORY_PAYLOAD_BITS) {
+        return false;
+    }
+    auto size = std::min<uint32_t>(HISTORY_READ_WINDOW, HISTORY_PAYLOAD_BITS / 8 - start);
+    if (esp_partition_read(partition, sectorOffset(cursor.generation) + HISTORY_HEADER_SIZE + start,
+                           cursor.window.data(), size) != ESP_OK) {
+        return false;
+    }
+    cursor.windowStart = start;
+    cursor.windowSize = size;
+    return true;
+}
+
+/// @brief Reads bits MSB first, the ones past the end of the sector read as erased flash
+uint32_t HistoryLog::readBits(HistoryCursor &cursor, uint8_t count) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        auto byte = cursor.bit / 8;
+        uint32_t bitValue = 1;
+        if (byte >= cursor.windowStart && byte < cursor.windowStart + cursor.windowSize) {
+            bitValue = cursor.window[byte - cursor.windowStart] >> (7 - cursor.bit % 8) & 1;
+        } else if (fill(cursor, cursor.bit)) {
+            bitValue = cursor.window[0] >> (7 - cursor.bit % 8) & 1;
+        }
+        value = value << 1 | bitValue;
+        cursor.bit++;
+    }
+    return value;
+}
@@ -0,0 +1,228 @@
+#include "JsonEncoder.h"
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // ArduinoJson writes numbers outside of this range with an exponent
+    constexpr double POSITIVE_EXPONENT_THRESHOLD = 1e7;
+    constexpr double NEGATIVE_EXPONENT_THRESHOLD = 1e-5;
+
+    constexpr double POSITIVE_BINARY_POWERS_OF_TEN[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+    constexpr double NEGATIVE_BINARY_POWERS_OF_TEN[] = {1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256};
+    constexpr double NEGATIVE_BINARY_POWERS_OF_TEN_PLUS_ONE[] = {1e0, 1e-1, 1e-3, 1e-7, 1e-15, 1e-31, 1e-63, 1e-127,
+                                                                 1e-255};
+    constexpr uint32_t POWERS_OF_TEN[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+    /// @brief Brings the value between 1 and 1e7 (or 1e-5) by multiplying it by powers of ten, in the same steps as
+    /// ArduinoJson so that the result is rounded the same way
+    /// @return The exponent that was taken out of the value
+    int16_t normalize(double &value) {
+        int16_t powersOf10 = 0;
+        int index = 8;
+        int bit = 1 << index;
+        if (value >= POSITIVE_EXPONENT_THRESHOLD) {
+            for (; index >= 0; index--) {
+                if (value >= POSITIVE_BINARY_POWERS_OF_TEN[index]) {
+                    value *= NEGATIVE_BINARY_POWERS_OF_TEN[index];
+                    powersOf10 = static_cast<int16_t>(powersOf10 + bit);
+                }
+                bit >>= 1;
+            }
+        }
+        if (value > 0 && value <= NEGATIVE_EXPONENT_THRESHOLD) {
+            for (; index >= 0; index--) {
+                if (value < NEGATIVE_BINARY_POWERS_OF_TEN_PLUS_ONE[index]) {
+                    value *= POSITIVE_BINARY_POWERS_OF_TEN[index];
+                    powersOf10 = static_cast<int16_t>(powersOf10 - bit);
+                }
+                bit >>= 1;
+            }
+        }
+        return powersOf10;
+    }
+
+    /// @brief Writes the digits of the value right-aligned, ending right before end
+    /// @return Pointer to the first digit
+    template<typename T>
+    char *writeDigits(T value, char *end) {
+        do {
+            *--end = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        return end;
+    }
+}
+
+JsonWriter::JsonWriter(char *buffer, size_t size) : buffer(buffer), size(size) {}
+
+void JsonWriter::raw(char c) {
+    if (used >= size) {
+        overflow = true;
+        return;
+    }
+    buffer[used++] = c;
+}
+
+void JsonWriter::raw(const char *text, size_t length) {
+    if (length > size - used) {
+        overflow = true;
+        used = size;
+        return;
+    }
+    memcpy(buffer + used, text, length);
+    used += length;
+}
+
+/// @brief Writes a quoted string, escaped the way ArduinoJson does it
+void JsonWriter::string(const char *text) {
+    raw('"');
+    for (auto c = text; *c != '\0'; c++) {
+        char escaped = 0;
+        switch (*c) {
+            case '"':
+                escaped = '"';
+                break;
+            case '\\':
+                escaped = '\\';
+                break;
+            case '\b':
+                escaped = 'b';
+                break;
+            case '\f':
+                escaped = 'f';
+                break;
+            case '\n':
+                escaped = 'n';
+                break;
+            case '\r':
+                escaped = 'r';
+                break;
+            case '\t':
+                escaped = 't';
+                break;
+            default:
+                break;
+        }
+        if (escaped != 0) {
+            raw('\\');
+            raw(escaped);
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            char unicode[] = {'\\', 'u', '0', '0', "0123456789abcdef"[(*c >> 4) & 0xF], "0123456789abcdef"[*c & 0xF]};
+            raw(unicode, sizeof(unicode));
+        } else {
+            raw(*c);
+        }
+    }
+    raw('"');
+}
+
+void JsonWriter::integer(int32_t value) {
+    if (value < 0) {
+        raw('-');
+        unsignedInteger(static_cast<uint32_t>(0) - static_cast<uint32_t>(value));
+    } else {
+        unsignedInteger(static_cast<uint32_t>(value));
+    }
+}
+
+void JsonWriter::integer(int64_t value) {
+    if (value < 0) {
+        raw('-');
+        unsignedInteger(static_cast<uint64_t>(0) - static_cast<uint64_t>(value));
+    } else {
+        unsignedInteger(static_cast<uint64_t>(value));
+    }
+}
+
+void JsonWriter::unsignedInteger(uint32_t value) {
+    char digits[10];
+    auto end = digits + sizeof(digits);
+    auto begin = writeDigits(value, end);
+    raw(begin, end - begin);
+}
+
+void JsonWriter::unsignedInteger(uint64_t value) {
+    // 32-bit divisions are much cheaper on the ESP32
+    if (value <= UINT32_MAX) {
+        unsignedInteger(static_cast<uint32_t>(value));
+        return;
+    }
+    char digits[20];
+    auto end = digits + sizeof(digits);
+    auto begin = writeDigits(value, end);
+    raw(begin, end - begin);
+}
+
+/// @brief Writes a number with integer arithmetic only, the same way ArduinoJson does it: the integral part, up to
+/// decimalPlaces significant digits in total with trailing zeros removed, and an exponent for very large or small values.
+/// NaN and infinity are written as null.
+void JsonWriter::floating(double value, int8_t decimalPlaces) {
+    if (std::isnan(value) || std::isinf(value)) {
+        raw("null", 4);
+        return;
+    }
+    if (value < 0.0) {
+        raw('-');
+        value = -value;
+    }
+
+    uint32_t maxDecimalPart = POWERS_OF_TEN[decimalPlaces];
+    auto exponent = normalize(value);
+    auto integral = static_cast<uint32_t>(value);
+    // every digit of the integral part takes one of the decimal places
+    for (auto remaining = integral; remaining >= 10; remaining /= 10) {
+        maxDecimalPart /= 10;
+        decimalPlaces--;
+    }
+    double remainder = (value - static_cast<double>(integral)) * static_cast<double>(maxDecimalPart);
+    auto decimal = static_cast<uint32_t>(remainder);
+    remainder -= static_cast<double>(decimal);
+    // rounds up if the remainder is at least 0.5
+    decimal += static_cast<uint32_t>(remainder * 2);
+    if (decimal >= maxDecimalPart) {
+        decimal = 0;
+        integral++;
+        if (exponent != 0 && integral >= 10) {
+            exponent++;
+            integral = 1;
+        }
+    }
+    while (decimal % 10 == 0 && decimalPlaces > 0) {
+        decimal /= 10;
+        decimalPlaces--;
+    }
+
+    unsignedInteger(integral);
+    if (decimalPlaces > 0) {
+        // zero padded to the amount of decimal places
+        char digits[JSON_DOUBLE_DECIMAL_PLACES + 1];
+        auto end = digits + sizeof(digits);
+        auto begin = end;
+        for (int8_t i = 0; i < decimalPlaces; i++) {
+            *--begin = static_cast<char>('0' + decimal % 10);
+            decimal /= 10;
+        }
+        *--begin = '.';
+        raw(begin, end - begin);
+    }
+    if (exponent != 0) {
+        raw('e');
+        integer(static_cast<int32_t>(exponent));
+    }
+}
+
+void JsonWriter::boolean(bool value) {
+    if (value) {
+        raw("true", 4);
+    } else {
+        raw("false", 5);
+    }
+}
+
+size_t JsonWriter::length() const {
+    return used;
+}
+
+bool JsonWriter::overflowed() const {
+    return overflow;
+}
@@ -0,0 +1,337 @@
+#include "Log.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#endif
+
+// how often the background task writes out new records
+constexpr uint32_t LOG_DRAIN_INTERVAL = 100;
+// longest formatted line, longer ones are cut
+constexpr size_t LOG_LINE_LENGTH = 160;
+
+namespace {
+    static_assert((LOG_RING_CAPACITY & (LOG_RING_CAPACITY - 1)) == 0, "LOG_RING_CAPACITY must be a power of 2");
+
+    enum class ReadResult : uint8_t {
+        Ok,
+        // the record wasn't written yet, or is being written
+        NotReady,
+        // a newer record took the slot
+        Overwritten
+    };
+
+    /// @brief Slot of the ring. The sequence works like a seqlock: it's odd while a writer fills the slot and even once the
+    /// record with index (sequence / 2 - 1) is complete, so a reader can tell whether the copy it made is consistent.
+    struct Slot {
+        std::atomic<uint32_t> sequence{0};
+        LogRecord record;
+    };
+
+    std::array<Slot, LOG_RING_CAPACITY> ring;
+    // index the next record will be written at
+    std::atomic<uint32_t> head{0};
+    // index of the next record to drain, only used by the drain
+    uint32_t drained = 0;
+    std::atomic<uint32_t> lost{0};
+    Log::Sink output = nullptr;
+
+    ReadResult read(uint32_t index, LogRecord &record) {
+        auto &slot = ring[index & (LOG_RING_CAPACITY - 1)];
+        uint32_t expected = (index + 1) * 2;
+        auto before = slot.sequence.load(std::memory_order_acquire);
+        if (before != expected) {
+            return static_cast<int32_t>(before - expected) > 0 ? ReadResult::Overwritten : ReadResult::NotReady;
+        }
+        memcpy(&record, &slot.record, sizeof(LogRecord));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == expected ? ReadResult::Ok : ReadResult::Overwritten;
+    }
+
+    char levelLetter(LogLevel level) {
+        switch (level) {
+            case LogLevel::Error:
+                return 'E';
+            case LogLevel::Warning:
+                return 'W';
+            case LogLevel::Info:
+                return 'I';
+            default:
+                return 'D';
+        }
+    }
+
+    /// @brief Appends formatted text, cutting it off at the end of the buffer
+    void append(char *buffer, size_t capacity, size_t &used, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+    void append(char *buffer, size_t capacity, size_t &used, const char *format, ...) {
+        if (used + 1 >= capacity) {
+            return;
+        }
+        va_list arguments;
+        va_start(arguments, format);
+        auto written = vsnprintf(buffer + used, capacity - used, format, arguments);
+        va_end(arguments);
+        if (written > 0) {
+            used = std::min(used + written, capacity - 1);
+        }
+    }
+
+#ifdef ARDUINO
+    void drainTask(void *) {
+        while (true) {
+            Log::drain();
+            vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+        }
+    }
+#endif
+}
+
+/// @brief Sets where the records are written and, on the device, starts the task that writes them. Records logged before
+/// are kept and written too.
+/// @param sink Function writing a formatted line (including the line break), e.g. to the serial port
+void Log::begin(Sink sink) {
+    output = sink;
+#ifdef ARDUINO
+    static TaskHandle_t task = nullptr;
+    if (task == nullptr) {
+        // lowest priority, writing at 9600 baud can take long and nothing should wait for it
+        xTaskCreate(drainTask, "log", 3072, nullptr, 1, &task);
+    }
+#endif
+}
+
+/// @brief Formats and writes every record logged since the last call. Called by the background task on the device, has to
+/// be called manually elsewhere. Must only be called from one task.
+void Log::drain() {
+    char line[LOG_LINE_LENGTH];
+    LogRecord record;
+    while (drained != head.load(std::memory_order_acquire)) {
+        // records that were overwritten before being drained are lost
+        auto newest = head.load(std::memory_order_acquire);
+        if (newest - drained > LOG_RING_CAPACITY) {
+            lost.fetch_add(newest - LOG_RING_CAPACITY - drained, std::memory_order_relaxed);
+            drained = newest - LOG_RING_CAPACITY;
+        }
+        auto result = read(drained, record);
+        if (result == ReadResult::NotReady) {
+            return;
+        }
+        drained++;
+        if (result == ReadResult::Overwritten) {
+            lost.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        auto length = format(record, line, sizeof(line));
+        if (output) {
+            output(line, length);
+        }
+    }
+}
+
+/// @brief Writes the most recent records that fit in the buffer, oldest first, one per line
+/// @return Length of the written text
+size_t Log::writeRecent(char *buffer, size_t capacity) {
+    char line[LOG_LINE_LENGTH];
+    LogRecord record;
+    auto newest = head.load(std::memory_order_acquire);
+    auto oldest = newest > LOG_RING_CAPACITY ? newest - LOG_RING_CAPACITY : 0;
+
+    // find the oldest record for which there's room, counting from the newest one
+    auto first = newest;
+    size_t needed = 0;
+    while (first > oldest) {
+        if (read(first - 1, record) == ReadResult::Ok) {
+            auto length = format(record, line, sizeof(line));
+            if (needed + length >= capacity) {
+                break;
+            }
+            needed += length;
+        }
+        first--;
+    }
+
+    size_t used = 0;
+    for (auto index = first; index != newest; index++) {
+        if (read(index, record) != ReadResult::Ok) {
+            continue;
+        }
+        auto length = format(record, line, sizeof(line));
+        // a record might have been replaced with a longer one in the meantime
+        if (used + length >= capacity) {
+            break;
+        }
+        memcpy(buffer + used, line, length);
+        used += length;
+    }
+    if (capacity > 0) {
+        buffer[used] = '\0';
+    }
+    return used;
+}
+
+/// @brief Formats a record into a line like "[   12345][I] TCP set up\n". Conversions in the format string only mark where
+/// the arguments go, every argument is formatted according to its own type, so e.g. passing an IPAddress to %s prints
+/// the address. Flags, width and precision are kept.
+/// @return Length of the line
+size_t Log::format(const LogRecord &record, char *buffer, size_t capacity) {
+    size_t used = 0;
+    append(buffer, capacity, used, "[%8lu][%c] ", static_cast<unsigned long>(record.timestamp),
+           levelLetter(record.site->level));
+
+    size_t argument = 0;
+    for (auto c = record.site->format; *c != '\0'; c++) {
+        if (*c != '%') {
+            append(buffer, capacity, used, "%c", *c);
+            continue;
+        }
+        if (c[1] == '%') {
+            append(buffer, capacity, used, "%%");
+            c++;
+            continue;
+        }
+        // copy the flags, width and precision, skip the length modifiers and the conversion
+        char spec[16] = "%";
+        size_t specLength = 1;
+        auto end = c + 1;
+        while (strchr("-+ #0123456789.", *end) != nullptr && *end != '\0') {
+            if (specLength < sizeof(spec) - 4) {
+                spec[specLength++] = *end;
+            }
+            end++;
+        }
+        while (strchr("hljztL", *end) != nullptr && *end != '\0') {
+            end++;
+        }
+        char conversion = *end;
+        if (conversion == '\0') {
+            break;
+        }
+        c = end;
+        if (argument == record.argumentCount) {
+            append(buffer, capacity, used, "<?>");
+            continue;
+        }
+
+        auto &value = record.arguments[argument++];
+        switch (value.type) {
+            case LogArgumentType::Signed:
+                strcpy(spec + specLength, "ld");
+                append(buffer, capacity, used, spec, static_cast<long>(value.i));
+                break;
+            case LogArgumentType::Unsigned:
+                strcpy(spec + specLength, conversion == 'x' || conversion == 'X' ? (conversion == 'x' ? "lx" : "lX") : "lu");
+                append(buffer, capacity, used, spec, static_cast<unsigned long>(value.u));
+                break;
+            case LogArgumentType::Float:
+                strcpy(spec + specLength, "f");
+                append(buffer, capacity, used, spec, static_cast<double>(value.f));
+                break;
+            case LogArgumentType::Text:
+                strcpy(spec + specLength, ".*s");
+                append(buffer, capacity, used, spec, static_cast<int>(value.textLength), record.text.data() + value.u);
+                break;
+            case LogArgumentType::Address:
+                append(buffer, capacity, used, "%u.%u.%u.%u", value.u & 0xFF, (value.u >> 8) & 0xFF,
+                       (value.u >> 16) & 0xFF, value.u >> 24);
+                break;
+        }
+    }
+    if (record.suppressed > 0) {
+        append(buffer, capacity, used, " (%lu similar messages suppressed)", static_cast<unsigned long>(record.suppressed));
+    }
+    // the line break is always there, even if the message was cut
+    if (used + 1 >= capacity) {
+        used = capacity - 2;
+    }
+    buffer[used++] = '\n';
+    buffer[used] = '\0';
+    return used;
+}
+
+/// @brief Gets the amount of records overwritten before they were drained
+uint32_t Log::getLost() {
+    return lost.load(std::memory_order_relaxed);
+}
+
+/// @brief Applies the call site's rate limit
+/// @param suppressed Set to the amount of records left out since the last admitted one
+/// @return false if the record should be left out
+bool Log::admit(LogSite &site, uint32_t &suppressed) {
+    auto time = now();
+    auto windowStart = site.windowStart.load(std::memory_order_relaxed);
+    if (time - windowStart >= LOG_SITE_WINDOW &&
+        site.windowStart.compare_exchange_strong(windowStart, time, std::memory_order_relaxed)) {
+        site.inWindow.store(0, std::memory_order_relaxed);
+    }
+    if (site.inWindow.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_BURST) {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+uint32_t Log::now() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/// @brief Claims the next slot and marks it as being written. Never blocks, a slow drain only loses the oldest records.
+/// @param index Set to the index of the record, which has to be passed to publish()
+LogRecord &Log::claim(uint32_t &index) {
+    index = head.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = ring[index & (LOG_RING_CAPACITY - 1)];
+    slot.sequence.store((index + 1) * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return slot.record;
+}
+
+/// @brief Marks the claimed record as complete
+void Log::publish(uint32_t index) {
+    ring[index & (LOG_RING_CAPACITY - 1)].sequence.store((index + 1) * 2, std::memory_order_release);
+}
+
+void Log::capture(LogRecord &record, double value) {
+    auto &argument = record.arguments[record.argumentCount++];
+    argument.type = LogArgumentType::Float;
+    argument.f = static_cast<float>(value);
+}
+
+void Log::capture(LogRecord &record, std::string_view value) {
+    auto &argument = record.arguments[record.argumentCount++];
+    auto length = std::min(value.size(), LOG_TEXT_LENGTH - record.textUsed);
+    memcpy(record.text.data() + record.textUsed, value.data(), length);
+    argument.type = LogArgumentType::Text;
+    argument.u = record.textUsed;
+    argument.textLength = length;
+    record.textUsed += length;
+}
+
+void Log::capture(LogRecord &record, const char *value) {
+    capture(record, std::string_view(value == nullptr ? "(null)" : value));
+}
+
+#ifdef ARDUINO
+
+void Log::capture(LogRecord &record, const String &value) {
+    capture(record, std::string_view(value.c_str(), value.length()));
+}
+
+void Log::capture(LogRecord &record, const IPAddress &value) {
+    auto &argument = record.arguments[record.argumentCount++];
+    argument.type = LogArgumentType::Address;
+    argument.u = static_cast<uint32_t>(value);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "Metrics.h"
+#include <cstdarg>
+#include <cstdio>
+
+FirmwareMetrics metrics;
+
+MetricsWriter::MetricsWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+    if (capacity > 0) {
+        buffer[0] = '\0';
+    }
+}
+
+void MetricsWriter::counter(const char *name, uint32_t value) {
+    type(name, "counter");
+    sample(name, nullptr, value);
+}
+
+void MetricsWriter::gauge(const char *name, int32_t value) {
+    type(name, "gauge");
+    append("%s %ld\n", name, static_cast<long>(value));
+}
+
+/// @brief Writes the TYPE line, which has to precede the metric's samples
+void MetricsWriter::type(const char *name, const char *type) {
+    append("# TYPE %s %s\n", name, type);
+}
+
+/// @brief Writes a single sample line
+/// @param labels Labels without the braces (e.g. client="3"), or nullptr
+void MetricsWriter::sample(const char *name, const char *labels, uint32_t value) {
+    if (labels == nullptr) {
+        append("%s %lu\n", name, static_cast<unsigned long>(value));
+    } else {
+        append("%s{%s} %lu\n", name, labels, static_cast<unsigned long>(value));
+    }
+}
+
+/// @brief Gets the length of the written text, not including the terminating null
+size_t MetricsWriter::length() const {
+    return used;
+}
+
+/// @brief Checks whether some lines were left out because the buffer was full
+bool MetricsWriter::truncated() const {
+    return overflowed;
+}
+
+void MetricsWriter::append(const char *format, ...) {
+    if (overflowed || used >= capacity) {
+        overflowed = true;
+        return;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    auto written = vsnprintf(buffer + used, capacity - used, format, arguments);
+    va_end(arguments);
+    if (written < 0 || static_cast<size_t>(written) >= capacity - used) {
+        // the line was cut off, it's removed so that the next line can't be glued to it either
+        buffer[used] = '\0';
+        overflowed = true;
+        return;
+    }
+    used += written;
+}
@@ -0,0 +1,168 @@
+#include "ProbeFrame.h"
+
+/// @brief Converts the value to a float
+float FixedDecimal::toFloat() const {
+    return static_cast<float>(hundredths) / 100.0f;
+}
+
+/// @brief Parses a decimal number like " 45.32", "+23.4" or "-5" without using atof. Surrounding spaces are allowed,
+/// digits past the second decimal place are rounded.
+/// @param text Text to parse
+/// @return FixedDecimal whose valid field is false if the text isn't a number (the probe sends e.g. "---.-" when a value is unavailable)
+FixedDecimal FixedDecimal::parse(std::string_view text) {
+    constexpr FixedDecimal invalid{0, false};
+    // more digits than that would overflow, and the probe never sends values that large
+    constexpr uint8_t MAX_INTEGER_DIGITS = 7;
+
+    size_t i = 0;
+    while (i < text.size() && text[i] == ' ') {
+        i++;
+    }
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+')) {
+        negative = text[i] == '-';
+        i++;
+    }
+
+    int32_t integerPart = 0;
+    uint8_t integerDigits = 0;
+    while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+        if (++integerDigits > MAX_INTEGER_DIGITS) {
+            return invalid;
+        }
+        integerPart = integerPart * 10 + (text[i] - '0');
+        i++;
+    }
+
+    int32_t fraction = 0;
+    uint8_t fractionDigits = 0;
+    bool roundUp = false;
+    if (i < text.size() && text[i] == '.') {
+        i++;
+        while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+            if (fractionDigits < 2) {
+                fraction = fraction * 10 + (text[i] - '0');
+            } else if (fractionDigits == 2) {
+                roundUp = text[i] >= '5';
+            }
+            fractionDigits++;
+            i++;
+        }
+    }
+    if (integerDigits == 0 && fractionDigits == 0) {
+        return invalid;
+    }
+    if (fractionDigits == 1) {
+        fraction *= 10;
+    }
+
+    while (i < text.size() && text[i] == ' ') {
+        i++;
+    }
+    if (i != text.size()) {
+        return invalid;
+    }
+
+    int32_t value = integerPart * 100 + fraction + (roundUp ? 1 : 0);
+    return FixedDecimal{negative ? -value : value, true};
+}
+
+/// @brief Checks whether both humidity and temperature were read successfully
+bool ProbeReading::valid() const {
+    return status == ProbeFrameStatus::Ok;
+}
+
+/// @brief Discards collected bytes so that the buffer can be reused for the next response
+void ProbeFrame::clear() {
+    used = 0;
+    fieldsFound = 0;
+    overflowed = false;
+}
+
+/// @brief Appends a byte to the frame
+/// @return false if the frame is already full, in which case the byte is dropped and the frame will fail to parse
+bool ProbeFrame::push(char c) {
+    if (used == buffer.size()) {
+        overflowed = true;
+        return false;
+    }
+    buffer[used++] = c;
+    return true;
+}
+
+/// @brief Splits the collected bytes into fields and reads humidity and temperature from them
+/// @return ProbeReading with a status telling why the frame was rejected, if it was
+ProbeReading ProbeFrame::parse() {
+    ProbeReading reading{{0, false}, {0, false}, ProbeFrameStatus::Ok};
+    fieldsFound = 0;
+    if (used == 0) {
+        reading.status = ProbeFrameStatus::Empty;
+        return reading;
+    }
+    if (overflowed) {
+        reading.status = ProbeFrameStatus::Overflow;
+        return reading;
+    }
+    // length of the frame is constant, doing a check to avoid processing truncated responses
+    if (used != PROBE_FRAME_LENGTH) {
+        reading.status = ProbeFrameStatus::WrongLength;
+        return reading;
+    }
+
+    split();
+    if (fieldsFound <= TEMPERATURE_FIELD) {
+        reading.status = ProbeFrameStatus::MissingFields;
+        return reading;
+    }
+    reading.humidity = decimalField(HUMIDITY_FIELD);
+    reading.temperature = decimalField(TEMPERATURE_FIELD);
+    if (!reading.humidity.valid) {
+        reading.status = ProbeFrameStatus::InvalidHumidity;
+    } else if (!reading.temperature.valid) {
+        reading.status = ProbeFrameStatus::InvalidTemperature;
+    }
+    return reading;
+}
+
+/// @brief Gets the amount of bytes collected so far
+size_t ProbeFrame::length() const {
+    return used;
+}
+
+/// @brief Gets the amount of fields found by the last parse()
+size_t ProbeFrame::fieldCount() const {
+    return fieldsFound;
+}
+
+/// @brief Gets the raw text of a field. The view points into the frame, so it's only valid until the frame is cleared.
+/// @param index Index of the field, 0 being the response header
+/// @return Text of the field or an empty view if there's no such field
+std::string_view ProbeFrame::field(size_t index) const {
+    if (index >= fieldsFound) {
+        return {};
+    }
+    return {buffer.data() + fields[index].start, fields[index].length};
+}
+
+/// @brief Parses a field as a decimal number
+/// @param index Index of the field, 0 being the response header
+FixedDecimal ProbeFrame::decimalField(size_t index) const {
+    if (index >= fieldsFound) {
+        return FixedDecimal{0, false};
+    }
+    return FixedDecimal::parse(field(index));
+}
+
+/// @brief Finds the fields separated by semicolons. Empty fields are skipped the same way strtok() skips them, so field
+/// indices stay the same as the ones the probe documentation (and the previous strtok() based parser) uses.
+void ProbeFrame::split() {
+    uint8_t start = 0;
+    for (uint8_t i = 0; i <= used && fieldsFound < fields.size(); i++) {
+        if (i == used || buffer[i] == ';') {
+            if (i > start) {
+                fields[fieldsFound++] = FieldSpan{start, static_cast<uint8_t>(i - start)};
+            }
+            start = i + 1;
+        }
+    }
+}
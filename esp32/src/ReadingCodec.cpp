@@ -0,0 +1,113 @@
+#include "ReadingCodec.h"
+#include <cstring>
+
+namespace {
+    void writeU16(uint8_t *out, uint16_t value) {
+        out[0] = value & 0xFF;
+        out[1] = value >> 8;
+    }
+
+    void writeU32(uint8_t *out, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            out[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    uint16_t readU16(const uint8_t *in) {
+        return in[0] | (in[1] << 8);
+    }
+
+    uint32_t readU32(const uint8_t *in) {
+        return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+               (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+}
+
+/// @brief Calculates CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+uint16_t crc16(const uint8_t *data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/// @brief Encodes a record into its binary form
+/// @param record Record to encode
+/// @param out Buffer of at least BINARY_RECORD_SIZE bytes
+/// @return Amount of bytes written
+size_t encodeBinaryRecord(const StreamRecord &record, uint8_t *out) {
+    out[0] = BINARY_RECORD_MAGIC;
+    out[1] = BINARY_RECORD_TYPE_READING;
+    out[2] = (record.valid ? BINARY_RECORD_FLAG_VALID : 0) | (record.probe << BINARY_RECORD_PROBE_SHIFT);
+    writeU32(out + 3, record.sequence);
+    writeU32(out + 7, record.uptime);
+    writeU16(out + 11, static_cast<uint16_t>(record.humidity));
+    writeU16(out + 13, static_cast<uint16_t>(record.temperature));
+    out[15] = static_cast<uint8_t>(record.rssi);
+    writeU16(out + 16, record.interval);
+    writeU16(out + 18, crc16(out, BINARY_RECORD_SIZE - 2));
+    return BINARY_RECORD_SIZE;
+}
+
+/// @brief Decodes a binary record
+/// @param in BINARY_RECORD_SIZE bytes to decode
+/// @param record Decoded record, left untouched if decoding fails
+/// @return false if the magic byte, record type or checksum don't match
+bool decodeBinaryRecord(const uint8_t *in, StreamRecord &record) {
+    if (in[0] != BINARY_RECORD_MAGIC || in[1] != BINARY_RECORD_TYPE_READING) {
+        return false;
+    }
+    if (readU16(in + 18) != crc16(in, BINARY_RECORD_SIZE - 2)) {
+        return false;
+    }
+    record.valid = in[2] & BINARY_RECORD_FLAG_VALID;
+    record.probe = in[2] >> BINARY_RECORD_PROBE_SHIFT;
+    record.sequence = readU32(in + 3);
+    record.uptime = readU32(in + 7);
+    record.humidity = static_cast<int16_t>(readU16(in + 11));
+    record.temperature = static_cast<int16_t>(readU16(in + 13));
+    record.rssi = static_cast<int8_t>(in[15]);
+    record.interval = readU16(in + 16);
+    return true;
+}
+
+/// @brief Feeds a single byte received from the stream
+/// @param byte Received byte
+/// @param record Set to the decoded record when the function returns true
+/// @return true if the byte completed a valid record
+bool BinaryRecordDecoder::push(uint8_t byte, StreamRecord &record) {
+    if (used == 0 && byte != BINARY_RECORD_MAGIC) {
+        droppedBytes++;
+        return false;
+    }
+    buffer[used++] = byte;
+    if (used < BINARY_RECORD_SIZE) {
+        return false;
+    }
+    if (decodeBinaryRecord(buffer.data(), record)) {
+        used = 0;
+        return true;
+    }
+    resync();
+    return false;
+}
+
+/// @brief Gets the amount of bytes skipped because they weren't part of a valid record
+uint32_t BinaryRecordDecoder::getDroppedBytes() const {
+    return droppedBytes;
+}
+
+/// @brief Drops the first byte of a corrupted record and moves the buffer to the next potential start of a record
+void BinaryRecordDecoder::resync() {
+    size_t next = 1;
+    while (next < used && buffer[next] != BINARY_RECORD_MAGIC) {
+        next++;
+    }
+    droppedBytes += next;
+    memmove(buffer.data(), buffer.data() + next, used - next);
+    used -= next;
+}
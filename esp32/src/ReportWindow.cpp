@@ -0,0 +1,98 @@
+#include "ReportWindow.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+    /// @brief Rounds a statistic to the hundredths readings are taken in, so the JSON isn't padded with noise
+    float hundredths(float value) {
+        return roundf(value * 100) / 100;
+    }
+}
+
+void RunningStats::add(float value) {
+    count++;
+    if (count == 1) {
+        min = max = mean = value;
+        m2 = 0.0f;
+        return;
+    }
+    min = std::min(min, value);
+    max = std::max(max, value);
+    auto delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+}
+
+void RunningStats::clear() {
+    *this = RunningStats();
+}
+
+uint32_t RunningStats::getCount() const {
+    return count;
+}
+
+float RunningStats::getMin() const {
+    return min;
+}
+
+float RunningStats::getMax() const {
+    return max;
+}
+
+float RunningStats::getMean() const {
+    return mean;
+}
+
+/// @brief Gets the population standard deviation, 0 for less than two values
+float RunningStats::getStddev() const {
+    return count > 1 ? sqrtf(m2 / count) : 0.0f;
+}
+
+/// @brief Folds a reading into the window and decides whether it's reported
+/// @return true if the reading has to be reported along with summary(), after which nextWindow() has to be called with it
+bool ReportWindow::add(const StreamRecord &record, const ReportThresholds &thresholds) {
+    if (!started) {
+        startedAt = record.uptime;
+        started = true;
+    }
+    if (record.valid) {
+        humidity.add(record.humidity / 100.0f);
+        temperature.add(record.temperature / 100.0f);
+    }
+    // the first reading, a change of validity and a heartbeat are reported whatever the values
+    if (!reported || record.valid != reportedValid || record.uptime - reportedAt >= thresholds.heartbeat * 1000u) {
+        return true;
+    }
+    return record.valid && (abs(record.humidity - reportedHumidity) > thresholds.humidityDeadband ||
+                            abs(record.temperature - reportedTemperature) > thresholds.temperatureDeadband);
+}
+
+/// @brief Remembers the reading as the reported one and starts a new window
+void ReportWindow::nextWindow(const StreamRecord &record) {
+    reported = true;
+    reportedHumidity = record.humidity;
+    reportedTemperature = record.temperature;
+    reportedValid = record.valid;
+    reportedAt = record.uptime;
+    humidity.clear();
+    temperature.clear();
+    started = false;
+}
+
+/// @brief Starts over as if nothing was reported yet, so that the next reading is
+void ReportWindow::reset() {
+    *this = ReportWindow();
+}
+
+/// @brief Gets the statistics of the readings added since the last report, including the one being reported
+WindowMessage ReportWindow::summary() const {
+    return WindowMessage{
+            humidity.getCount(),
+            startedAt,
+            {hundredths(humidity.getMin()), hundredths(humidity.getMax()), hundredths(humidity.getMean()),
+             hundredths(humidity.getStddev())},
+            {hundredths(temperature.getMin()), hundredths(temperature.getMax()), hundredths(temperature.getMean()),
+             hundredths(temperature.getStddev())}
+    };
+}
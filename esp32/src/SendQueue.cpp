@@ -0,0 +1,174 @@
+#include "SendQueue.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+FrameRef::FrameRef(const FrameRef &other) : block(other.block) {
+    if (block) {
+        block->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+FrameRef::FrameRef(FrameRef &&other) noexcept: block(other.block) {
+    other.block = nullptr;
+}
+
+FrameRef &FrameRef::operator=(FrameRef other) noexcept {
+    std::swap(block, other.block);
+    return *this;
+}
+
+FrameRef::~FrameRef() {
+    release();
+}
+
+/// @brief Allocates a frame holding a copy of the data. The header and the data share a single allocation.
+/// @return Reference to the frame, empty if the allocation failed
+FrameRef FrameRef::copyOf(const uint8_t *data, size_t size) {
+    FrameRef frame;
+    void *memory = malloc(sizeof(Block) + size);
+    if (!memory) {
+        return frame;
+    }
+    frame.block = new(memory) Block{{1}, size, size};
+    memcpy(reinterpret_cast<uint8_t *>(frame.block + 1), data, size);
+    return frame;
+}
+
+/// @brief Allocates an empty frame that can be filled with rewrite(), so that a message sent over and over doesn't need an
+/// allocation every time
+/// @return Reference to the frame, empty if the allocation failed
+FrameRef FrameRef::withCapacity(size_t capacity) {
+    FrameRef frame;
+    void *memory = malloc(sizeof(Block) + capacity);
+    if (!memory) {
+        return frame;
+    }
+    frame.block = new(memory) Block{{1}, 0, capacity};
+    return frame;
+}
+
+/// @brief Replaces the content of the frame. Frames are immutable once they're shared, so it only works while this is the
+/// only reference to it, i.e. when the previous content was sent.
+/// @return false if the frame is shared, empty or too small for the data
+bool FrameRef::rewrite(const uint8_t *data, size_t size) {
+    if (!block || size > block->capacity || block->references.load(std::memory_order_acquire) != 1) {
+        return false;
+    }
+    memcpy(reinterpret_cast<uint8_t *>(block + 1), data, size);
+    block->size = size;
+    return true;
+}
+
+const uint8_t *FrameRef::data() const {
+    return block ? reinterpret_cast<const uint8_t *>(block + 1) : nullptr;
+}
+
+size_t FrameRef::size() const {
+    return block ? block->size : 0;
+}
+
+FrameRef::operator bool() const {
+    return block != nullptr;
+}
+
+void FrameRef::release() {
+    if (block && block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block->~Block();
+        free(block);
+    }
+    block = nullptr;
+}
+
+/// @brief Adds a frame to the queue, applying the overflow policy if the queue is out of frame slots or bytes
+/// @return Evicted if the frame was queued in place of older ones, Dropped if it wasn't queued, Disconnect if the policy
+/// says the client should be disconnected, in which case the frame isn't queued either
+EnqueueResult SendQueue::push(const FrameRef &frame) {
+    auto overflows = [this, &frame]() {
+        return !fits(frame.size());
+    };
+    auto result = EnqueueResult::Queued;
+    if (overflows()) {
+        if (policy == QueueOverflowPolicy::Disconnect) {
+            stats.droppedFrames++;
+            return EnqueueResult::Disconnect;
+        }
+        if (policy == QueueOverflowPolicy::CoalesceToLatest) {
+            while (dropUnstarted()) {}
+        } else {
+            while (overflows() && dropUnstarted()) {}
+        }
+        // only a partially sent frame is left and there's still no space for the new one
+        if (overflows()) {
+            stats.droppedFrames++;
+            return EnqueueResult::Dropped;
+        }
+        result = EnqueueResult::Evicted;
+    }
+    frames[(head + count) % frames.size()] = frame;
+    count++;
+    stats.queuedBytes += frame.size();
+    return result;
+}
+
+/// @brief Drops all queued frames, used when the client disconnects
+void SendQueue::clear() {
+    while (count > 0) {
+        popFront();
+    }
+    stats.queuedBytes = 0;
+}
+
+bool SendQueue::empty() const {
+    return count == 0;
+}
+
+/// @brief Checks whether a frame of the given size can be queued without the overflow policy dropping anything
+bool SendQueue::fits(size_t bytes) const {
+    return count < frames.size() && stats.queuedBytes + bytes <= maxBytes;
+}
+
+void SendQueue::setPolicy(QueueOverflowPolicy newPolicy) {
+    policy = newPolicy;
+}
+
+/// @brief Sets the bytes the queue holds at most, SEND_QUEUE_MAX_BYTES by default
+void SendQueue::setMaxBytes(size_t bytes) {
+    maxBytes = bytes;
+}
+
+const SendQueueStats &SendQueue::getStats() const {
+    return stats;
+}
+
+void SendQueue::popFront() {
+    frames[head] = FrameRef();
+    head = (head + 1) % frames.size();
+    count--;
+    headOffset = 0;
+}
+
+/// @brief Drops the oldest frame that hasn't started being sent
+/// @return false if there was no such frame
+bool SendQueue::dropUnstarted() {
+    auto index = firstUnstarted();
+    if (index == count) {
+        return false;
+    }
+    auto &frame = frames[(head + index) % frames.size()];
+    stats.queuedBytes -= frame.size();
+    stats.droppedFrames++;
+    // shift the newer frames one slot towards the dropped one to keep the order
+    for (auto i = index; i + 1 < count; i++) {
+        frames[(head + i) % frames.size()] = std::move(frames[(head + i + 1) % frames.size()]);
+    }
+    frames[(head + count - 1) % frames.size()] = FrameRef();
+    count--;
+    return true;
+}
+
+/// @brief Gets the index (relative to the head) of the first frame that no byte of was sent yet
+size_t SendQueue::firstUnstarted() const {
+    return (count > 0 && headOffset > 0) ? 1 : 0;
+}
@@ -1,82 +1,221 @@
 #include <Arduino.h>
+#include <climits>
 #include <utility>
 #include <Sensor.h>
-#include <ArduinoJson.h>
+#include "JsonEncoder.h"
+#include "Metrics.h"
+
+// the probe sometimes doesn't answer at all, 500ms is the same amount of time the old blocking read waited (5 retries, 100ms each)
+constexpr unsigned long RESPONSE_TIMEOUT = 500;
+constexpr unsigned long NO_DEMAND = ULONG_MAX;
+
+namespace {
+    struct SensorDataMessage {
+        float humidity;
+        float temperature;
+    };
+}
+
+template<>
+struct JsonSchema<SensorDataMessage> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("humidity", &SensorDataMessage::humidity),
+            jsonField("temperature", &SensorDataMessage::temperature));
+};
 
-Sensor::Sensor(int uartNr, int rxPin, int txPin) : serial(HardwareSerial(uartNr)) {
+Sensor::Sensor(int uartNr, int rxPin, int txPin, unsigned long pollInterval, unsigned long maxAge)
+        : serial(HardwareSerial(uartNr)), pollInterval(pollInterval), maxAge(maxAge), demandedAge(NO_DEMAND) {
     serial.begin(19200, SERIAL_8N1, rxPin, txPin);
 }
 
-/// @brief Gets data from the sensor
-/// @return std::pair where the first item is the humidity and the second item is the temperature
-std::pair<float, float> Sensor::getSensorData() {
-    String rawSensorResponse = readSensorData();
-    return processSensorData(rawSensorResponse);
+/// @brief Drives the acquisition state machine: sends a request to the probe every poll interval or when a consumer needs
+/// a fresher reading, and collects the response byte by byte without ever waiting for it. Must be used in loop() function
+/// in main.cpp.
+void Sensor::loop() {
+    switch (state) {
+        case State::Idle:
+            if (!requestedOnce || millis() - polledAt >= pollInterval.load(std::memory_order_relaxed)) {
+                polledAt = millis();
+                sendRequest();
+            } else if (demandPending()) {
+                metrics.sensorDemandReads.increment();
+                sendRequest();
+            }
+            break;
+        case State::AwaitingResponse:
+            collectResponse();
+            break;
+    }
 }
 
-/// @brief Gets data from the sensor and parses it into a JSON string
-/// @return JSON string containing current sensor reading.
-String Sensor::getJsonString() {
-    auto data = getSensorData();
-    JsonDocument doc;
-    doc["humidity"] = data.first;
-    doc["temperature"] = data.second;
-    String stringified;
-    serializeJson(doc, stringified);
-    return stringified;
+/// @brief Gets the time at which loop() has something to do even if no data arrives from the probe
+/// @return Time in milliseconds, as returned by millis()
+unsigned long Sensor::nextDeadline() const {
+    if (!requestedOnce) {
+        return millis();
+    }
+    if (state == State::AwaitingResponse) {
+        return requestSentAt + RESPONSE_TIMEOUT;
+    }
+    if (demandedAge.load(std::memory_order_relaxed) != NO_DEMAND) {
+        return millis();
+    }
+    return polledAt + pollInterval.load(std::memory_order_relaxed);
 }
 
-/// @brief Reads data from the sensor
-/// @return Unprocessed String returned by the sensor
-String Sensor::readSensorData() {
-    serial.println("{F99RDD}\r\n");
+/// @brief Sets the function called (from the UART driver's task) when data arrives from the probe
+void Sensor::onReceive(void (*callback)()) {
+    serial.onReceive(callback);
+}
 
-    char receivedChar;
-    String receivedMessage = "";
+/// @brief Sets the function called by loop() after a reading has been published, e.g. to wake up the task that calls
+/// takeReadings() when loop() runs on another core
+void Sensor::onPublish(void (*callback)()) {
+    publishCallback = callback;
+}
 
-    // sometimes the sensor returns an empty string, so retries are there just to make sure you actually get something if its connected
-    byte retries = 0;
-    while (retries < 5) {
-        while (serial.available() > 0) {
-            char receivedChar = serial.read();
+/// @brief Sets the function called by requestReading(), e.g. to wake up the task that calls loop()
+void Sensor::onDemand(void (*callback)()) {
+    demandCallback = callback;
+}
 
-            if (receivedChar == 0xD) {
-                return receivedMessage;
-            } else {
-                receivedMessage += receivedChar;
-            }
-        }
-        retries += 1;
-        delay(100);
+/// @brief Sets the time between consecutive requests sent to the probe. Safe to call from any task.
+/// @param interval Interval in milliseconds
+void Sensor::setPollInterval(unsigned long interval) {
+    pollInterval.store(interval, std::memory_order_relaxed);
+}
+
+/// @brief Sets the age up to which consumers serve the latest reading instead of asking for a fresh one with
+/// requestReading(). Safe to call from any task.
+/// @param age Age in milliseconds
+void Sensor::setMaxAge(unsigned long age) {
+    maxAge.store(age, std::memory_order_relaxed);
+}
+
+unsigned long Sensor::getMaxAge() const {
+    return maxAge.load(std::memory_order_relaxed);
+}
+
+/// @brief Asks loop() for a reading at most maxAge milliseconds old. Only one request is ever in flight: every demand
+/// made before it completes is met by it, so concurrent consumers share a single transaction with the probe. The reading
+/// is published like any other. Safe to call from any task.
+void Sensor::requestReading(unsigned long maxAge) {
+    auto demanded = demandedAge.load(std::memory_order_relaxed);
+    while (maxAge < demanded && !demandedAge.compare_exchange_weak(demanded, maxAge, std::memory_order_relaxed)) {}
+    if (demandCallback) {
+        demandCallback();
     }
+}
+
+/// @brief Takes the readings published by loop() since the last call, so that they're returned by getLatestReading().
+/// Must only be called by one task, the one that serves the readings (which may be different from the one running loop()).
+/// @return true if there was a new reading
+bool Sensor::takeReadings() {
+    return readings.poll();
+}
 
-    return receivedMessage;
+/// @brief Gets the most recent reading taken by takeReadings(). Doesn't communicate with the probe.
+/// @return SensorReading with the time at which it was taken. valid is false if the last transaction with the probe failed.
+SensorReading Sensor::getLatestReading() const {
+    return readings.latest();
 }
 
-/// @brief Processes raw String returned by the sensor
-/// @param sensorData String returned by the sensor
+/// @brief Gets the most recent data received from the sensor
 /// @return std::pair where the first item is the humidity and the second item is the temperature
-std::pair<float, float> Sensor::processSensorData(String &sensorData) {
-    // length of the string is constant, doing a check to avoid processing empty strings that sometimes get passed
-    if (sensorData.length() != 94) {
+std::pair<float, float> Sensor::getSensorData() {
+    auto &latest = readings.latest();
+    if (!latest.valid) {
         return std::make_pair(0.0f, 0.0f);
     }
-    char *data = new char[sensorData.length() + 1];
-    strcpy(data, sensorData.c_str());
+    return std::make_pair(latest.humidity, latest.temperature);
+}
 
-    char *split = strtok(data, ";");
+/// @brief Gets the most recent data received from the sensor and parses it into a JSON string
+/// @return JSON string containing current sensor reading.
+String Sensor::getJsonString() {
+    auto data = getSensorData();
+    char json[64];
+    auto length = encodeJson(SensorDataMessage{data.first, data.second}, json, sizeof(json) - 1);
+    json[length] = '\0';
+    return json;
+}
 
-    split = strtok(NULL, ";");
+/// @brief Gets the frame the latest reading was parsed from, so that fields other than humidity and temperature can be read.
+/// Only to be used by the task running loop().
+/// @return ProbeFrame that stays the same until the next response is received
+const ProbeFrame &Sensor::getLatestFrame() const {
+    return latestFrame;
+}
 
-    float humidity = atof(split);
+/// @brief Checks whether a consumer asked for a reading fresher than the latest one. A demand the latest reading already
+/// meets, e.g. because it was in flight when the demand was made, is dropped.
+bool Sensor::demandPending() {
+    auto demanded = demandedAge.load(std::memory_order_relaxed);
+    if (demanded == NO_DEMAND) {
+        return false;
+    }
+    if (millis() - lastPublished.timestamp > demanded) {
+        return true;
+    }
+    demandedAge.compare_exchange_strong(demanded, NO_DEMAND, std::memory_order_relaxed);
+    return false;
+}
 
-    for (int i = 0; i < 4; i++) {
-        split = strtok(NULL, ";");
+/// @brief Sends a read request to the probe
+void Sensor::sendRequest() {
+    // drop whatever is left from the previous transaction (e.g. the LF following the CR)
+    while (serial.available() > 0) {
+        serial.read();
     }
+    receivedFrame.clear();
+    serial.println("{F99RDD}\r\n");
+    requestSentAt = millis();
+    requestedOnce = true;
+    state = State::AwaitingResponse;
+}
 
-    float temperature = atof(split);
+/// @brief Reads the bytes that are already in the UART buffer, publishes the reading once the whole response arrived
+/// or the probe didn't answer in time
+void Sensor::collectResponse() {
+    while (serial.available() > 0) {
+        char receivedChar = serial.read();
 
-    delete[] data;
+        if (receivedChar == 0xD) {
+            metrics.sensorReadTime.observe(millis() - requestSentAt);
+            publishReading();
+            return;
+        }
+        // a frame longer than expected is rejected by the parser, the overflowing bytes can be dropped
+        receivedFrame.push(receivedChar);
+    }
 
-    return std::make_pair(humidity, temperature);
+    // sometimes the sensor returns an empty string, in which case the next poll will try again
+    if (millis() - requestSentAt >= RESPONSE_TIMEOUT) {
+        metrics.sensorTimeouts.increment();
+        publishReading();
+    }
+}
+
+/// @brief Parses the collected response and hands it over to takeReadings()
+void Sensor::publishReading() {
+    state = State::Idle;
+    auto reading = receivedFrame.parse();
+    // an empty frame means the probe didn't answer, which is counted as a timeout
+    if (!reading.valid() && reading.status != ProbeFrameStatus::Empty) {
+        metrics.sensorParseFailures.increment();
+    }
+    std::swap(receivedFrame, latestFrame);
+    // an invalid reading keeps the last valid values
+    lastPublished.timestamp = millis();
+    lastPublished.valid = reading.valid();
+    if (lastPublished.valid) {
+        lastPublished.humidity = reading.humidity.toFloat();
+        lastPublished.temperature = reading.temperature.toFloat();
+    }
+    // whoever asked for a reading while this one was in flight gets this one
+    demandedAge.store(NO_DEMAND, std::memory_order_relaxed);
+    readings.publish(lastPublished);
+    if (publishCallback) {
+        publishCallback();
+    }
 }
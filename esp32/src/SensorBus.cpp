@@ -0,0 +1,88 @@
+#include "SensorBus.h"
+#include <algorithm>
+
+/// @param pins UARTs and pins of the probes, the index of a probe in it is its id
+/// @param count Amount of probes, at most MAX_PROBES
+SensorBus::SensorBus(const ProbePins *pins, size_t count, unsigned long pollInterval, unsigned long maxAge)
+        : count(std::min(count, MAX_PROBES)) {
+    for (size_t i = 0; i < this->count; i++) {
+        probes[i] = std::make_unique<Sensor>(pins[i].uartNr, pins[i].rxPin, pins[i].txPin, pollInterval, maxAge);
+    }
+}
+
+/// @brief Drives every probe's state machine once. None of them waits for its probe, so a transaction with one probe
+/// never delays another. Must be used in loop() function in main.cpp.
+void SensorBus::loop() {
+    // whichever probe comes first gets its UART work done first, rotating it keeps the probes' latencies even
+    for (size_t i = 0; i < count; i++) {
+        probes[(first + i) % count]->loop();
+    }
+    first = (first + 1) % count;
+}
+
+/// @brief Gets the earliest time at which one of the probes has something to do
+/// @return Time in milliseconds, as returned by millis()
+unsigned long SensorBus::nextDeadline() const {
+    auto now = millis();
+    auto deadline = probes[0]->nextDeadline();
+    for (size_t i = 1; i < count; i++) {
+        auto probeDeadline = probes[i]->nextDeadline();
+        // comparing the time left handles millis() wrapping around
+        if (static_cast<long>(probeDeadline - now) < static_cast<long>(deadline - now)) {
+            deadline = probeDeadline;
+        }
+    }
+    return deadline;
+}
+
+/// @brief Sets the function called (from the UART driver's task) when data arrives from any of the probes
+void SensorBus::onReceive(void (*callback)()) {
+    for (size_t i = 0; i < count; i++) {
+        probes[i]->onReceive(callback);
+    }
+}
+
+/// @brief Sets the function called by loop() after any of the probes published a reading
+void SensorBus::onPublish(void (*callback)()) {
+    for (size_t i = 0; i < count; i++) {
+        probes[i]->onPublish(callback);
+    }
+}
+
+/// @brief Sets the function called when a reading is requested from any of the probes
+void SensorBus::onDemand(void (*callback)()) {
+    for (size_t i = 0; i < count; i++) {
+        probes[i]->onDemand(callback);
+    }
+}
+
+/// @brief Sets the time between consecutive requests sent to every probe. Safe to call from any task.
+/// @param interval Interval in milliseconds
+void SensorBus::setPollInterval(unsigned long interval) {
+    for (size_t i = 0; i < count; i++) {
+        probes[i]->setPollInterval(interval);
+    }
+}
+
+/// @brief Takes the readings every probe published since the last call, see Sensor::takeReadings()
+/// @return true if any of the probes had a new reading
+bool SensorBus::takeReadings() {
+    bool taken = false;
+    for (size_t i = 0; i < count; i++) {
+        taken |= probes[i]->takeReadings();
+    }
+    return taken;
+}
+
+size_t SensorBus::size() const {
+    return count;
+}
+
+/// @brief Gets a probe by its id, which must be below size()
+Sensor &SensorBus::operator[](size_t probe) {
+    return *probes[probe];
+}
+
+const Sensor &SensorBus::operator[](size_t probe) const {
+    return *probes[probe];
+}
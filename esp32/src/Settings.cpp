@@ -0,0 +1,246 @@
+#include "Settings.h"
+#include <Preferences.h>
+#include <algorithm>
+#include "Metrics.h"
+#include "ReadingCodec.h"
+#include "Log.h"
+
+namespace {
+    constexpr const char *SETTINGS_NAMESPACE = "settings";
+    constexpr const char *SETTINGS_KEY = "record";
+    // version, length
+    constexpr size_t HEADER_SIZE = 2;
+    constexpr size_t FIELDS_SIZE = SETTINGS_RECORD_SIZE - HEADER_SIZE - 2;
+
+    /// @brief Appends a value to the record, little endian
+    template<typename T>
+    void write(uint8_t *&out, T value) {
+        for (size_t i = 0; i < sizeof(T); i++) {
+            *out++ = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    /// @brief Takes a value from the record, leaving the field as it is if the record ends before it, so that fields added
+    /// after the record was written keep their defaults
+    template<typename T>
+    void read(const uint8_t *&in, const uint8_t *end, T &value) {
+        if (end - in < static_cast<ptrdiff_t>(sizeof(T))) {
+            in = end;
+            return;
+        }
+        value = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            value |= static_cast<T>(*in++) << (8 * i);
+        }
+    }
+}
+
+/// @brief Loads the settings from flash, migrating them from an older layout if needed. Must be called before they're used.
+void Settings::begin() {
+    if (loaded) {
+        return;
+    }
+    uint8_t record[SETTINGS_RECORD_SIZE * 2];
+    Preferences preferences;
+    preferences.begin(SETTINGS_NAMESPACE, true);
+    auto length = preferences.getBytes(SETTINGS_KEY, record, sizeof(record));
+    preferences.end();
+
+    uint8_t version = 0;
+    DeviceSettings settings;
+    if (length > 0 && !decode(record, length, settings, version)) {
+        LOG_ERROR("Stored settings are corrupted, using the defaults");
+        settings = DeviceSettings();
+        version = SETTINGS_VERSION;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        current = settings;
+        loaded = true;
+    }
+    LOG_INFO("Settings loaded, version %d", version);
+    if (version < SETTINGS_VERSION) {
+        // writes the record even if the settings have their defaults, so that the migration only happens once
+        migrate(version);
+    } else {
+        encode(current, stored.data());
+    }
+}
+
+/// @brief Brings settings stored by an older firmware to the current layout and writes them right away
+void Settings::migrate(uint8_t version) {
+    LOG_INFO("Migrating settings from version %d to %d", version, SETTINGS_VERSION);
+    switch (version) {
+        case 0: {
+            // before version 1 every setting was a separate key, IP addresses were stored as text
+            Preferences preferences;
+            preferences.begin("tcp");
+            current.tcpInterval = std::max<uint16_t>(preferences.getUShort("interval", current.tcpInterval), 1);
+            current.tcpBatch = std::max<uint16_t>(preferences.getUShort("batch", current.tcpBatch), 1);
+            current.tcpFlushTimeout = preferences.getULong("flushTimeout", current.tcpFlushTimeout);
+            preferences.clear();
+            preferences.end();
+
+            IPAddress addresses[3];
+            const char *keys[] = {"ip", "mask", "gateway"};
+            preferences.begin("ipSettings");
+            for (size_t i = 0; i < 3; i++) {
+                addresses[i].fromString(preferences.getString(keys[i], ""));
+            }
+            preferences.clear();
+            preferences.end();
+            current.ip = addresses[0];
+            current.subnetMask = addresses[1];
+            current.defaultGateway = addresses[2];
+        }
+            // later versions continue here, each case upgrading the settings by one version
+        default:
+            break;
+    }
+    dirty = true;
+    flush();
+}
+
+/// @brief Writes the changes once they stopped coming for SETTINGS_FLUSH_DELAY, or SETTINGS_MAX_FLUSH_DELAY after the first
+/// of them
+void Settings::loop() {
+    uint32_t deadline;
+    if (nextDeadline(deadline) && static_cast<int32_t>(millis() - deadline) >= 0) {
+        flush();
+    }
+}
+
+/// @brief Gets the time at which the changes should be written
+/// @return false if there's nothing to write
+bool Settings::nextDeadline(uint32_t &deadline) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!dirty) {
+        return false;
+    }
+    deadline = std::min(lastChangeAt + SETTINGS_FLUSH_DELAY, firstChangeAt + SETTINGS_MAX_FLUSH_DELAY);
+    return true;
+}
+
+/// @brief Writes the changes right away, e.g. before a reboot
+void Settings::flush() {
+    std::array<uint8_t, SETTINGS_RECORD_SIZE> record;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!dirty) {
+            return;
+        }
+        dirty = false;
+        encode(current, record.data());
+        // the settings were changed back before they were written
+        if (record == stored) {
+            return;
+        }
+    }
+
+    Preferences preferences;
+    preferences.begin(SETTINGS_NAMESPACE);
+    auto written = preferences.putBytes(SETTINGS_KEY, record.data(), record.size());
+    preferences.end();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (written != record.size()) {
+        LOG_ERROR("Couldn't write the settings");
+        // retried after another delay
+        dirty = true;
+        firstChangeAt = lastChangeAt = millis();
+        return;
+    }
+    stored = record;
+    metrics.settingsWrites.increment();
+    LOG_DEBUG("Settings written");
+}
+
+/// @brief Sets the function called (from the task making the change) when a setting changes. loop() should be called at
+/// nextDeadline() afterwards.
+void Settings::onChange(void (*callback)()) {
+    changeCallback = callback;
+}
+
+/// @brief Gets a copy of the current settings, including the changes that weren't written yet
+DeviceSettings Settings::get() {
+    std::lock_guard<std::mutex> guard(lock);
+    return current;
+}
+
+void Settings::setTcpInterval(uint16_t interval) {
+    update(&DeviceSettings::tcpInterval, interval);
+}
+
+void Settings::setTcpBatch(uint16_t batch) {
+    update(&DeviceSettings::tcpBatch, batch);
+}
+
+void Settings::setTcpFlushTimeout(uint32_t timeout) {
+    update(&DeviceSettings::tcpFlushTimeout, timeout);
+}
+
+/// @brief Sets the static network configuration, all zeros for DHCP
+void Settings::setNetwork(IPAddress ip, IPAddress subnetMask, IPAddress defaultGateway) {
+    update(&DeviceSettings::ip, static_cast<uint32_t>(ip));
+    update(&DeviceSettings::subnetMask, static_cast<uint32_t>(subnetMask));
+    update(&DeviceSettings::defaultGateway, static_cast<uint32_t>(defaultGateway));
+}
+
+/// @brief Changes a setting in RAM and schedules the write. Setting the value it already has does nothing.
+template<typename T>
+void Settings::update(T DeviceSettings::*field, T value) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (current.*field == value) {
+            return;
+        }
+        current.*field = value;
+        lastChangeAt = millis();
+        if (!dirty) {
+            dirty = true;
+            firstChangeAt = lastChangeAt;
+        }
+    }
+    if (changeCallback) {
+        changeCallback();
+    }
+}
+
+/// @brief Encodes the settings into a record of SETTINGS_RECORD_SIZE bytes in the current layout
+void Settings::encode(const DeviceSettings &settings, uint8_t *out) {
+    auto start = out;
+    write<uint8_t>(out, SETTINGS_VERSION);
+    write<uint8_t>(out, FIELDS_SIZE);
+    write(out, settings.tcpInterval);
+    write(out, settings.tcpBatch);
+    write(out, settings.tcpFlushTimeout);
+    write(out, settings.ip);
+    write(out, settings.subnetMask);
+    write(out, settings.defaultGateway);
+    write(out, crc16(start, out - start));
+}
+
+/// @brief Decodes a record written by this or an older version of the firmware. Fields the record's version didn't have
+/// keep their values, fields added by a newer version are ignored.
+/// @param version Set to the version the record was written by
+/// @return false if the record is truncated or its checksum doesn't match
+bool Settings::decode(const uint8_t *in, size_t length, DeviceSettings &settings, uint8_t &version) {
+    if (length < HEADER_SIZE + 2) {
+        return false;
+    }
+    auto fieldsSize = in[1];
+    auto size = HEADER_SIZE + fieldsSize;
+    if (length < size + 2 || crc16(in, size) != static_cast<uint16_t>(in[size] | (in[size + 1] << 8))) {
+        return false;
+    }
+    version = in[0];
+    auto field = in + HEADER_SIZE;
+    auto end = field + fieldsSize;
+    read(field, end, settings.tcpInterval);
+    read(field, end, settings.tcpBatch);
+    read(field, end, settings.tcpFlushTimeout);
+    read(field, end, settings.ip);
+    read(field, end, settings.subnetMask);
+    read(field, end, settings.defaultGateway);
+    return true;
+}
@@ -1,40 +1,125 @@
 #include "TCPServer.h"
 #include <sstream>
-#include <ESP32TimerInterrupt.h>
-#include <ArduinoJson.h>
-#include <driver/timer.h>
+#include <algorithm>
+#include <numeric>
+#include <climits>
 #include <WiFi.h>
-#include <Preferences.h>
+#include "Log.h"
 
-volatile bool timerFlag = false;
-unsigned short globalInterval;
+constexpr uint16_t SAMPLING_ID = 0;
+// sent to a client connecting while every slot is taken, before it's disconnected
+constexpr char BUSY_REPLY[] = "{\"error\":\"busy\"}\n";
 TCPServer *TCPServer::instance = nullptr;
 
-TCPServer::TCPServer(Sensor &sensor, unsigned short port) :
-        server(new AsyncServer(port)), sensor(sensor), timer(ESP32Timer(1)), port(port) {
+const TCPServer::CommandHandler TCPServer::commandHandlers[] = {
+        {"interval",            &TCPServer::setInterval},
+        {"save",                nullptr},
+        {"mode",                &TCPServer::setMode},
+        {"batch",               &TCPServer::setBatch},
+        {"flushTimeout",        &TCPServer::setFlushTimeout},
+        {"format",              &TCPServer::setFormat},
+        {"metrics",             &TCPServer::setMetrics},
+        {"overflow",            &TCPServer::setOverflow},
+        {"humidityDeadband",    &TCPServer::setDeadband},
+        {"temperatureDeadband", &TCPServer::setDeadband},
+        {"heartbeat",           &TCPServer::setHeartbeat},
+        {"since",               &TCPServer::requestSince},
+        {"ping",                &TCPServer::ping},
+        {"stats",               &TCPServer::sendStats}
+};
+
+/// @brief Reply to the stats command
+struct StatsReply {
+    const char *ack;
+    unsigned short interval;
+    uint32_t sequence;
+    uint32_t sentBytes;
+    uint32_t sentFrames;
+    uint32_t droppedFrames;
+    uint32_t queuedBytes;
+};
+
+/// @brief Message sent to clients when the WiFi link is back after a drop
+struct ReconnectNotice {
+    const char *event;
+    uint32_t downtime;
+    uint32_t sequence;
+};
+
+template<>
+struct JsonSchema<ReconnectNotice> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("event", &ReconnectNotice::event),
+            jsonField("downtime", &ReconnectNotice::downtime),
+            jsonField("sequence", &ReconnectNotice::sequence)
+    );
+};
+
+template<>
+struct JsonSchema<StatsReply> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("ack", &StatsReply::ack),
+            jsonField("interval", &StatsReply::interval),
+            jsonField("sequence", &StatsReply::sequence),
+            jsonField("sentBytes", &StatsReply::sentBytes),
+            jsonField("sentFrames", &StatsReply::sentFrames),
+            jsonField("droppedFrames", &StatsReply::droppedFrames),
+            jsonField("queuedBytes", &StatsReply::queuedBytes)
+    );
+};
+
+namespace {
+    /// @brief Gets the first multiple of the period after now, so that clients with the same interval are due at the same time
+    /// and can share the encoded frame
+    uint32_t alignedDeadline(uint32_t now, uint32_t period) {
+        return now - now % period + period;
+    }
+
+    /// @brief Gets the deadline following the one that just passed. If the loop was held up for longer than the period, the
+    /// missed deadlines are skipped instead of being caught up on all at once.
+    uint32_t followingDeadline(uint32_t deadline, uint32_t now, uint32_t period) {
+        auto next = deadline + period;
+        if (static_cast<int32_t>(now - next) >= 0) {
+            return alignedDeadline(now, period);
+        }
+        return next;
+    }
+}
+
+TCPServer::TCPServer(SensorBus &sensors, Settings &settings, unsigned short port) :
+        server(port), sensors(sensors), settings(settings), port(port) {
     instance = this;
+    for (auto &subscriber: clients) {
+        subscriber.statsReply = FrameRef::withCapacity(TCP_REPLY_BUFFER);
+    }
 }
 
 TCPServer::~TCPServer() {
-    for (auto client: clients) {
-        delete client;
-    }
+    stop();
 }
 
-/// @brief Sets up a TCP server periodically sending sensor readings to connected clients.
-/// Must be used in the setup() function in main.cpp. You must also include the TCPServer::loop() function in loop() in main.cpp.
+/// @brief Sets up a TCP server periodically sending sensor readings to connected clients. Every client gets readings at its
+/// own interval. Readings are taken and stored in history even when no client is connected, so that clients can request what
+/// they missed. Must be used in the setup() function in main.cpp. You must also include the TCPServer::loop() function in
+/// loop() in main.cpp.
 void TCPServer::setup() {
     if (started) {
         return;
     }
-    if (stopped) {
-        server = std::make_unique<AsyncServer>(port);
-        stopped = false;
-    }
-    server->onClient(&handleClient, nullptr);
-    server->begin();
+    stopped = false;
+    prepareReplies();
+    server.onClient(&handleClient, nullptr);
+    server.begin();
+
+    auto stored = settings.get();
+    defaultInterval = std::max<unsigned short>(stored.tcpInterval, 1);
+    batchSize = std::clamp<unsigned short>(stored.tcpBatch, 1, MAX_TCP_BATCH);
+    flushTimeout = std::min(stored.tcpFlushTimeout, MAX_TCP_FLUSH_TIMEOUT);
+    baseInterval = 0;
+    updateBaseInterval();
+
     started = true;
-    log_e("TCP set up");
+    LOG_INFO("TCP set up");
 }
 
 /// @brief Stops the TCP server.
@@ -42,127 +127,949 @@ void TCPServer::stop() {
     if (stopped) {
         return;
     }
-    server = nullptr;
-    for (auto client: clients) {
+    server.end();
+    for (auto &subscriber: clients) {
+        AsyncClient *client;
+        {
+            std::lock_guard<std::mutex> lock(slotLock);
+            client = subscriber.client;
+        }
+        if (client == nullptr) {
+            continue;
+        }
+        // the client's callbacks can't find it once its slot is free
+        client->onDisconnect(nullptr, nullptr);
+        releaseSubscriber(subscriber);
         delete client;
     }
-    clients.clear();
-    if (interruptAttachedOnce) {
-        timer.detachInterrupt();
-    }
+    // frames are only cached for the clients, a stopped server holds none
+    frameCache.fill({});
+    nextCacheSlot = 0;
+    scheduler.cancel(SAMPLING_ID);
     stopped = true;
     started = false;
-    log_e("TCP stopped");
+    LOG_INFO("TCP stopped");
 }
 
-/// @brief Client handler
-void TCPServer::handleClient(void *arg, AsyncClient *client) {
-    log_e("new client has been connected to server, ip: %s", client->remoteIP().toString());
-
-    // attach a timer interrupt with saved frequency or reattach it if it was attached once and then detached due to no clients connected
-    if (instance->clients.size() == 0) {
-        if (!instance->interruptAttachedOnce) {
-            Preferences preferences;
-            preferences.begin("tcp");
-            auto interval = preferences.getUShort("interval", 2);
-            float frequency = 1.0 / interval;
-            globalInterval = interval;
-            instance->timer.attachInterrupt(frequency, timerHandle);
-            instance->interruptAttachedOnce = true;
-        } else {
-            instance->timer.reattachInterrupt();
+/// @brief Sets the function called (from the AsyncTCP task) when something happens on a connection, e.g. a client connects,
+/// sends a command or acknowledges data and so has space for more. TCPServer::loop() should be called soon after.
+void TCPServer::onActivity(void (*callback)()) {
+    activityCallback = callback;
+}
+
+/// @brief Tells JSON clients that the WiFi link was down for the given time and is back, with the sequence number of the
+/// newest reading ({"event":"reconnected","downtime":1200,"sequence":345}). Connections survive short drops, but frames
+/// that didn't fit in a client's queue meanwhile were dropped, so a client can request them with {"since":N}.
+void TCPServer::announceReconnect(unsigned long downtime) {
+    if (connectedClients() == 0) {
+        return;
+    }
+    ReconnectNotice notice{"reconnected", static_cast<uint32_t>(downtime), sequence - 1};
+    char json[TCP_REPLY_BUFFER];
+    auto length = encodeJson(notice, json, sizeof(json) - 1);
+    json[length++] = '\n';
+    auto frame = FrameRef::copyOf(reinterpret_cast<const uint8_t *>(json), length);
+    for (auto &subscriber: clients) {
+        if (subscriber.active && subscriber.encoding == StreamEncoding::Json) {
+            queueReply(subscriber, frame);
         }
     }
+    notifyActivity();
+}
 
-    instance->clients.push_back(client);
+/// @brief Client handler, the client takes a free slot or is turned away with {"error":"busy"}. The slot is only claimed
+/// here, loop() takes it over and starts serving the client.
+void TCPServer::handleClient(void *arg, AsyncClient *client) {
+    bool claimed = false;
+    {
+        std::lock_guard<std::mutex> lock(instance->slotLock);
+        auto slot = findSubscriber(nullptr);
+        if (slot != nullptr) {
+            slot->client = client;
+            slot->joined = true;
+            slot->disconnected = false;
+            slot->pendingCount = 0;
+            slot->overrunCommands = 0;
+            slot->commands.reset();
+            slot->id = instance->nextSubscriberId++;
+            if (instance->nextSubscriberId == SAMPLING_ID) {
+                instance->nextSubscriberId++;
+            }
+            claimed = true;
+        }
+    }
+    if (!claimed) {
+        LOG_WARNING("Too many TCP clients, turning away IP: %s", client->remoteIP());
+        metrics.tcpRejectedConnections.increment();
+        client->onDisconnect([](void *arg, AsyncClient *client) { delete client; }, nullptr);
+        client->add(BUSY_REPLY, sizeof(BUSY_REPLY) - 1);
+        client->send();
+        client->close();
+        return;
+    }
+    LOG_INFO("New TCP client connected, IP: %s", client->remoteIP());
 
     client->onData(&handleData, nullptr);
     client->onError(&handleError, nullptr);
     client->onDisconnect(&handleDisconnect, nullptr);
     client->onTimeout(&handleTimeout, nullptr);
+    client->onAck(&handleAck, nullptr);
+    notifyActivity();
 }
 
-/// @brief Listens for timer flag changes. Must be used in loop() function in main.cpp. You must also include 
-/// the TCPServer::setup() function in setup() in main.cpp.
+/// @brief Takes readings and delivers them to clients whose deadlines passed, flushes batches that waited for too long and
+/// sends requested history. Must be used in loop() function in main.cpp. You must also include the TCPServer::setup() function
+/// in setup() in main.cpp.
 void TCPServer::loop() {
-    if (!instance->stopped) {
-        if (timerFlag) {
-            timerFlag = false;
-            sendDataToClient();
+    if (instance->stopped) {
+        return;
+    }
+    syncSlots();
+    auto now = static_cast<uint32_t>(millis());
+    uint16_t id;
+    uint32_t deadline;
+    // sampling has the lowest id, so when it's due at the same time as deliveries, they get the fresh reading
+    while (instance->scheduler.popDue(now, id, deadline)) {
+        if (id == SAMPLING_ID) {
+            takeSample();
+            instance->scheduler.schedule(SAMPLING_ID, followingDeadline(deadline, now, instance->baseInterval * 1000));
+            continue;
+        }
+        auto subscriber = std::find_if(instance->clients.begin(), instance->clients.end(),
+                                       [id](const TCPSubscriber &subscriber) {
+                                           return subscriber.active && subscriber.id == id;
+                                       });
+        if (subscriber == instance->clients.end()) {
+            continue;
+        }
+        deliver(*subscriber);
+        instance->scheduler.schedule(id, followingDeadline(deadline, now, subscriber->interval * 1000));
+    }
+
+    for (auto &subscriber: instance->clients) {
+        if (!subscriber.active) {
+            continue;
+        }
+        if (subscriber.heldFrames > 0 && instance->flushTimeout > 0 &&
+            millis() - subscriber.batchStartedAt >= instance->flushTimeout) {
+            releaseBatch(subscriber);
+        }
+        if (subscriber.heldFrames == 0) {
+            drainQueue(subscriber);
+        }
+        // history is only sent once everything queued before it is out, otherwise the order would break
+        if (subscriber.backfilling && subscriber.queue.empty()) {
+            sendBackfill(subscriber);
         }
     }
+    closeSlowClients();
 }
 
-/// @brief Sends current sensor reading (temperature, humidity) along with RSSI and TCP timer interval to all connected clients. 
-bool TCPServer::sendDataToClient() {
-    auto sensorData = instance->sensor.getSensorData();
-    JsonDocument doc;
-    doc["humidity"] = sensorData.first;
-    doc["temperature"] = sensorData.second;
-    doc["rssi"] = WiFi.RSSI();
-    doc["interval"] = globalInterval;
-    String serialized;
-    serializeJson(doc, serialized);
-    for (auto client: instance->clients) {
-        if (client->connected()) {
-            client->add(serialized.c_str(), strlen(serialized.c_str()));
-            client->send();
+/// @brief Gets the time at which loop() has something to do even if nothing happens on the connections
+/// @param deadline Set to the time in milliseconds, as returned by millis()
+/// @return false if there's nothing scheduled
+bool TCPServer::nextDeadline(uint32_t &deadline) {
+    if (instance->stopped || !instance->scheduler.nextDeadline(deadline)) {
+        return false;
+    }
+    if (instance->flushTimeout == 0) {
+        return true;
+    }
+    for (auto &subscriber: instance->clients) {
+        if (!subscriber.active || subscriber.heldFrames == 0) {
+            continue;
+        }
+        auto flushAt = static_cast<uint32_t>(subscriber.batchStartedAt + instance->flushTimeout);
+        if (static_cast<int32_t>(flushAt - deadline) < 0) {
+            deadline = flushAt;
         }
     }
     return true;
 }
 
-bool TCPServer::timerHandle(void *_) {
-    timerFlag = true;
+/// @brief Stores the latest reading (temperature, humidity) of every probe along with RSSI and base interval in history,
+/// one record per probe. Uses the readings cached by Sensor::loop(), so it never waits for the probes.
+void TCPServer::takeSample() {
+    auto rssi = static_cast<int8_t>(WiFi.RSSI());
+    for (size_t probe = 0; probe < instance->sensors.size(); probe++) {
+        auto &sensor = instance->sensors[probe];
+        auto reading = sensor.getLatestReading();
+        auto sensorData = sensor.getSensorData();
+        StreamRecord record{
+                instance->sequence++,
+                static_cast<uint32_t>(reading.timestamp),
+                static_cast<int16_t>(lroundf(sensorData.first * 100)),
+                static_cast<int16_t>(lroundf(sensorData.second * 100)),
+                rssi,
+                instance->baseInterval,
+                reading.valid,
+                static_cast<uint8_t>(probe)
+        };
+        instance->history.push(record);
+    }
+}
+
+/// @brief Queues a reading of every probe for a client whose deadline passed. Clients catching up on history get them with
+/// the rest of the history instead.
+void TCPServer::deliver(TCPSubscriber &subscriber) {
+    auto &history = instance->history;
+    if (subscriber.backfilling || history.empty() || !subscriber.client->connected()) {
+        return;
+    }
+    // no reading was taken since the last delivery
+    if (history.newest().sequence == subscriber.lastSentSequence) {
+        return;
+    }
+    if (subscriber.mode == DeliveryMode::Exception) {
+        deliverExceptions(subscriber);
+    } else {
+        for (size_t probe = 0; probe < instance->sensors.size(); probe++) {
+            StreamRecord record;
+            bool found = subscriber.mode == DeliveryMode::Average ?
+                         averageSince(subscriber.lastSentSequence, probe, record) :
+                         newestSince(subscriber.lastSentSequence, probe, record);
+            if (!found) {
+                continue;
+            }
+            record.interval = subscriber.interval;
+            queueFrame(subscriber, encodeFrame(record, subscriber));
+        }
+    }
+    subscriber.lastSentSequence = history.newest().sequence;
+    subscriber.lastSentUptime = history.newest().uptime;
+}
+
+/// @brief Folds every reading taken since the last delivery into the client's window of its probe, and queues the ones that
+/// moved past the client's deadband or came a heartbeat after the probe's last report, each with the aggregate of its
+/// window. The frames are the client's own, so they aren't cached.
+void TCPServer::deliverExceptions(TCPSubscriber &subscriber) {
+    auto &history = instance->history;
+    for (auto i = history.firstAfter(subscriber.lastSentSequence); i < history.size(); i++) {
+        auto record = history.at(i);
+        auto &window = subscriber.windows[record.probe];
+        if (!window.add(record, subscriber.thresholds)) {
+            metrics.tcpSuppressedReadings.increment();
+            continue;
+        }
+        record.interval = subscriber.interval;
+        auto summary = window.summary();
+        char json[JSON_FRAME_BUFFER];
+        auto length = toJson(record, subscriber.withMetrics, json, sizeof(json), &summary);
+        queueFrame(subscriber, FrameRef::copyOf(reinterpret_cast<const uint8_t *>(json), length));
+        window.nextWindow(record);
+    }
+}
+
+/// @brief Finds the newest reading of a probe taken after the one with the given sequence number
+/// @return false if the probe has no reading that new
+bool TCPServer::newestSince(uint32_t sequence, uint8_t probe, StreamRecord &record) {
+    auto &history = instance->history;
+    auto first = history.firstAfter(sequence);
+    // every sample covers all probes, so the newest one of the probe is among the last few
+    for (auto i = history.size(); i > first; i--) {
+        auto &sample = history.at(i - 1);
+        if (sample.probe == probe) {
+            record = sample;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Averages humidity and temperature of the valid readings of a probe taken after the one with the given sequence
+/// number
+/// @param record Set to the averaged values and the sequence number, uptime and RSSI of the probe's newest reading
+/// @return false if the probe has no reading that new
+bool TCPServer::averageSince(uint32_t sequence, uint8_t probe, StreamRecord &record) {
+    if (!newestSince(sequence, probe, record)) {
+        return false;
+    }
+    auto &history = instance->history;
+    int32_t humidity = 0;
+    int32_t temperature = 0;
+    int32_t count = 0;
+    for (auto i = history.firstAfter(sequence); i < history.size(); i++) {
+        auto &sample = history.at(i);
+        if (sample.probe == probe && sample.valid) {
+            humidity += sample.humidity;
+            temperature += sample.temperature;
+            count++;
+        }
+    }
+    record.valid = count > 0;
+    if (record.valid) {
+        record.humidity = static_cast<int16_t>(humidity / count);
+        record.temperature = static_cast<int16_t>(temperature / count);
+    }
     return true;
 }
 
-/// @brief Checks if client requested an interval change, in which case change it
+/// @brief Encodes a record in the client's format, reusing the frame if it was already encoded for another client
+FrameRef TCPServer::encodeFrame(const StreamRecord &record, const TCPSubscriber &subscriber) {
+    auto encoding = subscriber.encoding;
+    auto mode = subscriber.mode;
+    // binary records have no room for metrics
+    bool withMetrics = subscriber.withMetrics && encoding == StreamEncoding::Json;
+    for (auto &cached: instance->frameCache) {
+        if (cached.frame && cached.sequence == record.sequence && cached.interval == record.interval &&
+            cached.encoding == encoding && cached.mode == mode && cached.withMetrics == withMetrics) {
+            return cached.frame;
+        }
+    }
+
+    FrameRef frame;
+    if (encoding == StreamEncoding::Binary) {
+        uint8_t binary[BINARY_RECORD_SIZE];
+        encodeBinaryRecord(record, binary);
+        frame = FrameRef::copyOf(binary, BINARY_RECORD_SIZE);
+    } else {
+        char json[JSON_FRAME_BUFFER];
+        auto length = toJson(record, withMetrics, json, sizeof(json));
+        frame = FrameRef::copyOf(reinterpret_cast<const uint8_t *>(json), length);
+    }
+    auto &slot = instance->frameCache[instance->nextCacheSlot];
+    instance->nextCacheSlot = (instance->nextCacheSlot + 1) % instance->frameCache.size();
+    slot = CachedFrame{record.sequence, record.interval, encoding, mode, withMetrics, frame};
+    return frame;
+}
+
+/// @brief Puts a frame in the client's send queue. The frame is held there until the client's batch is complete, then the
+/// whole batch is handed to the socket at once. A frame the queue didn't take doesn't count towards the batch.
+void TCPServer::queueFrame(TCPSubscriber &subscriber, const FrameRef &frame) {
+    if (!frame) {
+        LOG_ERROR("Couldn't allocate a frame");
+        return;
+    }
+    // the frames held so far are sent before the queue would overflow, so that the policy never drops the batch's own
+    // frames. A batch of large frames, e.g. with metrics, goes out in parts.
+    if (subscriber.heldFrames > 0 && !subscriber.queue.fits(frame.size())) {
+        releaseBatch(subscriber);
+    }
+    auto result = enqueue(subscriber, frame);
+    if (result == EnqueueResult::Disconnect || result == EnqueueResult::Dropped) {
+        return;
+    }
+    if (subscriber.heldFrames++ == 0) {
+        subscriber.batchStartedAt = millis();
+    }
+    if (subscriber.heldFrames >= instance->batchSize) {
+        releaseBatch(subscriber);
+    }
+}
+
+/// @brief Sends the batch the client collected so far
+void TCPServer::releaseBatch(TCPSubscriber &subscriber) {
+    subscriber.heldFrames = 0;
+    drainQueue(subscriber);
+}
+
+/// @brief Hands queued frames to the client for as long as it has space in its send buffer. A client on a slow link only
+/// fills its own queue, it never makes the others wait.
+void TCPServer::drainQueue(TCPSubscriber &subscriber) {
+    auto client = subscriber.client;
+    if (subscriber.queue.empty() || !client->connected()) {
+        return;
+    }
+    auto sentFrames = subscriber.queue.getStats().sentFrames;
+    auto written = subscriber.queue.drainTo(*client);
+    if (written > 0) {
+        client->send();
+        auto &stats = subscriber.queue.getStats();
+        metrics.tcpSentBytes.increment(written);
+        metrics.tcpSentFrames.increment(stats.sentFrames - sentFrames);
+        subscriber.sentBytes.store(stats.sentBytes, std::memory_order_relaxed);
+        subscriber.sentFrames.store(stats.sentFrames, std::memory_order_relaxed);
+    }
+}
+
+/// @brief Closes clients whose send queue overflowed with the Disconnect policy, which frees their slots
+void TCPServer::closeSlowClients() {
+    for (auto &subscriber: instance->clients) {
+        if (!subscriber.active || !subscriber.closeRequested) {
+            continue;
+        }
+        subscriber.closeRequested = false;
+        LOG_WARNING("Disconnecting a client that can't keep up");
+        subscriber.client->close(true);
+    }
+}
+
+/// @brief Sends as much of the requested history as fits in the client's send buffer in one burst. History is thinned out
+/// to the client's interval. The rest is sent in the next loop() iterations, after which the client goes back to receiving
+/// readings at its deadlines.
+void TCPServer::sendBackfill(TCPSubscriber &subscriber) {
+    auto client = subscriber.client;
+    if (!client->connected()) {
+        return;
+    }
+    auto &history = instance->history;
+    // readings are taken at the base interval, half of it is enough of a margin for the jitter of reading timestamps
+    uint32_t intervalMs = subscriber.interval * 1000 - instance->baseInterval * 500;
+    auto index = history.firstAfter(subscriber.lastSentSequence);
+    bool added = false;
+    for (; index < history.size(); index++) {
+        auto record = history.at(index);
+        // a sample starts with the first probe's reading, the other probes' readings are kept or thinned out along with it
+        if (record.probe == 0) {
+            subscriber.backfillSample = record.uptime - subscriber.lastSentUptime >= intervalMs;
+        }
+        if (!subscriber.backfillSample) {
+            continue;
+        }
+        record.interval = subscriber.interval;
+        if (subscriber.encoding == StreamEncoding::Binary) {
+            if (client->space() < BINARY_RECORD_SIZE) {
+                break;
+            }
+            uint8_t binary[BINARY_RECORD_SIZE];
+            encodeBinaryRecord(record, binary);
+            client->add(reinterpret_cast<const char *>(binary), BINARY_RECORD_SIZE);
+            metrics.tcpSentBytes.increment(BINARY_RECORD_SIZE);
+        } else {
+            // metrics describe the device now, not at the time of the reading
+            char json[JSON_FRAME_BUFFER];
+            auto length = toJson(record, false, json, sizeof(json));
+            if (client->space() < length) {
+                break;
+            }
+            client->add(json, length);
+            metrics.tcpSentBytes.increment(length);
+        }
+        metrics.tcpSentFrames.increment();
+        if (record.probe == 0) {
+            subscriber.lastSentUptime = record.uptime;
+        }
+        added = true;
+    }
+    if (index > 0) {
+        subscriber.lastSentSequence = history.at(index - 1).sequence;
+    }
+    if (added) {
+        client->send();
+    }
+    if (index == history.size()) {
+        subscriber.backfilling = false;
+    }
+}
+
+/// @brief Serializes a record as a newline-terminated JSON object into the buffer
+/// @param window Aggregate of the readings the record stands for, left out if null
+/// @return Length of the frame, 0 if it didn't fit
+size_t TCPServer::toJson(const StreamRecord &record, bool withMetrics, char *buffer, size_t size,
+                         const WindowMessage *window) {
+    HealthMessage health{};
+    if (withMetrics) {
+        health = {ESP.getFreeHeap(), ESP.getMaxAllocHeap(), metrics.sensorTimeouts.get(),
+                  metrics.sensorParseFailures.get(), metrics.tcpDroppedFrames.get()};
+    }
+    StreamMessage message{
+            record.humidity / 100.0f,
+            record.temperature / 100.0f,
+            record.rssi,
+            record.interval,
+            record.sequence,
+            record.uptime,
+            record.probe,
+            window,
+            withMetrics ? &health : nullptr
+    };
+    auto length = encodeJson(message, buffer, size);
+    if (length == 0 || length == size) {
+        return 0;
+    }
+    buffer[length] = '\n';
+    return length + 1;
+}
+
+/// @brief Sets the interval at which readings are taken to the greatest common divisor of all clients' intervals and the
+/// default one, so every client's deadline falls on a reading and the probe isn't asked more often than needed. Clients that
+/// average readings need them taken every second.
+void TCPServer::updateBaseInterval() {
+    unsigned short base = instance->defaultInterval;
+    for (auto &subscriber: instance->clients) {
+        if (!subscriber.active) {
+            continue;
+        }
+        base = std::gcd(base, subscriber.mode == DeliveryMode::Latest ? subscriber.interval : 1);
+    }
+    if (base == instance->baseInterval) {
+        return;
+    }
+    instance->baseInterval = base;
+    instance->sensors.setPollInterval(base * 1000);
+    instance->scheduler.cancel(SAMPLING_ID);
+    instance->scheduler.schedule(SAMPLING_ID, alignedDeadline(millis(), base * 1000));
+}
+
+/// @brief Schedules the next delivery for a client, replacing the previous one
+void TCPServer::scheduleSubscriber(TCPSubscriber &subscriber) {
+    instance->scheduler.cancel(subscriber.id);
+    if (!instance->scheduler.schedule(subscriber.id, alignedDeadline(millis(), subscriber.interval * 1000))) {
+        LOG_ERROR("Too many TCP clients, client won't receive readings");
+    }
+}
+
+/// @brief Finds the subscriber a client belongs to, or a free slot when client is nullptr. The caller holds slotLock.
+/// @return Pointer to the subscriber or nullptr if the client isn't subscribed (there's no free slot)
+TCPSubscriber *TCPServer::findSubscriber(AsyncClient *client) {
+    for (auto &subscriber: instance->clients) {
+        if (subscriber.client == client) {
+            return &subscriber;
+        }
+    }
+    return nullptr;
+}
+
+size_t TCPServer::connectedClients() {
+    std::lock_guard<std::mutex> lock(instance->slotLock);
+    return std::count_if(instance->clients.begin(), instance->clients.end(),
+                         [](const TCPSubscriber &subscriber) { return subscriber.client != nullptr; });
+}
+
+/// @brief Takes over a slot the AsyncTCP task claimed for a new client. JSON and the saved interval are the default,
+/// clients can change both with commands.
+void TCPServer::startSubscriber(TCPSubscriber &subscriber) {
+    subscriber.active = true;
+    subscriber.interval = instance->defaultInterval;
+    subscriber.encoding = StreamEncoding::Json;
+    subscriber.mode = DeliveryMode::Latest;
+    subscriber.withMetrics = false;
+    subscriber.backfilling = false;
+    subscriber.backfillSample = false;
+    subscriber.lastSentSequence = instance->sequence - 1;
+    subscriber.lastSentUptime = 0;
+    subscriber.queue = SendQueue();
+    subscriber.heldFrames = 0;
+    subscriber.batchStartedAt = 0;
+    subscriber.closeRequested = false;
+    subscriber.thresholds = ReportThresholds();
+    for (auto &window: subscriber.windows) {
+        window.reset();
+    }
+    subscriber.sentBytes.store(0, std::memory_order_relaxed);
+    subscriber.sentFrames.store(0, std::memory_order_relaxed);
+    scheduleSubscriber(subscriber);
+    updateBaseInterval();
+}
+
+/// @brief Frees the subscriber's slot, the client itself is deleted by the caller. Frames still queued are released, so
+/// the slot holds no memory but its stats reply.
+void TCPServer::releaseSubscriber(TCPSubscriber &subscriber) {
+    instance->scheduler.cancel(subscriber.id);
+    subscriber.active = false;
+    subscriber.queue.clear();
+    subscriber.heldFrames = 0;
+    subscriber.backfilling = false;
+    subscriber.closeRequested = false;
+    {
+        std::lock_guard<std::mutex> lock(instance->slotLock);
+        subscriber.client = nullptr;
+        subscriber.joined = false;
+        subscriber.disconnected = false;
+        subscriber.pendingCount = 0;
+        subscriber.overrunCommands = 0;
+    }
+    updateBaseInterval();
+}
+
+/// @brief Takes over the slots the AsyncTCP task claimed for new clients, handles the commands it framed and frees the slots
+/// of the clients that disconnected, deleting them. Clients accepted by AsyncServer are owned by the application; they're
+/// deleted here rather than by handleDisconnect(), as loop() might be sending to them.
+void TCPServer::syncSlots() {
+    std::array<PendingCommand, TCP_PENDING_COMMANDS> commands;
+    for (auto &subscriber: instance->clients) {
+        AsyncClient *client;
+        bool joined;
+        bool disconnected;
+        uint8_t pendingCount;
+        uint8_t overrunCommands;
+        {
+            std::lock_guard<std::mutex> lock(instance->slotLock);
+            client = subscriber.client;
+            joined = subscriber.joined;
+            disconnected = subscriber.disconnected;
+            pendingCount = subscriber.pendingCount;
+            overrunCommands = subscriber.overrunCommands;
+            std::copy_n(subscriber.pendingCommands.begin(), pendingCount, commands.begin());
+            subscriber.joined = false;
+            subscriber.pendingCount = 0;
+            subscriber.overrunCommands = 0;
+        }
+        if (client == nullptr) {
+            continue;
+        }
+        if (disconnected) {
+            releaseSubscriber(subscriber);
+            delete client;
+            continue;
+        }
+        if (joined) {
+            startSubscriber(subscriber);
+        }
+        for (uint8_t i = 0; i < pendingCount; i++) {
+            auto &command = commands[i];
+            handleCommand(subscriber, std::string_view(command.text.data(), command.length), command.tooLong);
+        }
+        if (overrunCommands > 0) {
+            LOG_WARNING("A TCP client sent %u commands faster than they were handled", overrunCommands);
+        }
+        for (uint8_t i = 0; i < overrunCommands; i++) {
+            metrics.tcpCommands.increment();
+            metrics.tcpCommandErrors.increment();
+            queueReply(subscriber, instance->busyReply);
+        }
+    }
+}
+
+/// @brief Splits the received bytes into commands and hands the complete ones to loop(). A command split across packets is
+/// completed by the following ones, several commands in one packet are handled one after another.
 void TCPServer::handleData(void *arg, AsyncClient *client, void *data, size_t len) {
-    auto input = static_cast<char *>(data);
-    JsonDocument doc;
-    deserializeJson(doc, input);
-    // no need to validate the json because even if it's invalid it doesnt throw an exception, 
-    // the check for existence of a key in the document is the more important part
-    unsigned long interval = doc["interval"];
-    if (interval) {
-        // need to use the esp-idf functions rather than the ones from the external library because those 
-        // don't work properly when you try to change the interval
-        timer_set_counter_value(TIMER_GROUP_0, TIMER_1, 0);
-        timer_set_alarm_value(TIMER_GROUP_0, TIMER_1, interval * 1000000);
-        timer_start(TIMER_GROUP_0, TIMER_1);
-        Preferences preferences;
-        preferences.begin("tcp");
-        preferences.putUShort("interval", interval);
-        globalInterval = interval;
-        log_e("Set TCP timer interval to %f", interval);
+    {
+        std::lock_guard<std::mutex> lock(instance->slotLock);
+        auto subscriber = findSubscriber(client);
+        if (!subscriber) {
+            return;
+        }
+        subscriber->commands.push(static_cast<const char *>(data), len, [subscriber](std::string_view text, bool tooLong) {
+            if (subscriber->pendingCount == TCP_PENDING_COMMANDS) {
+                if (subscriber->overrunCommands < UINT8_MAX) {
+                    subscriber->overrunCommands++;
+                }
+                return;
+            }
+            auto &command = subscriber->pendingCommands[subscriber->pendingCount++];
+            std::copy(text.begin(), text.end(), command.text.begin());
+            command.length = text.size();
+            command.tooLong = tooLong;
+        });
     }
+    notifyActivity();
 }
 
-void TCPServer::handleError(void *arg, AsyncClient *client, int8_t error) {
-    log_e("There has been an error in %s", client->remoteIP());
+/// @brief Handles a client's command. Every key of the command object is a separate command and gets its own reply:
+/// {"ack":"<key>"} when it was carried out, {"error":"invalidValue","command":"<key>"} when its value was wrong and
+/// {"error":"unknownCommand"} when the key isn't a command. A command that isn't a flat JSON object gets
+/// {"error":"malformed"}, one longer than TCP_COMMAND_BUFFER {"error":"tooLong"}. Replies are newline-terminated JSON
+/// objects queued with the readings, so they keep their order.
+void TCPServer::handleCommand(TCPSubscriber &subscriber, std::string_view text, bool tooLong) {
+    metrics.tcpCommands.increment();
+    Command command;
+    if (tooLong || !command.parse(text)) {
+        LOG_WARNING("Rejected a %s TCP command", tooLong ? "too long" : "malformed");
+        metrics.tcpCommandErrors.increment();
+        queueReply(subscriber, tooLong ? instance->tooLongReply : instance->malformedReply);
+        return;
+    }
+
+    // keys other than parameters, each of them gets a reply
+    size_t replies = 0;
+    for (size_t i = 0; i < command.size(); i++) {
+        auto &field = command[i];
+        auto handler = std::find_if(std::begin(commandHandlers), std::end(commandHandlers),
+                                    [&field](const CommandHandler &handler) { return field.key == handler.name; });
+        if (handler == std::end(commandHandlers)) {
+            replies++;
+            metrics.tcpCommandErrors.increment();
+            queueReply(subscriber, instance->unknownCommandReply);
+            continue;
+        }
+        if (!handler->handle) {
+            continue;
+        }
+        replies++;
+        auto index = handler - std::begin(commandHandlers);
+        switch (handler->handle(subscriber, field, command)) {
+            case CommandResult::Acknowledged:
+                queueReply(subscriber, instance->acknowledgements[index]);
+                break;
+            case CommandResult::Invalid:
+                metrics.tcpCommandErrors.increment();
+                queueReply(subscriber, instance->rejections[index]);
+                break;
+            case CommandResult::Busy:
+                queueReply(subscriber, instance->busyReply);
+                break;
+            case CommandResult::Replied:
+                break;
+        }
+    }
+    // e.g. {} or {"save":false} alone
+    if (replies == 0) {
+        metrics.tcpCommandErrors.increment();
+        queueReply(subscriber, instance->unknownCommandReply);
+    }
 }
 
-void TCPServer::handleDisconnect(void *arg, AsyncClient *client) {
-    log_e("Client disconnected");
-    auto iterator = std::find(instance->clients.begin(), instance->clients.end(), client);
-    if (iterator != instance->clients.end()) {
-        instance->clients.erase(iterator);
+/// @brief Puts a reply in the client's send queue. Replies don't count towards the batch, so they're sent right away unless
+/// a batch is being collected, in which case they go out with it.
+void TCPServer::queueReply(TCPSubscriber &subscriber, const FrameRef &reply) {
+    if (!reply) {
+        return;
     }
+    enqueue(subscriber, reply);
+}
 
-    if (instance->clients.size() == 0) {
-        instance->timer.detachInterrupt();
+/// @brief Pushes a frame to the client's send queue, counting every frame the overflow policy dropped (a push can evict
+/// several) and marking the client for closing if the policy says so
+EnqueueResult TCPServer::enqueue(TCPSubscriber &subscriber, const FrameRef &frame) {
+    auto dropped = subscriber.queue.getStats().droppedFrames;
+    auto result = subscriber.queue.push(frame);
+    metrics.tcpDroppedFrames.increment(subscriber.queue.getStats().droppedFrames - dropped);
+    if (result == EnqueueResult::Disconnect) {
+        subscriber.closeRequested = true;
     }
+    return result;
 }
 
-void TCPServer::handleTimeout(void *arg, AsyncClient *client, uint32_t time) {
-    log_e("Client timed out, IP: %s", client->remoteIP().toString());
-    auto iterator = std::find(instance->clients.begin(), instance->clients.end(), client);
-    if (iterator != instance->clients.end()) {
-        instance->clients.erase(iterator);
+/// @brief Encodes the replies to commands once, so that replying never allocates
+void TCPServer::prepareReplies() {
+    if (!instance->acknowledgements.empty()) {
+        return;
+    }
+    auto copyOf = [](const char *text, int length) {
+        return FrameRef::copyOf(reinterpret_cast<const uint8_t *>(text), length);
+    };
+    char reply[64];
+    for (auto &handler: commandHandlers) {
+        if (!handler.handle) {
+            instance->acknowledgements.emplace_back();
+            instance->rejections.emplace_back();
+            continue;
+        }
+        instance->acknowledgements.push_back(copyOf(reply, snprintf(reply, sizeof(reply), "{\"ack\":\"%s\"}\n",
+                                                                    handler.name)));
+        instance->rejections.push_back(copyOf(reply, snprintf(reply, sizeof(reply),
+                                                              "{\"error\":\"invalidValue\",\"command\":\"%s\"}\n",
+                                                              handler.name)));
+    }
+    instance->unknownCommandReply = copyOf(reply, snprintf(reply, sizeof(reply), "{\"error\":\"unknownCommand\"}\n"));
+    instance->malformedReply = copyOf(reply, snprintf(reply, sizeof(reply), "{\"error\":\"malformed\"}\n"));
+    instance->tooLongReply = copyOf(reply, snprintf(reply, sizeof(reply), "{\"error\":\"tooLong\"}\n"));
+    instance->busyReply = copyOf(reply, snprintf(reply, sizeof(reply), "{\"error\":\"busy\"}\n"));
+}
+
+/// @brief {"interval":5} sets the seconds between deliveries, the interval also becomes the default for new clients unless
+/// "save":false is added
+CommandResult TCPServer::setInterval(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t interval;
+    bool save = true;
+    auto saveField = command.find("save");
+    if (!field.toUnsigned(interval) || interval == 0 || interval > USHRT_MAX || (saveField && !saveField->toBool(save))) {
+        return CommandResult::Invalid;
+    }
+    subscriber.interval = interval;
+    scheduleSubscriber(subscriber);
+    if (save) {
+        instance->defaultInterval = interval;
+        instance->settings.setTcpInterval(interval);
+    }
+    updateBaseInterval();
+    LOG_INFO("Set TCP interval to %d", interval);
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"mode":"average"} or {"mode":"latest"}
+CommandResult TCPServer::setMode(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    if (field.type != CommandValueType::String) {
+        return CommandResult::Invalid;
+    }
+    if (field.value == "latest") {
+        subscriber.mode = DeliveryMode::Latest;
+    } else if (field.value == "average") {
+        subscriber.mode = DeliveryMode::Average;
+    } else if (field.value == "exception" && subscriber.encoding == StreamEncoding::Json) {
+        // binary records have no room for the window aggregate
+        subscriber.mode = DeliveryMode::Exception;
+        for (auto &window: subscriber.windows) {
+            window.reset();
+        }
+    } else {
+        return CommandResult::Invalid;
+    }
+    updateBaseInterval();
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"batch":8} sets the amount of readings sent in one frame to every client, larger sizes are clamped to
+/// MAX_TCP_BATCH
+CommandResult TCPServer::setBatch(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t batch;
+    if (!field.toUnsigned(batch) || batch == 0) {
+        return CommandResult::Invalid;
+    }
+    instance->batchSize = std::min<uint32_t>(batch, MAX_TCP_BATCH);
+    instance->settings.setTcpBatch(instance->batchSize);
+    LOG_INFO("Set TCP batch size to %d", instance->batchSize);
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"flushTimeout":30000} sets the ms after which an incomplete batch is sent anyway, 0 disables it. Longer
+/// timeouts are clamped to MAX_TCP_FLUSH_TIMEOUT.
+CommandResult TCPServer::setFlushTimeout(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t timeout;
+    if (!field.toUnsigned(timeout)) {
+        return CommandResult::Invalid;
+    }
+    instance->flushTimeout = std::min(timeout, MAX_TCP_FLUSH_TIMEOUT);
+    instance->settings.setTcpFlushTimeout(instance->flushTimeout);
+    LOG_INFO("Set TCP flush timeout to %lu", instance->flushTimeout);
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"format":"binary"} or {"format":"json"}
+CommandResult TCPServer::setFormat(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    if (field.type != CommandValueType::String || (field.value != "binary" && field.value != "json")) {
+        return CommandResult::Invalid;
+    }
+    if (field.value == "binary" && subscriber.mode == DeliveryMode::Exception) {
+        return CommandResult::Invalid;
+    }
+    subscriber.encoding = field.value == "binary" ? StreamEncoding::Binary : StreamEncoding::Json;
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"metrics":true} adds the device's metrics to JSON frames
+CommandResult TCPServer::setMetrics(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    return field.toBool(subscriber.withMetrics) ? CommandResult::Acknowledged : CommandResult::Invalid;
+}
+
+/// @brief {"overflow":"dropOldest"}, "coalesce" or "disconnect" sets what happens when the client's send queue fills up
+CommandResult TCPServer::setOverflow(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    if (field.type != CommandValueType::String) {
+        return CommandResult::Invalid;
+    }
+    if (field.value == "dropOldest") {
+        subscriber.queue.setPolicy(QueueOverflowPolicy::DropOldest);
+    } else if (field.value == "coalesce") {
+        subscriber.queue.setPolicy(QueueOverflowPolicy::CoalesceToLatest);
+    } else if (field.value == "disconnect") {
+        subscriber.queue.setPolicy(QueueOverflowPolicy::Disconnect);
+    } else {
+        return CommandResult::Invalid;
+    }
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"humidityDeadband":50} and {"temperatureDeadband":20} set the change from the last reported value, in
+/// hundredths of %rh and °C, that the exception mode reports right away
+CommandResult TCPServer::setDeadband(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t deadband;
+    if (!field.toUnsigned(deadband) || deadband > UINT16_MAX) {
+        return CommandResult::Invalid;
+    }
+    auto &thresholds = subscriber.thresholds;
+    (field.key == "humidityDeadband" ? thresholds.humidityDeadband : thresholds.temperatureDeadband) = deadband;
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"heartbeat":300} sets the seconds after which the exception mode reports a probe's reading even if it didn't
+/// change
+CommandResult TCPServer::setHeartbeat(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t heartbeat;
+    if (!field.toUnsigned(heartbeat) || heartbeat == 0 || heartbeat > UINT16_MAX) {
+        return CommandResult::Invalid;
+    }
+    subscriber.thresholds.heartbeat = heartbeat;
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"since":123} requests all readings taken after the one with the given sequence number
+CommandResult TCPServer::requestSince(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    uint32_t since;
+    if (!field.toUnsigned(since)) {
+        return CommandResult::Invalid;
     }
+    auto &history = instance->history;
+    if (!history.empty()) {
+        subscriber.lastSentSequence = since;
+        // pretend the reading before the first requested one was sent a whole interval earlier, so that one isn't thinned out
+        auto first = std::min(history.firstAfter(subscriber.lastSentSequence), history.size() - 1);
+        subscriber.lastSentUptime = history.at(first).uptime - subscriber.interval * 1000;
+        subscriber.backfillSample = false;
+        subscriber.backfilling = true;
+    }
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"ping":true} only gets an acknowledgement, e.g. to check that the connection is alive
+CommandResult TCPServer::ping(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    return CommandResult::Acknowledged;
+}
+
+/// @brief {"stats":true} replies with the client's interval, the sequence number of the last reading sent to it and its
+/// send queue counters
+CommandResult TCPServer::sendStats(TCPSubscriber &subscriber, const CommandField &field, const Command &command) {
+    if (!subscriber.statsReply) {
+        subscriber.statsReply = FrameRef::withCapacity(TCP_REPLY_BUFFER);
+    }
+    auto &stats = subscriber.queue.getStats();
+    StatsReply reply{"stats", subscriber.interval, subscriber.lastSentSequence, stats.sentBytes, stats.sentFrames,
+                     stats.droppedFrames, stats.queuedBytes};
+    char json[TCP_REPLY_BUFFER];
+    auto length = encodeJson(reply, json, sizeof(json) - 1);
+    json[length++] = '\n';
+    // the previous reply is still queued, or the frame couldn't be allocated
+    if (length == 1 || !subscriber.statsReply.rewrite(reinterpret_cast<const uint8_t *>(json), length)) {
+        return CommandResult::Busy;
+    }
+    queueReply(subscriber, subscriber.statsReply);
+    return CommandResult::Replied;
+}
+
+/// @brief Writes the amount of bytes and frames sent to every connected client, labelled with the client's id
+void TCPServer::writeMetrics(MetricsWriter &writer) {
+    char labels[16];
+    writer.gauge("poleko_tcp_clients", connectedClients());
+    // called by the HTTP server on the AsyncTCP task, so it only reads what loop() publishes
+    std::lock_guard<std::mutex> lock(instance->slotLock);
+    writer.type("poleko_tcp_client_sent_bytes", "counter");
+    for (auto &subscriber: instance->clients) {
+        if (subscriber.client == nullptr) {
+            continue;
+        }
+        snprintf(labels, sizeof(labels), "client=\"%u\"", subscriber.id);
+        writer.sample("poleko_tcp_client_sent_bytes", labels, subscriber.sentBytes.load(std::memory_order_relaxed));
+    }
+    writer.type("poleko_tcp_client_sent_frames", "counter");
+    for (auto &subscriber: instance->clients) {
+        if (subscriber.client == nullptr) {
+            continue;
+        }
+        snprintf(labels, sizeof(labels), "client=\"%u\"", subscriber.id);
+        writer.sample("poleko_tcp_client_sent_frames", labels, subscriber.sentFrames.load(std::memory_order_relaxed));
+    }
+}
+
+void TCPServer::handleError(void *arg, AsyncClient *client, int8_t error) {
+    LOG_WARNING("TCP client error %d, IP: %s", error, client->remoteIP());
+}
+
+/// @brief Marks the client's slot disconnected, loop() frees it and deletes the client
+void TCPServer::handleDisconnect(void *arg, AsyncClient *client) {
+    LOG_INFO("TCP client disconnected");
+    {
+        std::lock_guard<std::mutex> lock(instance->slotLock);
+        auto subscriber = findSubscriber(client);
+        if (subscriber != nullptr) {
+            subscriber->disconnected = true;
+        }
+    }
+    notifyActivity();
+}
+
+/// @brief Closes the client, loop() frees its slot once it's disconnected
+void TCPServer::handleTimeout(void *arg, AsyncClient *client, uint32_t time) {
+    LOG_WARNING("TCP client timed out, IP: %s", client->remoteIP());
+    client->close(true);
+}
+
+/// @brief Called when the client acknowledged sent data, which frees space for queued frames and history
+void TCPServer::handleAck(void *arg, AsyncClient *client, size_t len, uint32_t time) {
+    notifyActivity();
+}
 
-    if (instance->clients.size() == 0) {
-        instance->timer.detachInterrupt();
+void TCPServer::notifyActivity() {
+    if (instance->activityCallback) {
+        instance->activityCallback();
     }
 }
@@ -2,14 +2,14 @@
 #include <Arduino.h>
 #include <WiFiManager.h>
 #include <WiFi.h>
-#include <Preferences.h>
+#include "Log.h"
 
 bool initialWiFiSetupOver = false;
 
 /// @brief Sets up sensor's WiFi connection. Gets saved IP preferences and tries to connect to a saved access point if there is such.
 /// If it cannot connect to the saved AP, opens a configuration portal.
-void setupWiFi() {
-    auto ipSettings = getSavedIpSettings();
+void setupWiFi(Settings &settings) {
+    auto ipSettings = getSavedIpSettings(settings);
     WiFi.config(ipSettings.ip, ipSettings.defaultGateway, ipSettings.subnetMask);
     pinMode(LED_PIN, OUTPUT);
     WiFiManager wm;
@@ -25,8 +25,8 @@ void setupWiFi() {
 }
 
 /// @brief Sets up the network configuration portal on which you can change the current WiFi and network parameters.
-void setupIpSetup() {
-    auto prefSettings = getSavedIpSettings();
+void setupIpSetup(Settings &settings) {
+    auto prefSettings = getSavedIpSettings(settings);
 
     WiFiManager wm;
     wm.setCountry("PL");
@@ -56,8 +56,8 @@ void setupIpSetup() {
     IPAddress paramMask = maskParam.getValue();
     if ((prefSettings.ip != paramIp) || (prefSettings.defaultGateway != paramGateway) ||
         (prefSettings.subnetMask != paramMask)) {
-        auto settings = IpSettings{paramIp, paramMask, paramGateway};
-        saveIpSettings(settings);
+        auto ipSettings = IpSettings{paramIp, paramMask, paramGateway};
+        saveIpSettings(settings, ipSettings);
         WiFi.config(paramIp, paramGateway, paramMask);
         digitalWrite(LED_PIN, HIGH);
     }
@@ -65,29 +65,17 @@ void setupIpSetup() {
 
 /// @brief Gets network parameters saved in microcontroller's flash memory.
 /// @return IpSettings struct containing network parameters.
-IpSettings getSavedIpSettings() {
-    Preferences preferences;
-    preferences.begin("ipSettings");
-    auto prefIp = preferences.getString("ip", "");
-    IPAddress ip;
-    ip.fromString(prefIp);
-    auto prefMask = preferences.getString("mask", "");
-    IPAddress mask;
-    mask.fromString(prefMask);
-    auto prefGateway = preferences.getString("gateway", "");
-    IPAddress gateway;
-    gateway.fromString(prefGateway);
-    return IpSettings{ip, mask, gateway};
+IpSettings getSavedIpSettings(Settings &settings) {
+    auto stored = settings.get();
+    return IpSettings{IPAddress(stored.ip), IPAddress(stored.subnetMask), IPAddress(stored.defaultGateway)};
 }
 
-/// @brief Saves network parameters to microcontroller's flash memory.
-/// @param settings Settings to save
-void saveIpSettings(IpSettings &settings) {
-    Preferences preferences;
-    preferences.begin("ipSettings");
-    preferences.putString("ip", settings.ip.toString());
-    preferences.putString("mask", settings.subnetMask.toString());
-    preferences.putString("gateway", settings.defaultGateway.toString());
+/// @brief Saves network parameters to microcontroller's flash memory. They're written right away, as the device may be
+/// restarted soon after they're changed.
+/// @param ipSettings Settings to save
+void saveIpSettings(Settings &settings, IpSettings &ipSettings) {
+    settings.setNetwork(ipSettings.ip, ipSettings.subnetMask, ipSettings.defaultGateway);
+    settings.flush();
 }
 
 IPAddressParameter::IPAddressParameter(const char *id, const char *placeholder, IPAddress address)
@@ -99,7 +87,7 @@ IPAddressParameter::IPAddressParameter(const char *id, const char *placeholder,
 /// @return IP entered in the input or IPAddress(0u), which can set DHCP up if all 3 parameters are set to it
 IPAddress IPAddressParameter::getValue() {
     IPAddress ip;
-    Serial.println(WiFiManagerParameter::getValue());
+    LOG_DEBUG("IP parameter value: %s", WiFiManagerParameter::getValue());
     if (isValid()) {
         ip.fromString(WiFiManagerParameter::getValue());
     } else {
@@ -1,65 +1,261 @@
 #include <Arduino.h>
-#include "Sensor.h"
+#include "SensorBus.h"
 #include "WiFiHelpers.h"
 #include "TCPServer.h"
 #include "EspUDPServer.h"
 #include "HTTPServer.h"
+#include "EventLoop.h"
+#include "Settings.h"
+#include "Connectivity.h"
+#include "HistoryLog.h"
+#include "Log.h"
 #include <WiFiManager.h>
 #include <WiFi.h>
-#include <Preferences.h>
+#include <ctime>
+
+// the unit tests bring their own main() and build the services they need, none of the firmware's globals are wanted
+#ifndef PIO_UNIT_TESTING
 
 constexpr byte
 BOOT_BUTTON_PIN = 0;
 
-Sensor sensor(2, 16, 17);
-TCPServer tcpServer(sensor);
-HTTPServer httpServer(sensor);
-EspUDPServer udpServer;
+// requests are answered right away, the HTTP server only needs to be told about new readings and RSSI changes
+constexpr unsigned long HTTP_REFRESH_INTERVAL = 1000;
+// presses closer to each other than that are treated as contact bounce
+constexpr unsigned long BUTTON_DEBOUNCE = 200;
+// seconds between rows of the history log, the log keeps about four months of them
+constexpr uint32_t HISTORY_INTERVAL = 10;
+// the history log's rows are timestamped with the time SNTP sets, in UTC
+constexpr char NTP_SERVER[] = "pool.ntp.org";
+
+// Memory plan of the network services: they're constructed once and hold a fixed amount of slots, along with the
+// buffers every connection needs, so that weeks of clients coming and going don't fragment the heap. Only AsyncTCP's
+// clients and the frames in flight are allocated at run time, /metrics and /status report the heap's low watermark.
+#ifdef CONFIG_LWIP_MAX_ACTIVE_TCP
+constexpr size_t MAX_TCP_CONNECTIONS = CONFIG_LWIP_MAX_ACTIVE_TCP;
+#else
+constexpr size_t MAX_TCP_CONNECTIONS = 16;
+#endif
+static_assert(MAX_TCP_CLIENTS + MAX_HTTP_CONNECTIONS + MAX_HTTP_STREAMS <= MAX_TCP_CONNECTIONS,
+              "the services accept more connections than lwIP can have open");
+// RAM the services take statically, most of it is the TCP server's history of readings
+constexpr size_t NETWORK_MEMORY_BUDGET = 40 * 1024;
+static_assert(sizeof(TCPServer) + sizeof(HTTPServer) + sizeof(EspUDPServer) <= NETWORK_MEMORY_BUDGET,
+              "the network services take more RAM than planned");
+
+#ifndef SENSOR_PROBES
+// amount of probes connected to the device, the first ones of PROBE_PINS are used
+#define SENSOR_PROBES 1
+#endif
+
+// the console takes UART0, every other UART can have a probe. UART1's default pins are taken by the flash, so it's moved.
+constexpr ProbePins PROBE_PINS[] = {{2, 16, 17}, {1, 25, 26}};
+static_assert(SENSOR_PROBES >= 1 && SENSOR_PROBES <= sizeof(PROBE_PINS) / sizeof(PROBE_PINS[0]),
+              "SENSOR_PROBES must match the pins in PROBE_PINS");
+
+#ifdef SENSOR_TASK_CORE
+// the sensor task only does UART work, a small stack is enough
+constexpr uint32_t SENSOR_TASK_STACK = 4096;
+constexpr UBaseType_t SENSOR_TASK_PRIORITY = 2;
 
-bool prevButtonState = HIGH;
+TaskHandle_t sensorTaskHandle = nullptr;
+#endif
+
+Settings settings;
+SensorBus sensors(PROBE_PINS, SENSOR_PROBES);
+TCPServer tcpServer(sensors, settings);
+HistoryLog history;
+HTTPServer httpServer(sensors, history);
+EspUDPServer udpServer(SENSOR_PROBES);
+EventLoop eventLoop;
+Connectivity connectivity;
+
+unsigned long lastButtonPress = 0;
+// how long the link was down for before the last reconnect, in ms
+unsigned long lastDowntime = 0;
+// Unix time of the last row appended to the history log
+uint32_t lastHistoryRow = 0;
 
 void setupSerial();
 
+void setupEvents();
+
 void startServices();
 
 void stopServices();
 
+void runServices();
+
+void reconfigureNetwork();
+
+void recordHistory();
+
+#ifdef SENSOR_TASK_CORE
+void sensorTask(void *);
+#endif
+
 void setup() {
     setupSerial();
+    settings.begin();
+    history.begin();
     // this call can potentially block the thread, because the configPortal blocks
-    setupWiFi();
+    setupWiFi(settings);
+    configTime(0, 0, NTP_SERVER);
+    setupEvents();
     startServices();
 }
 
-// DO NOT USE ANY FUNCTION THAT DELAYS THE EXECUTION OF CODE INSIDE THIS FUNCTION!!!
+// the loop sleeps until an event is posted or a service's deadline passes. DO NOT USE ANY FUNCTION THAT DELAYS THE EXECUTION
+// OF CODE INSIDE THE EVENT HANDLERS!!!
 void loop() {
-    auto buttonState = digitalRead(BOOT_BUTTON_PIN);
-    // if the BOOT button was pressed, set up the configuration portal
-    if (buttonState == LOW && prevButtonState == HIGH) {
-        digitalWrite(LED_PIN, LOW);
-        stopServices();
-        setupIpSetup();
-        startServices();
-    }
-    prevButtonState = buttonState;
-    // if WiFi disconnected, turn the LED off and set up the configuration portal
-    if (WiFi.status() != WL_CONNECTED) {
-        digitalWrite(LED_PIN, LOW);
-        stopServices();
-        setupIpSetup();
-        startServices();
-    }
-
-    // server code
-    udpServer.loop();
-    tcpServer.loop();
-    httpServer.loop();
+    eventLoop.runOnce();
 }
 
-
-/// @brief Sets up USB UART connection
+/// @brief Sets up USB UART connection, which log records are written to in the background
 void setupSerial() {
     Serial.begin(9600);
+    Log::begin([](const char *line, size_t length) {
+        Serial.write(reinterpret_cast<const uint8_t *>(line), length);
+    });
+}
+
+void ARDUINO_ISR_ATTR handleButtonInterrupt() {
+    eventLoop.postFromISR(Event::ButtonPressed);
+}
+
+/// @brief Connects interrupts and callbacks to the event loop and registers event handlers
+void setupEvents() {
+    eventLoop.begin();
+
+    attachInterrupt(digitalPinToInterrupt(BOOT_BUTTON_PIN), handleButtonInterrupt, FALLING);
+    // a dropped link is reconnected in the background while the services keep running, the portal is the last resort
+    connectivity.onChange([]() { eventLoop.post(Event::Connectivity); });
+    connectivity.onReconnected([](unsigned long downtime) {
+        lastDowntime = downtime;
+        eventLoop.post(Event::Reconnected);
+    });
+    connectivity.onPortalNeeded(reconfigureNetwork);
+    connectivity.begin();
+    // the beacon only changes with the address, so it's rebuilt and announced in a new burst when one is assigned
+    WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info) {
+        udpServer.addressChanged();
+        eventLoop.post(Event::UDP);
+    }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+#ifdef SENSOR_TASK_CORE
+    // the probes are driven by their own task, the event loop only takes the readings they publish
+    sensors.onReceive([]() { xTaskNotifyGive(sensorTaskHandle); });
+    sensors.onPublish([]() { eventLoop.post(Event::Sensor); });
+    sensors.onDemand([]() { xTaskNotifyGive(sensorTaskHandle); });
+    xTaskCreatePinnedToCore(sensorTask, "sensor", SENSOR_TASK_STACK, nullptr, SENSOR_TASK_PRIORITY, &sensorTaskHandle,
+                            SENSOR_TASK_CORE);
+#else
+    sensors.onReceive([]() { eventLoop.post(Event::Sensor); });
+    sensors.onDemand([]() { eventLoop.post(Event::Sensor); });
+#endif
+    tcpServer.onActivity([]() { eventLoop.post(Event::TCP); });
+    httpServer.onActivity([]() { eventLoop.post(Event::HTTP); });
+    settings.onChange([]() { eventLoop.post(Event::Settings); });
+
+    // if the BOOT button was pressed, set up the configuration portal
+    eventLoop.on(Event::ButtonPressed, []() {
+        if (digitalRead(BOOT_BUTTON_PIN) == LOW && millis() - lastButtonPress >= BUTTON_DEBOUNCE) {
+            lastButtonPress = millis();
+            reconfigureNetwork();
+        }
+    });
+    eventLoop.on(Event::Connectivity, []() {
+        connectivity.loop();
+        uint32_t deadline;
+        if (connectivity.nextDeadline(deadline)) {
+            eventLoop.setTimer(Event::Connectivity, deadline);
+        } else {
+            eventLoop.cancelTimer(Event::Connectivity);
+        }
+    });
+    // clients stayed connected through the drop, they're told about it so that they can request what they missed
+    eventLoop.on(Event::Reconnected, []() {
+        tcpServer.announceReconnect(lastDowntime);
+        eventLoop.post(Event::TCP);
+    });
+#ifdef SENSOR_TASK_CORE
+    eventLoop.on(Event::Sensor, []() {
+        if (sensors.takeReadings()) {
+            recordHistory();
+            eventLoop.post(Event::HTTP);
+        }
+    });
+#else
+    eventLoop.on(Event::Sensor, []() {
+        sensors.loop();
+        if (sensors.takeReadings()) {
+            recordHistory();
+            eventLoop.post(Event::HTTP);
+        }
+        eventLoop.setTimer(Event::Sensor, sensors.nextDeadline());
+    });
+#endif
+    eventLoop.on(Event::TCP, []() {
+        TCPServer::loop();
+        uint32_t deadline;
+        if (TCPServer::nextDeadline(deadline)) {
+            eventLoop.setTimer(Event::TCP, deadline);
+        } else {
+            eventLoop.cancelTimer(Event::TCP);
+        }
+    });
+    eventLoop.on(Event::UDP, []() {
+        udpServer.loop();
+        eventLoop.setTimer(Event::UDP, udpServer.nextDeadline());
+    });
+    eventLoop.on(Event::HTTP, []() {
+        httpServer.loop();
+        eventLoop.setTimer(Event::HTTP, millis() + HTTP_REFRESH_INTERVAL);
+    });
+    // changes are written to flash in the background, once they stop coming
+    eventLoop.on(Event::Settings, []() {
+        settings.loop();
+        uint32_t deadline;
+        if (settings.nextDeadline(deadline)) {
+            eventLoop.setTimer(Event::Settings, deadline);
+        } else {
+            eventLoop.cancelTimer(Event::Settings);
+        }
+    });
+}
+
+#ifdef SENSOR_TASK_CORE
+/// @brief Owns the UART connections to the probes: drives them and sleeps until data arrives or the next deadline, so that
+/// the probes are polled on time no matter what the networking code on the other core is doing
+void sensorTask(void *) {
+    while (true) {
+        sensors.loop();
+        long remaining = static_cast<long>(sensors.nextDeadline() - millis());
+        if (remaining > 0) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining));
+        }
+    }
+}
+#endif
+
+/// @brief Appends the probes' latest readings to the history log, once every HISTORY_INTERVAL seconds after SNTP set the
+/// clock. Writing a row programs a few bytes of flash, which doesn't hold up the loop.
+void recordHistory() {
+    auto now = static_cast<uint32_t>(time(nullptr));
+    if (now - lastHistoryRow < HISTORY_INTERVAL) {
+        return;
+    }
+    HistorySample samples[MAX_PROBES];
+    for (size_t probe = 0; probe < sensors.size(); probe++) {
+        auto reading = sensors[probe].getLatestReading();
+        samples[probe] = HistorySample{
+                static_cast<int16_t>(lroundf(reading.humidity * 100)),
+                static_cast<int16_t>(lroundf(reading.temperature * 100)),
+                reading.valid
+        };
+    }
+    if (history.append(now, samples, sensors.size())) {
+        lastHistoryRow = now;
+    }
 }
 
 /// @brief Starts servers
@@ -67,6 +263,7 @@ void startServices() {
     tcpServer.setup();
     udpServer.setup();
     httpServer.setup();
+    runServices();
 }
 
 /// @brief Stops servers
@@ -74,4 +271,26 @@ void stopServices() {
     tcpServer.stop();
     udpServer.stop();
     httpServer.stop();
-}
\ No newline at end of file
+}
+
+/// @brief Makes every service run once, after which it schedules its own deadline
+void runServices() {
+    eventLoop.post(Event::Sensor);
+    eventLoop.post(Event::TCP);
+    eventLoop.post(Event::UDP);
+    eventLoop.post(Event::HTTP);
+}
+
+/// @brief Turns the LED off and blocks in the configuration portal until the network is set up again
+void reconfigureNetwork() {
+    digitalWrite(LED_PIN, LOW);
+    stopServices();
+    // the portal can restart the device
+    settings.flush();
+    setupIpSetup(settings);
+    startServices();
+    // the portal might have been left without connecting to a network, which starts another grace period
+    eventLoop.post(Event::Connectivity);
+}
+
+#endif
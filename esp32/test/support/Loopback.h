@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#pragma once
+
+// Clients of the in-process servers, which the native AsyncTCP serves on the loopback interface. Shared by the test suites,
+// so it's header-only: every suite is built on its own.
+
+// how long a test waits for a reply or for a server to notice a disconnect
+constexpr unsigned long LOOPBACK_TIMEOUT = 3000;
+
+/// @brief Connects to an in-process server over loopback
+/// @param port Port as the firmware knows it, POLEKO_PORT_OFFSET is added
+/// @return The socket or -1 if the connection failed
+inline int openLoopback(uint16_t port) {
+    auto socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(hal::hostPort(port));
+    if (connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        close(socket);
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return socket;
+}
+
+/// @brief Runs step() until the condition holds or the timeout passes, sleeping a little in between like the event loop
+/// would while waiting
+/// @return false if the condition didn't hold in time
+template<typename Condition, typename Step>
+bool pumpUntil(Condition condition, Step step, unsigned long timeout = LOOPBACK_TIMEOUT) {
+    auto startedAt = millis();
+    while (!condition()) {
+        if (millis() - startedAt > timeout) {
+            return false;
+        }
+        step();
+        delayMicroseconds(200);
+    }
+    return true;
+}
+
+/// @brief Connection to an in-process server whose messages are lines, like the TCP server's
+class LoopbackClient {
+public:
+    explicit LoopbackClient(uint16_t port) : socket(openLoopback(port)) {}
+
+    ~LoopbackClient() {
+        disconnect();
+    }
+
+    LoopbackClient(const LoopbackClient &) = delete;
+
+    LoopbackClient &operator=(const LoopbackClient &) = delete;
+
+    bool connected() const {
+        return socket >= 0;
+    }
+
+    void disconnect() {
+        if (socket >= 0) {
+            close(socket);
+            socket = -1;
+        }
+    }
+
+    bool send(std::string_view text) {
+        return ::send(socket, text.data(), text.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+    }
+
+    /// @brief Reads what arrived so far without waiting
+    /// @return false once the server closed the connection
+    bool poll() {
+        char buffer[1024];
+        while (true) {
+            auto length = recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (length > 0) {
+                received.append(buffer, length);
+                continue;
+            }
+            return length < 0;
+        }
+    }
+
+    /// @brief Takes the first complete line received, without its newline
+    /// @return false if no line is complete yet
+    bool nextLine(std::string &line) {
+        poll();
+        auto end = received.find('\n');
+        if (end == std::string::npos) {
+            return false;
+        }
+        line = received.substr(0, end);
+        received.erase(0, end + 1);
+        return true;
+    }
+
+    /// @brief Takes the given amount of bytes, e.g. a binary record
+    /// @return false if fewer arrived so far
+    bool nextBytes(size_t count, std::string &bytes) {
+        poll();
+        if (received.size() < count) {
+            return false;
+        }
+        bytes = received.substr(0, count);
+        received.erase(0, count);
+        return true;
+    }
+
+    /// @brief Everything received and not taken yet
+    std::string &buffer() {
+        return received;
+    }
+
+private:
+    int socket;
+    std::string received;
+};
+
+/// @brief Reads an unsigned number following "<key>": in a JSON line
+/// @return The number or -1 if the key isn't there
+inline long jsonNumber(std::string_view line, std::string_view key) {
+    std::string pattern = "\"" + std::string(key) + "\":";
+    auto found = line.find(pattern);
+    if (found == std::string_view::npos) {
+        return -1;
+    }
+    return strtol(line.data() + found + pattern.size(), nullptr, 10);
+}
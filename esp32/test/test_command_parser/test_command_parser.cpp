@@ -0,0 +1,112 @@
+#include <unity.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "CommandParser.h"
+
+// Framing and parsing of TCP commands, no matter how TCP splits them.
+
+namespace {
+    struct Framed {
+        std::string text;
+        bool tooLong;
+    };
+
+    /// @brief Feeds the input to a new framer in chunks of the given size
+    std::vector<Framed> frame(std::string_view input, size_t chunk = SIZE_MAX) {
+        std::vector<Framed> commands;
+        CommandFramer framer;
+        for (size_t offset = 0; offset < input.size(); offset += chunk) {
+            auto part = input.substr(offset, chunk);
+            framer.push(part.data(), part.size(), [&commands](std::string_view text, bool tooLong) {
+                commands.push_back({std::string(text), tooLong});
+            });
+        }
+        return commands;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_commands_end_with_a_newline_or_their_brace() {
+    auto commands = frame("{\"ping\":true}\n  {\"interval\":5}{\"stats\":true}\nnot json\n\n");
+    TEST_ASSERT_EQUAL(4, commands.size());
+    TEST_ASSERT_EQUAL_STRING("{\"ping\":true}", commands[0].text.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"interval\":5}", commands[1].text.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"stats\":true}", commands[2].text.c_str());
+    TEST_ASSERT_EQUAL_STRING("not json", commands[3].text.c_str());
+}
+
+void test_braces_in_strings_dont_end_a_command() {
+    auto commands = frame("{\"mode\":\"}\\\"{\"}");
+    TEST_ASSERT_EQUAL(1, commands.size());
+    TEST_ASSERT_EQUAL_STRING("{\"mode\":\"}\\\"{\"}", commands[0].text.c_str());
+}
+
+void test_newline_ends_an_unterminated_string() {
+    auto commands = frame("{\"mode\":\"average}\n{\"ping\":true}\n");
+    TEST_ASSERT_EQUAL(2, commands.size());
+    Command command;
+    TEST_ASSERT_FALSE(command.parse(commands[0].text));
+    TEST_ASSERT_EQUAL_STRING("{\"ping\":true}", commands[1].text.c_str());
+    TEST_ASSERT_TRUE(command.parse(commands[1].text));
+}
+
+void test_split_commands_come_out_the_same() {
+    std::string_view input = "{\"interval\":5,\"save\":false}\n{\"format\":\"binary\"}{\"since\":12}\n";
+    auto whole = frame(input);
+    TEST_ASSERT_EQUAL(3, whole.size());
+    for (size_t chunk = 1; chunk < input.size(); chunk++) {
+        auto split = frame(input, chunk);
+        TEST_ASSERT_EQUAL(whole.size(), split.size());
+        for (size_t i = 0; i < whole.size(); i++) {
+            TEST_ASSERT_EQUAL_STRING(whole[i].text.c_str(), split[i].text.c_str());
+        }
+    }
+}
+
+void test_too_long_command_is_skipped_as_a_whole() {
+    std::string input = "{\"ping\":\"" + std::string(TCP_COMMAND_BUFFER, 'x') + "\"}\n{\"ping\":true}\n";
+    auto commands = frame(input, 7);
+    TEST_ASSERT_EQUAL(2, commands.size());
+    TEST_ASSERT_TRUE(commands[0].tooLong);
+    TEST_ASSERT_TRUE(commands[0].text.empty());
+    TEST_ASSERT_FALSE(commands[1].tooLong);
+}
+
+void test_fields_are_parsed() {
+    Command command;
+    TEST_ASSERT_TRUE(command.parse("{\"interval\":5, \"save\":false, \"mode\":\"average\"}"));
+    TEST_ASSERT_EQUAL(3, command.size());
+    uint32_t interval;
+    TEST_ASSERT_TRUE(command[0].toUnsigned(interval));
+    TEST_ASSERT_EQUAL_UINT32(5, interval);
+    bool save = true;
+    TEST_ASSERT_NOT_NULL(command.find("save"));
+    TEST_ASSERT_TRUE(command.find("save")->toBool(save));
+    TEST_ASSERT_FALSE(save);
+    TEST_ASSERT_EQUAL(CommandValueType::String, command[2].type);
+    TEST_ASSERT_TRUE(command[2].value == "average");
+    TEST_ASSERT_NULL(command.find("batch"));
+}
+
+void test_malformed_commands_are_rejected() {
+    Command command;
+    for (auto text: {"", "{", "{\"ping\"}", "{\"ping\":}", "[1]", "{\"a\":{\"b\":1}}", "{\"ping\":true} x"}) {
+        TEST_ASSERT_FALSE_MESSAGE(command.parse(text), text);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_commands_end_with_a_newline_or_their_brace);
+    RUN_TEST(test_braces_in_strings_dont_end_a_command);
+    RUN_TEST(test_newline_ends_an_unterminated_string);
+    RUN_TEST(test_split_commands_come_out_the_same);
+    RUN_TEST(test_too_long_command_is_skipped_as_a_whole);
+    RUN_TEST(test_fields_are_parsed);
+    RUN_TEST(test_malformed_commands_are_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,86 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <WiFi.h>
+#include "Connectivity.h"
+#include "Metrics.h"
+#include "WiFiHelpers.h"
+
+// Reconnecting in the background when the native WiFi's access point goes away for a while, the way POLEKO_LINK_FLAPS
+// scripts it.
+
+// longer than an outage plus the reconnect attempts that follow it
+constexpr unsigned long TEST_TIMEOUT = 3000;
+constexpr unsigned long PORTAL_TIMEOUT = 1500;
+
+namespace {
+    // begin() registers WiFi event handlers, so there's one instance for all the tests
+    Connectivity connectivity(PORTAL_TIMEOUT);
+    unsigned long lastDowntime = 0;
+    unsigned portalRequests = 0;
+
+    /// @brief Runs loop() the way the event loop would, until the link is in the given state or TEST_TIMEOUT passes
+    /// @return false if it didn't get there
+    bool pumpUntil(LinkState state) {
+        auto startedAt = millis();
+        while (millis() - startedAt < TEST_TIMEOUT) {
+            connectivity.loop();
+            if (connectivity.getState() == state) {
+                return true;
+            }
+            delay(1);
+        }
+        return false;
+    }
+}
+
+void setUp() {
+    WiFi.simulateConnection(true);
+    TEST_ASSERT_TRUE(pumpUntil(LinkState::Connected));
+    digitalWrite(LED_PIN, HIGH);
+}
+
+void tearDown() {}
+
+void test_led_is_off_while_the_link_is_down() {
+    auto disconnects = metrics.wifiDisconnects.get();
+    WiFi.simulateOutage(300);
+    TEST_ASSERT_TRUE(pumpUntil(LinkState::Reconnecting));
+    TEST_ASSERT_EQUAL(LOW, digitalRead(LED_PIN));
+    TEST_ASSERT_EQUAL_UINT32(disconnects + 1, metrics.wifiDisconnects.get());
+    TEST_ASSERT_TRUE(pumpUntil(LinkState::Connected));
+    TEST_ASSERT_EQUAL(HIGH, digitalRead(LED_PIN));
+    TEST_ASSERT_GREATER_OR_EQUAL(300, lastDowntime);
+}
+
+void test_flapping_link_is_followed() {
+    for (int flap = 0; flap < 3; flap++) {
+        WiFi.simulateOutage(100);
+        TEST_ASSERT_TRUE(pumpUntil(LinkState::Reconnecting));
+        TEST_ASSERT_EQUAL(LOW, digitalRead(LED_PIN));
+        TEST_ASSERT_TRUE(pumpUntil(LinkState::Connected));
+        TEST_ASSERT_EQUAL(HIGH, digitalRead(LED_PIN));
+    }
+    TEST_ASSERT_EQUAL(0, portalRequests);
+}
+
+void test_portal_is_needed_after_the_grace_period() {
+    WiFi.simulateOutage(PORTAL_TIMEOUT * 2);
+    TEST_ASSERT_TRUE(pumpUntil(LinkState::Portal));
+    TEST_ASSERT_EQUAL(1, portalRequests);
+    TEST_ASSERT_EQUAL(LOW, digitalRead(LED_PIN));
+    // the portal returned without a connection, another grace period starts
+    connectivity.loop();
+    TEST_ASSERT_EQUAL(LinkState::Reconnecting, connectivity.getState());
+    TEST_ASSERT_EQUAL(LOW, digitalRead(LED_PIN));
+}
+
+int main() {
+    connectivity.onReconnected([](unsigned long downtime) { lastDowntime = downtime; });
+    connectivity.onPortalNeeded([]() { portalRequests++; });
+    connectivity.begin();
+    UNITY_BEGIN();
+    RUN_TEST(test_led_is_off_while_the_link_is_down);
+    RUN_TEST(test_flapping_link_is_followed);
+    RUN_TEST(test_portal_is_needed_after_the_grace_period);
+    return UNITY_END();
+}
@@ -0,0 +1,189 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include "HistoryLog.h"
+
+// The history log on the emulated flash, kept in memory: rows read back exactly whatever their values, ranges, surviving a
+// reboot, and the ring of sectors turning over evenly.
+
+namespace {
+    std::unique_ptr<HistoryLog> history;
+
+    struct LoggedRow {
+        uint32_t time;
+        HistorySample samples[2];
+    };
+
+    /// @brief Rows of two probes at irregular times, with values that mostly stay put but sometimes jump as far as they
+    /// can, and readings missing now and then
+    std::vector<LoggedRow> irregularRows(size_t count) {
+        std::mt19937 random(11);
+        std::vector<LoggedRow> rows;
+        uint32_t time = HISTORY_MIN_TIME;
+        int16_t values[4] = {4500, 2300, 5500, 1800};
+        for (size_t i = 0; i < count; i++) {
+            auto gap = random() % 100;
+            time += gap < 80 ? 10 : gap < 98 ? 1 + random() % 600 : 100000 + random() % 5000000;
+            for (auto &value: values) {
+                auto change = random() % 100;
+                if (change >= 60 && change < 95) {
+                    value += static_cast<int16_t>(random() % 21) - 10;
+                } else if (change >= 95) {
+                    value = static_cast<int16_t>(random() % 30000) - 10000;
+                }
+            }
+            rows.push_back({time, {{values[0], values[1], random() % 50 != 0}, {values[2], values[3], random() % 50 != 0}}});
+        }
+        return rows;
+    }
+
+    void appendAll(const std::vector<LoggedRow> &rows) {
+        for (auto &row: rows) {
+            TEST_ASSERT_TRUE(history->append(row.time, row.samples, 2));
+        }
+    }
+
+    /// @brief Reads the range and checks it against the logged rows that fall into it
+    void expectRange(const std::vector<LoggedRow> &rows, uint32_t from, uint32_t to) {
+        HistoryCursor cursor;
+        HistoryRow row;
+        TEST_ASSERT_TRUE(history->open(cursor, from, to));
+        size_t expected = 0;
+        while (expected < rows.size() && rows[expected].time < from) {
+            expected++;
+        }
+        while (history->next(cursor, row)) {
+            TEST_ASSERT_TRUE(expected < rows.size() && rows[expected].time <= to);
+            auto &logged = rows[expected++];
+            TEST_ASSERT_EQUAL_UINT32(logged.time, row.time);
+            TEST_ASSERT_EQUAL(2, row.probes);
+            for (size_t probe = 0; probe < 2; probe++) {
+                TEST_ASSERT_EQUAL(logged.samples[probe].valid, row.samples[probe].valid);
+                if (logged.samples[probe].valid) {
+                    TEST_ASSERT_EQUAL_INT(logged.samples[probe].humidity, row.samples[probe].humidity);
+                    TEST_ASSERT_EQUAL_INT(logged.samples[probe].temperature, row.samples[probe].temperature);
+                }
+            }
+        }
+        TEST_ASSERT_TRUE(expected == rows.size() || rows[expected].time > to);
+    }
+}
+
+void setUp() {
+    history = std::make_unique<HistoryLog>();
+    TEST_ASSERT_TRUE(history->begin());
+    history->erase();
+}
+
+void tearDown() {
+    history = nullptr;
+}
+
+void test_rows_are_read_back_exactly() {
+    auto rows = irregularRows(20000);
+    appendAll(rows);
+    TEST_ASSERT_EQUAL_UINT32(rows.size(), history->getStats().rows);
+    TEST_ASSERT_GREATER_THAN(1, history->getStats().sectorsUsed);
+    expectRange(rows, 0, UINT32_MAX);
+}
+
+void test_ranges_hold_only_their_rows() {
+    auto rows = irregularRows(5000);
+    appendAll(rows);
+    expectRange(rows, rows[1234].time, rows[3210].time);
+    expectRange(rows, rows[4000].time + 1, rows[4000].time + 3600);
+    expectRange(rows, rows.back().time, UINT32_MAX);
+    HistoryCursor cursor;
+    HistoryRow row;
+    TEST_ASSERT_TRUE(history->open(cursor, rows.back().time + 1, UINT32_MAX));
+    TEST_ASSERT_FALSE(history->next(cursor, row));
+}
+
+void test_rows_out_of_order_or_before_the_clock_is_set_are_rejected() {
+    HistorySample sample{4500, 2300, true};
+    TEST_ASSERT_FALSE(history->append(HISTORY_MIN_TIME - 1, &sample, 1));
+    TEST_ASSERT_TRUE(history->append(HISTORY_MIN_TIME + 10, &sample, 1));
+    TEST_ASSERT_FALSE(history->append(HISTORY_MIN_TIME + 10, &sample, 1));
+    TEST_ASSERT_FALSE(history->append(HISTORY_MIN_TIME + 5, &sample, 1));
+    TEST_ASSERT_FALSE(history->append(HISTORY_MIN_TIME + 20, &sample, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, history->getStats().rows);
+}
+
+void test_rows_survive_a_reboot() {
+    auto rows = irregularRows(3000);
+    std::vector<LoggedRow> before(rows.begin(), rows.begin() + 2000);
+    appendAll(before);
+    history = std::make_unique<HistoryLog>();
+    TEST_ASSERT_TRUE(history->begin());
+    expectRange(before, 0, UINT32_MAX);
+    // the log continues after the last row written before the reboot, in a new sector
+    auto sectors = history->getStats().sectorsUsed;
+    TEST_ASSERT_FALSE(history->append(before.back().time, before.back().samples, 2));
+    appendAll(std::vector<LoggedRow>(rows.begin() + 2000, rows.end()));
+    TEST_ASSERT_EQUAL_UINT32(sectors + 1, history->getStats().sectorsUsed);
+    expectRange(rows, 0, UINT32_MAX);
+}
+
+void test_steady_rows_take_a_few_bits() {
+    HistorySample sample{4500, 2300, true};
+    for (uint32_t i = 0; i < 10000; i++) {
+        // the probe's noise, a hundredth up or down every few readings
+        sample.humidity = static_cast<int16_t>(4500 + (i / 7) % 2);
+        TEST_ASSERT_TRUE(history->append(HISTORY_MIN_TIME + 10 * i, &sample, 1));
+    }
+    auto stats = history->getStats();
+    char message[64];
+    snprintf(message, sizeof(message), "%.2f bits per row", static_cast<double>(stats.bitsStored) / stats.rows);
+    TEST_MESSAGE(message);
+    // against 8 bytes of an uncompressed row
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(8 * stats.rows, stats.bitsStored, message);
+}
+
+void test_ring_overwrites_the_oldest_sectors_evenly() {
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "history");
+    TEST_ASSERT_NOT_NULL(partition);
+    auto sectorCount = history->getStats().sectorCount;
+    auto erasesBefore = flashStats(partition).erases;
+    // values jumping every row fill sectors quickly
+    std::mt19937 random(3);
+    uint32_t time = HISTORY_MIN_TIME;
+    HistorySample sample{};
+    while (flashStats(partition).erases - erasesBefore < 2 * sectorCount) {
+        time += 10;
+        sample = {static_cast<int16_t>(random() % 10000), static_cast<int16_t>(random() % 10000), true};
+        TEST_ASSERT_TRUE(history->append(time, &sample, 1));
+    }
+    auto stats = history->getStats();
+    TEST_ASSERT_EQUAL_UINT32(sectorCount, stats.sectorsUsed);
+    TEST_ASSERT_GREATER_THAN(HISTORY_MIN_TIME, stats.oldestTime);
+    auto wear = flashStats(partition);
+    TEST_ASSERT_LESS_OR_EQUAL(1, wear.maxSectorErases - wear.minSectorErases);
+    // what's kept starts at the oldest sector and ends with the last row
+    HistoryCursor cursor;
+    HistoryRow row;
+    TEST_ASSERT_TRUE(history->open(cursor, 0, UINT32_MAX));
+    TEST_ASSERT_TRUE(history->next(cursor, row));
+    TEST_ASSERT_EQUAL_UINT32(stats.oldestTime, row.time);
+    auto last = row;
+    while (history->next(cursor, row)) {
+        TEST_ASSERT_EQUAL_UINT32(last.time + 10, row.time);
+        last = row;
+    }
+    TEST_ASSERT_EQUAL_UINT32(time, last.time);
+    TEST_ASSERT_EQUAL_INT(sample.humidity, last.samples[0].humidity);
+}
+
+int main() {
+    setenv("POLEKO_FLASH", ":memory:", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_rows_are_read_back_exactly);
+    RUN_TEST(test_ranges_hold_only_their_rows);
+    RUN_TEST(test_rows_out_of_order_or_before_the_clock_is_set_are_rejected);
+    RUN_TEST(test_rows_survive_a_reboot);
+    RUN_TEST(test_steady_rows_take_a_few_bits);
+    RUN_TEST(test_ring_overwrites_the_oldest_sectors_evenly);
+    return UNITY_END();
+}
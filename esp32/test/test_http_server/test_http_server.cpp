@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "../support/Loopback.h"
+#include "HistoryLog.h"
+#include "HTTPServer.h"
+#include "Metrics.h"
+#include "SensorBus.h"
+
+// /reading over loopback: served from the latest reading while it's recent enough, otherwise the request waits for a fresh
+// one and every request waiting meanwhile shares it. The probe answers after PROBE_DELAY and is only polled every
+// POLL_INTERVAL, so that the reads the requests demand can be counted.
+
+constexpr uint16_t HTTP_PORT = 8085;
+constexpr unsigned long POLL_INTERVAL = 60000;
+constexpr unsigned long PROBE_DELAY = 200;
+constexpr ProbePins PINS[] = {{1, 16, 17}};
+
+namespace {
+    std::unique_ptr<SensorBus> sensors;
+    std::unique_ptr<HistoryLog> history;
+    std::unique_ptr<HTTPServer> server;
+    std::atomic<bool> activity{false};
+    unsigned long refreshedAt = 0;
+
+    /// @brief Runs the sensor and the server the way the event loop does: loop() runs after a reading is taken, when the
+    /// server asks for it and once a second
+    void step() {
+        sensors->loop();
+        bool taken = sensors->takeReadings();
+        if (taken || activity.exchange(false) || millis() - refreshedAt >= 1000) {
+            server->loop();
+            refreshedAt = millis();
+        }
+    }
+
+    void get(LoopbackClient &client, const std::string &target) {
+        client.send("GET " + target + " HTTP/1.1\r\nHost: poleko\r\n\r\n");
+    }
+
+    /// @brief Waits for the next response and takes its body
+    /// @return The body, empty if no response arrived in time
+    std::string expectBody(LoopbackClient &client) {
+        std::string body;
+        pumpUntil([&]() {
+            client.poll();
+            auto &received = client.buffer();
+            auto end = received.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                return false;
+            }
+            auto length = static_cast<size_t>(jsonNumber(received.substr(0, end), "Content-Length"));
+            if (received.size() < end + 4 + length) {
+                return false;
+            }
+            body = received.substr(end + 4, length);
+            received.erase(0, end + 4 + length);
+            return true;
+        }, step);
+        return body;
+    }
+
+    /// @brief Waits until the probe was read, so that there's a reading to serve, and until it's at least a millisecond
+    /// old, so that ?maxAge=0 asks for a new one
+    void expectReading() {
+        TEST_ASSERT_TRUE(pumpUntil([]() { return (*sensors)[0].getLatestReading().timestamp != 0; }, step));
+        auto takenAt = (*sensors)[0].getLatestReading().timestamp;
+        pumpUntil([takenAt]() { return millis() - takenAt > 1; }, step);
+        server->loop();
+    }
+}
+
+void setUp() {
+    server->setup();
+}
+
+void tearDown() {
+    server->stop();
+}
+
+void test_recent_reading_is_served_from_the_cache() {
+    expectReading();
+    auto hits = metrics.readingCacheHits.get();
+    auto demanded = metrics.sensorDemandReads.get();
+    LoopbackClient client(HTTP_PORT);
+    get(client, "/reading");
+    auto body = expectBody(client);
+    TEST_ASSERT_EQUAL((*sensors)[0].getLatestReading().timestamp, jsonNumber(body, "timestamp"));
+    TEST_ASSERT_EQUAL_UINT32(hits + 1, metrics.readingCacheHits.get());
+    TEST_ASSERT_EQUAL_UINT32(demanded, metrics.sensorDemandReads.get());
+}
+
+void test_waiting_request_is_answered_when_the_reading_is_published() {
+    expectReading();
+    auto demanded = metrics.sensorDemandReads.get();
+    LoopbackClient client(HTTP_PORT);
+    auto sentAt = millis();
+    get(client, "/reading?maxAge=0");
+    auto body = expectBody(client);
+    auto answeredAt = millis();
+    auto takenAt = static_cast<unsigned long>(jsonNumber(body, "timestamp"));
+    TEST_ASSERT_GREATER_OR_EQUAL(sentAt + PROBE_DELAY, takenAt);
+    // answered by the loop() run that follows the reading, not by the next AsyncTCP poll
+    TEST_ASSERT_LESS_THAN(50, answeredAt - takenAt);
+    TEST_ASSERT_EQUAL_UINT32(demanded + 1, metrics.sensorDemandReads.get());
+}
+
+void test_waiting_requests_share_one_reading() {
+    expectReading();
+    auto demanded = metrics.sensorDemandReads.get();
+    auto misses = metrics.readingCacheMisses.get();
+    LoopbackClient first(HTTP_PORT);
+    LoopbackClient second(HTTP_PORT);
+    get(first, "/reading?maxAge=0");
+    get(second, "/reading?maxAge=0");
+    auto firstTakenAt = jsonNumber(expectBody(first), "timestamp");
+    auto secondTakenAt = jsonNumber(expectBody(second), "timestamp");
+    TEST_ASSERT_EQUAL(firstTakenAt, secondTakenAt);
+    TEST_ASSERT_EQUAL_UINT32(misses + 2, metrics.readingCacheMisses.get());
+    TEST_ASSERT_EQUAL_UINT32(demanded + 1, metrics.sensorDemandReads.get());
+}
+
+void test_request_behind_a_waiting_one_isnt_held_up() {
+    expectReading();
+    auto latest = (*sensors)[0].getLatestReading().timestamp;
+    LoopbackClient client(HTTP_PORT);
+    auto sentAt = millis();
+    get(client, "/reading?maxAge=0");
+    pumpUntil([]() { return false; }, step, 20);
+    get(client, "/status");
+    // the waiting request gets the latest reading right away, the one behind it is answered next
+    auto reading = expectBody(client);
+    TEST_ASSERT_EQUAL(latest, jsonNumber(reading, "timestamp"));
+    auto status = expectBody(client);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, jsonNumber(status, "uptime"));
+    TEST_ASSERT_LESS_THAN(PROBE_DELAY, millis() - sentAt);
+}
+
+void test_client_leaving_while_waiting_frees_its_slot() {
+    expectReading();
+    {
+        LoopbackClient client(HTTP_PORT);
+        get(client, "/reading?maxAge=0");
+        pumpUntil([]() { return false; }, step, 20);
+    }
+    // the reading arrives after the client left
+    pumpUntil([]() { return false; }, step, PROBE_DELAY * 2);
+    LoopbackClient client(HTTP_PORT);
+    get(client, "/status");
+    TEST_ASSERT_EQUAL(1, jsonNumber(expectBody(client), "httpConnections"));
+}
+
+int main() {
+    // in-process ports away from those of a firmware process, and no files
+    setenv("POLEKO_PORT_OFFSET", "31000", 1);
+    setenv("POLEKO_FLASH", ":memory:", 1);
+    setenv("POLEKO_PROBE_DELAY", "200", 1);
+    sensors = std::make_unique<SensorBus>(PINS, 1, POLL_INTERVAL);
+    history = std::make_unique<HistoryLog>();
+    history->begin();
+    server = std::make_unique<HTTPServer>(*sensors, *history, HTTP_PORT);
+    server->onActivity([]() { activity = true; });
+
+    UNITY_BEGIN();
+    RUN_TEST(test_recent_reading_is_served_from_the_cache);
+    RUN_TEST(test_waiting_request_is_answered_when_the_reading_is_published);
+    RUN_TEST(test_waiting_requests_share_one_reading);
+    RUN_TEST(test_request_behind_a_waiting_one_isnt_held_up);
+    RUN_TEST(test_client_leaving_while_waiting_frees_its_slot);
+    auto failures = UNITY_END();
+    // the network thread is still running, static destructors would race with it
+    fflush(stdout);
+    _exit(failures);
+}
@@ -0,0 +1,209 @@
+#include <unity.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "JsonEncoder.h"
+#include "ReadingCodec.h"
+#include "TCPServer.h"
+
+// JsonEncoder against the bytes ArduinoJson 7 writes for the same values: the expected strings are those of
+// ArduinoJson's own TextFormatter tests (with NaN and infinity written as null, the default) and frames it serialized, as
+// the firmware sent them before JsonEncoder. The monitoring app mustn't be able to tell the two apart.
+
+namespace {
+    struct Sample {
+        float single;
+        double precise;
+        int32_t small;
+        int64_t large;
+        uint64_t count;
+        bool on;
+        const char *name;
+        const HealthMessage *metrics;
+    };
+
+    char json[256];
+
+    const char *floating(double value, int8_t decimalPlaces) {
+        JsonWriter writer(json, sizeof(json) - 1);
+        writer.floating(value, decimalPlaces);
+        json[writer.length()] = '\0';
+        return json;
+    }
+
+    const char *asDouble(double value) {
+        return floating(value, JSON_DOUBLE_DECIMAL_PLACES);
+    }
+
+    const char *asFloat(float value) {
+        return floating(value, JSON_FLOAT_DECIMAL_PLACES);
+    }
+
+    const char *string(const char *text) {
+        JsonWriter writer(json, sizeof(json) - 1);
+        writer.string(text);
+        json[writer.length()] = '\0';
+        return json;
+    }
+
+    const char *frame(const StreamRecord &record) {
+        auto length = TCPServer::toJson(record, false, json, sizeof(json) - 1);
+        json[length] = '\0';
+        return json;
+    }
+
+    template<typename Message>
+    const char *encode(const Message &message) {
+        auto length = encodeJson(message, json, sizeof(json) - 1);
+        json[length] = '\0';
+        return json;
+    }
+}
+
+template<>
+struct JsonSchema<Sample> {
+    static constexpr auto fields = std::make_tuple(
+            jsonField("single", &Sample::single),
+            jsonField("precise", &Sample::precise),
+            jsonField("small", &Sample::small),
+            jsonField("large", &Sample::large),
+            jsonField("count", &Sample::count),
+            jsonField("on", &Sample::on),
+            jsonField("name", &Sample::name),
+            jsonField("metrics", &Sample::metrics));
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_doubles_keep_nine_decimal_places() {
+    TEST_ASSERT_EQUAL_STRING("3.141592654", asDouble(3.14159265359));
+    TEST_ASSERT_EQUAL_STRING("0", asDouble(0.0));
+    TEST_ASSERT_EQUAL_STRING("0", asDouble(-0.0));
+    TEST_ASSERT_EQUAL_STRING("0.100000001", asDouble(0.100000001));
+    TEST_ASSERT_EQUAL_STRING("0.999999999", asDouble(0.999999999));
+    TEST_ASSERT_EQUAL_STRING("9.000000001", asDouble(9.000000001));
+    TEST_ASSERT_EQUAL_STRING("9.999999999", asDouble(9.999999999));
+    // one more is rounded away, carrying into the integral part
+    TEST_ASSERT_EQUAL_STRING("0.1", asDouble(0.1000000001));
+    TEST_ASSERT_EQUAL_STRING("1", asDouble(0.9999999999));
+    TEST_ASSERT_EQUAL_STRING("9", asDouble(9.0000000001));
+    TEST_ASSERT_EQUAL_STRING("10", asDouble(9.9999999999));
+}
+
+void test_floats_keep_six_decimal_places() {
+    TEST_ASSERT_EQUAL_STRING("3.141593", asFloat(3.14159265359f));
+    // neither shows the float's binary error, which nine places would (999.9000244)
+    TEST_ASSERT_EQUAL_STRING("999.9", asFloat(999.9f));
+    TEST_ASSERT_EQUAL_STRING("24.3", asFloat(24.3f));
+    TEST_ASSERT_EQUAL_STRING("45.32", asFloat(4532 / 100.0f));
+    TEST_ASSERT_EQUAL_STRING("0.07", asFloat(7 / 100.0f));
+    TEST_ASSERT_EQUAL_STRING("100", asFloat(10000 / 100.0f));
+}
+
+void test_negative_values_are_written_like_positive_ones() {
+    TEST_ASSERT_EQUAL_STRING("-24.3", asFloat(-24.3f));
+    TEST_ASSERT_EQUAL_STRING("-40", asFloat(-4000 / 100.0f));
+    TEST_ASSERT_EQUAL_STRING("-0.01", asFloat(-1 / 100.0f));
+    TEST_ASSERT_EQUAL_STRING("-0.0001", asDouble(-1e-4));
+    TEST_ASSERT_EQUAL_STRING("-9999999.999", asDouble(-9999999.999));
+}
+
+void test_large_and_small_values_get_an_exponent() {
+    TEST_ASSERT_EQUAL_STRING("9999999.999", asDouble(9999999.999));
+    TEST_ASSERT_EQUAL_STRING("1e7", asDouble(10000000.0));
+    TEST_ASSERT_EQUAL_STRING("-1e7", asDouble(-10000000.0));
+    TEST_ASSERT_EQUAL_STRING("0.0001", asDouble(1e-4));
+    TEST_ASSERT_EQUAL_STRING("1e-5", asDouble(1e-5));
+    TEST_ASSERT_EQUAL_STRING("-1e-5", asDouble(-1e-5));
+    TEST_ASSERT_EQUAL_STRING("1e255", asDouble(1e255));
+    TEST_ASSERT_EQUAL_STRING("1e-255", asDouble(1e-255));
+    TEST_ASSERT_EQUAL_STRING("1.797693135e308", asDouble(std::numeric_limits<double>::max()));
+    TEST_ASSERT_EQUAL_STRING("-1.797693135e308", asDouble(-std::numeric_limits<double>::max()));
+    TEST_ASSERT_EQUAL_STRING("2.225073859e-308", asDouble(std::numeric_limits<double>::min()));
+    TEST_ASSERT_EQUAL_STRING("-2.225073859e-308", asDouble(-std::numeric_limits<double>::min()));
+    // rounding can move a value across the thresholds
+    TEST_ASSERT_EQUAL_STRING("0.0001", asDouble(0.000099999999999));
+    TEST_ASSERT_EQUAL_STRING("1e-5", asDouble(0.0000099999999999));
+    TEST_ASSERT_EQUAL_STRING("1e10", asFloat(1e10f));
+}
+
+void test_nan_and_infinity_are_null() {
+    TEST_ASSERT_EQUAL_STRING("null", asDouble(std::numeric_limits<double>::quiet_NaN()));
+    TEST_ASSERT_EQUAL_STRING("null", asDouble(std::numeric_limits<double>::signaling_NaN()));
+    TEST_ASSERT_EQUAL_STRING("null", asDouble(std::numeric_limits<double>::infinity()));
+    TEST_ASSERT_EQUAL_STRING("null", asDouble(-std::numeric_limits<double>::infinity()));
+    TEST_ASSERT_EQUAL_STRING("null", asFloat(std::numeric_limits<float>::quiet_NaN()));
+    TEST_ASSERT_EQUAL_STRING("null", asFloat(-std::numeric_limits<float>::infinity()));
+}
+
+void test_strings_are_escaped() {
+    TEST_ASSERT_EQUAL_STRING("\"\"", string(""));
+    TEST_ASSERT_EQUAL_STRING("\"\\\"\"", string("\""));
+    TEST_ASSERT_EQUAL_STRING("\"\\\\\"", string("\\"));
+    // allowed to be escaped, but ArduinoJson doesn't
+    TEST_ASSERT_EQUAL_STRING("\"/\"", string("/"));
+    TEST_ASSERT_EQUAL_STRING("\"\\b\"", string("\b"));
+    TEST_ASSERT_EQUAL_STRING("\"\\f\"", string("\f"));
+    TEST_ASSERT_EQUAL_STRING("\"\\n\"", string("\n"));
+    TEST_ASSERT_EQUAL_STRING("\"\\r\"", string("\r"));
+    TEST_ASSERT_EQUAL_STRING("\"\\t\"", string("\t"));
+    // UTF-8 is copied as it is
+    TEST_ASSERT_EQUAL_STRING("\"23.45 \xc2\xb0" "C\"", string("23.45 \xc2\xb0" "C"));
+    TEST_ASSERT_EQUAL_STRING("\"a \\\"quoted\\\"\\r\\n path\\\\to\"", string("a \"quoted\"\r\n path\\to"));
+}
+
+void test_integers_cover_their_whole_range() {
+    Sample sample{1.5f, -2.25, INT32_MIN, INT64_MIN, UINT64_MAX, false, "probe", nullptr};
+    TEST_ASSERT_EQUAL_STRING("{\"single\":1.5,\"precise\":-2.25,\"small\":-2147483648,\"large\":-9223372036854775808,"
+                             "\"count\":18446744073709551615,\"on\":false,\"name\":\"probe\"}", encode(sample));
+    sample = {0.0f, 0.0, INT32_MAX, INT64_MAX, 4294967296u, true, "", nullptr};
+    TEST_ASSERT_EQUAL_STRING("{\"single\":0,\"precise\":0,\"small\":2147483647,\"large\":9223372036854775807,"
+                             "\"count\":4294967296,\"on\":true,\"name\":\"\"}", encode(sample));
+}
+
+void test_nested_messages_and_nan_values() {
+    HealthMessage health{180000, 110000, 3, 0, 12};
+    Sample sample{NAN, INFINITY, -1, 0, 0, true, "x", &health};
+    TEST_ASSERT_EQUAL_STRING("{\"single\":null,\"precise\":null,\"small\":-1,\"large\":0,\"count\":0,\"on\":true,"
+                             "\"name\":\"x\",\"metrics\":{\"freeHeap\":180000,\"largestBlock\":110000,"
+                             "\"sensorTimeouts\":3,\"parseFailures\":0,\"droppedFrames\":12}}", encode(sample));
+}
+
+void test_tcp_frames_match_arduinojson() {
+    // frames as ArduinoJson serialized them: humidity and temperature are floats of hundredths over 100
+    StreamRecord record{1234, 5678000, 4532, 2345, -61, 2, true};
+    TEST_ASSERT_EQUAL_STRING("{\"humidity\":45.32,\"temperature\":23.45,\"rssi\":-61,\"interval\":2,\"sequence\":1234,"
+                             "\"timestamp\":5678000,\"probe\":0}\n", frame(record));
+    record = {4294967295u, 4294967295u, -1, -4000, -128, 65535, true, 3};
+    TEST_ASSERT_EQUAL_STRING("{\"humidity\":-0.01,\"temperature\":-40,\"rssi\":-128,\"interval\":65535,"
+                             "\"sequence\":4294967295,\"timestamp\":4294967295,\"probe\":3}\n", frame(record));
+    record = {7, 0, 10000, 12345, 0, 1, true};
+    TEST_ASSERT_EQUAL_STRING("{\"humidity\":100,\"temperature\":123.45,\"rssi\":0,\"interval\":1,\"sequence\":7,"
+                             "\"timestamp\":0,\"probe\":0}\n", frame(record));
+}
+
+void test_frames_that_dont_fit_are_not_written() {
+    StreamRecord record{1234, 5678000, 4532, 2345, -61, 2, true};
+    char small[32];
+    TEST_ASSERT_EQUAL(0, TCPServer::toJson(record, false, small, sizeof(small)));
+    Sample sample{1.5f, -2.25, 0, 0, 0, false, "probe", nullptr};
+    TEST_ASSERT_EQUAL(0, encodeJson(sample, small, sizeof(small)));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_doubles_keep_nine_decimal_places);
+    RUN_TEST(test_floats_keep_six_decimal_places);
+    RUN_TEST(test_negative_values_are_written_like_positive_ones);
+    RUN_TEST(test_large_and_small_values_get_an_exponent);
+    RUN_TEST(test_nan_and_infinity_are_null);
+    RUN_TEST(test_strings_are_escaped);
+    RUN_TEST(test_integers_cover_their_whole_range);
+    RUN_TEST(test_nested_messages_and_nan_values);
+    RUN_TEST(test_tcp_frames_match_arduinojson);
+    RUN_TEST(test_frames_that_dont_fit_are_not_written);
+    return UNITY_END();
+}
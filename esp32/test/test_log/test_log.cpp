@@ -0,0 +1,106 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Log.h"
+
+// The deferred log: records the drain didn't get to before the ring came around again are counted as lost, the rate
+// limit of a call site and the formatting of the captured arguments. Log::begin() would start the drain task, so the
+// tests drain by hand and read the records back from the ring.
+
+namespace {
+    constexpr size_t OVERFLOW_RECORDS = 10;
+
+    // a site per record, the rate limit only lets a few records of each one through per window
+    LogSite sites[LOG_RING_CAPACITY + OVERFLOW_RECORDS];
+
+    /// @brief Gets the messages of the records still in the ring, oldest first, without the timestamp and level
+    std::vector<std::string> recentMessages() {
+        static char buffer[8192];
+        std::string text(buffer, Log::writeRecent(buffer, sizeof(buffer)));
+        std::vector<std::string> messages;
+        for (size_t start = 0; start < text.size();) {
+            auto end = text.find('\n', start);
+            // "[   12345][I] message"
+            auto line = text.substr(start, end - start);
+            messages.push_back(line.substr(line.find("] ") + 2));
+            start = end + 1;
+        }
+        return messages;
+    }
+
+    void logRecords(size_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            Log::write(sites[i], i);
+        }
+    }
+}
+
+void setUp() {
+    // whatever the previous test left is written out (nowhere, there's no sink)
+    Log::drain();
+}
+
+void tearDown() {}
+
+void test_drain_counts_records_overwritten_before_it_ran() {
+    auto lost = Log::getLost();
+    logRecords(LOG_RING_CAPACITY + OVERFLOW_RECORDS);
+    Log::drain();
+    TEST_ASSERT_EQUAL_UINT32(lost + OVERFLOW_RECORDS, Log::getLost());
+    // the oldest records are the ones lost, the ring holds the newest ones in order
+    auto messages = recentMessages();
+    TEST_ASSERT_EQUAL(LOG_RING_CAPACITY, messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING(("record " + std::to_string(i + OVERFLOW_RECORDS)).c_str(), messages[i].c_str());
+    }
+    // they're counted once
+    Log::drain();
+    TEST_ASSERT_EQUAL_UINT32(lost + OVERFLOW_RECORDS, Log::getLost());
+}
+
+void test_full_ring_drained_in_time_loses_nothing() {
+    auto lost = Log::getLost();
+    logRecords(LOG_RING_CAPACITY);
+    Log::drain();
+    logRecords(LOG_RING_CAPACITY / 2);
+    Log::drain();
+    TEST_ASSERT_EQUAL_UINT32(lost, Log::getLost());
+}
+
+void test_rate_limit_reports_suppressed_records() {
+    static LogSite site{"retry %u", LogLevel::Warning};
+    for (uint32_t i = 0; i < LOG_SITE_BURST + 3; i++) {
+        Log::write(site, i);
+    }
+    auto messages = recentMessages();
+    TEST_ASSERT_EQUAL_STRING(("retry " + std::to_string(LOG_SITE_BURST - 1)).c_str(), messages.back().c_str());
+
+    delay(LOG_SITE_WINDOW + 50);
+    Log::write(site, 99u);
+    TEST_ASSERT_EQUAL_STRING("retry 99 (3 similar messages suppressed)", recentMessages().back().c_str());
+}
+
+void test_arguments_are_formatted_by_their_type() {
+    static LogSite site{"%s sent %d bytes, %.1f%% of %04x", LogLevel::Error};
+    Log::write(site, "client", -5, 12.5, 255u);
+    TEST_ASSERT_EQUAL_STRING("client sent -5 bytes, 12.5% of 00ff", recentMessages().back().c_str());
+    // text arguments share LOG_TEXT_LENGTH bytes, missing arguments are marked
+    static LogSite texts{"%s|%s|%s", LogLevel::Info};
+    Log::write(texts, "0123456789abcdef", "0123456789abcdef");
+    TEST_ASSERT_EQUAL_STRING("0123456789abcdef|01234567|<?>", recentMessages().back().c_str());
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(sites) / sizeof(sites[0]); i++) {
+        sites[i].format = "record %u";
+        sites[i].level = LogLevel::Info;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_drain_counts_records_overwritten_before_it_ran);
+    RUN_TEST(test_full_ring_drained_in_time_loses_nothing);
+    RUN_TEST(test_rate_limit_reports_suppressed_records);
+    RUN_TEST(test_arguments_are_formatted_by_their_type);
+    return UNITY_END();
+}
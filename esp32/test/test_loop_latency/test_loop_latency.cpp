@@ -0,0 +1,119 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include "EventLoop.h"
+#include "Sensor.h"
+
+// The worst latency of the event loop while a probe is being read, before and after reading it became non-blocking. The
+// simulated probes on UART 2 and 3 take PROBE_DELAY ms to answer and ignore PROBE_DROP % of the requests. Meanwhile
+// another task posts an event every NETWORK_EVENT_INTERVAL ms, like AsyncTCP does when a packet arrives, and the loop
+// measures how long each one waited for its handler.
+
+constexpr unsigned long PROBE_DELAY = 150;
+constexpr unsigned long PROBE_DROP = 30;
+constexpr unsigned long POLL_INTERVAL = 100;
+constexpr unsigned long NETWORK_EVENT_INTERVAL = 5;
+constexpr unsigned long MEASUREMENT = 3000;
+// what an event may wait for with nothing blocking the loop: far below the probe's delay, generous for a loaded machine
+constexpr uint32_t MAX_LATENCY_US = 20000;
+
+namespace {
+    std::unique_ptr<EventLoop> events;
+    std::unique_ptr<HardwareSerial> serial;
+    std::unique_ptr<Sensor> sensor;
+    unsigned readings = 0;
+
+    /// @brief How the probe was read before Sensor's state machine: the request is sent and the response waited for in
+    /// place, checking the UART 5 times, 100 ms apart
+    void blockingRead() {
+        serial->print("{F99RDD}\r\n\r\n");
+        std::string response;
+        for (int retries = 0; retries < 5; retries++) {
+            while (serial->available() > 0) {
+                auto c = static_cast<char>(serial->read());
+                if (c == '\r') {
+                    readings++;
+                    events->setTimer(Event::Sensor, millis() + POLL_INTERVAL);
+                    return;
+                }
+                response += c;
+            }
+            delay(100);
+        }
+        events->setTimer(Event::Sensor, millis() + POLL_INTERVAL);
+    }
+
+    /// @brief The firmware's sensor handler
+    void stateMachine() {
+        sensor->loop();
+        readings += sensor->takeReadings() && sensor->getLatestReading().valid;
+        events->setTimer(Event::Sensor, sensor->nextDeadline());
+    }
+
+    /// @brief Runs the loop with the given sensor handler for MEASUREMENT ms
+    /// @return The longest time an event waited for its handler, in µs
+    uint32_t worstLatency(EventLoop::Handler sensorHandler) {
+        events = std::make_unique<EventLoop>();
+        events->begin();
+        events->on(Event::Sensor, sensorHandler);
+        events->on(Event::UDP, []() {});
+        readings = 0;
+        std::atomic<bool> running{true};
+        std::thread network([&running]() {
+            while (running) {
+                events->post(Event::UDP);
+                delay(NETWORK_EVENT_INTERVAL);
+            }
+        });
+        events->post(Event::Sensor);
+        auto startedAt = millis();
+        while (millis() - startedAt < MEASUREMENT) {
+            events->runOnce();
+        }
+        running = false;
+        network.join();
+        return events->getStats().maxLatencyUs;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_blocking_read_stalls_the_loop() {
+    serial = std::make_unique<HardwareSerial>(2);
+    serial->begin(19200, SERIAL_8N1, 16, 17);
+    auto worst = worstLatency(blockingRead);
+    serial = nullptr;
+    char message[64];
+    snprintf(message, sizeof(message), "blocking read: %u readings, worst latency %u us", readings, worst);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN_MESSAGE(0, readings, message);
+    // the harness sees the stall it's there to catch
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(PROBE_DELAY * 1000 / 2, worst, message);
+}
+
+void test_state_machine_keeps_the_loop_responsive() {
+    sensor = std::make_unique<Sensor>(3, 16, 17, POLL_INTERVAL);
+    sensor->onReceive([]() { events->post(Event::Sensor); });
+    auto worst = worstLatency(stateMachine);
+    sensor = nullptr;
+    char message[64];
+    snprintf(message, sizeof(message), "state machine: %u readings, worst latency %u us", readings, worst);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN_MESSAGE(0, readings, message);
+    TEST_ASSERT_LESS_THAN_MESSAGE(MAX_LATENCY_US, worst, message);
+}
+
+int main() {
+    setenv("POLEKO_PROBE_DELAY", std::to_string(PROBE_DELAY).c_str(), 1);
+    setenv("POLEKO_PROBE_DROP", std::to_string(PROBE_DROP).c_str(), 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_blocking_read_stalls_the_loop);
+    RUN_TEST(test_state_machine_keeps_the_loop_responsive);
+    return UNITY_END();
+}
@@ -0,0 +1,221 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <malloc.h>
+#include <memory>
+#include <string>
+#include "../support/Loopback.h"
+#include "EspUDPServer.h"
+#include "HistoryLog.h"
+#include "HTTPServer.h"
+#include "Metrics.h"
+#include "SensorBus.h"
+#include "Settings.h"
+#include "TCPServer.h"
+
+// The network services cycled through hundreds of lives: set up, filled with clients beyond their slots, stopped with half
+// of the clients gone and the others still connected. Nothing a life allocates may outlive it. The bytes still allocated
+// are counted by wrapping malloc, which the sanitizers do themselves, so their environments skip this suite.
+
+constexpr uint16_t TCP_PORT = 5515;
+constexpr uint16_t HTTP_PORT = 8095;
+constexpr uint16_t UDP_PORT = 5516;
+constexpr ProbePins PINS[] = {{1, 16, 17}};
+// cycles measured, after the ones that warm up lazily allocated state
+constexpr int SOAK_CYCLES = 500;
+constexpr int SOAK_WARMUP_CYCLES = 20;
+
+namespace {
+    // bytes held by blocks that weren't freed yet, as malloc sized them. Every thread is counted.
+    std::atomic<int64_t> liveBytes{0};
+
+    std::unique_ptr<Settings> settings;
+    std::unique_ptr<SensorBus> sensors;
+    std::unique_ptr<HistoryLog> history;
+    std::unique_ptr<TCPServer> tcpServer;
+    std::unique_ptr<HTTPServer> httpServer;
+    std::unique_ptr<EspUDPServer> udpServer;
+
+    void step() {
+        TCPServer::loop();
+        httpServer->loop();
+    }
+
+    /// @brief Gets the amount of TCP clients holding a slot, from the server's metrics
+    unsigned long tcpClientCount() {
+        char text[2048];
+        MetricsWriter writer(text, sizeof(text));
+        TCPServer::writeMetrics(writer);
+        auto found = strstr(text, "\npoleko_tcp_clients ");
+        return found == nullptr ? ULONG_MAX : strtoul(found + sizeof("\npoleko_tcp_clients ") - 1, nullptr, 10);
+    }
+
+    /// @brief Sends a request and waits for the whole response
+    /// @return The body, empty if no response arrived in time
+    std::string exchange(LoopbackClient &client, const char *target) {
+        client.send(std::string("GET ") + target + " HTTP/1.1\r\nHost: poleko\r\n\r\n");
+        std::string body;
+        pumpUntil([&]() {
+            client.poll();
+            auto &received = client.buffer();
+            auto end = received.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                return false;
+            }
+            auto length = static_cast<size_t>(jsonNumber(received.substr(0, end), "Content-Length"));
+            if (received.size() < end + 4 + length) {
+                return false;
+            }
+            body = received.substr(end + 4, length);
+            received.erase(0, end + 4 + length);
+            return true;
+        }, step);
+        return body;
+    }
+
+    /// @brief One life of the network services
+    void soakCycle() {
+        tcpServer->setup();
+        udpServer->setup(UDP_PORT);
+        httpServer->setup();
+
+        // one client more than there are slots, it's turned away
+        std::array<std::unique_ptr<LoopbackClient>, MAX_TCP_CLIENTS + 1> tcpClients;
+        std::array<std::string, MAX_TCP_CLIENTS + 1> replies;
+        for (auto &client: tcpClients) {
+            client = std::make_unique<LoopbackClient>(TCP_PORT);
+            client->send("{\"ping\":true}\n");
+        }
+        TEST_ASSERT_TRUE(pumpUntil([&]() {
+            bool replied = true;
+            for (size_t i = 0; i < tcpClients.size(); i++) {
+                replied &= !replies[i].empty() || tcpClients[i]->nextLine(replies[i]);
+            }
+            return replied;
+        }, step));
+        TEST_ASSERT_EQUAL_STRING("{\"error\":\"busy\"}", replies.back().substr(0, 16).c_str());
+        for (size_t i = 0; i < MAX_TCP_CLIENTS; i += 2) {
+            tcpClients[i] = nullptr;
+        }
+        tcpClients.back() = nullptr;
+        TEST_ASSERT_TRUE(pumpUntil([]() { return tcpClientCount() == MAX_TCP_CLIENTS / 2; }, step));
+
+        // every request slot but one, which an /events stream takes, then half of the requests' clients leave
+        std::array<std::unique_ptr<LoopbackClient>, MAX_HTTP_CONNECTIONS - 1> httpClients;
+        for (auto &client: httpClients) {
+            client = std::make_unique<LoopbackClient>(HTTP_PORT);
+            TEST_ASSERT_FALSE(exchange(*client, "/status").empty());
+        }
+        LoopbackClient stream(HTTP_PORT);
+        stream.send("GET /events HTTP/1.1\r\nHost: poleko\r\n\r\n");
+        TEST_ASSERT_TRUE(pumpUntil([&]() {
+            stream.poll();
+            return stream.buffer().find("retry:") != std::string::npos;
+        }, step));
+        for (size_t i = 0; i < httpClients.size(); i += 2) {
+            httpClients[i] = nullptr;
+        }
+        TEST_ASSERT_TRUE(pumpUntil([&]() {
+            return jsonNumber(exchange(*httpClients[1], "/status"), "httpConnections") ==
+                   static_cast<long>(httpClients.size() / 2);
+        }, step));
+
+        // stopped while the remaining clients are still connected
+        tcpServer->stop();
+        udpServer->stop();
+        httpServer->stop();
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_services_survive_their_slots_filling_up() {
+    for (int i = 0; i < SOAK_WARMUP_CYCLES; i++) {
+        soakCycle();
+    }
+}
+
+void test_cycles_leave_nothing_allocated() {
+    auto liveBefore = liveBytes.load(std::memory_order_relaxed);
+    auto startedAt = millis();
+    for (int i = 0; i < SOAK_CYCLES; i++) {
+        soakCycle();
+    }
+    auto growth = liveBytes.load(std::memory_order_relaxed) - liveBefore;
+    char message[96];
+    snprintf(message, sizeof(message), "%d cycles, %.2f ms per cycle, heap growth %lld bytes", SOAK_CYCLES,
+             static_cast<double>(millis() - startedAt) / SOAK_CYCLES, static_cast<long long>(growth));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(0, growth, message);
+}
+
+// malloc is wrapped rather than operator new, frames and strings don't go through new
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *memory, size_t size);
+void __libc_free(void *memory);
+
+void *malloc(size_t size) {
+    auto memory = __libc_malloc(size);
+    if (memory != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+void *calloc(size_t count, size_t size) {
+    auto memory = __libc_calloc(count, size);
+    if (memory != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+void *realloc(void *memory, size_t size) {
+    auto previous = memory == nullptr ? 0 : static_cast<int64_t>(malloc_usable_size(memory));
+    auto moved = __libc_realloc(memory, size);
+    if (moved != nullptr) {
+        liveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(moved)) - previous, std::memory_order_relaxed);
+    } else if (size == 0) {
+        liveBytes.fetch_sub(previous, std::memory_order_relaxed);
+    }
+    return moved;
+}
+
+void free(void *memory) {
+    if (memory != nullptr) {
+        liveBytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+    }
+    __libc_free(memory);
+}
+}
+
+int main() {
+    // in-process ports away from those of a firmware process, and no files
+    setenv("POLEKO_PORT_OFFSET", "31000", 1);
+    setenv("POLEKO_NVS", ":memory:", 1);
+    setenv("POLEKO_FLASH", ":memory:", 1);
+    settings = std::make_unique<Settings>();
+    settings->begin();
+    sensors = std::make_unique<SensorBus>(PINS, 1);
+    history = std::make_unique<HistoryLog>();
+    history->begin();
+    // constructed once, like the firmware does, every cycle only sets them up and stops them
+    tcpServer = std::make_unique<TCPServer>(*sensors, *settings, TCP_PORT);
+    httpServer = std::make_unique<HTTPServer>(*sensors, *history, HTTP_PORT);
+    udpServer = std::make_unique<EspUDPServer>();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_services_survive_their_slots_filling_up);
+    RUN_TEST(test_cycles_leave_nothing_allocated);
+    auto failures = UNITY_END();
+    // the network thread is still running, static destructors would race with it
+    fflush(stdout);
+    _exit(failures);
+}
@@ -0,0 +1,123 @@
+#include <unity.h>
+#include <string>
+#include <string_view>
+#include "ProbeFrame.h"
+
+// Parsing of the probe's responses, as Sensor::loop() collects them: CR stripped, one byte at a time.
+
+namespace {
+    // a whole response to {F99RDD}
+    constexpr std::string_view RESPONSE =
+            "{F00rdd 001; 45.32;%rh;000;=; 23.45;'C;000;=;nc;---.-;'C;000; ;001;V1.7-1;0060568338;        }";
+
+    ProbeFrame frame;
+
+    /// @brief Pushes the text into the frame and parses it
+    ProbeReading parse(std::string_view text) {
+        frame.clear();
+        for (auto c: text) {
+            frame.push(c);
+        }
+        return frame.parse();
+    }
+
+    /// @brief Gets the response with the text of a field replaced, padded so that the frame keeps its length
+    std::string withField(size_t index, std::string_view value) {
+        std::string text(RESPONSE);
+        size_t start = 0;
+        for (size_t i = 0; i < index; i++) {
+            start = text.find(';', start) + 1;
+        }
+        auto end = text.find(';', start);
+        text.replace(start, end - start, value);
+        text.resize(PROBE_FRAME_LENGTH - 1, ' ');
+        text += '}';
+        return text;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_response_is_parsed() {
+    static_assert(RESPONSE.size() == PROBE_FRAME_LENGTH);
+    auto reading = parse(RESPONSE);
+    TEST_ASSERT_TRUE(reading.valid());
+    TEST_ASSERT_EQUAL_INT32(4532, reading.humidity.hundredths);
+    TEST_ASSERT_EQUAL_INT32(2345, reading.temperature.hundredths);
+    TEST_ASSERT_EQUAL_FLOAT(45.32f, reading.humidity.toFloat());
+    // field indices are the probe documentation's, with the empty fields skipped
+    TEST_ASSERT_TRUE(frame.field(0) == "{F00rdd 001");
+    TEST_ASSERT_TRUE(frame.field(2) == "%rh");
+    TEST_ASSERT_TRUE(frame.field(10) == "---.-");
+    TEST_ASSERT_TRUE(frame.field(PROBE_FRAME_MAX_FIELDS).empty());
+}
+
+void test_empty_frame_is_a_timeout() {
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::Empty, parse("").status);
+}
+
+void test_truncated_frame_is_rejected() {
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::WrongLength, parse(RESPONSE.substr(0, PROBE_FRAME_LENGTH - 1)).status);
+}
+
+void test_overflowing_frame_is_rejected() {
+    frame.clear();
+    for (auto c: RESPONSE) {
+        TEST_ASSERT_TRUE(frame.push(c));
+    }
+    TEST_ASSERT_FALSE(frame.push(' '));
+    TEST_ASSERT_EQUAL(PROBE_FRAME_LENGTH, frame.length());
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::Overflow, frame.parse().status);
+    // the frame can be reused once it's cleared
+    TEST_ASSERT_TRUE(parse(RESPONSE).valid());
+}
+
+void test_frame_without_fields_is_rejected() {
+    std::string text(PROBE_FRAME_LENGTH, ' ');
+    text.replace(0, 11, "{F00rdd 001");
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::MissingFields, parse(text).status);
+}
+
+void test_unavailable_values_are_rejected() {
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::InvalidHumidity, parse(withField(1, "---.-")).status);
+    TEST_ASSERT_EQUAL(ProbeFrameStatus::InvalidTemperature, parse(withField(5, "---.-")).status);
+}
+
+void test_negative_temperature_is_parsed() {
+    auto reading = parse(withField(5, "-12.5"));
+    TEST_ASSERT_TRUE(reading.valid());
+    TEST_ASSERT_EQUAL_INT32(-1250, reading.temperature.hundredths);
+}
+
+void test_decimals_are_parsed_without_atof() {
+    TEST_ASSERT_EQUAL_INT32(4532, FixedDecimal::parse(" 45.32 ").hundredths);
+    TEST_ASSERT_EQUAL_INT32(2340, FixedDecimal::parse("+23.4").hundredths);
+    TEST_ASSERT_EQUAL_INT32(-500, FixedDecimal::parse("-5").hundredths);
+    TEST_ASSERT_EQUAL_INT32(50, FixedDecimal::parse(".5").hundredths);
+    // the third decimal place rounds
+    TEST_ASSERT_EQUAL_INT32(1235, FixedDecimal::parse("12.345").hundredths);
+    TEST_ASSERT_EQUAL_INT32(1234, FixedDecimal::parse("12.3449").hundredths);
+    TEST_ASSERT_TRUE(FixedDecimal::parse("9999999").valid);
+}
+
+void test_invalid_decimals_are_rejected() {
+    for (auto text: {"", " ", "-", ".", "---.-", "1.2.3", "12a", "1 2", "12345678"}) {
+        TEST_ASSERT_FALSE_MESSAGE(FixedDecimal::parse(text).valid, text);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_response_is_parsed);
+    RUN_TEST(test_empty_frame_is_a_timeout);
+    RUN_TEST(test_truncated_frame_is_rejected);
+    RUN_TEST(test_overflowing_frame_is_rejected);
+    RUN_TEST(test_frame_without_fields_is_rejected);
+    RUN_TEST(test_unavailable_values_are_rejected);
+    RUN_TEST(test_negative_temperature_is_parsed);
+    RUN_TEST(test_decimals_are_parsed_without_atof);
+    RUN_TEST(test_invalid_decimals_are_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,87 @@
+#include <unity.h>
+#include <thread>
+#include "ReadingChannel.h"
+
+// The handoff between the task reading the probe and the one serving the readings. The stress test runs the two sides on
+// their own threads, `pio test -e native_tsan` runs it under ThreadSanitizer.
+
+namespace {
+    /// @brief Reading whose values are derived from its timestamp, so that a torn copy can be told apart
+    SensorReading readingOf(unsigned long timestamp) {
+        auto value = static_cast<float>(timestamp % 1024);
+        return {value, -value, timestamp, true};
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_nothing_is_taken_before_a_publish() {
+    ReadingChannel channel;
+    TEST_ASSERT_FALSE(channel.poll());
+    TEST_ASSERT_FALSE(channel.latest().valid);
+    TEST_ASSERT_TRUE(channel.publish(readingOf(1)));
+    TEST_ASSERT_TRUE(channel.poll());
+    TEST_ASSERT_EQUAL_UINT32(1, channel.latest().timestamp);
+    TEST_ASSERT_FALSE(channel.poll());
+    TEST_ASSERT_EQUAL_UINT32(1, channel.latest().timestamp);
+}
+
+void test_newest_reading_replaces_the_untaken_ones() {
+    ReadingChannel channel;
+    TEST_ASSERT_TRUE(channel.publish(readingOf(1)));
+    TEST_ASSERT_FALSE(channel.publish(readingOf(2)));
+    TEST_ASSERT_FALSE(channel.publish(readingOf(3)));
+    TEST_ASSERT_TRUE(channel.poll());
+    TEST_ASSERT_EQUAL_UINT32(3, channel.latest().timestamp);
+    TEST_ASSERT_EQUAL_UINT32(3, channel.getPublished());
+    TEST_ASSERT_EQUAL_UINT32(2, channel.getDropped());
+    // the consumer's buffer isn't written to while it's being read
+    TEST_ASSERT_TRUE(channel.publish(readingOf(4)));
+    TEST_ASSERT_FALSE(channel.publish(readingOf(5)));
+    TEST_ASSERT_EQUAL_UINT32(3, channel.latest().timestamp);
+    TEST_ASSERT_TRUE(channel.poll());
+    TEST_ASSERT_EQUAL_UINT32(5, channel.latest().timestamp);
+}
+
+void test_producer_and_consumer_on_their_own_threads() {
+    constexpr unsigned long READINGS = 200000;
+    ReadingChannel channel;
+    std::thread producer([&channel]() {
+        for (unsigned long i = 1; i <= READINGS; i++) {
+            channel.publish(readingOf(i));
+        }
+    });
+    uint32_t taken = 0;
+    unsigned long last = 0;
+    bool torn = false;
+    bool backwards = false;
+    while (last != READINGS) {
+        if (!channel.poll()) {
+            std::this_thread::yield();
+            continue;
+        }
+        taken++;
+        auto &reading = channel.latest();
+        torn |= reading.humidity != readingOf(reading.timestamp).humidity ||
+                reading.temperature != readingOf(reading.timestamp).temperature;
+        backwards |= reading.timestamp <= last;
+        last = reading.timestamp;
+    }
+    producer.join();
+    TEST_ASSERT_FALSE(torn);
+    TEST_ASSERT_FALSE(backwards);
+    // the last reading always arrives, every other one was either taken or replaced by a newer one
+    TEST_ASSERT_FALSE(channel.poll());
+    TEST_ASSERT_EQUAL_UINT32(READINGS, channel.getPublished());
+    TEST_ASSERT_EQUAL_UINT32(READINGS, taken + channel.getDropped());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_nothing_is_taken_before_a_publish);
+    RUN_TEST(test_newest_reading_replaces_the_untaken_ones);
+    RUN_TEST(test_producer_and_consumer_on_their_own_threads);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+#include <unity.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "ReadingCodec.h"
+
+// The binary stream format: records reassembled by BinaryRecordDecoder no matter how TCP split or coalesced them,
+// finding its way back to the records after garbage, and never accepting a record whose CRC-16 doesn't match.
+
+namespace {
+    const StreamRecord FIRST{1234, 5678000, 4532, -1250, -61, 2, true, 0};
+    const StreamRecord SECOND{1235, 5680000, 10000, 2345, -90, 60, false, 3};
+    const StreamRecord THIRD{4294967295u, 4294967295u, -32768, 32767, 0, 65535, true, 15};
+
+    std::vector<uint8_t> encode(std::initializer_list<StreamRecord> records) {
+        std::vector<uint8_t> bytes;
+        uint8_t binary[BINARY_RECORD_SIZE];
+        for (auto &record: records) {
+            bytes.insert(bytes.end(), binary, binary + encodeBinaryRecord(record, binary));
+        }
+        return bytes;
+    }
+
+    /// @brief Pushes the bytes into the decoder the way the TCP client reads them
+    std::vector<StreamRecord> decode(BinaryRecordDecoder &decoder, const uint8_t *bytes, size_t length) {
+        std::vector<StreamRecord> records;
+        StreamRecord record{};
+        for (size_t i = 0; i < length; i++) {
+            if (decoder.push(bytes[i], record)) {
+                records.push_back(record);
+            }
+        }
+        return records;
+    }
+
+    std::vector<StreamRecord> decode(BinaryRecordDecoder &decoder, const std::vector<uint8_t> &bytes) {
+        return decode(decoder, bytes.data(), bytes.size());
+    }
+
+    void assertSameRecord(const StreamRecord &expected, const StreamRecord &actual) {
+        TEST_ASSERT_EQUAL_UINT32(expected.sequence, actual.sequence);
+        TEST_ASSERT_EQUAL_UINT32(expected.uptime, actual.uptime);
+        TEST_ASSERT_EQUAL_INT16(expected.humidity, actual.humidity);
+        TEST_ASSERT_EQUAL_INT16(expected.temperature, actual.temperature);
+        TEST_ASSERT_EQUAL_INT8(expected.rssi, actual.rssi);
+        TEST_ASSERT_EQUAL_UINT16(expected.interval, actual.interval);
+        TEST_ASSERT_EQUAL(expected.valid, actual.valid);
+        TEST_ASSERT_EQUAL_UINT8(expected.probe, actual.probe);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_crc_is_ccitt_false() {
+    // the check value of the CRC catalogue
+    const char check[] = "123456789";
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16(reinterpret_cast<const uint8_t *>(check), strlen(check)));
+}
+
+void test_record_round_trips() {
+    for (auto &expected: {FIRST, SECOND, THIRD}) {
+        auto bytes = encode({expected});
+        TEST_ASSERT_EQUAL(BINARY_RECORD_SIZE, bytes.size());
+        TEST_ASSERT_EQUAL_HEX8(BINARY_RECORD_MAGIC, bytes[0]);
+        StreamRecord record{};
+        TEST_ASSERT_TRUE(decodeBinaryRecord(bytes.data(), record));
+        assertSameRecord(expected, record);
+    }
+}
+
+void test_record_split_across_reads_is_reassembled() {
+    auto bytes = encode({FIRST});
+    for (size_t split = 1; split < BINARY_RECORD_SIZE; split++) {
+        BinaryRecordDecoder decoder;
+        TEST_ASSERT_EQUAL(0, decode(decoder, bytes.data(), split).size());
+        auto records = decode(decoder, bytes.data() + split, bytes.size() - split);
+        TEST_ASSERT_EQUAL(1, records.size());
+        assertSameRecord(FIRST, records[0]);
+        TEST_ASSERT_EQUAL_UINT32(0, decoder.getDroppedBytes());
+    }
+}
+
+void test_several_records_in_one_read_are_all_decoded() {
+    BinaryRecordDecoder decoder;
+    auto records = decode(decoder, encode({FIRST, SECOND, THIRD}));
+    TEST_ASSERT_EQUAL(3, records.size());
+    assertSameRecord(FIRST, records[0]);
+    assertSameRecord(SECOND, records[1]);
+    assertSameRecord(THIRD, records[2]);
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.getDroppedBytes());
+}
+
+void test_decoder_resyncs_after_garbage() {
+    // magic bytes in the garbage start false records, which overlap the real one
+    const uint8_t garbage[] = {0x00, BINARY_RECORD_MAGIC, BINARY_RECORD_TYPE_READING, 0x02, BINARY_RECORD_MAGIC, 0x11};
+    std::vector<uint8_t> bytes(garbage, garbage + sizeof(garbage));
+    auto records = encode({FIRST, SECOND});
+    bytes.insert(bytes.end(), records.begin(), records.end());
+
+    BinaryRecordDecoder decoder;
+    auto decoded = decode(decoder, bytes);
+    TEST_ASSERT_EQUAL(2, decoded.size());
+    assertSameRecord(FIRST, decoded[0]);
+    assertSameRecord(SECOND, decoded[1]);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(garbage), decoder.getDroppedBytes());
+
+    // and after a record cut short, e.g. by a reconnect
+    auto cut = encode({THIRD});
+    cut.resize(BINARY_RECORD_SIZE / 2);
+    cut.insert(cut.end(), records.begin(), records.end());
+    decoded = decode(decoder, cut);
+    TEST_ASSERT_EQUAL(2, decoded.size());
+    assertSameRecord(FIRST, decoded[0]);
+    assertSameRecord(SECOND, decoded[1]);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(garbage) + BINARY_RECORD_SIZE / 2, decoder.getDroppedBytes());
+}
+
+void test_record_with_crc_mismatch_is_rejected() {
+    auto bytes = encode({FIRST});
+    // a flipped bit in the humidity, and in the checksum itself
+    for (size_t corrupted: {size_t{11}, BINARY_RECORD_SIZE - 1}) {
+        auto damaged = bytes;
+        damaged[corrupted] ^= 0x04;
+        StreamRecord record = SECOND;
+        TEST_ASSERT_FALSE(decodeBinaryRecord(damaged.data(), record));
+        // left untouched
+        assertSameRecord(SECOND, record);
+
+        // the decoder skips it and finds the next record
+        BinaryRecordDecoder decoder;
+        auto next = encode({SECOND});
+        damaged.insert(damaged.end(), next.begin(), next.end());
+        auto decoded = decode(decoder, damaged);
+        TEST_ASSERT_EQUAL(1, decoded.size());
+        assertSameRecord(SECOND, decoded[0]);
+        TEST_ASSERT_EQUAL_UINT32(BINARY_RECORD_SIZE, decoder.getDroppedBytes());
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_is_ccitt_false);
+    RUN_TEST(test_record_round_trips);
+    RUN_TEST(test_record_split_across_reads_is_reassembled);
+    RUN_TEST(test_several_records_in_one_read_are_all_decoded);
+    RUN_TEST(test_decoder_resyncs_after_garbage);
+    RUN_TEST(test_record_with_crc_mismatch_is_rejected);
+    return UNITY_END();
+}
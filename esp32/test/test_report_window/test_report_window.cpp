@@ -0,0 +1,156 @@
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "ReportWindow.h"
+
+// Report-by-exception: the single-pass statistics, the deadband and heartbeat deciding what's reported, and a replayed
+// chamber trace checked for its compression and for the error a client holding the last report sees.
+
+namespace {
+    ReportThresholds thresholds;
+
+    StreamRecord recordAt(uint32_t second, int16_t humidity, int16_t temperature, bool valid = true) {
+        return StreamRecord{second, second * 1000, humidity, temperature, -60, 1, valid, 0};
+    }
+
+    /// @brief Six hours of readings taken every second in a chamber, in hundredths: the probe's noise on top of the set
+    /// point, a slow drift and the door opened every 2 hours, the humidity jumping and settling over minutes
+    std::vector<std::pair<int16_t, int16_t>> chamberTrace() {
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> noise(-0.03f, 0.03f);
+        std::vector<std::pair<int16_t, int16_t>> trace;
+        for (uint32_t second = 0; second < 6 * 3600; second++) {
+            auto humidity = 45.0f + noise(random);
+            auto temperature = 23.0f + 0.5f * sinf(second * 2 * static_cast<float>(M_PI) / (6 * 3600)) + noise(random);
+            if (second >= 1800) {
+                auto sinceOpening = (second - 1800) % 7200;
+                humidity += 8.0f * expf(-static_cast<float>(sinceOpening) / 120);
+                temperature -= 1.5f * expf(-static_cast<float>(sinceOpening) / 300);
+            }
+            trace.emplace_back(lroundf(humidity * 100), lroundf(temperature * 100));
+        }
+        return trace;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_running_stats_match_two_passes() {
+    const float values[] = {45.12f, 44.98f, 45.31f, 52.7f, 47.05f, 45.0f, 44.87f};
+    RunningStats stats;
+    float sum = 0.0f;
+    for (auto value: values) {
+        stats.add(value);
+        sum += value;
+    }
+    auto count = sizeof(values) / sizeof(values[0]);
+    auto mean = sum / count;
+    float squares = 0.0f;
+    for (auto value: values) {
+        squares += (value - mean) * (value - mean);
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, stats.getCount());
+    TEST_ASSERT_EQUAL_FLOAT(44.87f, stats.getMin());
+    TEST_ASSERT_EQUAL_FLOAT(52.7f, stats.getMax());
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, mean, stats.getMean());
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, sqrtf(squares / count), stats.getStddev());
+    stats.clear();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.getCount());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, stats.getStddev());
+}
+
+void test_only_changes_past_the_deadband_are_reported() {
+    ReportWindow window;
+    auto first = recordAt(0, 4500, 2300);
+    TEST_ASSERT_TRUE(window.add(first, thresholds));
+    window.nextWindow(first);
+    // within the deadband, though one of them is a short spike the report has to carry
+    TEST_ASSERT_FALSE(window.add(recordAt(1, 4540, 2310), thresholds));
+    TEST_ASSERT_FALSE(window.add(recordAt(2, 4460, 2285), thresholds));
+    TEST_ASSERT_FALSE(window.add(recordAt(3, 4550, 2320), thresholds));
+    auto moved = recordAt(4, 4500, 2321);
+    TEST_ASSERT_TRUE(window.add(moved, thresholds));
+    auto summary = window.summary();
+    TEST_ASSERT_EQUAL_UINT32(4, summary.count);
+    TEST_ASSERT_EQUAL_UINT32(1000, summary.start);
+    TEST_ASSERT_EQUAL_FLOAT(44.6f, summary.humidity.min);
+    TEST_ASSERT_EQUAL_FLOAT(45.5f, summary.humidity.max);
+    TEST_ASSERT_EQUAL_FLOAT(22.85f, summary.temperature.min);
+    TEST_ASSERT_EQUAL_FLOAT(23.21f, summary.temperature.max);
+    window.nextWindow(moved);
+    // measured from the reported value, not from the first one
+    TEST_ASSERT_FALSE(window.add(recordAt(5, 4500, 2340), thresholds));
+}
+
+void test_heartbeat_and_validity_changes_are_reported() {
+    ReportWindow window;
+    auto first = recordAt(0, 4500, 2300);
+    window.add(first, thresholds);
+    window.nextWindow(first);
+    TEST_ASSERT_FALSE(window.add(recordAt(thresholds.heartbeat - 1, 4500, 2300), thresholds));
+    auto heartbeat = recordAt(thresholds.heartbeat, 4500, 2300);
+    TEST_ASSERT_TRUE(window.add(heartbeat, thresholds));
+    window.nextWindow(heartbeat);
+    auto lost = recordAt(thresholds.heartbeat + 1, 0, 0, false);
+    TEST_ASSERT_TRUE(window.add(lost, thresholds));
+    // invalid readings aren't part of the statistics
+    TEST_ASSERT_EQUAL_UINT32(0, window.summary().count);
+    window.nextWindow(lost);
+    TEST_ASSERT_FALSE(window.add(recordAt(thresholds.heartbeat + 2, 0, 0, false), thresholds));
+    TEST_ASSERT_TRUE(window.add(recordAt(thresholds.heartbeat + 3, 4500, 2300), thresholds));
+    window.reset();
+    TEST_ASSERT_TRUE(window.add(recordAt(thresholds.heartbeat + 4, 4500, 2300), thresholds));
+}
+
+void test_replayed_trace_is_compressed_within_the_deadband() {
+    auto trace = chamberTrace();
+    ReportWindow window;
+    uint32_t reports = 0;
+    std::pair<int16_t, int16_t> held{};
+    int32_t maxHumidityError = 0;
+    int32_t maxTemperatureError = 0;
+    int16_t windowMin = INT16_MAX;
+    int16_t windowMax = INT16_MIN;
+    uint32_t hiddenExtremes = 0;
+    for (uint32_t i = 0; i < trace.size(); i++) {
+        auto record = recordAt(i, trace[i].first, trace[i].second);
+        windowMin = std::min(windowMin, record.humidity);
+        windowMax = std::max(windowMax, record.humidity);
+        if (window.add(record, thresholds)) {
+            auto summary = window.summary();
+            hiddenExtremes += lroundf(summary.humidity.min * 100) != windowMin;
+            hiddenExtremes += lroundf(summary.humidity.max * 100) != windowMax;
+            window.nextWindow(record);
+            windowMin = INT16_MAX;
+            windowMax = INT16_MIN;
+            held = trace[i];
+            reports++;
+        }
+        maxHumidityError = std::max(maxHumidityError, abs(trace[i].first - held.first));
+        maxTemperatureError = std::max(maxTemperatureError, abs(trace[i].second - held.second));
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "%zu readings, %u reports, compression %.1f, max error %.2f %%rh %.2f C",
+             trace.size(), reports, static_cast<double>(trace.size()) / reports, maxHumidityError / 100.0,
+             maxTemperatureError / 100.0);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(10 * reports, trace.size(), message);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(thresholds.humidityDeadband, maxHumidityError, message);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(thresholds.temperatureDeadband, maxTemperatureError, message);
+    TEST_ASSERT_EQUAL_UINT32(0, hiddenExtremes);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_running_stats_match_two_passes);
+    RUN_TEST(test_only_changes_past_the_deadband_are_reported);
+    RUN_TEST(test_heartbeat_and_validity_changes_are_reported);
+    RUN_TEST(test_replayed_trace_is_compressed_within_the_deadband);
+    return UNITY_END();
+}
@@ -0,0 +1,138 @@
+#include <unity.h>
+#include <cstdint>
+#include "DeadlineScheduler.h"
+#include "SampleRing.h"
+
+// The history ring: wrapping around its array, its overflow policies and finding records by sequence number, also when the
+// sequence numbers and the clock sampling into it wrap around.
+
+namespace {
+    struct Sample {
+        uint32_t sequence;
+        uint32_t uptime;
+    };
+
+    constexpr size_t CAPACITY = 8;
+    constexpr uint16_t SAMPLING = 0;
+    constexpr uint32_t INTERVAL = 1000;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_ring_wraps_around_its_array() {
+    SampleRing<Sample, CAPACITY> ring;
+    for (uint32_t sequence = 0; sequence < 3 * CAPACITY + 3; sequence++) {
+        TEST_ASSERT_TRUE(ring.push({sequence, 0}));
+    }
+    TEST_ASSERT_EQUAL(CAPACITY, ring.size());
+    // the oldest sample sits in the middle of the array by now, indices are still counted from it
+    for (size_t i = 0; i < CAPACITY; i++) {
+        TEST_ASSERT_EQUAL_UINT32(2 * CAPACITY + 3 + i, ring.at(i).sequence);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3 * CAPACITY + 2, ring.newest().sequence);
+    TEST_ASSERT_EQUAL_UINT32(2 * CAPACITY + 3, ring.getDropped());
+}
+
+void test_drop_newest_keeps_the_oldest() {
+    SampleRing<Sample, CAPACITY, OverflowPolicy::DropNewest> ring;
+    for (uint32_t sequence = 0; sequence < CAPACITY; sequence++) {
+        TEST_ASSERT_TRUE(ring.push({sequence, 0}));
+    }
+    TEST_ASSERT_FALSE(ring.push({CAPACITY, 0}));
+    TEST_ASSERT_FALSE(ring.push({CAPACITY + 1, 0}));
+    TEST_ASSERT_EQUAL(CAPACITY, ring.size());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.at(0).sequence);
+    TEST_ASSERT_EQUAL_UINT32(CAPACITY - 1, ring.newest().sequence);
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getDropped());
+}
+
+void test_first_after_finds_the_next_sequence() {
+    SampleRing<Sample, CAPACITY> ring;
+    TEST_ASSERT_EQUAL(0, ring.firstAfter(0));
+    for (uint32_t sequence = 10; sequence < 10 + 2 * CAPACITY; sequence += 2) {
+        ring.push({sequence, 0});
+    }
+    // 10, 12 ... 24
+    TEST_ASSERT_EQUAL(0, ring.firstAfter(3));
+    TEST_ASSERT_EQUAL(1, ring.firstAfter(10));
+    TEST_ASSERT_EQUAL(2, ring.firstAfter(13));
+    TEST_ASSERT_EQUAL(CAPACITY - 1, ring.firstAfter(23));
+    TEST_ASSERT_EQUAL(ring.size(), ring.firstAfter(24));
+    TEST_ASSERT_EQUAL(ring.size(), ring.firstAfter(1000));
+}
+
+void test_first_after_handles_sequence_wrap_around() {
+    SampleRing<Sample, CAPACITY> ring;
+    // UINT32_MAX - 3 ... UINT32_MAX, 0 ... 3
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+        ring.push({UINT32_MAX - 3 + i, 0});
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, ring.newest().sequence);
+    TEST_ASSERT_EQUAL(0, ring.firstAfter(UINT32_MAX - 10));
+    TEST_ASSERT_EQUAL(3, ring.firstAfter(UINT32_MAX - 1));
+    TEST_ASSERT_EQUAL(4, ring.firstAfter(UINT32_MAX));
+    TEST_ASSERT_EQUAL(5, ring.firstAfter(0));
+    TEST_ASSERT_EQUAL(ring.size(), ring.firstAfter(3));
+}
+
+void test_sampling_continues_across_the_clock_overflow() {
+    // the way TCPServer samples into history: a deadline per interval, the next one scheduled from the one that passed
+    DeadlineScheduler<4> scheduler;
+    SampleRing<Sample, CAPACITY> ring;
+    uint32_t now = UINT32_MAX - 3 * INTERVAL - 500;
+    uint32_t sequence = UINT32_MAX - 2;
+    TEST_ASSERT_TRUE(scheduler.schedule(SAMPLING, now + INTERVAL));
+    for (uint32_t elapsed = 0; elapsed <= 6 * INTERVAL; elapsed += 100) {
+        auto tick = now + elapsed;
+        uint16_t id;
+        uint32_t deadline;
+        while (scheduler.popDue(tick, id, deadline)) {
+            TEST_ASSERT_EQUAL_UINT16(SAMPLING, id);
+            ring.push({sequence++, deadline});
+            scheduler.schedule(SAMPLING, deadline + INTERVAL);
+        }
+    }
+    // a sample per interval, the clock's wrap neither skipped nor repeated one
+    TEST_ASSERT_EQUAL(6, ring.size());
+    for (size_t i = 1; i < ring.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(INTERVAL, ring.at(i).uptime - ring.at(i - 1).uptime);
+        TEST_ASSERT_EQUAL_UINT32(1, ring.at(i).sequence - ring.at(i - 1).sequence);
+    }
+    TEST_ASSERT_TRUE(ring.newest().uptime < ring.at(0).uptime);
+    // a client that saw the last sample before the overflow gets the ones after it
+    TEST_ASSERT_EQUAL(3, ring.firstAfter(UINT32_MAX));
+    uint32_t next;
+    TEST_ASSERT_TRUE(scheduler.nextDeadline(next));
+    TEST_ASSERT_EQUAL_UINT32(ring.newest().uptime + INTERVAL, next);
+}
+
+void test_scheduler_orders_deadlines_across_the_overflow() {
+    DeadlineScheduler<4> scheduler;
+    scheduler.schedule(1, 100);
+    scheduler.schedule(2, UINT32_MAX - 100);
+    scheduler.schedule(3, UINT32_MAX);
+    uint16_t id;
+    uint32_t deadline;
+    TEST_ASSERT_FALSE(scheduler.popDue(UINT32_MAX - 101, id, deadline));
+    TEST_ASSERT_TRUE(scheduler.popDue(50, id, deadline));
+    TEST_ASSERT_EQUAL_UINT16(2, id);
+    TEST_ASSERT_TRUE(scheduler.popDue(50, id, deadline));
+    TEST_ASSERT_EQUAL_UINT16(3, id);
+    TEST_ASSERT_FALSE(scheduler.popDue(50, id, deadline));
+    TEST_ASSERT_TRUE(scheduler.popDue(100, id, deadline));
+    TEST_ASSERT_EQUAL_UINT16(1, id);
+    TEST_ASSERT_EQUAL(0, scheduler.size());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_wraps_around_its_array);
+    RUN_TEST(test_drop_newest_keeps_the_oldest);
+    RUN_TEST(test_first_after_finds_the_next_sequence);
+    RUN_TEST(test_first_after_handles_sequence_wrap_around);
+    RUN_TEST(test_sampling_continues_across_the_clock_overflow);
+    RUN_TEST(test_scheduler_orders_deadlines_across_the_overflow);
+    return UNITY_END();
+}
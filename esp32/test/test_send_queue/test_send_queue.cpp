@@ -0,0 +1,258 @@
+#include <unity.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "SendQueue.h"
+
+// The per-client send queue: its overflow policies, the counters the servers report from it and fanning frames out to
+// clients whose send windows fill up.
+
+namespace {
+    FrameRef frameOf(const std::string &text) {
+        return FrameRef::copyOf(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+    }
+
+    /// @brief Frame of the given size whose bytes are all the same character, so that frames can be told apart
+    FrameRef frameOf(char c, size_t size) {
+        return frameOf(std::string(size, c));
+    }
+
+    /// @brief Drains the queue into a string, accepting at most the given amount of bytes
+    std::string drain(SendQueue &queue, size_t window = SIZE_MAX) {
+        std::string sent;
+        queue.drain([&](const uint8_t *data, size_t size) -> size_t {
+            auto accepted = std::min(size, window - sent.size());
+            sent.append(reinterpret_cast<const char *>(data), accepted);
+            return accepted;
+        });
+        return sent;
+    }
+
+    /// @brief Stands in for AsyncClient with a send window of the given size: add() takes what fits, ack() makes room again
+    /// the way the peer acknowledging data would
+    class MockClient {
+    public:
+        explicit MockClient(size_t window) : window(window) {}
+
+        bool canSend() {
+            return space() > 0;
+        }
+
+        size_t space() {
+            return window - inFlight.size();
+        }
+
+        size_t add(const char *data, size_t size) {
+            auto accepted = std::min(size, space());
+            inFlight.append(data, accepted);
+            return accepted;
+        }
+
+        /// @brief Acknowledges up to the given amount of bytes, they count as received from then on
+        void ack(size_t bytes = SIZE_MAX) {
+            bytes = std::min(bytes, inFlight.size());
+            received.append(inFlight, 0, bytes);
+            inFlight.erase(0, bytes);
+        }
+
+        std::string received;
+
+    private:
+        size_t window;
+        std::string inFlight;
+    };
+
+    std::string recordOf(uint32_t sequence) {
+        return "{\"sequence\":" + std::to_string(sequence) + "}\n";
+    }
+
+    /// @brief Checks that the text is made of whole records with increasing sequence numbers
+    /// @return Amount of records
+    size_t checkRecords(const std::string &text) {
+        size_t records = 0;
+        long previous = -1;
+        for (size_t start = 0; start < text.size();) {
+            auto end = text.find('\n', start);
+            TEST_ASSERT_TRUE(end != std::string::npos);
+            auto line = text.substr(start, end + 1 - start);
+            auto sequence = std::stol(line.substr(12));
+            TEST_ASSERT_EQUAL_STRING(recordOf(sequence).c_str(), line.c_str());
+            TEST_ASSERT_GREATER_THAN(previous, sequence);
+            previous = sequence;
+            records++;
+            start = end + 1;
+        }
+        return records;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_frames_are_sent_in_order() {
+    SendQueue queue;
+    TEST_ASSERT_EQUAL(EnqueueResult::Queued, queue.push(frameOf("ab")));
+    TEST_ASSERT_EQUAL(EnqueueResult::Queued, queue.push(frameOf("cd")));
+    TEST_ASSERT_EQUAL_UINT32(4, queue.getStats().queuedBytes);
+    TEST_ASSERT_EQUAL_STRING("abcd", drain(queue).c_str());
+    TEST_ASSERT_TRUE(queue.empty());
+    TEST_ASSERT_EQUAL_UINT32(2, queue.getStats().sentFrames);
+    TEST_ASSERT_EQUAL_UINT32(4, queue.getStats().sentBytes);
+}
+
+void test_drop_oldest_evicts_one_frame() {
+    SendQueue queue;
+    for (size_t i = 0; i < SEND_QUEUE_CAPACITY; i++) {
+        TEST_ASSERT_EQUAL(EnqueueResult::Queued, queue.push(frameOf('a' + i % 26, 1)));
+    }
+    TEST_ASSERT_EQUAL(EnqueueResult::Evicted, queue.push(frameOf('!', 1)));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.getStats().droppedFrames);
+    auto sent = drain(queue);
+    TEST_ASSERT_EQUAL(SEND_QUEUE_CAPACITY, sent.size());
+    TEST_ASSERT_EQUAL('b', sent.front());
+    TEST_ASSERT_EQUAL('!', sent.back());
+}
+
+void test_coalescing_counts_every_evicted_frame() {
+    SendQueue queue;
+    queue.setPolicy(QueueOverflowPolicy::CoalesceToLatest);
+    for (size_t i = 0; i < SEND_QUEUE_CAPACITY; i++) {
+        queue.push(frameOf('a', 1));
+    }
+    TEST_ASSERT_EQUAL(EnqueueResult::Evicted, queue.push(frameOf('z', 1)));
+    TEST_ASSERT_EQUAL_UINT32(SEND_QUEUE_CAPACITY, queue.getStats().droppedFrames);
+    TEST_ASSERT_EQUAL_STRING("z", drain(queue).c_str());
+}
+
+void test_byte_limit_evicts_until_the_frame_fits() {
+    SendQueue queue;
+    queue.setMaxBytes(10);
+    queue.push(frameOf('a', 4));
+    queue.push(frameOf('b', 4));
+    TEST_ASSERT_EQUAL(EnqueueResult::Evicted, queue.push(frameOf('c', 8)));
+    TEST_ASSERT_EQUAL_UINT32(2, queue.getStats().droppedFrames);
+    TEST_ASSERT_EQUAL_STRING("cccccccc", drain(queue).c_str());
+}
+
+void test_started_frame_is_never_dropped() {
+    SendQueue queue;
+    queue.setMaxBytes(10);
+    queue.push(frameOf('a', 8));
+    // half of it went out, the rest of the frame has to follow
+    TEST_ASSERT_EQUAL_STRING("aaaa", drain(queue, 4).c_str());
+    TEST_ASSERT_EQUAL(EnqueueResult::Dropped, queue.push(frameOf('b', 8)));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.getStats().droppedFrames);
+    TEST_ASSERT_EQUAL_STRING("aaaa", drain(queue).c_str());
+    TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_disconnect_policy_doesnt_queue() {
+    SendQueue queue;
+    queue.setPolicy(QueueOverflowPolicy::Disconnect);
+    queue.setMaxBytes(4);
+    queue.push(frameOf('a', 4));
+    TEST_ASSERT_EQUAL(EnqueueResult::Disconnect, queue.push(frameOf('b', 1)));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.getStats().droppedFrames);
+    TEST_ASSERT_EQUAL_STRING("aaaa", drain(queue).c_str());
+}
+
+void test_frames_are_shared_and_released() {
+    auto frame = frameOf("shared");
+    {
+        SendQueue first;
+        SendQueue second;
+        first.push(frame);
+        second.push(frame);
+        // the queues hold references to it, a rewrite would change what they send
+        TEST_ASSERT_FALSE(frame.rewrite(reinterpret_cast<const uint8_t *>("x"), 1));
+        drain(first);
+        second.clear();
+    }
+    TEST_ASSERT_TRUE(frame.rewrite(reinterpret_cast<const uint8_t *>("x"), 1));
+    TEST_ASSERT_EQUAL(1, frame.size());
+}
+
+void test_narrow_window_resumes_within_a_frame() {
+    SendQueue queue;
+    MockClient client(5);
+    queue.push(frameOf("hello world\n"));
+    queue.push(frameOf("next\n"));
+    TEST_ASSERT_EQUAL(5, queue.drainTo(client));
+    TEST_ASSERT_EQUAL(0, queue.drainTo(client));
+    client.ack(2);
+    TEST_ASSERT_EQUAL(2, queue.drainTo(client));
+    while (!queue.empty()) {
+        client.ack();
+        queue.drainTo(client);
+    }
+    client.ack();
+    TEST_ASSERT_EQUAL_STRING("hello world\nnext\n", client.received.c_str());
+    TEST_ASSERT_EQUAL_UINT32(2, queue.getStats().sentFrames);
+    TEST_ASSERT_EQUAL_UINT32(0, queue.getStats().queuedBytes);
+    TEST_ASSERT_EQUAL_UINT32(0, queue.getStats().droppedFrames);
+}
+
+void test_slow_client_doesnt_hold_up_the_others() {
+    // a recorder that acks everything and a viewer whose window stays nearly shut, both fed the same frames
+    SendQueue recorder;
+    SendQueue viewer;
+    MockClient recorderClient(5744);
+    MockClient viewerClient(16);
+    constexpr uint32_t RECORDS = 200;
+    for (uint32_t sequence = 0; sequence < RECORDS; sequence++) {
+        auto frame = frameOf(recordOf(sequence));
+        recorder.push(frame);
+        viewer.push(frame);
+        recorder.drainTo(recorderClient);
+        viewer.drainTo(viewerClient);
+        recorderClient.ack();
+        TEST_ASSERT_LESS_OR_EQUAL(SEND_QUEUE_MAX_BYTES, viewer.getStats().queuedBytes);
+    }
+    TEST_ASSERT_EQUAL(RECORDS, checkRecords(recorderClient.received));
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.getStats().droppedFrames);
+    TEST_ASSERT_TRUE(recorder.empty());
+    TEST_ASSERT_GREATER_THAN(0, viewer.getStats().droppedFrames);
+    // once its window opens, the viewer gets whole records, the newest ones among them
+    while (!viewer.empty()) {
+        viewerClient.ack();
+        viewer.drainTo(viewerClient);
+    }
+    viewerClient.ack();
+    auto delivered = checkRecords(viewerClient.received);
+    TEST_ASSERT_EQUAL(RECORDS, delivered + viewer.getStats().droppedFrames);
+    TEST_ASSERT_TRUE(viewerClient.received.ends_with(recordOf(RECORDS - 1)));
+}
+
+void test_coalescing_client_skips_to_the_newest_frame() {
+    SendQueue queue;
+    queue.setPolicy(QueueOverflowPolicy::CoalesceToLatest);
+    queue.setMaxBytes(64);
+    MockClient client(4);
+    for (uint32_t sequence = 0; sequence < 50; sequence++) {
+        queue.push(frameOf(recordOf(sequence)));
+        queue.drainTo(client);
+    }
+    while (!queue.empty()) {
+        client.ack();
+        queue.drainTo(client);
+    }
+    client.ack();
+    // the record that started being sent is finished, everything else was coalesced into the newest one
+    TEST_ASSERT_EQUAL_STRING((recordOf(0) + recordOf(49)).c_str(), client.received.c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_are_sent_in_order);
+    RUN_TEST(test_drop_oldest_evicts_one_frame);
+    RUN_TEST(test_coalescing_counts_every_evicted_frame);
+    RUN_TEST(test_byte_limit_evicts_until_the_frame_fits);
+    RUN_TEST(test_started_frame_is_never_dropped);
+    RUN_TEST(test_disconnect_policy_doesnt_queue);
+    RUN_TEST(test_frames_are_shared_and_released);
+    RUN_TEST(test_narrow_window_resumes_within_a_frame);
+    RUN_TEST(test_slow_client_doesnt_hold_up_the_others);
+    RUN_TEST(test_coalescing_client_skips_to_the_newest_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,85 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <memory>
+#include "Metrics.h"
+#include "Sensor.h"
+
+// Sensor's state machine against the simulated probes of the native HardwareSerial: the one on UART 1 answers every
+// request, the one on UART 2 never does.
+
+constexpr unsigned long POLL_INTERVAL = 1000;
+// longer than a poll interval plus RESPONSE_TIMEOUT
+constexpr unsigned long TEST_TIMEOUT = 3000;
+
+namespace {
+    std::unique_ptr<Sensor> sensor;
+
+    /// @brief Runs loop() the way the event loop would, until a reading is published or TEST_TIMEOUT passes
+    /// @return false if no reading arrived
+    bool pumpUntilReading(Sensor &probe) {
+        auto startedAt = millis();
+        while (millis() - startedAt < TEST_TIMEOUT) {
+            probe.loop();
+            if (probe.takeReadings()) {
+                return true;
+            }
+            delay(1);
+        }
+        return false;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {
+    sensor = nullptr;
+}
+
+void test_reading_is_published() {
+    sensor = std::make_unique<Sensor>(1, 16, 17, POLL_INTERVAL);
+    auto before = millis();
+    TEST_ASSERT_TRUE(pumpUntilReading(*sensor));
+    auto reading = sensor->getLatestReading();
+    TEST_ASSERT_TRUE(reading.valid);
+    TEST_ASSERT_FLOAT_WITHIN(50.0f, 50.0f, reading.humidity);
+    TEST_ASSERT_FLOAT_WITHIN(70.0f, 15.0f, reading.temperature);
+    TEST_ASSERT_GREATER_OR_EQUAL(before, reading.timestamp);
+    TEST_ASSERT_EQUAL(PROBE_FRAME_LENGTH, sensor->getLatestFrame().length());
+    TEST_ASSERT_EQUAL_STRING("{\"humidity\":", sensor->getJsonString().substring(0, 12).c_str());
+}
+
+void test_next_reading_follows_the_poll_interval() {
+    sensor = std::make_unique<Sensor>(1, 16, 17, POLL_INTERVAL);
+    TEST_ASSERT_TRUE(pumpUntilReading(*sensor));
+    auto first = sensor->getLatestReading().timestamp;
+    // nothing to do until the next poll, which is timed from when the request was sent
+    TEST_ASSERT_GREATER_THAN(first, sensor->nextDeadline());
+    TEST_ASSERT_LESS_OR_EQUAL(first + POLL_INTERVAL, sensor->nextDeadline());
+    TEST_ASSERT_TRUE(pumpUntilReading(*sensor));
+    auto interval = sensor->getLatestReading().timestamp - first;
+    TEST_ASSERT_UINT32_WITHIN(100, POLL_INTERVAL, interval);
+}
+
+void test_silent_probe_times_out() {
+    sensor = std::make_unique<Sensor>(2, 25, 26, POLL_INTERVAL);
+    auto timeouts = metrics.sensorTimeouts.get();
+    auto before = millis();
+    TEST_ASSERT_TRUE(pumpUntilReading(*sensor));
+    auto reading = sensor->getLatestReading();
+    TEST_ASSERT_FALSE(reading.valid);
+    // published when RESPONSE_TIMEOUT passed, not before
+    TEST_ASSERT_GREATER_OR_EQUAL(before + 500, reading.timestamp);
+    TEST_ASSERT_EQUAL_UINT32(timeouts + 1, metrics.sensorTimeouts.get());
+    auto data = sensor->getSensorData();
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, data.first);
+}
+
+int main() {
+    setenv("POLEKO_PROBE_DROP", "0,100", 1);
+    setenv("POLEKO_PROBE_DELAY", "0", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_reading_is_published);
+    RUN_TEST(test_next_reading_follows_the_poll_interval);
+    RUN_TEST(test_silent_probe_times_out);
+    return UNITY_END();
+}
@@ -0,0 +1,107 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <cstdlib>
+#include <string>
+#include "SensorBus.h"
+
+// Several simulated probes on one bus: the ones on UART 1 to 3 take PROBE_DELAY ms to start answering, the one on UART 4
+// SLOW_PROBE_DELAY ms.
+
+constexpr unsigned long PROBE_DELAY = 50;
+constexpr unsigned long SLOW_PROBE_DELAY = 400;
+constexpr unsigned long MEASUREMENT = 1500;
+
+namespace {
+    const ProbePins PINS[MAX_PROBES] = {{1, -1, -1}, {2, -1, -1}, {3, -1, -1}, {4, -1, -1}};
+    const ProbePins SLOW_FIRST[2] = {PINS[3], PINS[0]};
+
+    /// @brief Asks every probe of the bus for a new reading as soon as it answered, for MEASUREMENT ms
+    /// @return Amount of readings taken
+    uint32_t readingsWhileDemanding(SensorBus &bus) {
+        uint32_t readings = 0;
+        auto startedAt = millis();
+        while (millis() - startedAt < MEASUREMENT) {
+            for (size_t probe = 0; probe < bus.size(); probe++) {
+                bus[probe].requestReading(0);
+            }
+            bus.loop();
+            for (size_t probe = 0; probe < bus.size(); probe++) {
+                readings += bus[probe].takeReadings();
+            }
+            delayMicroseconds(200);
+        }
+        return readings;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_every_probe_delivers_its_own_readings() {
+    SensorBus bus(PINS, 3, 200);
+    TEST_ASSERT_EQUAL(3, bus.size());
+    bool received[3] = {};
+    auto startedAt = millis();
+    while (!(received[0] && received[1] && received[2]) && millis() - startedAt < 2000) {
+        bus.loop();
+        for (size_t probe = 0; probe < bus.size(); probe++) {
+            received[probe] |= bus[probe].takeReadings() && bus[probe].getLatestReading().valid;
+        }
+        delay(1);
+    }
+    TEST_ASSERT_TRUE(received[0] && received[1] && received[2]);
+    // every simulated probe measures a different spot of the chamber, so the readings tell which probe they came from
+    TEST_ASSERT_TRUE(bus[0].getLatestReading().humidity != bus[1].getLatestReading().humidity);
+    TEST_ASSERT_TRUE(bus[1].getLatestReading().humidity != bus[2].getLatestReading().humidity);
+}
+
+void test_slow_probe_doesnt_delay_the_others() {
+    // the slow probe comes first, a bus polling one probe after another would make the fast one wait for it
+    SensorBus bus(SLOW_FIRST, 2, 60000);
+    auto startedAt = millis();
+    unsigned long answeredAt[2] = {};
+    while ((answeredAt[0] == 0 || answeredAt[1] == 0) && millis() - startedAt < 2000) {
+        bus.loop();
+        for (size_t probe = 0; probe < bus.size(); probe++) {
+            if (bus[probe].takeReadings() && answeredAt[probe] == 0) {
+                answeredAt[probe] = millis() - startedAt + 1;
+            }
+        }
+        delayMicroseconds(200);
+    }
+    TEST_ASSERT_TRUE(bus[0].getLatestReading().valid);
+    TEST_ASSERT_TRUE(bus[1].getLatestReading().valid);
+    TEST_ASSERT_LESS_THAN(SLOW_PROBE_DELAY, answeredAt[1]);
+    TEST_ASSERT_GREATER_OR_EQUAL(SLOW_PROBE_DELAY, answeredAt[0]);
+}
+
+void test_readings_per_second_grow_with_the_probes() {
+    uint32_t single;
+    {
+        SensorBus bus(PINS, 1);
+        single = readingsWhileDemanding(bus);
+    }
+    uint32_t three;
+    {
+        SensorBus bus(PINS, 3);
+        three = readingsWhileDemanding(bus);
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "1 probe: %u readings, 3 probes: %u", single, three);
+    TEST_ASSERT_GREATER_THAN_MESSAGE(5, single, message);
+    // overlapping transactions, so close to three times as many
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(single * 5 / 2, three, message);
+}
+
+int main() {
+    setenv("POLEKO_PROBE_DROP", "0", 1);
+    auto delays = std::to_string(PROBE_DELAY) + "," + std::to_string(PROBE_DELAY) + "," + std::to_string(PROBE_DELAY) +
+                  "," + std::to_string(SLOW_PROBE_DELAY);
+    setenv("POLEKO_PROBE_DELAY", delays.c_str(), 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_every_probe_delivers_its_own_readings);
+    RUN_TEST(test_slow_probe_doesnt_delay_the_others);
+    RUN_TEST(test_readings_per_second_grow_with_the_probes);
+    return UNITY_END();
+}
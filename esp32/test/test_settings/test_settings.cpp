@@ -0,0 +1,158 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <Preferences.h>
+#include <cstdlib>
+#include "Metrics.h"
+#include "Settings.h"
+
+// The settings cache against the native Preferences kept in memory, whose counters stand in for the wear of the flash:
+// loading once, migrating the keys of older firmware, and coalescing changes into a single write.
+
+namespace {
+    /// @brief Removes what an earlier test stored, the in-memory NVS lives as long as the process
+    void eraseNamespace(const char *name) {
+        Preferences preferences;
+        preferences.begin(name);
+        preferences.clear();
+        preferences.end();
+    }
+
+    uint32_t nvsWrites() {
+        return nvsStats().writes;
+    }
+}
+
+void setUp() {
+    for (auto name: {"settings", "tcp", "ipSettings"}) {
+        eraseNamespace(name);
+    }
+}
+
+void tearDown() {}
+
+void test_first_boot_stores_the_defaults_once() {
+    auto writes = nvsWrites();
+    Settings settings;
+    settings.begin();
+    TEST_ASSERT_EQUAL_UINT32(2, settings.get().tcpInterval);
+    TEST_ASSERT_EQUAL_UINT32(1, settings.get().tcpBatch);
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+    // the next boot only reads them
+    Settings rebooted;
+    rebooted.begin();
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+    uint32_t deadline;
+    TEST_ASSERT_FALSE(rebooted.nextDeadline(deadline));
+}
+
+void test_keys_of_older_firmware_are_migrated() {
+    Preferences preferences;
+    preferences.begin("tcp");
+    preferences.putUShort("interval", 7);
+    preferences.putUShort("batch", 3);
+    preferences.putULong("flushTimeout", 1500);
+    preferences.end();
+    preferences.begin("ipSettings");
+    preferences.putString("ip", "192.168.1.50");
+    preferences.putString("mask", "255.255.255.0");
+    preferences.putString("gateway", "192.168.1.1");
+    preferences.end();
+
+    auto writes = nvsWrites();
+    Settings settings;
+    settings.begin();
+    auto migrated = settings.get();
+    TEST_ASSERT_EQUAL_UINT32(7, migrated.tcpInterval);
+    TEST_ASSERT_EQUAL_UINT32(3, migrated.tcpBatch);
+    TEST_ASSERT_EQUAL_UINT32(1500, migrated.tcpFlushTimeout);
+    TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(IPAddress(192, 168, 1, 50)), migrated.ip);
+    TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(IPAddress(255, 255, 255, 0)), migrated.subnetMask);
+    TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(IPAddress(192, 168, 1, 1)), migrated.defaultGateway);
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+    preferences.begin("tcp", true);
+    TEST_ASSERT_FALSE(preferences.isKey("interval"));
+    preferences.end();
+
+    // migrated once, the next boot reads the record
+    Settings rebooted;
+    rebooted.begin();
+    TEST_ASSERT_EQUAL_UINT32(7, rebooted.get().tcpInterval);
+    TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(IPAddress(192, 168, 1, 50)), rebooted.get().ip);
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+}
+
+void test_burst_of_changes_is_written_once() {
+    Settings settings;
+    settings.begin();
+    auto writes = nvsWrites();
+    auto counted = metrics.settingsWrites.get();
+    auto startedAt = millis();
+    for (uint16_t i = 0; i < 1000; i++) {
+        settings.setTcpInterval(i % 60 + 1);
+        settings.setTcpBatch(i % 4 + 1);
+        settings.loop();
+    }
+    TEST_ASSERT_EQUAL_UINT32(writes, nvsWrites());
+    uint32_t deadline;
+    TEST_ASSERT_TRUE(settings.nextDeadline(deadline));
+    TEST_ASSERT_GREATER_OR_EQUAL(startedAt + SETTINGS_FLUSH_DELAY, deadline);
+    TEST_ASSERT_EQUAL_UINT32(40, settings.get().tcpInterval);
+
+    settings.flush();
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+    TEST_ASSERT_EQUAL_UINT32(counted + 1, metrics.settingsWrites.get());
+    TEST_ASSERT_FALSE(settings.nextDeadline(deadline));
+    Settings rebooted;
+    rebooted.begin();
+    TEST_ASSERT_EQUAL_UINT32(40, rebooted.get().tcpInterval);
+    TEST_ASSERT_EQUAL_UINT32(4, rebooted.get().tcpBatch);
+}
+
+void test_changes_are_written_after_the_quiet_period() {
+    Settings settings;
+    settings.begin();
+    auto writes = nvsWrites();
+    auto changedAt = millis();
+    settings.setTcpFlushTimeout(250);
+    while (nvsWrites() == writes && millis() - changedAt < SETTINGS_FLUSH_DELAY + 1000) {
+        settings.loop();
+        delay(10);
+    }
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, nvsWrites());
+    TEST_ASSERT_GREATER_OR_EQUAL(SETTINGS_FLUSH_DELAY, millis() - changedAt);
+}
+
+void test_reverted_change_isnt_written() {
+    Settings settings;
+    settings.begin();
+    auto writes = nvsWrites();
+    settings.setTcpInterval(30);
+    settings.setTcpInterval(2);
+    settings.flush();
+    TEST_ASSERT_EQUAL_UINT32(writes, nvsWrites());
+}
+
+void test_corrupted_record_falls_back_to_the_defaults() {
+    Preferences preferences;
+    preferences.begin("settings");
+    uint8_t garbage[SETTINGS_RECORD_SIZE] = {SETTINGS_VERSION, SETTINGS_RECORD_SIZE - 4, 0x12, 0x34};
+    preferences.putBytes("record", garbage, sizeof(garbage));
+    preferences.end();
+
+    Settings settings;
+    settings.begin();
+    TEST_ASSERT_EQUAL_UINT32(2, settings.get().tcpInterval);
+    TEST_ASSERT_EQUAL_UINT32(0, settings.get().ip);
+}
+
+int main() {
+    setenv("POLEKO_NVS", ":memory:", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_first_boot_stores_the_defaults_once);
+    RUN_TEST(test_keys_of_older_firmware_are_migrated);
+    RUN_TEST(test_burst_of_changes_is_written_once);
+    RUN_TEST(test_changes_are_written_after_the_quiet_period);
+    RUN_TEST(test_reverted_change_isnt_written);
+    RUN_TEST(test_corrupted_record_falls_back_to_the_defaults);
+    return UNITY_END();
+}
@@ -0,0 +1,394 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <array>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../support/Loopback.h"
+#include "Metrics.h"
+#include "ReadingCodec.h"
+#include "SensorBus.h"
+#include "Settings.h"
+#include "TCPServer.h"
+
+// The TCP server over loopback, with the simulated probe behind it. The test drives the sensor and the server's loop() the
+// way the event loop does.
+
+constexpr uint16_t TCP_PORT = 5505;
+constexpr ProbePins PINS[] = {{1, 16, 17}};
+constexpr ProbePins BUS_PINS[MAX_PROBES] = {{1, -1, -1}, {2, -1, -1}, {3, -1, -1}, {4, -1, -1}};
+
+namespace {
+    std::unique_ptr<Settings> settings;
+    std::unique_ptr<SensorBus> sensors;
+    std::unique_ptr<TCPServer> server;
+    // readings the probe delivered
+    unsigned readingsTaken = 0;
+
+    /// @brief Replaces the server with one reading the given probes, stopped until setup() is called
+    void serveProbes(const ProbePins *pins, size_t count) {
+        server = nullptr;
+        sensors = std::make_unique<SensorBus>(pins, count);
+        server = std::make_unique<TCPServer>(*sensors, *settings, TCP_PORT);
+    }
+
+    void step() {
+        sensors->loop();
+        if (sensors->takeReadings()) {
+            readingsTaken++;
+        }
+        TCPServer::loop();
+    }
+
+    /// @brief Gets the amount of clients holding a slot, from the server's metrics
+    unsigned long tcpClientCount() {
+        char text[2048];
+        MetricsWriter writer(text, sizeof(text));
+        TCPServer::writeMetrics(writer);
+        auto found = strstr(text, "\npoleko_tcp_clients ");
+        return found == nullptr ? ULONG_MAX : strtoul(found + sizeof("\npoleko_tcp_clients ") - 1, nullptr, 10);
+    }
+
+    /// @brief Waits for the next line from the server
+    /// @return The line, empty if none arrived in time
+    std::string expectLine(LoopbackClient &client, unsigned long timeout = LOOPBACK_TIMEOUT) {
+        std::string line;
+        pumpUntil([&]() { return client.nextLine(line); }, step, timeout);
+        return line;
+    }
+
+    /// @brief Waits for the next line that isn't a reading
+    std::string expectReply(LoopbackClient &client) {
+        while (true) {
+            auto line = expectLine(client);
+            if (line.empty() || jsonNumber(line, "sequence") < 0 || line.find("\"ack\"") != std::string::npos) {
+                return line;
+            }
+        }
+    }
+
+    /// @brief Waits for the given amount of readings
+    /// @return When each of them arrived, empty if they didn't arrive in time
+    std::vector<unsigned long> expectReadings(LoopbackClient &client, size_t count, unsigned long timeout) {
+        std::vector<unsigned long> arrivals;
+        while (arrivals.size() < count) {
+            auto line = expectLine(client, timeout);
+            if (line.empty()) {
+                return {};
+            }
+            arrivals.push_back(millis());
+        }
+        return arrivals;
+    }
+
+    /// @brief Waits for the next line with the given key, e.g. a notice or stats, which carry a sequence number too
+    std::string expectLineWith(LoopbackClient &client, std::string_view key) {
+        while (true) {
+            auto line = expectLine(client);
+            if (line.empty() || jsonNumber(line, key) >= 0) {
+                return line;
+            }
+        }
+    }
+}
+
+void setUp() {
+    // the batching is the server's, every test starts without it
+    settings->setTcpBatch(1);
+    settings->setTcpFlushTimeout(0);
+    server->setup();
+}
+
+void tearDown() {
+    server->stop();
+    if (sensors->size() != 1) {
+        serveProbes(PINS, 1);
+    }
+}
+
+void test_commands_are_acknowledged() {
+    LoopbackClient client(TCP_PORT);
+    TEST_ASSERT_TRUE(client.connected());
+    client.send("{\"ping\":true}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(client).c_str());
+    client.send("{\"interval\":0}\n{\"bogus\":1}\nnot json\n");
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"invalidValue\",\"command\":\"interval\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"unknownCommand\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"malformed\"}", expectReply(client).c_str());
+}
+
+void test_command_split_across_packets_is_completed() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"pi");
+    pumpUntil([]() { return false; }, step, 50);
+    client.send("ng\":true}\n{\"metrics\":");
+    pumpUntil([]() { return false; }, step, 50);
+    client.send("true}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"metrics\"}", expectReply(client).c_str());
+}
+
+void test_commands_beyond_the_pending_ones_are_busy() {
+    LoopbackClient client(TCP_PORT);
+    TEST_ASSERT_TRUE(pumpUntil([]() { return tcpClientCount() == 1; }, step));
+    // all of them arrive before loop() runs again
+    std::string burst;
+    for (size_t i = 0; i < TCP_PENDING_COMMANDS + 2; i++) {
+        burst += "{\"ping\":true}\n";
+    }
+    client.send(burst);
+    delay(100);
+    for (size_t i = 0; i < TCP_PENDING_COMMANDS; i++) {
+        TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(client).c_str());
+    }
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"busy\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"busy\"}", expectReply(client).c_str());
+    client.send("{\"ping\":true}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(client).c_str());
+}
+
+void test_readings_are_delivered_at_the_interval() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"interval\":1,\"save\":false}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(client).c_str());
+    long previous = -1;
+    unsigned long previousAt = 0;
+    for (int i = 0; i < 3; i++) {
+        auto line = expectLine(client, 2000);
+        auto receivedAt = millis();
+        TEST_ASSERT_FALSE(line.empty());
+        TEST_ASSERT_EQUAL(1, jsonNumber(line, "interval"));
+        auto sequence = jsonNumber(line, "sequence");
+        TEST_ASSERT_GREATER_THAN(previous, sequence);
+        if (previous >= 0) {
+            TEST_ASSERT_UINT32_WITHIN(150, 1000, receivedAt - previousAt);
+        }
+        previous = sequence;
+        previousAt = receivedAt;
+    }
+}
+
+void test_mixed_intervals_are_delivered_on_time() {
+    // with the default of 2 s, readings are taken every 2 s and each client gets them on its own multiple of that
+    constexpr unsigned long DURATION = 8200;
+    LoopbackClient fast(TCP_PORT);
+    LoopbackClient slow(TCP_PORT);
+    fast.send("{\"interval\":2,\"save\":false}\n");
+    slow.send("{\"interval\":4,\"save\":false}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(fast).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(slow).c_str());
+
+    struct Delivery {
+        unsigned long receivedAt;
+        long sequence;
+    };
+    std::vector<Delivery> fastDeliveries;
+    std::vector<Delivery> slowDeliveries;
+    auto readingsBefore = readingsTaken;
+    auto startedAt = millis();
+    pumpUntil([]() { return false; }, [&]() {
+        step();
+        std::string line;
+        while (fast.nextLine(line)) {
+            fastDeliveries.push_back({millis(), jsonNumber(line, "sequence")});
+        }
+        while (slow.nextLine(line)) {
+            slowDeliveries.push_back({millis(), jsonNumber(line, "sequence")});
+        }
+    }, DURATION);
+    auto seconds = (millis() - startedAt) / 1000.0;
+
+    TEST_ASSERT_UINT32_WITHIN(1, 4, fastDeliveries.size());
+    TEST_ASSERT_UINT32_WITHIN(1, 2, slowDeliveries.size());
+    // deadlines are aligned to multiples of the interval, the jitter is how late a delivery arrived after its deadline
+    for (auto &delivery: fastDeliveries) {
+        TEST_ASSERT_LESS_THAN(100, delivery.receivedAt % 2000);
+    }
+    for (auto &delivery: slowDeliveries) {
+        TEST_ASSERT_LESS_THAN(100, delivery.receivedAt % 4000);
+    }
+    for (size_t i = 1; i < slowDeliveries.size(); i++) {
+        TEST_ASSERT_EQUAL(slowDeliveries[i - 1].sequence + 2, slowDeliveries[i].sequence);
+    }
+    // the probe is read at the base interval, not once a second
+    auto readsPerSecond = (readingsTaken - readingsBefore) / seconds;
+    TEST_ASSERT_FLOAT_WITHIN(0.15, 0.5, readsPerSecond);
+}
+
+void test_every_evicted_frame_is_counted() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"overflow\":\"coalesce\"}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"overflow\"}", expectReply(client).c_str());
+    // loop() doesn't run in between, so the notices pile up in the client's queue and the last one replaces all of them
+    auto dropped = metrics.tcpDroppedFrames.get();
+    for (size_t i = 0; i <= SEND_QUEUE_CAPACITY; i++) {
+        server->announceReconnect(1000 + i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(dropped + SEND_QUEUE_CAPACITY, metrics.tcpDroppedFrames.get());
+    auto notice = expectLineWith(client, "downtime");
+    TEST_ASSERT_EQUAL(1000 + SEND_QUEUE_CAPACITY, jsonNumber(notice, "downtime"));
+    client.send("{\"stats\":true}\n");
+    TEST_ASSERT_EQUAL(SEND_QUEUE_CAPACITY, jsonNumber(expectLineWith(client, "droppedFrames"), "droppedFrames"));
+}
+
+void test_batch_is_released_once_complete() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"interval\":1,\"save\":false,\"batch\":3}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"batch\"}", expectReply(client).c_str());
+    auto configuredAt = millis();
+    auto arrivals = expectReadings(client, 3, 4000);
+    TEST_ASSERT_EQUAL(3, arrivals.size());
+    // the first reading waited for the other two, a second apart
+    TEST_ASSERT_GREATER_OR_EQUAL(1900, arrivals[0] - configuredAt);
+    TEST_ASSERT_LESS_THAN(100, arrivals[2] - arrivals[0]);
+}
+
+void test_incomplete_batch_is_released_at_the_timeout() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"interval\":1,\"save\":false,\"batch\":" + std::to_string(MAX_TCP_BATCH) +
+                ",\"flushTimeout\":1500}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"batch\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"flushTimeout\"}", expectReply(client).c_str());
+    auto configuredAt = millis();
+    // the readings of the first 1.5 s, then those of the next batch 2 s later
+    auto arrivals = expectReadings(client, 3, 4000);
+    TEST_ASSERT_EQUAL(3, arrivals.size());
+    TEST_ASSERT_GREATER_OR_EQUAL(1400, arrivals[0] - configuredAt);
+    TEST_ASSERT_LESS_THAN(100, arrivals[1] - arrivals[0]);
+    TEST_ASSERT_UINT32_WITHIN(150, 2000, arrivals[2] - arrivals[1]);
+}
+
+void test_batch_and_flush_timeout_are_bounded() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"batch\":0}\n{\"batch\":-1}\n{\"flushTimeout\":\"soon\"}\n{\"flushTimeout\":4294967296}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"invalidValue\",\"command\":\"batch\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"invalidValue\",\"command\":\"batch\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"invalidValue\",\"command\":\"flushTimeout\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"invalidValue\",\"command\":\"flushTimeout\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL(1, settings->get().tcpBatch);
+    TEST_ASSERT_EQUAL_UINT32(0, settings->get().tcpFlushTimeout);
+    // too large values are clamped
+    client.send("{\"batch\":1000,\"flushTimeout\":4294967295}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"batch\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"flushTimeout\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL(MAX_TCP_BATCH, settings->get().tcpBatch);
+    TEST_ASSERT_EQUAL_UINT32(MAX_TCP_FLUSH_TIMEOUT, settings->get().tcpFlushTimeout);
+}
+
+void test_batch_larger_than_the_send_queue_arrives_whole() {
+    // every probe's reading is a frame of its own, so a bus of them fills the batch within a few seconds
+    server->stop();
+    serveProbes(BUS_PINS, MAX_PROBES);
+    server->setup();
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"interval\":1,\"save\":false,\"metrics\":true,\"batch\":" + std::to_string(MAX_TCP_BATCH) + "}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"metrics\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"batch\"}", expectReply(client).c_str());
+    auto dropped = metrics.tcpDroppedFrames.get();
+    size_t bytes = 0;
+    long previous = -1;
+    for (unsigned short i = 0; i < MAX_TCP_BATCH; i++) {
+        auto line = expectLine(client, 2 * MAX_TCP_BATCH * 1000 / MAX_PROBES);
+        TEST_ASSERT_FALSE(line.empty());
+        TEST_ASSERT_TRUE(line.find("\"metrics\"") != std::string::npos);
+        // every probe's reading of every sample, none of them dropped to make room for the others
+        auto sequence = jsonNumber(line, "sequence");
+        if (previous >= 0) {
+            TEST_ASSERT_EQUAL(previous + 1, sequence);
+        }
+        previous = sequence;
+        bytes += line.size() + 1;
+    }
+    TEST_ASSERT_GREATER_THAN(SEND_QUEUE_MAX_BYTES, bytes);
+    TEST_ASSERT_EQUAL_UINT32(dropped, metrics.tcpDroppedFrames.get());
+}
+
+void test_binary_records_are_decoded() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"format\":\"binary\",\"interval\":1,\"save\":false}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"format\"}", expectReply(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(client).c_str());
+    std::string bytes;
+    TEST_ASSERT_TRUE(pumpUntil([&]() { return client.nextBytes(BINARY_RECORD_SIZE, bytes); }, step, 2000));
+    BinaryRecordDecoder decoder;
+    StreamRecord record{};
+    bool decoded = false;
+    for (auto byte: bytes) {
+        decoded = decoder.push(static_cast<uint8_t>(byte), record);
+    }
+    TEST_ASSERT_TRUE(decoded);
+    TEST_ASSERT_EQUAL(1, record.interval);
+    TEST_ASSERT_EQUAL(0, record.probe);
+}
+
+void test_history_is_sent_on_request() {
+    LoopbackClient client(TCP_PORT);
+    client.send("{\"interval\":1,\"save\":false}\n");
+    expectReply(client);
+    auto first = jsonNumber(expectLine(client, 2000), "sequence");
+    auto second = jsonNumber(expectLine(client, 2000), "sequence");
+    TEST_ASSERT_GREATER_THAN(first, second);
+
+    LoopbackClient late(TCP_PORT);
+    late.send("{\"interval\":1,\"save\":false,\"since\":" + std::to_string(first - 1) + "}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"interval\"}", expectReply(late).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"since\"}", expectReply(late).c_str());
+    TEST_ASSERT_EQUAL(first, jsonNumber(expectLine(late), "sequence"));
+    TEST_ASSERT_EQUAL(second, jsonNumber(expectLine(late), "sequence"));
+}
+
+void test_client_beyond_the_slots_is_turned_away() {
+    std::array<std::unique_ptr<LoopbackClient>, MAX_TCP_CLIENTS> clients;
+    for (auto &client: clients) {
+        client = std::make_unique<LoopbackClient>(TCP_PORT);
+        client->send("{\"ping\":true}\n");
+    }
+    for (auto &client: clients) {
+        TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(*client).c_str());
+    }
+    auto rejected = metrics.tcpRejectedConnections.get();
+    LoopbackClient extra(TCP_PORT);
+    TEST_ASSERT_EQUAL_STRING("{\"error\":\"busy\"}", expectLine(extra).c_str());
+    TEST_ASSERT_EQUAL_UINT32(rejected + 1, metrics.tcpRejectedConnections.get());
+
+    // a slot freed by a client leaving is taken by the next one
+    clients[0] = nullptr;
+    TEST_ASSERT_TRUE(pumpUntil([]() { return tcpClientCount() == MAX_TCP_CLIENTS - 1; }, step));
+    LoopbackClient next(TCP_PORT);
+    next.send("{\"ping\":true}\n");
+    TEST_ASSERT_EQUAL_STRING("{\"ack\":\"ping\"}", expectReply(next).c_str());
+}
+
+int main() {
+    // in-process ports away from those of a firmware process, and no settings file
+    setenv("POLEKO_PORT_OFFSET", "31000", 1);
+    setenv("POLEKO_NVS", ":memory:", 1);
+    settings = std::make_unique<Settings>();
+    settings->begin();
+    sensors = std::make_unique<SensorBus>(PINS, 1);
+    server = std::make_unique<TCPServer>(*sensors, *settings, TCP_PORT);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_commands_are_acknowledged);
+    RUN_TEST(test_command_split_across_packets_is_completed);
+    RUN_TEST(test_commands_beyond_the_pending_ones_are_busy);
+    RUN_TEST(test_readings_are_delivered_at_the_interval);
+    RUN_TEST(test_mixed_intervals_are_delivered_on_time);
+    RUN_TEST(test_every_evicted_frame_is_counted);
+    RUN_TEST(test_batch_is_released_once_complete);
+    RUN_TEST(test_incomplete_batch_is_released_at_the_timeout);
+    RUN_TEST(test_batch_and_flush_timeout_are_bounded);
+    RUN_TEST(test_batch_larger_than_the_send_queue_arrives_whole);
+    RUN_TEST(test_binary_records_are_decoded);
+    RUN_TEST(test_history_is_sent_on_request);
+    RUN_TEST(test_client_beyond_the_slots_is_turned_away);
+    auto failures = UNITY_END();
+    // the network thread is still running, static destructors would race with it
+    fflush(stdout);
+    _exit(failures);
+}